@@ -0,0 +1,141 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+namespace
+{
+const uint32_t MAX_SAMPLES = 31;
+
+struct Sample
+{
+  int64_t elapsedUs;
+  uint32_t cycles;
+};
+
+// Contador de ciclos só existe na placa (CCOUNT, 32 bits: amostras têm de
+// ficar abaixo de ~17 s a 240 MHz)
+uint32_t cycleCount()
+{
+#ifdef ARDUINO
+  return ESP.getCycleCount();
+#else
+  return 0;
+#endif
+}
+
+uint32_t cpuMhz()
+{
+#ifdef ARDUINO
+  return ESP.getCpuFreqMHz();
+#else
+  return 0;
+#endif
+}
+
+Sample measure(const Benchmark &bench, uint32_t iterations)
+{
+  if (bench.setup) bench.setup(iterations);
+
+  Sample sample;
+  int64_t startUs = hal::micros64();
+  uint32_t startCycles = cycleCount();
+  bench.run(iterations);
+  sample.cycles = cycleCount() - startCycles;
+  sample.elapsedUs = hal::micros64() - startUs;
+  return sample;
+}
+
+// Dobra as iterações até a amostra passar de minSampleUs (ou bater no teto)
+uint32_t calibrate(const Benchmark &bench, uint32_t minSampleUs)
+{
+  uint32_t iterations = 1;
+  for (;;)
+  {
+    Sample sample = measure(bench, iterations);
+    if (sample.elapsedUs >= minSampleUs || iterations >= bench.maxIterations)
+      return iterations;
+
+    uint64_t next = iterations * 2ULL;
+    if (sample.elapsedUs > 0)
+    {
+      uint64_t scaled = static_cast<uint64_t>(iterations) * minSampleUs / sample.elapsedUs + 1;
+      if (scaled > next) next = scaled;
+    }
+    iterations = next > bench.maxIterations ? bench.maxIterations : static_cast<uint32_t>(next);
+  }
+}
+
+void sortSamples(double *values, uint32_t count)
+{
+  for (uint32_t i = 1; i < count; i++)
+  {
+    double value = values[i];
+    uint32_t j = i;
+    while (j > 0 && values[j - 1] > value)
+    {
+      values[j] = values[j - 1];
+      j--;
+    }
+    values[j] = value;
+  }
+}
+} // namespace
+
+size_t benchBytesPerOp = 0;
+
+size_t runBenchmarks(const Benchmark *benchmarks, size_t count, const BenchOptions &options)
+{
+  uint32_t samples = options.samples;
+  if (samples == 0) samples = 1;
+  if (samples > MAX_SAMPLES) samples = MAX_SAMPLES;
+
+  hal::logf("BENCH_BEGIN {\"env\":\"%s\",\"cpuMHz\":%u,\"samples\":%u}\n",
+            options.env, static_cast<unsigned int>(cpuMhz()), static_cast<unsigned int>(samples));
+
+  size_t ran = 0;
+  for (size_t b = 0; b < count; b++)
+  {
+    const Benchmark &bench = benchmarks[b];
+    if (options.filter && !strstr(bench.name, options.filter)) continue;
+
+    // Logs do núcleo ficam mudos durante a medição
+    hal::setLogEnabled(false);
+    benchBytesPerOp = 0;
+    uint32_t iterations = calibrate(bench, options.minSampleUs);
+
+    double nsPerOp[MAX_SAMPLES];
+    double cyclesPerOp[MAX_SAMPLES];
+    for (uint32_t s = 0; s < samples; s++)
+    {
+      Sample sample = measure(bench, iterations);
+      nsPerOp[s] = sample.elapsedUs * 1000.0 / iterations;
+      cyclesPerOp[s] = static_cast<double>(sample.cycles) / iterations;
+    }
+    hal::setLogEnabled(true);
+
+    sortSamples(nsPerOp, samples);
+    sortSamples(cyclesPerOp, samples);
+
+    char cycles[40] = "";
+    if (cpuMhz() > 0)
+      snprintf(cycles, sizeof(cycles), ",\"cyclesPerOp\":%.1f", cyclesPerOp[samples / 2]);
+    char bytes[32] = "";
+    if (benchBytesPerOp > 0)
+      snprintf(bytes, sizeof(bytes), ",\"bytesPerOp\":%u", static_cast<unsigned int>(benchBytesPerOp));
+
+    hal::logf("BENCH {\"name\":\"%s\",\"iterations\":%u,\"nsPerOp\":%.1f,\"minNsPerOp\":%.1f,"
+              "\"maxNsPerOp\":%.1f%s%s}\n",
+              bench.name, static_cast<unsigned int>(iterations), nsPerOp[samples / 2], nsPerOp[0],
+              nsPerOp[samples - 1], cycles, bytes);
+    ran++;
+  }
+
+  hal::logf("BENCH_END {\"count\":%u}\n", static_cast<unsigned int>(ran));
+  return ran;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Harness de microbenchmarks do núcleo (src/core).
+//
+// Roda no host (ambiente `bench`) e na placa (ambiente `bench_device`,
+// com o contador de ciclos da CPU). Cada resultado sai numa linha
+// "BENCH {json}" no stdout/Serial; tools/bench.py converte a captura em
+// baseline e compara execuções.
+struct Benchmark
+{
+  const char *name;
+  // Fora da medição, antes de cada amostra (nullptr = nada a preparar)
+  void (*setup)(uint32_t iterations);
+  void (*run)(uint32_t iterations);
+  // Teto de iterações por amostra (operações em flash são lentas e
+  // precisam de estado preparado pelo setup)
+  uint32_t maxIterations;
+};
+
+struct BenchOptions
+{
+  const char *env;
+  const char *filter;     // substring do nome; nullptr = todos
+  uint32_t samples;       // amostras por benchmark (mediana)
+  uint32_t minSampleUs;   // duração mínima de cada amostra na calibração
+};
+
+// Bytes gerados por operação, gravados pelo run() de quem serializa
+// (respostas da API); sai como "bytesPerOp" quando diferente de zero
+extern size_t benchBytesPerOp;
+
+// Devolve quantos benchmarks rodaram
+size_t runBenchmarks(const Benchmark *benchmarks, size_t count, const BenchOptions &options);
@@ -0,0 +1,474 @@
+#include "bench.h"
+#include "dosing.h"
+#include "http_api.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include "hal_native.h"
+#endif
+
+// Benchmarks dos caminhos quentes do núcleo e do corpo das respostas de
+// src/api. Os ganchos de dosing.h e http_api.h são implementados aqui sem
+// custo (relógio fixo, sem métricas, sem bloco da placa no /status) para
+// medir só o núcleo; na placa o ambiente bench_device liga HAL_GPIO_DRY_RUN.
+namespace
+{
+const char *const BENCH_TIMESTAMP = "15/03/2026 08:30:00";
+const char *const BENCH_LOG_LINE =
+    "{\"bombaId\":1,\"timestamp\":\"15/03/2026 08:30\",\"bomba\":\"Bomba 1\",\"dosagem\":2.5,\"origem\":\"Programado\"}\n";
+
+DateTime benchNow(2026, 3, 15, 8, 30, 0);
+char configJson[CONFIG_JSON_MAX];
+size_t configJsonLength = 0;
+char configPack[CONFIG_JSON_MAX];
+size_t configPackLength = 0;
+volatile uint32_t sink = 0;
+bool partitionAvailable = false;
+
+// Configuração cheia: todas as bombas com os três horários ativos todos os
+// dias, fora do minuto de benchNow (o scheduler percorre tudo sem enfileirar)
+void fillBenchConfig()
+{
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    bombas[i].name.printf("Bomba de teste %d", i + 1);
+    bombas[i].calibrPpm = 1050000;
+    bombas[i].estoqueUl = 750500;
+    for (int j = 0; j < SCHEDULE_COUNT; j++)
+    {
+      Schedule &schedule = bombas[i].schedules[j];
+      schedule.hour = 6 + j * 6;
+      schedule.minute = 15 * i;
+      schedule.dosagemUl = 1250 + j * UL_PER_ML;
+      schedule.status = true;
+      schedule.lastRunMinute = -1;
+      for (int d = 0; d < 7; d++)
+        schedule.diasSemana[d] = true;
+    }
+  }
+}
+
+void writeLogLines(size_t lines)
+{
+  hal::File file = hal::fsOpen(LOG_FILE, hal::FILE_MODE_WRITE);
+  size_t length = strlen(BENCH_LOG_LINE);
+  for (size_t i = 0; i < lines; i++)
+    file.write(BENCH_LOG_LINE, length);
+  file.close();
+  logCount = lines;
+}
+
+// --- parseDateTime ---
+void runParseDateTime(uint32_t iterations)
+{
+  DateTime parsed;
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    parseDateTime(BENCH_TIMESTAMP, parsed);
+    sink += parsed.minute();
+  }
+}
+
+// --- buildConfigJson: escrita pelo esquema, direto no buffer ---
+void runBuildConfigJson(uint32_t iterations)
+{
+  for (uint32_t i = 0; i < iterations; i++)
+    sink += buildConfigJson(configJson, sizeof(configJson));
+}
+
+// --- buildConfigMsgPack: o mesmo esquema em MessagePack ---
+void runBuildConfigMsgPack(uint32_t iterations)
+{
+  for (uint32_t i = 0; i < iterations; i++)
+    sink += buildConfigMsgPack(configPack, sizeof(configPack));
+}
+
+// --- parseConfigJson: parser de uma passada para a cópia de trabalho ---
+Bomb stagedBombas[BOMBA_COUNT];
+uint32_t stagedChannels;
+
+void runParseConfigJson(uint32_t iterations)
+{
+  for (uint32_t i = 0; i < iterations; i++)
+    sink += parseConfigJson(configJson, configJsonLength, stagedBombas, stagedChannels, false);
+}
+
+// --- parseConfigMsgPack: o body do POST /config em MessagePack ---
+void runParseConfigMsgPack(uint32_t iterations)
+{
+  for (uint32_t i = 0; i < iterations; i++)
+    sink += parseConfigMsgPack(configPack, configPackLength, stagedBombas, stagedChannels);
+}
+
+// --- applyConfigJson: caminho do POST /config (parse + aplica) e a
+// gravação da geração que o loop faz em seguida (serviceConfig) ---
+void runApplyConfigJson(uint32_t iterations)
+{
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    sink += applyConfigJson(configJson, configJsonLength);
+    serviceConfig();
+  }
+}
+
+// --- appendLocalLog no LittleFS abaixo do limite (sem trim) ---
+// logPartitionReady escolhe o backend: os casos de arquivo desligam a
+// partição, os "/partition" religam
+void setupAppendLocalLog(uint32_t)
+{
+  logPartitionReady = false;
+  clearLocalLogs();
+}
+
+void runAppendLocalLog(uint32_t iterations)
+{
+  for (uint32_t i = 0; i < iterations; i++)
+    appendLocalLog(i % BOMBA_COUNT, 2500, "Programado", benchNow);
+}
+
+// --- appendLocalLog com o arquivo cheio (cada append faz trim) ---
+void setupAppendFullLog(uint32_t)
+{
+  logPartitionReady = false;
+  writeLogLines(LOG_LIMIT);
+}
+
+// --- appendLocalLog na partição crua (inclui os apagamentos de setor) ---
+void setupAppendPartitionLog(uint32_t)
+{
+  logPartitionReady = partitionAvailable;
+  clearLocalLogs();
+}
+
+// --- leitura de LOG_LIMIT linhas como no GET /logs: arquivo x partição ---
+void setupReadFileLogs(uint32_t)
+{
+  logPartitionReady = false;
+  writeLogLines(LOG_LIMIT);
+}
+
+void runReadFileLogs(uint32_t iterations)
+{
+  char line[LOG_LINE_MAX];
+  size_t length;
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    hal::File file = hal::fsOpen(LOG_FILE, hal::FILE_MODE_READ);
+    while (file.readLine(line, sizeof(line), length))
+      sink += length;
+    file.close();
+  }
+}
+
+void setupReadPartitionLogs(uint32_t)
+{
+  setupAppendPartitionLog(0);
+  runAppendLocalLog(LOG_LIMIT);
+}
+
+void runReadPartitionLogs(uint32_t iterations)
+{
+  char line[LOG_LINE_MAX];
+  size_t length;
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    LogCursor cursor;
+    logCursorBegin(cursor);
+    while (logCursorNext(cursor, line, length))
+      sink += length + static_cast<uint8_t>(line[0]);
+  }
+}
+
+// --- trimLogFile de uma linha com o arquivo no limite ---
+void setupTrimLogFile(uint32_t iterations)
+{
+  writeLogLines(LOG_LIMIT + iterations);
+}
+
+void runTrimLogFile(uint32_t iterations)
+{
+  for (uint32_t i = 0; i < iterations; i++)
+    sink += trimLogFile(1);
+}
+
+// --- countLogLines (abre, conta e fecha, como o GET /logs) ---
+void setupCountLogLines(uint32_t)
+{
+  writeLogLines(LOG_LIMIT);
+}
+
+void runCountLogLines(uint32_t iterations)
+{
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    hal::File file = hal::fsOpen(LOG_FILE, hal::FILE_MODE_READ);
+    sink += countLogLines(file);
+  }
+}
+
+// --- checkSchedules: varredura de um minuto sem horário vencido ---
+void setupCheckSchedules(uint32_t)
+{
+  fillBenchConfig();
+}
+
+void runCheckSchedules(uint32_t iterations)
+{
+  for (uint32_t i = 0; i < iterations; i++)
+    sink += runSchedulesAt(benchNow);
+}
+
+// --- pumpBank.tick/N: varredura desenrolada + acionamento no MCP23017 ---
+// Um quarto dos canais vence a cada tick (um dia depois do anterior, para
+// lastRunMinute não barrar); cada canal vencido liga e desliga no expansor.
+// Na placa o I2C fica em dry run, então mede só o custo da CPU.
+template <uint8_t Channels>
+struct PumpBankTick
+{
+  typedef PumpBank<Channels, Mcp23017PumpDriver<(Channels + 15) / 16>> Bank;
+
+  static Bomb channels[Channels];
+  static Bank bank;
+
+  static void setup(uint32_t)
+  {
+    for (uint8_t i = 0; i < Channels; i++)
+    {
+      for (int j = 0; j < SCHEDULE_COUNT; j++)
+      {
+        Schedule &schedule = channels[i].schedules[j];
+        bool due = j == 0 && i % 4 == 0;
+        schedule.hour = due ? benchNow.hour() : 6 + j * 6;
+        schedule.minute = due ? benchNow.minute() : 15 * (i % 4);
+        schedule.dosagemUl = 1250;
+        schedule.status = true;
+        schedule.lastRunMinute = -1;
+        for (int d = 0; d < 7; d++)
+          schedule.diasSemana[d] = true;
+      }
+    }
+    bank.begin();
+  }
+
+  static void run(uint32_t iterations)
+  {
+    auto actuate = [](int i, int) {
+      bank.set(i, true);
+      bank.set(i, false);
+      return true;
+    };
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+      DateTime day(benchNow.unixtime() + (i % 64) * 86400UL);
+      sink += scanDueSchedules(channels, day, actuate);
+    }
+  }
+};
+
+template <uint8_t Channels>
+Bomb PumpBankTick<Channels>::channels[Channels];
+
+template <uint8_t Channels>
+typename PumpBankTick<Channels>::Bank PumpBankTick<Channels>::bank;
+
+// --- Corpo de GET /status, /config e /logs em JSON e MessagePack ---
+// Mesmo caminho dos handlers até o Print da resposta; o destino copia para
+// um buffer fixo, como o AsyncResponseStream, e conta os bytes (bytesPerOp)
+class ResponseSink : public Print
+{
+public:
+  size_t write(uint8_t c) override
+  {
+    buffer_[size_++ % sizeof(buffer_)] = c;
+    return 1;
+  }
+
+  size_t write(const uint8_t *data, size_t length) override
+  {
+    for (size_t i = 0; i < length; i++)
+      buffer_[(size_ + i) % sizeof(buffer_)] = data[i];
+    size_ += length;
+    return length;
+  }
+
+  size_t take()
+  {
+    size_t size = size_;
+    size_ = 0;
+    return size;
+  }
+
+private:
+  uint8_t buffer_[4096];
+  size_t size_ = 0;
+};
+
+ResponseSink responseSink;
+
+template <WireFormat Format>
+void runResponseStatus(uint32_t iterations)
+{
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    JsonLease lease(jsonLargePool);
+    JsonDocument &doc = lease.doc();
+    buildStatusDocument(doc, Format);
+    if (Format == WIRE_MSGPACK) serializeMsgPack(doc, responseSink);
+    else serializeJson(doc, responseSink);
+    benchBytesPerOp = responseSink.take();
+  }
+}
+
+// Os dois formatos saem do esquema direto no buffer, como no handler
+template <WireFormat Format>
+void runResponseConfig(uint32_t iterations)
+{
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    size_t size = Format == WIRE_MSGPACK ? buildConfigMsgPack(configPack, sizeof(configPack))
+                                         : buildConfigJson(configJson, sizeof(configJson));
+    responseSink.write(reinterpret_cast<const uint8_t *>(Format == WIRE_MSGPACK ? configPack : configJson), size);
+    benchBytesPerOp = responseSink.take();
+  }
+}
+
+// LOG_LIMIT linhas na partição: JSON copia as linhas, MessagePack faz
+// parse de cada uma; sai em chunks de um segmento TCP, como no handler
+template <WireFormat Format>
+void runResponseLogs(uint32_t iterations)
+{
+  uint8_t chunk[1436];
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    LogsBody body(Format, hal::File());
+    body.begin(nullptr);
+    size_t length;
+    while ((length = body.fill(chunk, sizeof(chunk))) > 0)
+      responseSink.write(chunk, length);
+    benchBytesPerOp = responseSink.take();
+  }
+}
+
+// --- enqueuePumpJob + startNextPumpJob (sem terminar a dose em flash) ---
+void runEnqueueStartPumpJob(uint32_t iterations)
+{
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    enqueuePumpJob(i % BOMBA_COUNT, 2.5f, "Manual");
+    startNextPumpJob();
+    pumpActive = false;
+  }
+}
+
+const Benchmark BENCHMARKS[] = {
+    {"parseDateTime", nullptr, runParseDateTime, 1000000},
+    {"buildConfigJson", nullptr, runBuildConfigJson, 100000},
+    {"buildConfigMsgPack", nullptr, runBuildConfigMsgPack, 100000},
+    {"parseConfigJson", nullptr, runParseConfigJson, 100000},
+    {"parseConfigMsgPack", nullptr, runParseConfigMsgPack, 100000},
+    {"applyConfigJson", nullptr, runApplyConfigJson, 64},
+    {"appendLocalLog", setupAppendLocalLog, runAppendLocalLog, LOG_LIMIT / 2},
+    {"appendLocalLog/full", setupAppendFullLog, runAppendLocalLog, 16},
+    {"appendLocalLog/partition", setupAppendPartitionLog, runAppendLocalLog, LOG_LIMIT},
+    {"trimLogFile", setupTrimLogFile, runTrimLogFile, 16},
+    {"countLogLines", setupCountLogLines, runCountLogLines, 256},
+    {"readLogs/littlefs", setupReadFileLogs, runReadFileLogs, 256},
+    {"readLogs/partition", setupReadPartitionLogs, runReadPartitionLogs, 4096},
+    {"response/status/json", nullptr, runResponseStatus<WIRE_JSON>, 100000},
+    {"response/status/msgpack", nullptr, runResponseStatus<WIRE_MSGPACK>, 100000},
+    {"response/config/json", nullptr, runResponseConfig<WIRE_JSON>, 100000},
+    {"response/config/msgpack", nullptr, runResponseConfig<WIRE_MSGPACK>, 100000},
+    {"response/logs/json", setupReadPartitionLogs, runResponseLogs<WIRE_JSON>, 4096},
+    {"response/logs/msgpack", setupReadPartitionLogs, runResponseLogs<WIRE_MSGPACK>, 4096},
+    {"checkSchedules", setupCheckSchedules, runCheckSchedules, 1000000},
+    {"pumpBank.tick/4", PumpBankTick<4>::setup, PumpBankTick<4>::run, 1000000},
+    {"pumpBank.tick/16", PumpBankTick<16>::setup, PumpBankTick<16>::run, 1000000},
+    {"pumpBank.tick/32", PumpBankTick<32>::setup, PumpBankTick<32>::run, 1000000},
+    {"enqueuePumpJob+start", nullptr, runEnqueueStartPumpJob, 1000000},
+};
+
+const size_t BENCHMARK_COUNT = sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]);
+
+void prepareCore()
+{
+  rtcReady = true;
+  prefsReady = hal::kvBegin("bench");
+  initLogStorage();
+  partitionAvailable = logPartitionReady;
+  fillBenchConfig();
+  configJsonLength = buildConfigJson(configJson, sizeof(configJson));
+  configPackLength = buildConfigMsgPack(configPack, sizeof(configPack));
+}
+} // namespace
+
+// --- Ganchos do núcleo: sem custo, para medir só o núcleo ---
+DateTime clockNow()
+{
+  return benchNow;
+}
+
+void onPumpJobQueued() {}
+void reportDoseStartDelay(uint32_t) {}
+void reportDoseCutoffDelay(uint32_t) {}
+void recordFlashOp(FlashOp, uint32_t) {}
+void onOutboxBatchReady() {}
+void onHubFetchReady() {}
+
+// --- Ganchos de src/api: nada da placa ---
+void wakeLoop() {}
+size_t largestFreeBlock()
+{
+  return SIZE_MAX;
+}
+bool admittedRequestBody(AsyncWebServerRequest *, const char *&, size_t &)
+{
+  return false;
+}
+void noteBulkResponse(AsyncWebServerRequest *, bool, size_t) {}
+void fillPlatformStatus(JsonDocument &) {}
+
+#ifdef ARDUINO
+void setup()
+{
+  Serial.begin(115200);
+  delay(2000);
+
+  hal::fsBegin();
+  prepareCore();
+
+  BenchOptions options = {"esp32s3", nullptr, 7, 200000};
+  runBenchmarks(BENCHMARKS, BENCHMARK_COUNT, options);
+}
+
+void loop()
+{
+  delay(1000);
+}
+#else
+int main(int argc, char **argv)
+{
+  BenchOptions options = {"native", nullptr, 7, 50000};
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (strcmp(argv[i], "--filter") == 0) options.filter = argv[i + 1];
+    else if (strcmp(argv[i], "--samples") == 0) options.samples = strtoul(argv[i + 1], nullptr, 10);
+    else if (strcmp(argv[i], "--min-ms") == 0) options.minSampleUs = strtoul(argv[i + 1], nullptr, 10) * 1000;
+    else if (strcmp(argv[i], "--env") == 0) options.env = argv[i + 1];
+    else
+    {
+      printf("uso: program [--filter nome] [--samples N] [--min-ms ms] [--env nome]\n");
+      return 2;
+    }
+  }
+
+  hal::native::setFsRoot("bench_fs");
+  hal::fsBegin();
+  prepareCore();
+  return runBenchmarks(BENCHMARKS, BENCHMARK_COUNT, options) > 0 ? 0 : 1;
+}
+#endif
@@ -0,0 +1,736 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <RTClib.h>
+#include "fixed_point.h"
+#include "hal.h"
+#include "inline_string.h"
+#include "json_arena.h"
+#include "pump_bank.h"
+
+// Núcleo do dosador: bombas e agendamentos, configuração (NVS), logs
+// locais, scheduler e fila de bombas (src/core). Só depende da HAL, do
+// RTClib (DateTime) e do ArduinoJson, então compila também no ambiente
+// `native` (Linux). Volumes em microlitros e tempos em microssegundos,
+// inteiros (fixed_point.h); ml em ponto flutuante só na borda da API.
+
+// --- Configurações Gerais ---
+#define TEMPO_POR_ML 700 // ms por ml = µs por µL (com calibração 1.0)
+#define BOMBA1_PIN 4
+#define BOMBA2_PIN 5
+#define BOMBA3_PIN 6
+#define BOMBA4_PIN 7
+
+// Bombas no banco: 4 nas saídas da placa; até 32 com expansores
+// MCP23017 (-D BOMBA_COUNT=16 -D PUMP_DRIVER_MCP23017)
+#ifndef BOMBA_COUNT
+#define BOMBA_COUNT 4
+#endif
+#ifndef PUMP_GPIO_PINS
+#define PUMP_GPIO_PINS BOMBA1_PIN, BOMBA2_PIN, BOMBA3_PIN, BOMBA4_PIN
+#endif
+#ifndef PUMP_MCP23017_ADDRESS
+#define PUMP_MCP23017_ADDRESS 0x20
+#endif
+
+#define SCHEDULE_COUNT 3
+#define MAX_PUMP_QUEUE 14
+#define CONFIG_DOC_SIZE 10240
+#define CONFIG_JSON_MAX (1024 * BOMBA_COUNT)
+// String da NVS vai até ~4000 bytes: bancos maiores gravam a config como blob
+// (formato antigo, só lido na migração para os slots A/B)
+#define CONFIG_KV_BLOB (BOMBA_COUNT > 4)
+#define CONFIG_SLOT_MAGIC 0x42414643UL // "CFAB"
+#define LOG_LIMIT 300
+#define LOG_FILE "/logs.jsonl"
+#define LOG_TEMP_FILE "/logs.tmp"
+#define LOG_LINE_MAX 256
+// Log de doses numa partição crua (partitions.csv): setores em anel e
+// leitura pela flash mapeada; sem a partição, o log fica em LOG_FILE
+#define LOG_PARTITION_LABEL "doselog"
+#define LOG_SECTOR_SIZE 4096
+#define LOG_PARTITION_MAX_SECTORS 64
+#define BOMBA_NAME_SIZE 32
+#define ORIGEM_SIZE 16
+#define TIMESTAMP_SIZE 20
+#define NO_NEXT_DOSE 0xFFFFFFFFUL
+
+// Outbox da sincronização: eventos de dose aguardando envio em lotes
+#define OUTBOX_FILE "/outbox.jsonl"
+#define OUTBOX_TEMP_FILE "/outbox.tmp"
+#define OUTBOX_LIMIT 1000
+#define OUTBOX_BATCH_MAX 20
+#define OUTBOX_BODY_MAX (OUTBOX_BATCH_MAX * (LOG_LINE_MAX + 1) + 96)
+#define OUTBOX_URL_SIZE 128
+#define OUTBOX_LINGER_MS 30000UL
+#define OUTBOX_BACKOFF_MIN_MS 5000UL
+#define OUTBOX_BACKOFF_MAX_MS 600000UL
+
+// Hub: um controlador puxa os logs de outros por GET /logs?afterSeq= (o
+// seq de log é crescente por dispositivo) e guarda as linhas em HUB_FILE
+#define HUB_FILE "/hub.jsonl"
+#define HUB_TEMP_FILE "/hub.tmp"
+#define HUB_PEERS_MAX 4
+#define HUB_LOG_LIMIT (HUB_PEERS_MAX * LOG_LIMIT)
+#define HUB_PAGE_MAX 20
+#define HUB_STATUS_MAX 384
+#define HUB_PAGE_BODY_MAX (HUB_PAGE_MAX * (LOG_LINE_MAX + 1) + HUB_STATUS_MAX + 96)
+#define HUB_URL_SIZE 64
+#define HUB_DEVICE_SIZE 24
+// Linha da visão agregada: {"device":"<id>", + linha local sem o '{'
+#define MERGED_LINE_MAX (LOG_LINE_MAX + HUB_DEVICE_SIZE + 14)
+#define HUB_POLL_MS 60000UL
+#define HUB_BACKOFF_MAX_MS 600000UL
+
+// Gravador de entradas (trace): buffer em RAM só depois de ligado pela API
+#define TRACE_FILE "/inputs.trc"
+#define TRACE_FILE_MAX (256 * 1024UL)
+#define TRACE_BUFFER_SIZE (CONFIG_JSON_MAX + 2048)
+#define TRACE_FLUSH_MS 5000UL
+
+// Diário de doses (WAL): anel de registros de 16 bytes num arquivo
+// pré-alocado; no boot, a dose interrompida é contabilizada e a fila
+// pendente volta se o reset foi recente
+#define JOURNAL_FILE "/doses.wal"
+#define JOURNAL_SLOTS 128
+#define JOURNAL_PROGRESS_MS 1000
+#define JOURNAL_REQUEUE_PENDING 1
+#define JOURNAL_REQUEUE_MAX_AGE_S 900
+
+// Programas de dose: passos (bomba, volume, espera) esperam na tabela e
+// entram na fila em lotes contíguos quando a espera vence; um lote nunca
+// ocupa as PROGRAM_QUEUE_RESERVE vagas guardadas para doses programadas
+// e manuais
+#define PROGRAM_MAX_STEPS 12
+#define PROGRAM_QUEUE_RESERVE BOMBA_COUNT
+#define PROGRAM_BATCH_MAX (MAX_PUMP_QUEUE - 1 - PROGRAM_QUEUE_RESERVE)
+#define PROGRAM_SLOTS 4
+#define PROGRAM_NAME_SIZE 24
+#define PROGRAM_MAX_DELAY_S 86400L
+#define PROGRAM_ORIGIN "Programa"
+
+// Previsão de estoque: EWMA do volume diário (alfa 1/4 ~ janela de 7 dias)
+#define CONSUMPTION_EWMA_DIVISOR 4
+#define CONSUMPTION_WARMUP_DAYS 7
+#define FORECAST_FLOOR_DEFAULT_UL 50000
+#define FORECAST_HORIZON_DAYS 3650
+
+// Arenas JSON: pequenas para bodies curtos e linhas de log, grandes para
+// config e /status (tamanhos conferidos pelo pico em /status.jsonArenas)
+#define JSON_ARENA_SMALL_COUNT 4
+#define JSON_ARENA_SMALL_SIZE 2048
+#define JSON_ARENA_LARGE_COUNT 2
+#define JSON_ARENA_LARGE_SIZE (1536 * BOMBA_COUNT)
+
+#ifdef PUMP_DRIVER_MCP23017
+typedef Mcp23017PumpDriver<(BOMBA_COUNT + 15) / 16, PUMP_MCP23017_ADDRESS> PumpDriver;
+#else
+typedef GpioPumpDriver<PUMP_GPIO_PINS> PumpDriver;
+#endif
+typedef PumpBank<BOMBA_COUNT, PumpDriver> DosingPumpBank;
+
+// --- Estruturas ---
+struct Schedule
+{
+  int hour;
+  int minute;
+  int32_t dosagemUl;
+  bool status;
+  bool diasSemana[7];
+  long lastRunMinute;
+
+  Schedule()
+  {
+    hour = 0;
+    minute = 0;
+    dosagemUl = 0;
+    status = false;
+    lastRunMinute = -1;
+    for (int i = 0; i < 7; i++)
+      diasSemana[i] = false;
+  }
+};
+
+struct Bomb
+{
+  InlineString<BOMBA_NAME_SIZE> name;
+  int32_t calibrPpm; // calibrCoef no JSON
+  int32_t estoqueUl; // quantidadeEstoque no JSON
+  Schedule schedules[SCHEDULE_COUNT];
+
+  Bomb()
+  {
+    calibrPpm = CALIBR_PPM_ONE;
+    estoqueUl = 0;
+  }
+};
+
+// Config gravada em dois slots da NVS ("cfgA"/"cfgB"), cada um com geração
+// e CRC. previous = 0: sem geração anterior para rollback. Lida e gravada
+// sob pumpQueueLock (fora do config.cpp, por copyConfigGenerations()).
+struct ConfigGenerations
+{
+  uint32_t active;
+  uint32_t previous;
+  uint8_t activeSlot;
+};
+
+enum ConfigApply
+{
+  CONFIG_APPLY_OK,
+  CONFIG_APPLY_INVALID,
+  CONFIG_APPLY_BUSY, // banco de trabalho ainda em uso pelo scheduler
+};
+
+enum ConfigRollback
+{
+  CONFIG_ROLLBACK_OK,
+  CONFIG_ROLLBACK_NONE,    // nenhuma geração anterior válida
+  CONFIG_ROLLBACK_INVALID, // slot anterior não passou no parse
+  CONFIG_ROLLBACK_BUSY,    // banco de trabalho ainda em uso pelo scheduler
+};
+
+struct PumpJob
+{
+  int bombaIndex;
+  int32_t dosagemUl;
+  InlineString<ORIGEM_SIZE> origem;
+  DateTime timestamp;
+  int64_t enqueuedAtUs;
+  uint16_t programId;  // 0 = fora de programa
+  uint8_t programStep;
+};
+
+// Consumo observado de uma bomba (persistido na NVS a cada virada de dia)
+struct PumpConsumption
+{
+  int32_t ewmaDailyUl;   // dias já fechados
+  int32_t todayUl;       // dia corrente, ainda fora da EWMA
+  int32_t day;           // unixtime / 86400 do dia corrente (-1 = nunca dosou)
+  uint16_t daysObserved;
+
+  PumpConsumption() : ewmaDailyUl(0), todayUl(0), day(-1), daysObserved(0) {}
+};
+
+struct PumpForecast
+{
+  int32_t dailyUl;          // consumo previsto (EWMA + programado)
+  int32_t ewmaDailyUl;
+  int32_t scheduledDailyUl;
+  int64_t secondsRemaining; // < 0 = sem consumo previsto
+  uint32_t emptyAt;         // unixtime previsto para esvaziar (0 = fora do horizonte)
+  uint16_t daysObserved;
+};
+
+// hold != 0: doses programadas que deixariam o estoque abaixo de floorUl
+// não são enfileiradas
+struct ForecastSettings
+{
+  int32_t floorUl;
+  uint8_t hold;
+};
+
+// Passo de um programa de dose. Passos do mesmo grupo rodam em seguida,
+// sem espera entre eles; delayMs vale no primeiro passo do grupo.
+struct ProgramStep
+{
+  uint8_t bombaIndex;
+  uint8_t group;
+  int32_t dosagemUl;
+  uint32_t delayMs;
+};
+
+enum ProgramState : uint8_t
+{
+  PROGRAM_QUEUED,
+  PROGRAM_RUNNING,
+  PROGRAM_DONE,
+  PROGRAM_CANCELLED
+};
+
+struct DoseProgram
+{
+  uint16_t id;
+  ProgramState state;
+  InlineString<PROGRAM_NAME_SIZE> name;
+  ProgramStep steps[PROGRAM_MAX_STEPS];
+  uint8_t stepCount;
+  uint8_t stepsQueued; // passos já entregues à fila; os demais esperam aqui
+  uint8_t stepsDone;   // passos concluídos (ou cortados pelo cancelamento)
+  int8_t currentStep;  // passo com a bomba ligada (-1 = nenhum)
+  int32_t plannedUl;
+  int32_t dosedUl;
+  uint32_t submittedAt;
+  uint32_t finishedAt; // 0 = em andamento
+  int64_t waitFromUs;  // início da espera do próximo lote (submit ou fim do lote anterior)
+
+  DoseProgram() : id(0), state(PROGRAM_QUEUED), stepCount(0), stepsQueued(0), stepsDone(0), currentStep(-1),
+                  plannedUl(0), dosedUl(0), submittedAt(0), finishedAt(0), waitFromUs(0) {}
+};
+
+enum ProgramVerdict : uint8_t
+{
+  PROGRAM_OK,
+  PROGRAM_INVALID,
+  PROGRAM_QUEUE_FULL,  // detail = slots livres na fila
+  PROGRAM_NO_STOCK,    // detail = índice da bomba
+  PROGRAM_TABLE_FULL,  // PROGRAM_SLOTS programas ainda em andamento
+  PROGRAM_NOT_FOUND,
+  PROGRAM_FINISHED
+};
+
+// Operações em flash medidas pela aplicação (mesma ordem de MET_FLASH_*)
+enum FlashOp : uint8_t
+{
+  FLASH_OP_CONFIG_SAVE,
+  FLASH_OP_CONFIG_LOAD,
+  FLASH_OP_LOG_APPEND,
+  FLASH_OP_LOG_TRIM,
+  FLASH_OP_OUTBOX_APPEND,
+  FLASH_OP_JOURNAL_WRITE,
+  FLASH_OP_LOG_ERASE,
+  FLASH_OP_TRACE_WRITE,
+  FLASH_OP_HUB_MERGE
+};
+
+// Registros do arquivo de entradas (trace.cpp descreve o formato)
+enum TraceRecordType : uint8_t
+{
+  TRACE_START = 1, // início de sessão: relógio, config e tabela de rotas
+  TRACE_HTTP,
+  TRACE_WIFI,
+  TRACE_CLOCK
+};
+
+// Flags de TRACE_START / TRACE_HTTP
+#define TRACE_START_BOOT 0x01
+#define TRACE_HTTP_MSGPACK_BODY 0x01
+#define TRACE_HTTP_MSGPACK_REPLY 0x02
+#define TRACE_HTTP_GZIP 0x04
+#define TRACE_HTTP_TRUNCATED 0x08
+#define TRACE_QUERY_MAX 96
+
+// Eventos de WiFi no trace: códigos próprios, estáveis entre versões do core
+enum TraceWifiEvent : uint8_t
+{
+  TRACE_WIFI_STA_GOT_IP = 1,
+  TRACE_WIFI_STA_LOST_IP,
+  TRACE_WIFI_STA_DISCONNECTED, // detail = motivo do driver
+  TRACE_WIFI_AP_CLIENT_JOINED, // detail = clientes no AP
+  TRACE_WIFI_AP_CLIENT_LEFT,
+  TRACE_WIFI_AP_STOPPED
+};
+
+struct TraceStats
+{
+  bool recording;
+  bool full;
+  uint32_t records;
+  uint32_t dropped; // buffer cheio entre dois despejos
+  uint32_t bytes;   // tamanho de TRACE_FILE
+};
+
+// Registro lido do arquivo; text/body apontam para dentro dos dados lidos.
+// START: text = config JSON, code = rotas na tabela; HTTP: code = rota,
+// text = query, body = body; WIFI: code = evento, value = detalhe.
+struct TraceEvent
+{
+  TraceRecordType type;
+  uint8_t code;
+  uint8_t flags;
+  int32_t value;
+  int64_t atUs; // uptime da placa
+  uint32_t unixTime;
+  const char *text;
+  size_t textLength;
+  const char *body;
+  size_t bodyLength;
+
+  TraceEvent()
+      : type(TRACE_START), code(0), flags(0), value(0), atUs(0), unixTime(0), text(nullptr), textLength(0),
+        body(nullptr), bodyLength(0)
+  {
+  }
+};
+
+struct TraceReader
+{
+  const uint8_t *data;
+  size_t size;
+  size_t offset;
+  int64_t lastUs;
+  uint32_t lastUnix;
+  uint8_t bombaCount;
+};
+
+// OUTBOX_SENDING: lote montado, nas mãos da task de envio
+enum OutboxState : uint8_t
+{
+  OUTBOX_IDLE,
+  OUTBOX_SENDING,
+  OUTBOX_DONE
+};
+
+struct OutboxStats
+{
+  uint32_t nextSeq;
+  uint32_t ackedSeq; // último seq confirmado (persistido na NVS)
+  uint32_t pending;
+  uint32_t sent;
+  uint32_t batches;
+  uint32_t failures;
+  uint32_t rejected;
+  uint32_t dropped;
+  uint32_t backoffMs;
+  uint32_t lastUploadMs;
+  int lastStatus;
+};
+
+// HUB_FETCHING: GET montado, nas mãos da task de envio (a mesma do outbox)
+enum HubState : uint8_t
+{
+  HUB_IDLE,
+  HUB_FETCHING,
+  HUB_DONE
+};
+
+// Um controlador puxado pelo hub. lastSeq é o cursor (último seq guardado
+// em HUB_FILE); bombas é o array "bombas" do cabeçalho da última página
+struct HubPeer
+{
+  InlineString<HUB_URL_SIZE> url;
+  InlineString<HUB_DEVICE_SIZE> device;
+  uint32_t lastSeq;
+  uint32_t remoteSeq; // último seq do próprio controlador, na última página
+  uint32_t pulled;
+  uint32_t gaps;      // seq que saíram do log do controlador antes do hub puxar
+  uint32_t failures;
+  uint32_t lastPullAt; // hora Unix da última página recebida
+  int lastStatus;
+  char bombas[HUB_STATUS_MAX];
+};
+
+struct HubStats
+{
+  uint8_t peers;
+  uint32_t stored; // linhas em HUB_FILE
+  uint32_t merged;
+  uint32_t duplicates;
+  uint32_t polls;
+  uint32_t failures;
+};
+
+// Última dose já debitada no estoque gravado. Vai no slot da config junto
+// com o estoque (uma gravação só), então a releitura do diário sabe se a
+// dose interrompida já saiu do estoque e se a linha de log já foi escrita
+struct AppliedDose
+{
+  uint32_t journalSeq; // seq do START dela no diário
+  uint32_t logSeq;     // seq que a linha de log dela recebe
+  int32_t dosedUl;
+};
+
+struct JournalStats
+{
+  uint32_t nextSeq;
+  uint32_t writes;
+  uint32_t checkpoints;
+  uint32_t writeErrors;
+  // Reconciliação do último boot
+  uint8_t replayed;     // registros relidos depois do último checkpoint
+  bool partialDose;     // havia uma dose em andamento no reset
+  int32_t recoveredUl;  // volume estimado dessa dose (debitado do estoque)
+  uint8_t requeued;
+  uint8_t discarded;
+};
+
+// Leitura do log na partição: cada linha é copiada da flash mapeada para o
+// buffer do leitor (LOG_LINE_MAX bytes) antes da conferência do setor
+struct LogCursor
+{
+  uint16_t sector;
+  uint16_t sectorsLeft;
+  uint32_t sectorSeq; // seq do cabeçalho do setor: mudou = setor reaproveitado
+  uint32_t offset;
+  size_t skip; // registros mais antigos que os LOG_LIMIT servidos
+};
+
+// Leitor da visão agregada do hub: o log local (partição ou arquivo) e
+// depois HUB_FILE, uma linha por vez
+struct MergedLogCursor
+{
+  uint8_t phase = 0;
+  bool partition = false;
+  LogCursor log;
+  hal::File file;
+};
+
+// --- Estado ---
+// Banco vivo (um dos dois em configBanks): config nova entra trocando o ponteiro
+extern Bomb *bombas;
+extern ConfigGenerations configGenerations;
+extern DosingPumpBank pumpBank;
+
+extern PumpJob pumpQueue[MAX_PUMP_QUEUE];
+extern volatile int pumpHead;
+extern volatile int pumpTail;
+extern bool pumpActive;
+extern PumpJob activeJob;
+extern int64_t pumpStartUs;
+extern int64_t pumpDurationUs;
+extern int64_t pumpFinishedAtUs;
+extern hal::CriticalSection pumpQueueLock;
+
+extern StaticJsonArenaPool<JSON_ARENA_SMALL_COUNT, JSON_ARENA_SMALL_SIZE> jsonSmallPool;
+extern StaticJsonArenaPool<JSON_ARENA_LARGE_COUNT, JSON_ARENA_LARGE_SIZE> jsonLargePool;
+
+extern bool rtcReady;
+extern bool prefsReady;
+extern bool fsReady;
+extern size_t logCount;
+extern bool logPartitionReady;
+extern uint32_t logNextSeq;
+extern OutboxStats outboxStats;
+extern TraceStats traceStats;
+extern HubStats hubStats;
+extern PumpConsumption pumpConsumption[BOMBA_COUNT];
+extern ForecastSettings forecastSettings;
+extern uint32_t heldScheduledDoses;
+extern JournalStats journalStats;
+extern AppliedDose appliedDose;
+
+// --- Ganchos implementados pela aplicação (main.cpp / native) ---
+DateTime clockNow();
+void onPumpJobQueued();
+void reportDoseStartDelay(uint32_t delayUs);
+void reportDoseCutoffDelay(uint32_t delayUs);
+void recordFlashOp(FlashOp op, uint32_t elapsedUs);
+// Lote pronto: a aplicação chama outboxUpload() fora do loop (task)
+void onOutboxBatchReady();
+// GET do hub pronto: a aplicação chama hubFetch() fora do loop (task)
+void onHubFetchReady();
+
+class FlashOpTimer
+{
+public:
+  explicit FlashOpTimer(FlashOp op) : op_(op), startUs_(hal::micros64()) {}
+  ~FlashOpTimer() { recordFlashOp(op_, static_cast<uint32_t>(hal::micros64() - startUs_)); }
+
+private:
+  FlashOp op_;
+  int64_t startUs_;
+};
+
+// --- Helpers ---
+void formatTimestamp(const DateTime &now, char *buffer, size_t size);
+bool parseDateTime(const char *value, DateTime &output);
+uint8_t crc8(const void *data, size_t length);
+uint32_t crc32(const void *data, size_t length);
+
+// Formato de serialização negociado por requisição (JSON é o padrão)
+enum WireFormat
+{
+  WIRE_JSON,
+  WIRE_MSGPACK
+};
+
+// Ponto fixo no documento. JSON: o decimal direto do inteiro (sem float).
+// MessagePack não tem decimal e grava o serialized() cru, então lá o valor
+// vai como inteiro quando exato e como double só quando tem fração.
+template <typename Slot>
+void jsonSetFixed(Slot &&slot, int32_t value, uint8_t decimals, WireFormat format = WIRE_JSON)
+{
+  if (format == WIRE_MSGPACK)
+  {
+    int32_t scale = 1;
+    for (uint8_t i = 0; i < decimals; i++)
+      scale *= 10;
+    if (value % scale == 0)
+      slot = value / scale;
+    else
+      slot = static_cast<double>(value) / scale;
+    return;
+  }
+  FixedText text(value, decimals);
+  slot = serialized(text.data(), text.length());
+}
+
+template <typename Slot>
+void jsonSetMl(Slot &&slot, int32_t ul, WireFormat format = WIRE_JSON)
+{
+  jsonSetFixed(slot, ul, 3, format);
+}
+
+// Número recebido no JSON -> ponto fixo na escala dada (fallback se
+// ausente ou não numérico); jsonMl: ml -> µL
+inline int32_t jsonFixed(JsonVariantConst value, int32_t scale, int32_t fallback)
+{
+  return value.is<double>() ? fixed::scaleRound(value.as<double>(), scale) : fallback;
+}
+
+inline int32_t jsonMl(JsonVariantConst value, int32_t fallbackUl)
+{
+  return jsonFixed(value, UL_PER_ML, fallbackUl);
+}
+
+// --- Config / JSON ---
+void inicializarBombas();
+void saveBombasConfig();
+void loadBombasConfig();
+void initDefaultBombasConfig();
+size_t buildConfigJson(char *buffer, size_t size);
+size_t buildConfigMsgPack(char *buffer, size_t size);
+// Parse para uma cópia de bombas[] (só as bombas presentes mudam, marcadas
+// em channels); clampRanges satura valores fora da faixa em vez de recusar
+bool parseConfigJson(const char *json, size_t length, Bomb *staged, uint32_t &channels, bool clampRanges);
+// MessagePack só chega pela API: faixa sempre conferida
+bool parseConfigMsgPack(const char *data, size_t length, Bomb *staged, uint32_t &channels);
+ConfigApply applyConfigJson(const char *json, size_t length);
+ConfigApply applyConfigMsgPack(const char *data, size_t length);
+ConfigRollback rollbackConfig();
+void serviceConfig();
+ConfigGenerations copyConfigGenerations();
+Bomb *acquireScheduleBank();
+void releaseScheduleBank();
+void resetSchedule(Schedule &schedule);
+
+// --- Logs locais ---
+bool initLogStorage();
+size_t countLogLines(hal::File &file);
+bool trimLogFile(size_t removeCount);
+// Boot: resolve o temporário de uma compactação interrompida por reset
+void recoverTempFile(const char *tempPath, const char *path);
+void appendLocalLog(int bombaIndex, int32_t dosagemUl, const char *origem, const DateTime &timestamp);
+void clearLocalLogs();
+void requestClearLocalLogs();
+void serviceLocalLogs();
+void logCursorBegin(LogCursor &cursor);
+// line: buffer de LOG_LINE_MAX bytes, sem terminador
+bool logCursorNext(LogCursor &cursor, char *line, size_t &length);
+uint32_t logLineSeq(const char *line, size_t length);
+
+// --- Outbox (sincronização com a nuvem) ---
+void initOutbox();
+bool outboxEnabled();
+void setOutboxUrl(const char *url);
+void outboxUrl(char *buffer, size_t size);
+void flushOutbox();
+void outboxAppend(int bombaIndex, int32_t dosagemUl, const char *origem, const char *timestamp);
+void serviceOutbox();
+void outboxUpload();
+uint32_t outboxOldestPendingSec();
+
+// --- Hub (logs de vários controladores) ---
+// Página de GET /logs?afterSeq= (lado do controlador puxado) e o hub, que
+// puxa os controladores de HUB_PEERS_MAX URLs e serve a visão agregada.
+// hubFetch() roda na task de envio; o resto, no loop.
+typedef void (*LogLineSink)(void *context, const char *line, size_t length);
+size_t buildLogPage(uint32_t afterSeq, char *buffer, size_t size);
+void buildHubSelf(JsonDocument &doc, WireFormat format = WIRE_JSON);
+void initHub();
+bool setHubPeers(const char *const *urls, uint8_t count);
+uint8_t hubPeerCount();
+bool copyHubPeer(uint8_t index, HubPeer &out);
+void pullHubNow();
+void serviceHub();
+void hubFetch();
+void forEachMergedLog(LogLineSink sink, void *context);
+void mergedLogBegin(MergedLogCursor &cursor);
+// merged: buffer de MERGED_LINE_MAX + 1 bytes, sem terminador
+bool mergedLogNext(MergedLogCursor &cursor, char *merged, size_t &length);
+
+// --- Gravador de entradas (trace) ---
+// traceHttp/traceWifi/traceClock podem vir de qualquer task; o arquivo só
+// é escrito por flushInputTrace() (loop)
+void initInputTrace(const char *const *routeNames, uint8_t routeCount);
+bool inputTraceEnabled();
+void setInputTrace(bool enabled);
+void clearInputTrace();
+void traceHttp(uint8_t route, uint8_t flags, const char *query, size_t queryLength, const char *body,
+               size_t bodyLength);
+void traceWifi(uint8_t event, int32_t detail);
+void traceClock(uint32_t unixTime);
+void flushInputTrace();
+bool traceReaderBegin(TraceReader &reader, const uint8_t *data, size_t size);
+bool traceReaderNext(TraceReader &reader, TraceEvent &event);
+bool traceRouteName(const TraceEvent &start, uint8_t index, const char *&name, size_t &length);
+
+// --- Diário de doses (WAL) ---
+// Só o loop escreve: jobs enfileirados pelo HTTP entram no diário em
+// journalQueuedJobs(), antes de qualquer início de dose
+void initJournal();
+void journalQueuedJobs();
+void journalStart(int64_t durationUs);
+void journalProgress(int64_t elapsedUs);
+void journalDone();
+// seq do START da dose ativa (muda quando um checkpoint o regrava)
+uint32_t journalActiveSeq();
+// Job que saiu da fila sem ligar a bomba (programa cancelado)
+void journalDropped(const PumpJob &job);
+
+// --- Consumo e previsão de estoque ---
+void loadConsumption();
+void setForecastSettings(const ForecastSettings &settings);
+void recordConsumption(int bombaIndex, int32_t ul, const DateTime &when);
+int32_t scheduledDailyUl(int bombaIndex);
+PumpForecast forecastPump(int bombaIndex, const DateTime &now);
+bool holdScheduledDose(int bombaIndex, int32_t dosagemUl);
+
+// --- Scheduler ---
+void checkSchedules();
+int runSchedulesAt(const DateTime &rtcNow);
+uint32_t secondsUntilNextDose();
+
+// Chama onDue(bomba, agendamento) para cada agendamento que vence no minuto
+// de rtcNow e marca lastRunMinute; devolve quantos onDue aceitaram (true).
+// N é o tamanho do banco, então o laço por bomba é desenrolado.
+template <size_t N, typename OnDue>
+int scanDueSchedules(Bomb (&bank)[N], const DateTime &rtcNow, OnDue &onDue)
+{
+  const long minuteKey = rtcNow.unixtime() / 60;
+  const int diaSemana = rtcNow.dayOfTheWeek();
+  const int hour = rtcNow.hour();
+  const int minute = rtcNow.minute();
+  int accepted = 0;
+
+  auto scanChannel = [&](size_t i) {
+    for (int j = 0; j < SCHEDULE_COUNT; j++)
+    {
+      Schedule &schedule = bank[i].schedules[j];
+
+      if (!schedule.status) continue;
+      if (schedule.lastRunMinute == minuteKey) continue;
+      if (!schedule.diasSemana[diaSemana]) continue;
+      if (schedule.hour != hour || schedule.minute != minute) continue;
+
+      schedule.lastRunMinute = minuteKey;
+      if (onDue(static_cast<int>(i), j)) accepted++;
+    }
+  };
+  UnrollChannels<N>::run(scanChannel);
+  return accepted;
+}
+
+// --- Fila de bombas ---
+bool enqueuePumpJob(int bombaIndex, int32_t dosagemUl, const char *origem);
+int pumpQueueDepth();
+bool pumpQueueIdle();
+void processPumpQueue();
+void startNextPumpJob();
+void finishPumpJob();
+void cutPumpJob();
+
+// --- Programas de dose ---
+void initDosePrograms();
+ProgramVerdict parseDoseProgram(JsonVariantConst body, DoseProgram &program);
+ProgramVerdict submitDoseProgram(DoseProgram &program, int &detail);
+ProgramVerdict cancelDoseProgram(uint16_t id);
+bool copyDoseProgram(uint8_t slot, DoseProgram &out);
+int64_t doseProgramDurationUs(const DoseProgram &program);
+const char *programStateName(ProgramState state);
+// Chamados pela fila de bombas (loop)
+void releaseProgramSteps();
+uint32_t secondsUntilProgramStep();
+bool programJobCancelled(const PumpJob &job);
+void programStepStarted(const PumpJob &job);
+void programStepFinished(const PumpJob &job);
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Ponto fixo para volumes e coeficientes.
+//
+// O núcleo conta volume em microlitros (int32_t, até ~2147 litros) e o
+// coeficiente de calibração em partes por milhão (1.0 = 1000000). Soma e
+// subtração de estoque são exatas: o total não deriva com o número de
+// doses nem com idas e voltas pelo JSON. A conversão de/para ml em ponto
+// flutuante só acontece na borda da API (parse do JSON recebido); a
+// saída usa FixedText, que escreve o decimal direto do inteiro.
+
+#define UL_PER_ML 1000
+#define CALIBR_PPM_ONE 1000000L
+#define FIXED_TEXT_SIZE 16
+
+namespace fixed
+{
+// valor * scale arredondado para o inteiro mais próximo, saturado em int32
+// (ml -> µL com UL_PER_ML, coeficiente -> ppm com CALIBR_PPM_ONE)
+inline int32_t scaleRound(double value, int32_t scale)
+{
+  double scaled = value * scale;
+  if (scaled >= 2147483647.0) return INT32_MAX;
+  if (scaled <= -2147483648.0) return INT32_MIN;
+  return static_cast<int32_t>(scaled >= 0 ? scaled + 0.5 : scaled - 0.5);
+}
+} // namespace fixed
+
+// Texto decimal de um valor em ponto fixo, sem zeros à direita:
+//   FixedText(12500, 3) -> "12.5", FixedText(1050000, 6) -> "1.05"
+class FixedText
+{
+public:
+  FixedText(int32_t value, uint8_t decimals) : length_(0)
+  {
+    uint32_t magnitude = value < 0 ? 0U - static_cast<uint32_t>(value) : static_cast<uint32_t>(value);
+    char digits[12];
+    uint8_t count = 0;
+    do
+    {
+      digits[count++] = static_cast<char>('0' + magnitude % 10);
+      magnitude /= 10;
+    } while (magnitude > 0 || count <= decimals);
+
+    // Casas decimais zeradas à direita não são escritas
+    uint8_t skip = 0;
+    while (skip < decimals && digits[skip] == '0')
+      skip++;
+
+    if (value < 0) text_[length_++] = '-';
+    for (uint8_t i = count; i > skip; i--)
+    {
+      if (i == decimals) text_[length_++] = '.';
+      text_[length_++] = digits[i - 1];
+    }
+    text_[length_] = '\0';
+  }
+
+  const char *c_str() const { return text_; }
+  // char* para o serialized() do ArduinoJson, que então copia o texto
+  char *data() { return text_; }
+  size_t length() const { return length_; }
+
+private:
+  char text_[FIXED_TEXT_SIZE];
+  uint8_t length_;
+};
+
+// Volume em ml para logs e JSON: MlText(2500).c_str() -> "2.5"
+class MlText : public FixedText
+{
+public:
+  explicit MlText(int32_t ul) : FixedText(ul, 3) {}
+};
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <Print.h>
+#include <stdint.h>
+#include <string.h>
+
+// Compressor gzip em streaming (deflate com códigos Huffman fixos).
+//
+// Usa apenas janela deslizante + tabela hash de tamanho fixo, então o
+// consumo de RAM é conhecido em tempo de compilação (memoryFootprint()).
+// Os dados escritos com write() são comprimidos e repassados ao Print de
+// saída; finish() fecha o bloco e grava o trailer (CRC32 + tamanho).
+template <uint8_t WindowBits = 11, uint8_t HashBits = 10>
+class GzipPrint : public Print
+{
+  static_assert(WindowBits >= 9 && WindowBits <= 15, "janela deflate entre 512 B e 32 KB");
+
+public:
+  static constexpr size_t kWindowSize = size_t(1) << WindowBits;
+  static constexpr size_t kHashSize = size_t(1) << HashBits;
+
+  static constexpr size_t memoryFootprint() { return sizeof(GzipPrint); }
+
+  explicit GzipPrint(Print &out) : out_(out)
+  {
+    memset(head_, 0, sizeof(head_));
+    memset(prev_, 0, sizeof(prev_));
+
+    static const uint8_t header[10] = {0x1F, 0x8B, 0x08, 0, 0, 0, 0, 0, 0, 0xFF};
+    emitBytes(header, sizeof(header));
+
+    // Um único bloco final com Huffman fixo (BFINAL=1, BTYPE=01)
+    putBits(1, 1);
+    putBits(1, 2);
+  }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+
+  size_t write(const uint8_t *data, size_t len) override
+  {
+    if (finished_) return 0;
+
+    crc_ = crc32Update(crc_, data, len);
+    totalIn_ += len;
+
+    size_t remaining = len;
+    while (remaining > 0)
+    {
+      size_t room = sizeof(window_) - fill_;
+      size_t chunk = remaining < room ? remaining : room;
+      memcpy(window_ + fill_, data, chunk);
+      fill_ += chunk;
+      data += chunk;
+      remaining -= chunk;
+
+      if (fill_ == sizeof(window_))
+        deflate(false);
+    }
+    return len;
+  }
+
+  void finish()
+  {
+    if (finished_) return;
+    deflate(true);
+    putHuffman(256);
+
+    if (bitCount_ > 0)
+      emitByte(static_cast<uint8_t>(bitBuf_));
+    bitBuf_ = 0;
+    bitCount_ = 0;
+
+    uint8_t trailer[8];
+    for (int i = 0; i < 4; i++)
+    {
+      trailer[i] = static_cast<uint8_t>((crc_ ^ 0xFFFFFFFFu) >> (8 * i));
+      trailer[4 + i] = static_cast<uint8_t>(totalIn_ >> (8 * i));
+    }
+    emitBytes(trailer, sizeof(trailer));
+    flushOutput();
+    finished_ = true;
+  }
+
+  size_t totalIn() const { return totalIn_; }
+  size_t totalOut() const { return totalOut_ + outFill_; }
+
+private:
+  static constexpr size_t kMinMatch = 3;
+  static constexpr size_t kMaxMatch = 258;
+  static constexpr uint8_t kMaxChain = 16;
+
+  Print &out_;
+  uint8_t window_[2 * kWindowSize];
+  uint16_t head_[kHashSize];      // posição + 1 (0 = vazio)
+  uint16_t prev_[kWindowSize];    // cadeia de posições com o mesmo hash
+  size_t fill_ = 0;
+  size_t pos_ = 0;
+
+  uint32_t bitBuf_ = 0;
+  uint8_t bitCount_ = 0;
+  uint8_t outBuf_[64];
+  size_t outFill_ = 0;
+
+  uint32_t crc_ = 0xFFFFFFFFu;
+  uint32_t totalIn_ = 0;
+  size_t totalOut_ = 0;
+  bool finished_ = false;
+
+  static uint32_t crc32Update(uint32_t crc, const uint8_t *data, size_t len)
+  {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+    for (size_t i = 0; i < len; i++)
+    {
+      crc ^= data[i];
+      crc = (crc >> 4) ^ table[crc & 0x0F];
+      crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+    return crc;
+  }
+
+  uint16_t hashAt(size_t pos) const
+  {
+    uint32_t v = (uint32_t(window_[pos]) << 16) | (uint32_t(window_[pos + 1]) << 8) | window_[pos + 2];
+    return static_cast<uint16_t>((v * 2654435761u) >> (32 - HashBits));
+  }
+
+  void insertHash(size_t pos)
+  {
+    if (pos + kMinMatch > fill_) return;
+    uint16_t h = hashAt(pos);
+    prev_[pos & (kWindowSize - 1)] = head_[h];
+    head_[h] = static_cast<uint16_t>(pos + 1);
+  }
+
+  size_t findMatch(size_t pos, size_t maxLen, size_t &distance) const
+  {
+    size_t bestLen = 0;
+    uint16_t candidate = head_[hashAt(pos)];
+    uint8_t chain = kMaxChain;
+
+    while (candidate != 0 && chain-- > 0)
+    {
+      size_t cpos = candidate - 1;
+      if (cpos >= pos || pos - cpos >= kWindowSize) break;
+
+      if (window_[cpos + bestLen] == window_[pos + bestLen])
+      {
+        size_t len = 0;
+        while (len < maxLen && window_[cpos + len] == window_[pos + len])
+          len++;
+        if (len > bestLen)
+        {
+          bestLen = len;
+          distance = pos - cpos;
+          if (len == maxLen) break;
+        }
+      }
+
+      uint16_t next = prev_[cpos & (kWindowSize - 1)];
+      if (next == 0 || next - 1u >= cpos) break;
+      candidate = next;
+    }
+    return bestLen;
+  }
+
+  void deflate(bool flush)
+  {
+    while (pos_ < fill_ && (flush || fill_ - pos_ >= kMaxMatch))
+    {
+      size_t available = fill_ - pos_;
+      size_t maxLen = available < kMaxMatch ? available : kMaxMatch;
+      size_t distance = 0;
+      size_t len = (maxLen >= kMinMatch) ? findMatch(pos_, maxLen, distance) : 0;
+
+      if (len >= kMinMatch)
+      {
+        putMatch(len, distance);
+        for (size_t i = 0; i < len; i++)
+          insertHash(pos_ + i);
+        pos_ += len;
+      }
+      else
+      {
+        putHuffman(window_[pos_]);
+        insertHash(pos_);
+        pos_++;
+      }
+    }
+
+    if (!flush && pos_ >= kWindowSize)
+      slide();
+  }
+
+  // Descarta a metade antiga do buffer e reajusta as posições da tabela hash
+  void slide()
+  {
+    memmove(window_, window_ + kWindowSize, fill_ - kWindowSize);
+    fill_ -= kWindowSize;
+    pos_ -= kWindowSize;
+    for (size_t i = 0; i < kHashSize; i++)
+      head_[i] = head_[i] > kWindowSize ? head_[i] - kWindowSize : 0;
+    for (size_t i = 0; i < kWindowSize; i++)
+      prev_[i] = prev_[i] > kWindowSize ? prev_[i] - kWindowSize : 0;
+  }
+
+  void putMatch(size_t len, size_t distance)
+  {
+    static const uint16_t lenBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27,
+                                         31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t lenExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                         2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t distBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                          193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                          6145, 8193, 12289, 16385, 24577};
+    static const uint8_t distExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                          6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    int lc = 28;
+    while (lenBase[lc] > len) lc--;
+    putHuffman(257 + lc);
+    putBits(len - lenBase[lc], lenExtra[lc]);
+
+    int dc = 29;
+    while (distBase[dc] > distance) dc--;
+    putBits(reverseBits(dc, 5), 5);
+    putBits(distance - distBase[dc], distExtra[dc]);
+  }
+
+  void putHuffman(uint16_t symbol)
+  {
+    if (symbol < 144)
+      putBits(reverseBits(0x30 + symbol, 8), 8);
+    else if (symbol < 256)
+      putBits(reverseBits(0x190 + symbol - 144, 9), 9);
+    else if (symbol < 280)
+      putBits(reverseBits(symbol - 256, 7), 7);
+    else
+      putBits(reverseBits(0xC0 + symbol - 280, 8), 8);
+  }
+
+  static uint32_t reverseBits(uint32_t code, uint8_t len)
+  {
+    uint32_t reversed = 0;
+    for (uint8_t i = 0; i < len; i++)
+    {
+      reversed = (reversed << 1) | (code & 1);
+      code >>= 1;
+    }
+    return reversed;
+  }
+
+  void putBits(uint32_t value, uint8_t count)
+  {
+    bitBuf_ |= value << bitCount_;
+    bitCount_ += count;
+    while (bitCount_ >= 8)
+    {
+      emitByte(static_cast<uint8_t>(bitBuf_));
+      bitBuf_ >>= 8;
+      bitCount_ -= 8;
+    }
+  }
+
+  void emitByte(uint8_t b)
+  {
+    outBuf_[outFill_++] = b;
+    if (outFill_ == sizeof(outBuf_))
+      flushOutput();
+  }
+
+  void emitBytes(const uint8_t *data, size_t len)
+  {
+    for (size_t i = 0; i < len; i++)
+      emitByte(data[i]);
+  }
+
+  void flushOutput()
+  {
+    if (outFill_ == 0) return;
+    out_.write(outBuf_, outFill_);
+    totalOut_ += outFill_;
+    outFill_ = 0;
+  }
+};
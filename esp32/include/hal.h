@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#else
+#include <mutex>
+#endif
+
+// Camada fina de hardware (HAL).
+//
+// Dosagem, scheduler, configuração e logs (src/core) só falam com o
+// hardware por aqui. src/hal/hal_esp32.cpp implementa com o core Arduino
+// (GPIO, DS3231, Preferences, LittleFS, WiFi); native/hal_native.cpp
+// implementa com fakes em memória e um diretório do host para o ambiente
+// `native` do PlatformIO. Nada aqui aloca por chamada, exceto fsOpen().
+namespace hal
+{
+// --- Console ---
+void logf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+// false silencia logf (benchmarks, perf); a firmware nunca desliga
+void setLogEnabled(bool enabled);
+
+// --- Tempo monotônico ---
+// millis()/uptimeUs(): relógio da firmware (no native segue o relógio
+// manual); micros64(): tempo real, para medir duração de operações
+uint32_t millis();
+int64_t uptimeUs();
+int64_t micros64();
+
+// --- RTC (DS3231 na placa): hora local em segundos Unix ---
+bool rtcBegin();
+bool rtcRead(uint32_t &unixTime);
+bool rtcWrite(uint32_t unixTime);
+
+// --- GPIO ---
+void gpioOutput(uint8_t pin);
+void gpioWrite(uint8_t pin, bool high);
+
+// --- I2C (barramento do RTC; expansores das bombas) ---
+// Escreve o bloco em uma transação; false = sem ACK
+bool i2cWrite(uint8_t address, const uint8_t *data, size_t length);
+
+// --- Chave/valor (NVS na placa) ---
+// get* devolvem o tamanho lido (0 = ausente ou não coube); put* o gravado
+bool kvBegin(const char *space);
+size_t kvGetBytes(const char *key, void *buffer, size_t size);
+size_t kvPutBytes(const char *key, const void *data, size_t size);
+size_t kvGetString(const char *key, char *buffer, size_t size);
+size_t kvPutString(const char *key, const char *value);
+uint16_t kvGetU16(const char *key, uint16_t fallback);
+size_t kvPutU16(const char *key, uint16_t value);
+
+// --- Sistema de arquivos (LittleFS na placa, diretório no host) ---
+enum FileMode : uint8_t
+{
+  FILE_MODE_READ,
+  FILE_MODE_WRITE,
+  FILE_MODE_APPEND,
+  FILE_MODE_UPDATE // leitura e escrita no lugar, sem truncar ("r+")
+};
+
+class File
+{
+public:
+  File() : handle_(nullptr) {}
+  explicit File(void *handle) : handle_(handle) {}
+  File(File &&other) : handle_(other.handle_) { other.handle_ = nullptr; }
+  File &operator=(File &&other)
+  {
+    if (this != &other)
+    {
+      close();
+      handle_ = other.handle_;
+      other.handle_ = nullptr;
+    }
+    return *this;
+  }
+  File(const File &) = delete;
+  File &operator=(const File &) = delete;
+  ~File() { close(); }
+
+  explicit operator bool() const { return handle_ != nullptr; }
+
+  size_t read(void *buffer, size_t size);
+  size_t write(const void *data, size_t size);
+  size_t print(const char *text);
+  bool seek(size_t position);
+  size_t size();
+  // Grava na flash o que está em buffer, sem fechar
+  void flush();
+  void close();
+
+  // Próxima linha sem o '\n' (e sem '\r'). Linhas maiores que o buffer são
+  // truncadas e o restante descartado. Devolve false no fim do arquivo.
+  bool readLine(char *buffer, size_t size, size_t &length);
+
+private:
+  void *handle_;
+};
+
+bool fsBegin();
+bool fsExists(const char *path);
+bool fsRemove(const char *path);
+bool fsRename(const char *from, const char *to);
+File fsOpen(const char *path, FileMode mode);
+
+// --- Partição de dados crua (esp_partition na placa, arquivo mmap no host) ---
+// Flash NOR: apagar leva o setor a 0xFF e gravar só muda bits de 1 para 0.
+// A leitura é direto pela janela mapeada devolvida por partitionBegin(),
+// sem cópia; gravações aparecem nela em seguida.
+bool partitionBegin(const char *label, const uint8_t *&mapped, size_t &size);
+bool partitionErase(size_t offset, size_t length);
+bool partitionWrite(size_t offset, const void *data, size_t length);
+
+// --- Rede ---
+bool netLinkUp();
+// Identificador estável do controlador (derivado do MAC na placa)
+const char *deviceId();
+// POST síncrono; devolve o status HTTP (<= 0 = falha de transporte)
+int httpPost(const char *url, const char *contentType, const uint8_t *body, size_t length);
+// GET síncrono com o corpo no buffer; corpo maior que o buffer também é
+// falha (-2)
+int httpGet(const char *url, char *buffer, size_t size, size_t &length);
+
+// --- Exclusão mútua entre tasks (portMUX na placa) ---
+class CriticalSection
+{
+public:
+#ifdef ARDUINO
+  void enter() { portENTER_CRITICAL(&mux_); }
+  void exit() { portEXIT_CRITICAL(&mux_); }
+
+private:
+  portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;
+#else
+  void enter() { mutex_.lock(); }
+  void exit() { mutex_.unlock(); }
+
+private:
+  std::mutex mutex_;
+#endif
+};
+
+class ScopedCritical
+{
+public:
+  explicit ScopedCritical(CriticalSection &section) : section_(section) { section_.enter(); }
+  ~ScopedCritical() { section_.exit(); }
+
+private:
+  CriticalSection &section_;
+};
+} // namespace hal
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <ESPAsyncWebServer.h>
+#include "dosing.h"
+#include "gzip_print.h"
+
+#include <memory>
+
+// Handlers HTTP que só dependem do núcleo (src/api): GET /status, GET e
+// POST /config, POST /dose e GET /logs, mais os helpers de formato (JSON ou
+// MessagePack), gzip e body. Compilam na firmware, onde main.cpp registra
+// as rotas atrás da admissão, e no servidor nativo (native/server_native.cpp),
+// onde o ESPAsyncWebServer é o adaptador de native/include. O que só existe
+// na placa passa pelos ganchos no fim do arquivo.
+
+#define JSON_MIME "application/json"
+#define MSGPACK_MIME "application/msgpack"
+
+// Compressão gzip (GET /logs, GET /hub/logs e GET /config): janela de 2 KB,
+// ~10 KB de RAM do compressor por resposta, fora o buffer pendente do corpo
+#define GZIP_WINDOW_BITS 11
+#define GZIP_HASH_BITS 10
+#define GZIP_HEAP_RESERVE 24576
+
+typedef GzipPrint<GZIP_WINDOW_BITS, GZIP_HASH_BITS> GzipEncoder;
+
+// Respostas em massa saem em chunks (beginChunkedResponse): cada next() do
+// corpo escreve no máximo BULK_ITEM_MAX bytes (uma linha do log, um trecho
+// da config). Com gzip, um next() dispara no máximo um deflate da janela
+// dupla (9 bits por literal no pior caso) mais o trailer
+#define BULK_ITEM_MAX 512
+#define GZIP_BURST_MAX ((2u << GZIP_WINDOW_BITS) * 9 / 8 + 128)
+// Folga do buffer pendente além do pior next(): um segmento TCP
+#define BULK_CHUNK_SIZE 1536
+
+// Pools de arenas JSON (dosing.h), na ordem em que aparecem em /status e /metrics
+#define JSON_POOL_COUNT 2
+extern JsonArenaPool *const JSON_POOLS[JSON_POOL_COUNT];
+
+extern uint32_t gzipFallbackCount;
+
+// --- Handlers ---
+void handleStatus(AsyncWebServerRequest *request);
+void handleGetConfig(AsyncWebServerRequest *request);
+void handlePostConfig(AsyncWebServerRequest *request);
+void handlePostDose(AsyncWebServerRequest *request);
+void handleGetLogs(AsyncWebServerRequest *request);
+// Página incremental de GET /logs?afterSeq=N (hub.cpp)
+void sendLogPage(AsyncWebServerRequest *request, uint32_t afterSeq);
+
+// --- Corpo das respostas (também medido em bench/) ---
+// GET /status inteiro, com o bloco da placa vindo de fillPlatformStatus()
+void buildStatusDocument(JsonDocument &doc, WireFormat format);
+
+// Corpo gerado aos poucos: o AsyncTCP pede até maxLen bytes e fill() chama
+// next() até o buffer pendente ter o bastante, passando pelo gzip quando há.
+// RAM fixa por resposta (pendente + compressor), qualquer que seja o
+// tamanho do corpo.
+class BulkBody : public Print
+{
+public:
+  BulkBody() = default;
+  virtual ~BulkBody();
+  BulkBody(const BulkBody &) = delete;
+  BulkBody &operator=(const BulkBody &) = delete;
+
+  // Antes do primeiro fill(); o corpo passa a ser dono do compressor.
+  // false = sem memória para o buffer pendente
+  bool begin(GzipEncoder *gzip);
+  // Próximos bytes do corpo (já comprimidos); 0 = fim
+  size_t fill(uint8_t *buffer, size_t maxLen);
+  bool done() const { return done_ && head_ == tail_; }
+  size_t plainSize() const { return gzip_ ? gzip_->totalIn() : wireSize_; }
+  size_t wireSize() const { return wireSize_; }
+  // Para finishBulkResponse(), que fecha e apaga o compressor
+  GzipEncoder *releaseGzip();
+
+  // Saída do next() (ou do gzip) para o buffer pendente
+  using Print::write;
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *data, size_t length) override;
+
+protected:
+  // Escreve o próximo pedaço (até BULK_ITEM_MAX bytes); false = acabou
+  virtual bool next(Print &out) = 0;
+
+private:
+  GzipEncoder *gzip_ = nullptr;
+  std::unique_ptr<uint8_t[]> pending_;
+  size_t capacity_ = 0;
+  size_t burst_ = 0;
+  size_t head_ = 0;
+  size_t tail_ = 0;
+  size_t wireSize_ = 0;
+  bool done_ = false;
+};
+
+// GET /logs: uma linha por next(), do cursor da partição crua ou, sem ela,
+// do arquivo do LittleFS (file aberto; fechado = log vazio)
+class LogsBody : public BulkBody
+{
+public:
+  LogsBody(WireFormat format, hal::File file);
+
+protected:
+  bool next(Print &out) override;
+
+private:
+  bool nextLine(char *line, size_t &length);
+
+  WireFormat format_;
+  bool partition_;
+  LogCursor cursor_;
+  hal::File file_;
+  size_t count_ = 0; // MessagePack: contagem do cabeçalho
+  size_t sent_ = 0;
+  bool started_ = false;
+  bool closed_ = false; // JSON: "]" já escrito
+};
+
+// GET /hub/logs: array JSON com a visão agregada, uma linha por next()
+class HubLogsBody : public BulkBody
+{
+public:
+  HubLogsBody() { mergedLogBegin(cursor_); }
+
+protected:
+  bool next(Print &out) override;
+
+private:
+  MergedLogCursor cursor_;
+  size_t sent_ = 0;
+  bool started_ = false;
+  bool closed_ = false;
+};
+
+// Corpo já pronto num buffer do heap (config em JSON ou MessagePack),
+// em trechos de BULK_ITEM_MAX
+class BufferBody : public BulkBody
+{
+public:
+  BufferBody(std::unique_ptr<char[]> data, size_t size) : data_(std::move(data)), size_(size) {}
+
+protected:
+  bool next(Print &out) override;
+
+private:
+  std::unique_ptr<char[]> data_;
+  size_t size_;
+  size_t offset_ = 0;
+};
+
+// Responde 200 com o corpo em chunks (gzip se aceito); o corpo vive até o
+// último chunk ou até a conexão cair
+void sendBulkBody(AsyncWebServerRequest *request, WireFormat format, BulkBody *body);
+
+// --- Formato, compressão e body ---
+const char *wireFormatMime(WireFormat format);
+WireFormat responseFormat(AsyncWebServerRequest *request);
+WireFormat requestFormat(AsyncWebServerRequest *request);
+void sendDocument(AsyncWebServerRequest *request, int code, JsonDocument &doc);
+bool acceptsGzip(AsyncWebServerRequest *request);
+// Compressor escrevendo em out; nullptr = resposta sem compressão. Quem
+// chama põe o Content-Encoding na resposta
+GzipEncoder *beginGzip(AsyncWebServerRequest *request, Print &out);
+// Fecha e apaga o compressor e entrega os bytes na rede a noteBulkResponse()
+void finishBulkResponse(AsyncWebServerRequest *request, GzipEncoder *gzip, size_t plainSize);
+bool readRequestBody(AsyncWebServerRequest *request, const char *&body, size_t &length);
+bool readRequestDocument(AsyncWebServerRequest *request, JsonDocument &doc, DeserializationError &error);
+size_t writeMsgPackArrayHeader(Print &out, size_t count);
+
+// --- Blocos do GET /status que vêm do núcleo ---
+void fillSyncStatus(JsonObject status);
+void fillForecastStatus(JsonObject status, WireFormat format);
+void fillJournalStatus(JsonObject status, WireFormat format);
+void fillConfigStatus(JsonObject status);
+void fillTraceStatus(JsonObject status);
+void fillHubStatus(JsonObject status);
+void fillJsonArenaStatus(JsonObject arenas);
+
+// --- Ganchos implementados pela aplicação (main.cpp / server_native.cpp) ---
+// Trabalho entregue ao loop (geração da config, por exemplo)
+void wakeLoop();
+// Maior bloco alocável agora: abaixo do compressor + reserva, sem gzip
+size_t largestFreeBlock();
+// Body guardado pela admissão quando não há o parâmetro "plain"
+bool admittedRequestBody(AsyncWebServerRequest *request, const char *&body, size_t &length);
+// Resposta em massa: chamado no envio (wireSize 0, começa a medir a
+// transferência) e de novo com os bytes na rede quando o corpo termina
+void noteBulkResponse(AsyncWebServerRequest *request, bool compressed, size_t wireSize);
+// wifi, ap, http, ntp, clock e power do GET /status
+void fillPlatformStatus(JsonDocument &doc);
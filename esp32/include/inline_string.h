@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// String de capacidade fixa guardada inline (sem heap).
+// Textos maiores que Capacity - 1 são truncados.
+template <size_t Capacity>
+class InlineString
+{
+  static_assert(Capacity > 1, "capacidade minima de 2 bytes");
+
+public:
+  InlineString() { data_[0] = '\0'; }
+  InlineString(const char *text) { assign(text); }
+
+  void assign(const char *text)
+  {
+    if (text == nullptr)
+    {
+      data_[0] = '\0';
+      return;
+    }
+    strncpy(data_, text, Capacity - 1);
+    data_[Capacity - 1] = '\0';
+  }
+
+  InlineString &operator=(const char *text)
+  {
+    assign(text);
+    return *this;
+  }
+
+  void printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+  {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(data_, Capacity, format, args);
+    va_end(args);
+  }
+
+  void clear() { data_[0] = '\0'; }
+
+  const char *c_str() const { return data_; }
+  size_t length() const { return strlen(data_); }
+  bool isEmpty() const { return data_[0] == '\0'; }
+  static constexpr size_t capacity() { return Capacity - 1; }
+
+  bool operator==(const char *text) const { return text != nullptr && strcmp(data_, text) == 0; }
+  bool operator!=(const char *text) const { return !(*this == text); }
+
+private:
+  char data_[Capacity];
+};
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hal.h"
+
+// Arenas estáticas para JsonDocument (ArduinoJson 7).
+//
+// Cada pool tem N arenas de tamanho fixo, alocadas uma vez na RAM estática.
+// Um handler pega uma arena emprestada (JsonLease), o documento aloca nela
+// por bump pointer e, ao sair do escopo, a arena volta inteira para o pool:
+// nenhum malloc/free no caminho normal. O empréstimo é protegido por uma
+// seção crítica (o loop e a task do AsyncTCP pedem arenas ao mesmo tempo);
+// a arena em si tem um dono só e não precisa de trava.
+//
+// Pool esgotado: o documento usa o heap, como antes, e conta em
+// `exhausted`. Arena pequena para o documento: a alocação falha, o
+// ArduinoJson marca overflowed() / NoMemory e conta em `overflows`.
+
+// Bump allocator sobre um buffer fixo. Só o último bloco pode crescer no
+// lugar ou ser devolvido; o resto é liberado de uma vez em reset().
+class JsonArena : public ArduinoJson::Allocator
+{
+public:
+  JsonArena() : buffer_(nullptr), capacity_(0), used_(0), peak_(0), last_(nullptr), overflowed_(false) {}
+
+  void attach(uint8_t *buffer, size_t capacity)
+  {
+    buffer_ = buffer;
+    capacity_ = capacity;
+    reset();
+  }
+
+  void reset()
+  {
+    used_ = 0;
+    peak_ = 0;
+    last_ = nullptr;
+    overflowed_ = false;
+  }
+
+  size_t capacity() const { return capacity_; }
+  size_t peak() const { return peak_; }
+  bool overflowed() const { return overflowed_; }
+
+  void *allocate(size_t size) override
+  {
+    size_t offset = used_ + kHeader;
+    if (offset + size > capacity_)
+    {
+      overflowed_ = true;
+      return nullptr;
+    }
+    return place(offset, size);
+  }
+
+  void deallocate(void *ptr) override
+  {
+    if (ptr == nullptr || ptr != last_) return;
+    used_ = static_cast<uint8_t *>(ptr) - buffer_ - kHeader;
+    last_ = nullptr;
+  }
+
+  void *reallocate(void *ptr, size_t size) override
+  {
+    if (ptr == nullptr) return allocate(size);
+
+    if (ptr == last_)
+    {
+      size_t offset = static_cast<uint8_t *>(ptr) - buffer_;
+      if (offset + size > capacity_)
+      {
+        overflowed_ = true;
+        return nullptr;
+      }
+      return place(offset, size);
+    }
+
+    // Bloco antigo fica perdido até o reset()
+    void *moved = allocate(size);
+    if (moved == nullptr) return nullptr;
+    size_t oldSize = blockSize(ptr);
+    memcpy(moved, ptr, oldSize < size ? oldSize : size);
+    return moved;
+  }
+
+private:
+  static const size_t kHeader = 8; // tamanho do bloco, mantém alinhamento de 8
+
+  static size_t align(size_t size) { return (size + 7) & ~static_cast<size_t>(7); }
+
+  static size_t blockSize(void *ptr)
+  {
+    uint32_t size;
+    memcpy(&size, static_cast<uint8_t *>(ptr) - kHeader, sizeof(size));
+    return size;
+  }
+
+  void *place(size_t offset, size_t size)
+  {
+    uint32_t stored = static_cast<uint32_t>(size);
+    memcpy(buffer_ + offset - kHeader, &stored, sizeof(stored));
+    used_ = offset + align(size);
+    if (used_ > capacity_) used_ = capacity_;
+    if (used_ > peak_) peak_ = used_;
+    last_ = buffer_ + offset;
+    return last_;
+  }
+
+  uint8_t *buffer_;
+  size_t capacity_;
+  size_t used_;
+  size_t peak_;
+  uint8_t *last_;
+  bool overflowed_;
+};
+
+// Heap como reserva quando o pool esgota (mesmo comportamento de antes)
+class JsonHeapAllocator : public ArduinoJson::Allocator
+{
+public:
+  void *allocate(size_t size) override { return malloc(size); }
+  void deallocate(void *ptr) override { free(ptr); }
+  void *reallocate(void *ptr, size_t size) override { return realloc(ptr, size); }
+
+  static JsonHeapAllocator *instance()
+  {
+    static JsonHeapAllocator allocator;
+    return &allocator;
+  }
+};
+
+struct JsonArenaStats
+{
+  uint32_t leases;
+  uint32_t exhausted;
+  uint32_t overflows;
+  uint8_t inUse;
+  uint8_t peakInUse;
+  size_t peakBytes;
+};
+
+class JsonArenaPool
+{
+public:
+  JsonArenaPool(const char *name, JsonArena *arenas, bool *busy, uint8_t count, size_t arenaSize)
+      : name_(name), arenas_(arenas), busy_(busy), count_(count), arenaSize_(arenaSize)
+  {
+    memset(&stats_, 0, sizeof(stats_));
+  }
+
+  const char *name() const { return name_; }
+  uint8_t count() const { return count_; }
+  size_t arenaSize() const { return arenaSize_; }
+
+  // nullptr = pool esgotado
+  JsonArena *acquire()
+  {
+    hal::ScopedCritical guard(lock_);
+    stats_.leases++;
+    for (uint8_t i = 0; i < count_; i++)
+    {
+      if (busy_[i]) continue;
+      busy_[i] = true;
+      stats_.inUse++;
+      if (stats_.inUse > stats_.peakInUse) stats_.peakInUse = stats_.inUse;
+      return &arenas_[i];
+    }
+    stats_.exhausted++;
+    return nullptr;
+  }
+
+  void release(JsonArena *arena)
+  {
+    hal::ScopedCritical guard(lock_);
+    if (arena->peak() > stats_.peakBytes) stats_.peakBytes = arena->peak();
+    if (arena->overflowed()) stats_.overflows++;
+    arena->reset();
+    busy_[arena - arenas_] = false;
+    stats_.inUse--;
+  }
+
+  JsonArenaStats stats()
+  {
+    hal::ScopedCritical guard(lock_);
+    return stats_;
+  }
+
+protected:
+  const char *name_;
+  JsonArena *arenas_;
+  bool *busy_;
+  uint8_t count_;
+  size_t arenaSize_;
+  JsonArenaStats stats_;
+  hal::CriticalSection lock_;
+};
+
+// Pool com armazenamento estático: Count arenas de Size bytes
+template <uint8_t Count, size_t Size>
+class StaticJsonArenaPool : public JsonArenaPool
+{
+  static_assert(Count > 0, "pool sem arenas");
+  static_assert(Size % 8 == 0, "tamanho da arena multiplo de 8");
+
+public:
+  explicit StaticJsonArenaPool(const char *name) : JsonArenaPool(name, arenas_, busy_, Count, Size)
+  {
+    for (uint8_t i = 0; i < Count; i++)
+    {
+      arenas_[i].attach(buffers_[i], Size);
+      busy_[i] = false;
+    }
+  }
+
+private:
+  alignas(8) uint8_t buffers_[Count][Size];
+  JsonArena arenas_[Count];
+  bool busy_[Count];
+};
+
+// Empréstimo de uma arena com o JsonDocument já ligado a ela:
+//   JsonLease lease(jsonSmallPool);
+//   JsonDocument &doc = lease.doc();
+class JsonLease
+{
+public:
+  explicit JsonLease(JsonArenaPool &pool) : slot_(pool), doc_(slot_.allocator()) {}
+
+  JsonDocument &doc() { return doc_; }
+  bool pooled() const { return slot_.arena != nullptr; }
+
+private:
+  struct Slot
+  {
+    explicit Slot(JsonArenaPool &owner) : pool(owner), arena(owner.acquire()) {}
+    ~Slot()
+    {
+      if (arena) pool.release(arena);
+    }
+
+    ArduinoJson::Allocator *allocator()
+    {
+      if (arena) return arena;
+      return JsonHeapAllocator::instance();
+    }
+
+    JsonArenaPool &pool;
+    JsonArena *arena;
+  };
+
+  JsonLease(const JsonLease &) = delete;
+  JsonLease &operator=(const JsonLease &) = delete;
+
+  // Ordem importa: doc_ é destruído (e devolve a memória) antes do slot_
+  Slot slot_;
+  JsonDocument doc_;
+};
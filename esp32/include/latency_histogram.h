@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Histograma log-linear de memória fixa (estilo HDR).
+//
+// Cada potência de 2 é dividida em 2^SubBits faixas lineares, então o erro
+// relativo de um bucket é no máximo 1 / 2^SubBits. Com SubBits = 2 são 124
+// contadores de 32 bits (~500 bytes) cobrindo todo o intervalo de uint32_t.
+// record() é O(1) e não aloca; leituras concorrentes podem ver contagens
+// levemente defasadas, o que é aceitável para métricas.
+template <uint8_t SubBits = 2>
+class LatencyHistogram
+{
+  static_assert(SubBits >= 1 && SubBits <= 4, "SubBits entre 1 e 4");
+
+public:
+  static constexpr size_t kSubBuckets = size_t(1) << SubBits;
+  static constexpr size_t kBucketCount = (33 - SubBits) * kSubBuckets;
+
+  LatencyHistogram() { reset(); }
+
+  void reset()
+  {
+    memset(counts_, 0, sizeof(counts_));
+    total_ = 0;
+    sum_ = 0;
+    max_ = 0;
+  }
+
+  void record(uint32_t value)
+  {
+    counts_[bucketIndex(value)]++;
+    total_++;
+    sum_ += value;
+    if (value > max_) max_ = value;
+  }
+
+  uint32_t count() const { return total_; }
+  uint64_t sum() const { return sum_; }
+  uint32_t max() const { return max_; }
+  uint32_t bucketCount(size_t index) const { return counts_[index]; }
+
+  // Quantidade de amostras cujo bucket inteiro cabe em [0, limit]
+  uint32_t countAtOrBelow(uint32_t limit) const
+  {
+    uint32_t cumulative = 0;
+    for (size_t i = 0; i < kBucketCount; i++)
+    {
+      if (bucketUpperBound(i) > limit) break;
+      cumulative += counts_[i];
+    }
+    return cumulative;
+  }
+
+  // Estimativa do percentil (0-100) pelo limite superior do bucket
+  uint32_t percentile(float pct) const
+  {
+    if (total_ == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(pct / 100.0f * total_ + 0.5f);
+    if (rank == 0) rank = 1;
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < kBucketCount; i++)
+    {
+      cumulative += counts_[i];
+      if (cumulative >= rank)
+        return bucketUpperBound(i) < max_ ? bucketUpperBound(i) : max_;
+    }
+    return max_;
+  }
+
+  static size_t bucketIndex(uint32_t value)
+  {
+    if (value < kSubBuckets) return value;
+    uint8_t msb = 31 - __builtin_clz(value);
+    uint8_t shift = msb - SubBits;
+    size_t sub = (value >> shift) & (kSubBuckets - 1);
+    return (shift + 1) * kSubBuckets + sub;
+  }
+
+  static uint32_t bucketUpperBound(size_t index)
+  {
+    if (index < kSubBuckets) return static_cast<uint32_t>(index);
+    uint8_t shift = index / kSubBuckets - 1;
+    uint64_t lower = static_cast<uint64_t>(kSubBuckets + index % kSubBuckets) << shift;
+    uint64_t upper = lower + (uint64_t(1) << shift) - 1;
+    return upper > 0xFFFFFFFFu ? 0xFFFFFFFFu : static_cast<uint32_t>(upper);
+  }
+
+private:
+  uint32_t counts_[kBucketCount];
+  uint32_t total_;
+  uint64_t sum_;
+  uint32_t max_;
+};
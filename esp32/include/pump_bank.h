@@ -0,0 +1,228 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hal.h"
+
+// Banco de bombas parametrizado em tempo de compilação.
+//
+// PumpBank<Canais, Driver> liga/desliga as saídas pelo driver escolhido:
+// GPIO direto da placa ou expansores MCP23017 no I2C (16 canais por chip).
+// O número de canais é constante, então os laços por canal da
+// serialização e do scheduler são desenrolados por UnrollChannels e as
+// chaves "bomb1".."bombN" do JSON saem prontas de uma tabela estática,
+// sem snprintf. Tudo em C++11 (o toolchain Arduino da placa).
+
+// --- Desenrolamento de laços por canal ---
+// UnrollChannels<N>::run(f) chama f(0), f(1), ..., f(N - 1) sem laço
+template <size_t I, size_t N>
+struct UnrollFrom
+{
+  template <typename F>
+  static void run(F &f)
+  {
+    f(I);
+    UnrollFrom<I + 1, N>::run(f);
+  }
+};
+
+template <size_t N>
+struct UnrollFrom<N, N>
+{
+  template <typename F>
+  static void run(F &) {}
+};
+
+template <size_t N>
+struct UnrollChannels : UnrollFrom<0, N>
+{
+};
+
+// --- Chaves "bomb1".."bomb99" montadas em tempo de compilação ---
+template <size_t... I>
+struct IndexSeq
+{
+};
+
+template <size_t N, size_t... I>
+struct MakeIndexSeq : MakeIndexSeq<N - 1, N - 1, I...>
+{
+};
+
+template <size_t... I>
+struct MakeIndexSeq<0, I...>
+{
+  typedef IndexSeq<I...> type;
+};
+
+template <size_t Index>
+struct ChannelKey
+{
+  static_assert(Index < 99, "chave de canal com no maximo 2 digitos");
+  static const size_t number = Index + 1;
+  static const char value[7];
+};
+
+template <size_t Index>
+const char ChannelKey<Index>::value[7] = {
+    'b', 'o', 'm', 'b',
+    static_cast<char>(number < 10 ? '0' + number : '0' + number / 10),
+    static_cast<char>(number < 10 ? '\0' : '0' + number % 10),
+    '\0'};
+
+template <typename Seq>
+struct ChannelKeyTable;
+
+template <size_t... I>
+struct ChannelKeyTable<IndexSeq<I...>>
+{
+  static const char *const keys[sizeof...(I)];
+};
+
+template <size_t... I>
+const char *const ChannelKeyTable<IndexSeq<I...>>::keys[sizeof...(I)] = {ChannelKey<I>::value...};
+
+// --- Drivers de saída ---
+// Interface: CHANNELS, bool begin(), bool write(canal, ligado)
+
+// Uma saída GPIO por canal, na ordem dos pinos
+template <uint8_t... Pins>
+class GpioPumpDriver
+{
+public:
+  static const uint8_t CHANNELS = sizeof...(Pins);
+
+  bool begin()
+  {
+    for (uint8_t i = 0; i < CHANNELS; i++)
+    {
+      hal::gpioOutput(pins[i]);
+      hal::gpioWrite(pins[i], false);
+    }
+    return true;
+  }
+
+  bool write(uint8_t channel, bool on)
+  {
+    hal::gpioWrite(pins[channel], on);
+    return true;
+  }
+
+  static uint8_t pin(uint8_t channel) { return pins[channel]; }
+
+private:
+  static const uint8_t pins[CHANNELS];
+};
+
+template <uint8_t... Pins>
+const uint8_t GpioPumpDriver<Pins...>::pins[GpioPumpDriver<Pins...>::CHANNELS] = {Pins...};
+
+// Chips MCP23017 em endereços consecutivos a partir de BaseAddress.
+// Canal c: chip c / 16, porta A (0-7) ou B (8-15). O latch de cada porta
+// fica em RAM e cada mudança reescreve o OLAT inteiro (uma transação I2C).
+template <uint8_t Chips, uint8_t BaseAddress = 0x20>
+class Mcp23017PumpDriver
+{
+  static_assert(Chips > 0 && Chips <= 8, "MCP23017: 1 a 8 chips no barramento");
+  static_assert(BaseAddress >= 0x20 && BaseAddress + Chips <= 0x28, "MCP23017: enderecos 0x20-0x27");
+
+public:
+  static const uint8_t CHANNELS = Chips * 16;
+
+  static const uint8_t REG_IODIRA = 0x00;
+  static const uint8_t REG_OLATA = 0x14;
+
+  Mcp23017PumpDriver() : errors_(0)
+  {
+    for (uint8_t i = 0; i < Chips * 2; i++)
+      latch_[i] = 0;
+  }
+
+  // Saídas em nível baixo antes de virarem saída (IOCON.BANK = 0: os
+  // registradores A/B são vizinhos e o ponteiro auto-incrementa)
+  bool begin()
+  {
+    bool ok = true;
+    for (uint8_t chip = 0; chip < Chips; chip++)
+    {
+      const uint8_t latch[3] = {REG_OLATA, 0x00, 0x00};
+      const uint8_t direction[3] = {REG_IODIRA, 0x00, 0x00};
+      ok = send(chip, latch, sizeof(latch)) && ok;
+      ok = send(chip, direction, sizeof(direction)) && ok;
+    }
+    return ok;
+  }
+
+  bool write(uint8_t channel, bool on)
+  {
+    uint8_t chip = channel / 16;
+    uint8_t port = (channel % 16) / 8;
+    uint8_t mask = static_cast<uint8_t>(1U << (channel % 8));
+    uint8_t &latch = latch_[chip * 2 + port];
+
+    latch = on ? (latch | mask) : (latch & ~mask);
+    const uint8_t frame[2] = {static_cast<uint8_t>(REG_OLATA + port), latch};
+    return send(chip, frame, sizeof(frame));
+  }
+
+  uint32_t errors() const { return errors_; }
+
+private:
+  bool send(uint8_t chip, const uint8_t *data, size_t length)
+  {
+    if (hal::i2cWrite(BaseAddress + chip, data, length)) return true;
+    errors_++;
+    return false;
+  }
+
+  uint8_t latch_[Chips * 2];
+  uint32_t errors_;
+};
+
+// --- Banco ---
+template <uint8_t Channels, typename Driver>
+class PumpBank
+{
+  static_assert(Channels > 0 && Channels <= 32, "banco de 1 a 32 bombas");
+  static_assert(Channels <= Driver::CHANNELS, "driver com menos saidas que bombas");
+
+public:
+  static const uint8_t CHANNELS = Channels;
+  typedef ChannelKeyTable<typename MakeIndexSeq<Channels>::type> Keys;
+
+  PumpBank() : onMask_(0), ready_(false) {}
+
+  bool begin()
+  {
+    onMask_ = 0;
+    ready_ = driver_.begin();
+    return ready_;
+  }
+
+  bool set(uint8_t channel, bool on)
+  {
+    if (channel >= Channels) return false;
+    uint32_t bit = 1UL << channel;
+    onMask_ = on ? (onMask_ | bit) : (onMask_ & ~bit);
+    return driver_.write(channel, on);
+  }
+
+  bool isOn(uint8_t channel) const { return channel < Channels && (onMask_ >> channel) & 1U; }
+  uint32_t onMask() const { return onMask_; }
+  bool ready() const { return ready_; }
+  Driver &driver() { return driver_; }
+
+  // Chave do canal no JSON de configuração ("bomb1"...)
+  static const char *key(uint8_t channel) { return Keys::keys[channel]; }
+
+  template <typename F>
+  static void forEachChannel(F &f)
+  {
+    UnrollChannels<Channels>::run(f);
+  }
+
+private:
+  Driver driver_;
+  uint32_t onMask_;
+  bool ready_;
+};
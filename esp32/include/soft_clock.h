@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+// Relógio de software: uma âncora (instante monotônico -> hora) avançada
+// pelo contador monotônico (esp_timer_get_time() na firmware).
+//
+// Correções pequenas são aplicadas por slew: o relógio anda até
+// MaxSlewPpm mais rápido ou mais devagar até absorver o erro, sem nunca
+// voltar para trás. Só anchor() muda a hora de uma vez.
+template <int32_t MaxSlewPpm = 1000>
+class SoftClock
+{
+  static_assert(MaxSlewPpm > 0 && MaxSlewPpm < 1000000, "slew entre 1 e 999999 ppm");
+
+public:
+  void anchor(int64_t monoUs, int64_t timeUs)
+  {
+    anchorMonoUs_ = monoUs;
+    anchorTimeUs_ = timeUs;
+    slewTotalUs_ = 0;
+    anchored_ = true;
+  }
+
+  bool isAnchored() const { return anchored_; }
+
+  int64_t now(int64_t monoUs) const
+  {
+    int64_t elapsed = monoUs - anchorMonoUs_;
+    return anchorTimeUs_ + elapsed + slewApplied(elapsed);
+  }
+
+  // errorUs = referência - relógio. Substitui qualquer slew pendente.
+  void slew(int64_t monoUs, int64_t errorUs)
+  {
+    anchorTimeUs_ = now(monoUs);
+    anchorMonoUs_ = monoUs;
+    slewTotalUs_ = errorUs;
+  }
+
+  int64_t pendingSlew(int64_t monoUs) const
+  {
+    return slewTotalUs_ - slewApplied(monoUs - anchorMonoUs_);
+  }
+
+private:
+  int64_t anchorMonoUs_ = 0;
+  int64_t anchorTimeUs_ = 0;
+  int64_t slewTotalUs_ = 0;
+  bool anchored_ = false;
+
+  int64_t slewApplied(int64_t elapsed) const
+  {
+    if (slewTotalUs_ == 0 || elapsed <= 0) return 0;
+    int64_t budget = elapsed * MaxSlewPpm / 1000000;
+    if (slewTotalUs_ > 0) return budget < slewTotalUs_ ? budget : slewTotalUs_;
+    return -budget > slewTotalUs_ ? -budget : slewTotalUs_;
+  }
+};
@@ -0,0 +1,721 @@
+#include "hal_native.h"
+
+#include <chrono>
+#include <errno.h>
+#include <map>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// HAL do ambiente `native`: fakes em memória e um diretório do host.
+// Nada aqui é thread-safe além do necessário para a firmware (uma task).
+namespace
+{
+bool logEnabled = true;
+
+bool manualClock = false;
+int64_t manualUs = 0;
+const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+
+bool rtcPresent = true;
+uint32_t rtcBaseTime = 1767225600; // 01/01/2026 00:00:00
+int64_t rtcBaseUs = 0;
+uint32_t rtcWriteCount = 0;
+
+const uint8_t GPIO_COUNT = 64;
+bool gpioLevels[GPIO_COUNT];
+bool gpioOutputs[GPIO_COUNT];
+uint32_t gpioEdges[GPIO_COUNT];
+
+// I2C fake: um banco de 256 registradores por endereço, com o ponteiro
+// auto-incrementando como no MCP23017 (IOCON.BANK = 0)
+const uint8_t I2C_ADDRESS_COUNT = 128;
+uint8_t i2cRegs[I2C_ADDRESS_COUNT][256];
+bool i2cAbsent[I2C_ADDRESS_COUNT];
+uint32_t i2cWriteCount = 0;
+
+std::string kvSpace;
+std::map<std::string, std::vector<uint8_t>> kvStore;
+
+std::string fsRootDir = "native_fs";
+
+// Partição crua: arquivo "<fsRoot>.<label>" mapeado com mmap
+const size_t PARTITION_SECTOR_SIZE = 4096;
+size_t partitionSize = 128 * 1024;
+uint8_t *partitionMap = nullptr;
+size_t partitionMapped = 0;
+uint32_t partitionEraseCount = 0;
+
+// Gravações persistentes contadas e o ponto da queda de energia (-1 = sem)
+uint32_t persistentWriteCount = 0;
+int32_t powerCutAfter = -1;
+
+bool linkUp = true;
+std::string nativeDeviceId = "native-0001";
+int httpStatus = 200;
+std::vector<hal::native::HttpRequest> httpLog;
+
+// Heap modelado: blocos contíguos com cabeçalho, first-fit, vizinhos
+// livres juntados na liberação (como o heap da placa, sem as listas)
+struct HeapBlock
+{
+  uint32_t size; // bloco inteiro, cabeçalho incluso
+  uint32_t used;
+};
+
+const size_t HEAP_HEADER = 16; // mantém o alinhamento de 16 do new no host
+uint8_t *heapArena = nullptr;
+size_t heapArenaSize = 0;
+int heapScopeDepth = 0;
+uint32_t heapFailures = 0;
+size_t heapLargestLow = SIZE_MAX;
+
+HeapBlock *heapBlockAt(uint8_t *at)
+{
+  return at < heapArena + heapArenaSize ? reinterpret_cast<HeapBlock *>(at) : nullptr;
+}
+
+HeapBlock *heapNext(HeapBlock *block)
+{
+  return heapBlockAt(reinterpret_cast<uint8_t *>(block) + block->size);
+}
+
+// false = a energia já caiu: a gravação não chega à flash
+bool persist()
+{
+  if (powerCutAfter >= 0 && persistentWriteCount >= static_cast<uint32_t>(powerCutAfter)) return false;
+  persistentWriteCount++;
+  return true;
+}
+
+std::string kvKey(const char *key)
+{
+  return kvSpace + "/" + key;
+}
+
+std::string hostPath(const char *path)
+{
+  return fsRootDir + (path[0] == '/' ? "" : "/") + path;
+}
+
+// Base de millis() e do RTC: manual ou real
+int64_t firmwareUs()
+{
+  return manualClock ? manualUs : hal::micros64();
+}
+
+FILE *fileOf(void *handle)
+{
+  return static_cast<FILE *>(handle);
+}
+} // namespace
+
+namespace hal
+{
+// --- Console ---
+void logf(const char *format, ...)
+{
+  if (!logEnabled) return;
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+void setLogEnabled(bool enabled)
+{
+  logEnabled = enabled;
+}
+
+// --- Tempo monotônico ---
+int64_t micros64()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - bootTime)
+      .count();
+}
+
+uint32_t millis()
+{
+  return static_cast<uint32_t>(firmwareUs() / 1000);
+}
+
+int64_t uptimeUs()
+{
+  return firmwareUs();
+}
+
+// --- RTC ---
+bool rtcBegin()
+{
+  return rtcPresent;
+}
+
+bool rtcRead(uint32_t &unixTime)
+{
+  if (!rtcPresent) return false;
+  unixTime = rtcBaseTime + static_cast<uint32_t>((firmwareUs() - rtcBaseUs) / 1000000);
+  return true;
+}
+
+bool rtcWrite(uint32_t unixTime)
+{
+  if (!rtcPresent) return false;
+  native::setRtc(unixTime);
+  rtcWriteCount++;
+  return true;
+}
+
+// --- GPIO ---
+void gpioOutput(uint8_t pin)
+{
+  if (pin < GPIO_COUNT) gpioOutputs[pin] = true;
+}
+
+void gpioWrite(uint8_t pin, bool high)
+{
+  if (pin >= GPIO_COUNT) return;
+  if (high && !gpioLevels[pin]) gpioEdges[pin]++;
+  gpioLevels[pin] = high;
+}
+
+// --- I2C ---
+bool i2cWrite(uint8_t address, const uint8_t *data, size_t length)
+{
+  if (address >= I2C_ADDRESS_COUNT || i2cAbsent[address]) return false;
+  i2cWriteCount++;
+  if (length == 0) return true;
+
+  uint8_t reg = data[0];
+  for (size_t i = 1; i < length; i++)
+    i2cRegs[address][reg++] = data[i];
+  return true;
+}
+
+// --- Chave/valor ---
+bool kvBegin(const char *space)
+{
+  kvSpace = space;
+  return true;
+}
+
+size_t kvGetBytes(const char *key, void *buffer, size_t size)
+{
+  auto entry = kvStore.find(kvKey(key));
+  if (entry == kvStore.end() || entry->second.size() > size) return 0;
+  memcpy(buffer, entry->second.data(), entry->second.size());
+  return entry->second.size();
+}
+
+size_t kvPutBytes(const char *key, const void *data, size_t size)
+{
+  if (!persist()) return size;
+  native::HostHeapScope host;
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  kvStore[kvKey(key)].assign(bytes, bytes + size);
+  return size;
+}
+
+size_t kvGetString(const char *key, char *buffer, size_t size)
+{
+  // Guardada com o '\0', como na NVS
+  size_t stored = kvGetBytes(key, buffer, size);
+  return stored > 0 ? stored - 1 : 0;
+}
+
+size_t kvPutString(const char *key, const char *value)
+{
+  size_t length = strlen(value);
+  kvPutBytes(key, value, length + 1);
+  return length;
+}
+
+uint16_t kvGetU16(const char *key, uint16_t fallback)
+{
+  uint16_t value;
+  return kvGetBytes(key, &value, sizeof(value)) == sizeof(value) ? value : fallback;
+}
+
+size_t kvPutU16(const char *key, uint16_t value)
+{
+  return kvPutBytes(key, &value, sizeof(value));
+}
+
+// --- Sistema de arquivos ---
+size_t File::read(void *buffer, size_t size)
+{
+  return handle_ ? fread(buffer, 1, size, fileOf(handle_)) : 0;
+}
+
+size_t File::write(const void *data, size_t size)
+{
+  if (!handle_) return 0;
+  if (!persist()) return size;
+  return fwrite(data, 1, size, fileOf(handle_));
+}
+
+size_t File::print(const char *text)
+{
+  return write(text, strlen(text));
+}
+
+bool File::seek(size_t position)
+{
+  return handle_ && fseek(fileOf(handle_), static_cast<long>(position), SEEK_SET) == 0;
+}
+
+size_t File::size()
+{
+  if (!handle_) return 0;
+  FILE *file = fileOf(handle_);
+  long position = ftell(file);
+  fseek(file, 0, SEEK_END);
+  long end = ftell(file);
+  fseek(file, position, SEEK_SET);
+  return end < 0 ? 0 : static_cast<size_t>(end);
+}
+
+void File::flush()
+{
+  if (handle_) fflush(fileOf(handle_));
+}
+
+void File::close()
+{
+  if (!handle_) return;
+  fclose(fileOf(handle_));
+  handle_ = nullptr;
+}
+
+bool File::readLine(char *buffer, size_t size, size_t &length)
+{
+  length = 0;
+  if (!handle_) return false;
+
+  FILE *file = fileOf(handle_);
+  int c = getc(file);
+  if (c == EOF) return false;
+
+  while (c != EOF && c != '\n')
+  {
+    if (length + 1 < size) buffer[length++] = static_cast<char>(c);
+    c = getc(file);
+  }
+  while (length > 0 && (buffer[length - 1] == '\r' || buffer[length - 1] == ' '))
+    length--;
+  buffer[length] = '\0';
+  return true;
+}
+
+bool fsBegin()
+{
+  return mkdir(fsRootDir.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+bool fsExists(const char *path)
+{
+  struct stat info;
+  return stat(hostPath(path).c_str(), &info) == 0;
+}
+
+bool fsRemove(const char *path)
+{
+  if (!persist()) return fsExists(path);
+  return remove(hostPath(path).c_str()) == 0;
+}
+
+bool fsRename(const char *from, const char *to)
+{
+  if (!persist()) return fsExists(from);
+  return rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+File fsOpen(const char *path, FileMode mode)
+{
+  const char *flags = mode == FILE_MODE_READ     ? "rb"
+                      : mode == FILE_MODE_APPEND ? "ab"
+                      : mode == FILE_MODE_UPDATE ? "r+b"
+                                                 : "wb";
+  // Depois da queda o arquivo não é criado nem truncado; os writes somem
+  if (mode != FILE_MODE_READ && !persist()) flags = "rb";
+  return File(fopen(hostPath(path).c_str(), flags));
+}
+
+// --- Partição de dados crua ---
+bool partitionBegin(const char *label, const uint8_t *&mapped, size_t &size)
+{
+  if (partitionMap != nullptr)
+  {
+    munmap(partitionMap, partitionMapped);
+    partitionMap = nullptr;
+  }
+  if (partitionSize == 0) return false;
+
+  std::string path = fsRootDir + "." + label;
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) return false;
+
+  // Imagem nova (ou de outro tamanho) começa apagada, como flash virgem
+  struct stat info;
+  bool fresh = fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) != partitionSize;
+  if (fresh && ftruncate(fd, static_cast<off_t>(partitionSize)) != 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  void *window = mmap(nullptr, partitionSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (window == MAP_FAILED) return false;
+
+  partitionMap = static_cast<uint8_t *>(window);
+  partitionMapped = partitionSize;
+  if (fresh) memset(partitionMap, 0xFF, partitionSize);
+
+  mapped = partitionMap;
+  size = partitionSize;
+  return true;
+}
+
+// Mesmas restrições do esp_partition_erase_range: faixa alinhada ao setor
+bool partitionErase(size_t offset, size_t length)
+{
+  if (partitionMap == nullptr || offset % PARTITION_SECTOR_SIZE != 0 || length % PARTITION_SECTOR_SIZE != 0 ||
+      offset + length > partitionMapped)
+    return false;
+  if (!persist()) return true;
+  memset(partitionMap + offset, 0xFF, length);
+  partitionEraseCount += length / PARTITION_SECTOR_SIZE;
+  return true;
+}
+
+// Gravação NOR: só zera bits (regravar sem apagar corrompe, como na placa)
+bool partitionWrite(size_t offset, const void *data, size_t length)
+{
+  if (partitionMap == nullptr || offset + length > partitionMapped) return false;
+  if (!persist()) return true;
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < length; i++)
+    partitionMap[offset + i] &= bytes[i];
+  return true;
+}
+
+// --- Rede ---
+bool netLinkUp()
+{
+  return linkUp;
+}
+
+const char *deviceId()
+{
+  return nativeDeviceId.c_str();
+}
+
+int httpPost(const char *url, const char *contentType, const uint8_t *body, size_t length)
+{
+  if (!linkUp) return -1;
+  native::HostHeapScope host;
+  native::HttpRequest request;
+  request.url = url;
+  request.contentType = contentType;
+  request.body.assign(body, body + length);
+  httpLog.push_back(request);
+  return httpStatus;
+}
+
+// GET de verdade (HTTP/1.0 por TCP): os controladores puxados pelo hub
+// rodam como outros processos do executor (--serve)
+int httpGet(const char *url, char *buffer, size_t size, size_t &length)
+{
+  length = 0;
+  if (!linkUp || strncmp(url, "http://", 7) != 0) return -1;
+
+  std::string rest(url + 7);
+  size_t slash = rest.find('/');
+  std::string hostPort = rest.substr(0, slash);
+  std::string path = slash == std::string::npos ? "/" : rest.substr(slash);
+  size_t colon = hostPort.find(':');
+  std::string host = hostPort.substr(0, colon);
+  std::string port = colon == std::string::npos ? "80" : hostPort.substr(colon + 1);
+
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *address = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &address) != 0) return -1;
+
+  int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+  timeval timeout = {5, 0};
+  bool connected = fd >= 0 && setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0 &&
+                   connect(fd, address->ai_addr, address->ai_addrlen) == 0;
+  freeaddrinfo(address);
+  if (!connected)
+  {
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+
+  std::string request = "GET " + path + " HTTP/1.0\r\nHost: " + hostPort + "\r\n\r\n";
+  std::string response;
+  char chunk[2048];
+  ssize_t received = send(fd, request.data(), request.size(), 0) == static_cast<ssize_t>(request.size()) ? 1 : -1;
+  while (received > 0 && (received = recv(fd, chunk, sizeof(chunk), 0)) > 0)
+    response.append(chunk, received);
+  close(fd);
+
+  size_t bodyAt = response.find("\r\n\r\n");
+  int status = 0;
+  if (received < 0 || bodyAt == std::string::npos || sscanf(response.c_str(), "HTTP/%*s %d", &status) != 1)
+    return -1;
+  bodyAt += 4;
+  if (response.size() - bodyAt > size) return -2;
+  length = response.size() - bodyAt;
+  memcpy(buffer, response.data() + bodyAt, length);
+  return status;
+}
+
+// --- Controles dos fakes ---
+namespace native
+{
+void setManualClock(bool manual)
+{
+  if (manual && !manualClock) manualUs = micros64();
+  manualClock = manual;
+}
+
+void advanceUs(int64_t us)
+{
+  manualUs += us;
+}
+
+void setRtcPresent(bool present)
+{
+  rtcPresent = present;
+}
+
+void setRtc(uint32_t unixTime)
+{
+  rtcBaseTime = unixTime;
+  rtcBaseUs = firmwareUs();
+}
+
+uint32_t rtcWrites()
+{
+  return rtcWriteCount;
+}
+
+bool gpioLevel(uint8_t pin)
+{
+  return pin < GPIO_COUNT && gpioLevels[pin];
+}
+
+bool gpioIsOutput(uint8_t pin)
+{
+  return pin < GPIO_COUNT && gpioOutputs[pin];
+}
+
+uint32_t gpioRisingEdges(uint8_t pin)
+{
+  return pin < GPIO_COUNT ? gpioEdges[pin] : 0;
+}
+
+uint8_t i2cRegister(uint8_t address, uint8_t reg)
+{
+  return address < I2C_ADDRESS_COUNT ? i2cRegs[address][reg] : 0;
+}
+
+uint32_t i2cWrites()
+{
+  return i2cWriteCount;
+}
+
+void setI2cPresent(uint8_t address, bool present)
+{
+  if (address < I2C_ADDRESS_COUNT) i2cAbsent[address] = !present;
+}
+
+void kvClear()
+{
+  kvStore.clear();
+}
+
+size_t kvEntryCount()
+{
+  return kvStore.size();
+}
+
+void setFsRoot(const char *directory)
+{
+  fsRootDir = directory;
+}
+
+const char *fsRoot()
+{
+  return fsRootDir.c_str();
+}
+
+void setPartitionSize(size_t size)
+{
+  partitionSize = size;
+}
+
+uint32_t partitionErases()
+{
+  return partitionEraseCount;
+}
+
+void setPowerCutAfter(int32_t writes)
+{
+  powerCutAfter = writes;
+}
+
+uint32_t persistentWrites()
+{
+  return persistentWriteCount;
+}
+
+void setLinkUp(bool up)
+{
+  linkUp = up;
+}
+
+void setDeviceId(const char *id)
+{
+  nativeDeviceId = id;
+}
+
+void setHttpStatus(int status)
+{
+  httpStatus = status;
+}
+
+const std::vector<HttpRequest> &httpRequests()
+{
+  return httpLog;
+}
+
+void clearHttpRequests()
+{
+  httpLog.clear();
+}
+
+void heapModelBegin(size_t size)
+{
+  size &= ~(HEAP_HEADER - 1);
+  heapArena = static_cast<uint8_t *>(aligned_alloc(HEAP_HEADER, size));
+  heapArenaSize = size;
+  HeapBlock *block = reinterpret_cast<HeapBlock *>(heapArena);
+  block->size = static_cast<uint32_t>(size);
+  block->used = 0;
+}
+
+bool heapModelActive()
+{
+  return heapArena != nullptr;
+}
+
+size_t heapModelFree()
+{
+  size_t total = 0;
+  for (HeapBlock *block = heapBlockAt(heapArena); block; block = heapNext(block))
+  {
+    if (!block->used) total += block->size - HEAP_HEADER;
+  }
+  return total;
+}
+
+size_t heapModelLargestFree()
+{
+  size_t largest = 0;
+  for (HeapBlock *block = heapBlockAt(heapArena); block; block = heapNext(block))
+  {
+    if (!block->used && block->size - HEAP_HEADER > largest) largest = block->size - HEAP_HEADER;
+  }
+  return largest;
+}
+
+size_t heapModelTakeLargestLow()
+{
+  size_t low = heapLargestLow;
+  heapLargestLow = heapModelLargestFree();
+  return low < heapLargestLow ? low : heapLargestLow;
+}
+
+uint32_t heapModelFailures()
+{
+  return heapFailures;
+}
+
+void *heapModelAllocate(size_t size, bool &failed)
+{
+  failed = false;
+  if (heapArena == nullptr || heapScopeDepth == 0) return nullptr;
+
+  size_t need = HEAP_HEADER + ((size + HEAP_HEADER - 1) & ~(HEAP_HEADER - 1));
+  if (size == 0) need += HEAP_HEADER;
+  for (HeapBlock *block = heapBlockAt(heapArena); block; block = heapNext(block))
+  {
+    if (block->used || block->size < need) continue;
+    // Sobra que cabe outro bloco vira bloco livre logo depois
+    if (block->size - need >= 2 * HEAP_HEADER)
+    {
+      HeapBlock *rest = reinterpret_cast<HeapBlock *>(reinterpret_cast<uint8_t *>(block) + need);
+      rest->size = block->size - static_cast<uint32_t>(need);
+      rest->used = 0;
+      block->size = static_cast<uint32_t>(need);
+    }
+    block->used = 1;
+    size_t largest = heapModelLargestFree();
+    if (largest < heapLargestLow) heapLargestLow = largest;
+    return reinterpret_cast<uint8_t *>(block) + HEAP_HEADER;
+  }
+  heapFailures++;
+  failed = true;
+  return nullptr;
+}
+
+bool heapModelRelease(void *pointer)
+{
+  uint8_t *at = static_cast<uint8_t *>(pointer);
+  if (heapArena == nullptr || at < heapArena || at >= heapArena + heapArenaSize) return false;
+
+  reinterpret_cast<HeapBlock *>(at - HEAP_HEADER)->used = 0;
+  for (HeapBlock *block = heapBlockAt(heapArena); block; block = heapNext(block))
+  {
+    if (block->used) continue;
+    HeapBlock *next;
+    while ((next = heapNext(block)) != nullptr && !next->used)
+      block->size += next->size;
+  }
+  return true;
+}
+
+HeapScope::HeapScope()
+{
+  heapScopeDepth++;
+}
+
+HeapScope::~HeapScope()
+{
+  heapScopeDepth--;
+}
+
+HostHeapScope::HostHeapScope() : savedDepth_(heapScopeDepth)
+{
+  heapScopeDepth = 0;
+}
+
+HostHeapScope::~HostHeapScope()
+{
+  heapScopeDepth = savedDepth_;
+}
+} // namespace native
+} // namespace hal
@@ -0,0 +1,75 @@
+#include "hal_native.h"
+
+#include <stdlib.h>
+#include <new>
+
+// operator new/delete do ambiente `native` ligados ao heap modelado da HAL
+// fake (hal::native::heapModelBegin). Sem o modelo, ou fora de um
+// HeapScope, tudo vai para o malloc do host. Os outros ambientes nativos
+// não compilam este arquivo (native_server conta o heap do seu jeito).
+
+namespace
+{
+void *allocate(size_t size)
+{
+  bool failed;
+  void *pointer = hal::native::heapModelAllocate(size, failed);
+  if (pointer == nullptr && !failed) pointer = malloc(size ? size : 1);
+  return pointer;
+}
+
+// Sem espaço no modelo o new que lança exceção não tem como degradar:
+// a falha fica contada e o bloco sai do host para a simulação seguir
+void *allocateOrHost(size_t size)
+{
+  void *pointer = allocate(size);
+  if (pointer == nullptr) pointer = malloc(size ? size : 1);
+  if (pointer == nullptr) throw std::bad_alloc();
+  return pointer;
+}
+
+void release(void *pointer)
+{
+  if (pointer != nullptr && !hal::native::heapModelRelease(pointer)) free(pointer);
+}
+} // namespace
+
+void *operator new(size_t size)
+{
+  return allocateOrHost(size);
+}
+
+void *operator new[](size_t size)
+{
+  return allocateOrHost(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+  return allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+  return allocate(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+  release(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+  release(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+  release(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept
+{
+  release(pointer);
+}
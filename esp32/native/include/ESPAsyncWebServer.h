@@ -0,0 +1,230 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Print.h"
+
+// Substituto do ESPAsyncWebServer no ambiente `native`: só o lado que os
+// handlers de src/api enxergam. A requisição chega já lida (método, url,
+// parâmetros, headers e body) e a resposta fica montada em memória, ou,
+// quando chunked, guarda o filler que quem fala com o socket
+// (native/server_native.cpp) chama até devolver 0. Como na biblioteca, um
+// body que não é formulário vira o parâmetro POST "plain" e o destrutor
+// libera _tempObject com free().
+
+class String
+{
+public:
+  String(const char *text = "") : value_(text ? text : "") {}
+  String(const char *data, size_t length) : value_(data, length) {}
+
+  const char *c_str() const { return value_.c_str(); }
+  unsigned int length() const { return static_cast<unsigned int>(value_.size()); }
+
+  int indexOf(const char *text) const
+  {
+    size_t at = value_.find(text);
+    return at == std::string::npos ? -1 : static_cast<int>(at);
+  }
+
+private:
+  std::string value_;
+};
+
+// Mesmos bits da biblioteca
+enum WebRequestMethod : uint8_t
+{
+  HTTP_GET = 0b00000001,
+  HTTP_POST = 0b00000010,
+  HTTP_DELETE = 0b00000100,
+  HTTP_PUT = 0b00001000,
+  HTTP_PATCH = 0b00010000,
+  HTTP_HEAD = 0b00100000,
+  HTTP_OPTIONS = 0b01000000,
+  HTTP_ANY = 0b01111111
+};
+
+typedef uint8_t WebRequestMethodComposite;
+
+// Mesma assinatura da biblioteca: (buffer, maxLen, index) -> bytes; 0 = fim
+typedef std::function<size_t(uint8_t *buffer, size_t maxLen, size_t index)> AwsResponseFiller;
+
+class AsyncWebParameter
+{
+public:
+  AsyncWebParameter(const String &name, const String &value, bool post) : name_(name), value_(value), post_(post) {}
+
+  const String &name() const { return name_; }
+  const String &value() const { return value_; }
+  bool isPost() const { return post_; }
+
+private:
+  String name_;
+  String value_;
+  bool post_;
+};
+
+class AsyncWebServerResponse
+{
+public:
+  typedef std::pair<std::string, std::string> Header;
+
+  AsyncWebServerResponse(int code, const char *contentType, const char *content)
+      : code_(code), contentType_(contentType ? contentType : ""), content_(content ? content : "")
+  {
+  }
+  virtual ~AsyncWebServerResponse() {}
+
+  void setCode(int code) { code_ = code; }
+  void addHeader(const char *name, const char *value) { headers_.emplace_back(name, value); }
+
+  // Lido pelo servidor nativo ao escrever a resposta
+  int code() const { return code_; }
+  const std::string &contentType() const { return contentType_; }
+  const std::vector<Header> &headers() const { return headers_; }
+  const std::string &content() const { return content_; }
+  virtual bool chunked() const { return false; }
+  virtual size_t fill(uint8_t *, size_t, size_t) { return 0; }
+
+protected:
+  int code_;
+  std::string contentType_;
+  std::vector<Header> headers_;
+  std::string content_;
+};
+
+class AsyncResponseStream : public AsyncWebServerResponse, public Print
+{
+public:
+  explicit AsyncResponseStream(const char *contentType) : AsyncWebServerResponse(200, contentType, "") {}
+
+  using Print::write;
+  size_t write(uint8_t c) override
+  {
+    content_ += static_cast<char>(c);
+    return 1;
+  }
+
+  size_t write(const uint8_t *data, size_t length) override
+  {
+    content_.append(reinterpret_cast<const char *>(data), length);
+    return length;
+  }
+};
+
+class AsyncChunkedResponse : public AsyncWebServerResponse
+{
+public:
+  AsyncChunkedResponse(const char *contentType, AwsResponseFiller filler)
+      : AsyncWebServerResponse(200, contentType, ""), filler_(std::move(filler))
+  {
+  }
+
+  bool chunked() const override { return true; }
+  size_t fill(uint8_t *buffer, size_t maxLen, size_t index) override { return filler_(buffer, maxLen, index); }
+
+private:
+  AwsResponseFiller filler_;
+};
+
+class AsyncWebServerRequest
+{
+public:
+  AsyncWebServerRequest(WebRequestMethodComposite method, const char *url) : method_(method), url_(url) {}
+  ~AsyncWebServerRequest() { free(_tempObject); }
+  AsyncWebServerRequest(const AsyncWebServerRequest &) = delete;
+  AsyncWebServerRequest &operator=(const AsyncWebServerRequest &) = delete;
+
+  WebRequestMethodComposite method() const { return method_; }
+  const String &url() const { return url_; }
+  const String &contentType() const { return contentType_; }
+  size_t contentLength() const { return contentLength_; }
+
+  bool hasParam(const char *name, bool post = false) const { return getParam(name, post) != nullptr; }
+
+  AsyncWebParameter *getParam(const char *name, bool post = false) const
+  {
+    for (const auto &param : params_)
+    {
+      if (param->isPost() == post && strcmp(param->name().c_str(), name) == 0) return param.get();
+    }
+    return nullptr;
+  }
+
+  // Nomes de header sem diferenciar maiúsculas, como no HTTP
+  bool hasHeader(const char *name) const { return findHeader(name) != nullptr; }
+
+  String header(const char *name) const
+  {
+    const std::string *value = findHeader(name);
+    return value ? String(value->data(), value->size()) : String();
+  }
+
+  AsyncResponseStream *beginResponseStream(const char *contentType) { return new AsyncResponseStream(contentType); }
+
+  AsyncWebServerResponse *beginResponse(int code, const char *contentType = "", const char *content = "")
+  {
+    return new AsyncWebServerResponse(code, contentType, content);
+  }
+
+  AsyncWebServerResponse *beginChunkedResponse(const char *contentType, AwsResponseFiller filler)
+  {
+    return new AsyncChunkedResponse(contentType, std::move(filler));
+  }
+
+  void send(AsyncWebServerResponse *response) { response_.reset(response); }
+  void send(int code, const char *contentType = "", const char *content = "")
+  {
+    send(beginResponse(code, contentType, content));
+  }
+
+  // --- Montagem pelo servidor nativo ---
+  void addParam(const char *name, const char *value, bool post)
+  {
+    params_.emplace_back(new AsyncWebParameter(name, value, post));
+  }
+
+  void addHeader(const std::string &name, const std::string &value)
+  {
+    headers_.emplace_back(name, value);
+    if (strcasecmp(name.c_str(), "Content-Type") == 0) contentType_ = String(value.c_str());
+  }
+
+  void setBody(const char *data, size_t length)
+  {
+    contentLength_ = length;
+    params_.emplace_back(new AsyncWebParameter("plain", String(data, length), true));
+  }
+
+  AsyncWebServerResponse *response() const { return response_.get(); }
+
+  void *_tempObject = nullptr;
+
+private:
+  const std::string *findHeader(const char *name) const
+  {
+    for (const auto &header : headers_)
+    {
+      if (strcasecmp(header.first.c_str(), name) == 0) return &header.second;
+    }
+    return nullptr;
+  }
+
+  WebRequestMethodComposite method_;
+  String url_;
+  String contentType_;
+  size_t contentLength_ = 0;
+  std::vector<std::unique_ptr<AsyncWebParameter>> params_;
+  std::vector<std::pair<std::string, std::string>> headers_;
+  std::unique_ptr<AsyncWebServerResponse> response_;
+};
+
+typedef std::function<void(AsyncWebServerRequest *request)> ArRequestHandlerFunction;
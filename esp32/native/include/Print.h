@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Substituto do Print do Arduino no ambiente `native`: só write() e
+// print(texto), o que o gzip_print.h e os handlers de src/api usam.
+class Print
+{
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t c) = 0;
+
+  virtual size_t write(const uint8_t *data, size_t length)
+  {
+    size_t written = 0;
+    while (length-- > 0)
+      written += write(*data++);
+    return written;
+  }
+
+  size_t write(const char *text) { return text ? write(reinterpret_cast<const uint8_t *>(text), strlen(text)) : 0; }
+  size_t print(const char *text) { return write(text); }
+  size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+
+// Substituto do RTClib no ambiente `native`: só a classe DateTime, com a
+// mesma interface usada pela firmware (o driver do DS3231 fica na HAL).
+#define SECONDS_FROM_1970_TO_2000 946684800
+
+class DateTime
+{
+public:
+  DateTime(uint32_t t = SECONDS_FROM_1970_TO_2000) { setUnix(t); }
+
+  DateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour = 0, uint8_t min = 0, uint8_t sec = 0)
+  {
+    if (year >= 2000) year -= 2000;
+    yOff_ = static_cast<uint8_t>(year);
+    m_ = month;
+    d_ = day;
+    hh_ = hour;
+    mm_ = min;
+    ss_ = sec;
+  }
+
+  uint16_t year() const { return 2000U + yOff_; }
+  uint8_t month() const { return m_; }
+  uint8_t day() const { return d_; }
+  uint8_t hour() const { return hh_; }
+  uint8_t minute() const { return mm_; }
+  uint8_t second() const { return ss_; }
+
+  // 0 = domingo
+  uint8_t dayOfTheWeek() const { return static_cast<uint8_t>((daysSinceEpoch() + 4) % 7); }
+
+  uint32_t unixtime() const
+  {
+    return static_cast<uint32_t>(daysSinceEpoch() * 86400LL + hh_ * 3600L + mm_ * 60L + ss_);
+  }
+
+  bool operator==(const DateTime &other) const { return unixtime() == other.unixtime(); }
+  bool operator!=(const DateTime &other) const { return !(*this == other); }
+
+private:
+  uint8_t yOff_, m_, d_, hh_, mm_, ss_;
+
+  // Algoritmo de dias civis (Howard Hinnant)
+  int64_t daysSinceEpoch() const
+  {
+    int64_t y = year() - (m_ <= 2 ? 1 : 0);
+    int64_t era = y / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m_ + (m_ > 2 ? -3 : 9)) + 2) / 5 + d_ - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+  }
+
+  void setUnix(uint32_t t)
+  {
+    ss_ = t % 60;
+    t /= 60;
+    mm_ = t % 60;
+    t /= 60;
+    hh_ = t % 24;
+    int64_t z = t / 24 + 719468;
+    int64_t era = z / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    d_ = static_cast<uint8_t>(doy - (153 * mp + 2) / 5 + 1);
+    m_ = static_cast<uint8_t>(mp < 10 ? mp + 3 : mp - 9);
+    int64_t y = yoe + era * 400 + (m_ <= 2 ? 1 : 0);
+    yOff_ = static_cast<uint8_t>(y - 2000);
+  }
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "hal.h"
+
+// Controles dos fakes da HAL no ambiente `native` (só existem no host)
+namespace hal
+{
+namespace native
+{
+// Relógio: real (steady_clock) por padrão. No modo manual millis() e o
+// RTC só andam com advanceUs(); micros64() continua real para medir duração.
+void setManualClock(bool manual);
+void advanceUs(int64_t us);
+
+// RTC fake: anda junto com o relógio monotônico desde o último set/rtcWrite
+void setRtcPresent(bool present);
+void setRtc(uint32_t unixTime);
+uint32_t rtcWrites();
+
+// GPIO fake
+bool gpioLevel(uint8_t pin);
+bool gpioIsOutput(uint8_t pin);
+uint32_t gpioRisingEdges(uint8_t pin);
+
+// I2C fake: registradores gravados por endereço; todos respondem por padrão
+uint8_t i2cRegister(uint8_t address, uint8_t reg);
+uint32_t i2cWrites();
+void setI2cPresent(uint8_t address, bool present);
+
+// Chave/valor em memória
+void kvClear();
+size_t kvEntryCount();
+
+// Sistema de arquivos: caminhos da firmware relativos a este diretório
+void setFsRoot(const char *directory);
+const char *fsRoot();
+
+// Partição crua: imagem em "<fsRoot>.<label>" (128 KB; 0 = partição ausente)
+void setPartitionSize(size_t size);
+uint32_t partitionErases();
+
+// Queda de energia: depois de n gravações persistentes (put na chave/valor,
+// write, abertura para escrita, remove e rename de arquivo, erase e write da
+// partição) as seguintes somem sem erro, como se a placa tivesse desligado
+// ali; a RAM segue até o reset simulado. -1 desliga
+void setPowerCutAfter(int32_t writes);
+uint32_t persistentWrites();
+
+// Rede fake: estado do link e POSTs gravados em memória; httpGet() é um GET
+// de verdade por TCP (hub puxando outros processos do executor)
+struct HttpRequest
+{
+  std::string url;
+  std::string contentType;
+  std::vector<uint8_t> body;
+};
+
+void setLinkUp(bool up);
+void setDeviceId(const char *id);
+void setHttpStatus(int status);
+const std::vector<HttpRequest> &httpRequests();
+void clearHttpRequests();
+
+// Heap modelado: depois de heapModelBegin(), os
+// new/delete feitos dentro de um HeapScope vão para um first-fit do tamanho
+// dado, como o heap da placa; fora do escopo fica o malloc do host. Só o
+// ambiente `native` liga o operator new ao modelo (native/heap_native.cpp).
+// Os contêineres da própria HAL fake (chave/valor, POSTs) usam HostHeapScope.
+void heapModelBegin(size_t size);
+bool heapModelActive();
+size_t heapModelFree();
+size_t heapModelLargestFree();
+// Menor "maior bloco livre" visto depois de cada alocação desde a última
+// chamada (o aperto do período, não só o estado de repouso)
+size_t heapModelTakeLargestLow();
+// Pedidos que não couberam no modelo (new nothrow devolveu nullptr)
+uint32_t heapModelFailures();
+// Usados pelo operator new/delete de heap_native.cpp: nullptr quando fora
+// do escopo ou sem espaço (failed = true no segundo caso); release devolve
+// false para ponteiros que não são do modelo
+void *heapModelAllocate(size_t size, bool &failed);
+bool heapModelRelease(void *pointer);
+
+class HeapScope
+{
+public:
+  HeapScope();
+  ~HeapScope();
+  HeapScope(const HeapScope &) = delete;
+  HeapScope &operator=(const HeapScope &) = delete;
+};
+
+class HostHeapScope
+{
+public:
+  HostHeapScope();
+  ~HostHeapScope();
+  HostHeapScope(const HostHeapScope &) = delete;
+  HostHeapScope &operator=(const HostHeapScope &) = delete;
+
+private:
+  int savedDepth_;
+};
+} // namespace native
+} // namespace hal
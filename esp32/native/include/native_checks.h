@@ -0,0 +1,221 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include <new>
+
+#include "dosing.h"
+#include "hal_native.h"
+#include "http_api.h"
+
+// Conferências do ambiente `native`, usadas pelas suítes de test/ (pio test
+// -e native) e pelos modos de diagnóstico do executor (main_native.cpp)
+
+// Estoque esperado, recalculado fora do núcleo a partir das doses
+// concluídas, e o mesmo estoque em float, só para mostrar a deriva que a
+// conta antiga acumularia.
+struct StockCheck
+{
+  int32_t expectedUl[BOMBA_COUNT];
+  float floatMl[BOMBA_COUNT];
+  int64_t dosedUl[BOMBA_COUNT];
+  uint32_t doses;
+  uint32_t checks;
+  uint32_t mismatches;
+
+  void begin()
+  {
+    for (int i = 0; i < BOMBA_COUNT; i++)
+    {
+      expectedUl[i] = bombas[i].estoqueUl;
+      floatMl[i] = static_cast<float>(bombas[i].estoqueUl) / UL_PER_ML;
+      dosedUl[i] = 0;
+    }
+    doses = checks = mismatches = 0;
+  }
+
+  void onDoseFinished(int pump, int32_t dosagemUl)
+  {
+    doses++;
+    dosedUl[pump] += dosagemUl;
+    if (expectedUl[pump] > 0)
+    {
+      expectedUl[pump] = expectedUl[pump] > dosagemUl ? expectedUl[pump] - dosagemUl : 0;
+      floatMl[pump] -= static_cast<float>(dosagemUl) / UL_PER_ML;
+      if (floatMl[pump] < 0) floatMl[pump] = 0;
+    }
+    verify("dose");
+  }
+
+  void verify(const char *when)
+  {
+    checks++;
+    for (int i = 0; i < BOMBA_COUNT; i++)
+    {
+      if (bombas[i].estoqueUl == expectedUl[i]) continue;
+      mismatches++;
+      fprintf(stderr, "[check] Bomba %d divergiu (%s): estoque %d uL, esperado %d uL\n", i + 1, when,
+              bombas[i].estoqueUl, expectedUl[i]);
+      expectedUl[i] = bombas[i].estoqueUl;
+    }
+  }
+};
+
+// Agendamentos vencidos (contados aqui, fora do núcleo) contra doses
+// "Programado" que ligaram a bomba, e quanto cada uma esperou na fila
+const uint32_t SCHEDULE_WAIT_MAX_S = 600;
+
+struct ScheduleCheck
+{
+  long lastMinute = -1;
+  uint32_t due = 0;
+  uint32_t started = 0;
+  uint32_t late = 0;
+  uint32_t maxWaitS = 0;
+
+  void onTick(const DateTime &now)
+  {
+    long minuteKey = now.unixtime() / 60;
+    if (minuteKey == lastMinute) return;
+    lastMinute = minuteKey;
+    for (int i = 0; i < BOMBA_COUNT; i++)
+    {
+      for (int j = 0; j < SCHEDULE_COUNT; j++)
+      {
+        const Schedule &schedule = bombas[i].schedules[j];
+        if (schedule.status && schedule.diasSemana[now.dayOfTheWeek()] && schedule.hour == now.hour() &&
+            schedule.minute == now.minute())
+          due++;
+      }
+    }
+  }
+
+  void onDoseStarted()
+  {
+    if (strcmp(activeJob.origem.c_str(), "Programado") != 0) return;
+    started++;
+    uint32_t waitS = static_cast<uint32_t>((pumpStartUs - activeJob.enqueuedAtUs) / 1000000);
+    if (waitS > maxWaitS) maxWaitS = waitS;
+    if (waitS > SCHEDULE_WAIT_MAX_S)
+    {
+      late++;
+      fprintf(stderr, "[check] Dose programada da bomba %d esperou %u s na fila\n", activeJob.bombaIndex + 1, waitS);
+    }
+  }
+
+  bool ok() const { return late == 0 && started + heldScheduledDoses == due; }
+};
+
+// Folga do pico diário (menor maior-bloco durante as requisições): o ponto
+// em que uma dose cai no meio de uma resposta muda de um dia para o outro.
+// Acima disso é fragmentação acumulando
+const size_t SOAK_PEAK_MARGIN = 1024;
+
+// Requisições do soak e o maior bloco livre do heap modelado por dia
+struct SoakCheck
+{
+  uint32_t requests = 0;
+  uint32_t errors = 0;
+  uint32_t days = 0;
+  uint32_t shrinks = 0;
+  size_t firstLargest = 0;
+  size_t minLargest = SIZE_MAX;
+  size_t firstFree = 0;
+  size_t minFree = SIZE_MAX;
+  size_t firstLow = 0;
+  size_t minLow = SIZE_MAX;
+  size_t lastLow = 0;
+  // A resposta do GET /config fica viva até a hora seguinte, como a que o
+  // AsyncTCP ainda está enviando: doses e flash alocam em volta dela. A
+  // config é a mesma o mês todo, então o bloco preso tem tamanho fixo e o
+  // maior bloco livre do dia 1 vale como referência exata
+  std::unique_ptr<AsyncWebServerRequest> held;
+
+  std::unique_ptr<AsyncWebServerRequest> serve(void (*handler)(AsyncWebServerRequest *),
+                                               WebRequestMethodComposite method, const char *url,
+                                               const char *accept, bool gzip, const char *body = nullptr,
+                                               size_t length = 0)
+  {
+    std::unique_ptr<AsyncWebServerRequest> request(new AsyncWebServerRequest(method, url));
+    if (accept) request->addHeader("Accept", accept);
+    if (gzip) request->addHeader("Accept-Encoding", "gzip");
+    if (body) request->setBody(body, length);
+    handler(request.get());
+
+    requests++;
+    AsyncWebServerResponse *response = request->response();
+    if (response == nullptr || response->code() != 200)
+    {
+      errors++;
+      fprintf(stderr, "[soak] %s respondeu %d\n", url, response ? response->code() : 0);
+      return request;
+    }
+
+    // Chunked: drenado no mesmo tick, um segmento TCP por vez
+    uint8_t chunk[1436];
+    size_t index = 0;
+    size_t filled;
+    while (response->chunked() && (filled = response->fill(chunk, sizeof(chunk), index)) > 0)
+      index += filled;
+    return request;
+  }
+
+  // O body do POST fica no heap, como a reserva da admissão na placa
+  void hour()
+  {
+    held.reset();
+    std::unique_ptr<char[]> config(new (std::nothrow) char[CONFIG_JSON_MAX]);
+    size_t length = config ? buildConfigJson(config.get(), CONFIG_JSON_MAX) : 0;
+    if (length > 0)
+      serve(handlePostConfig, HTTP_POST, "/config", nullptr, false, config.get(), length);
+    config.reset();
+
+    serve(handleGetLogs, HTTP_GET, "/logs", nullptr, false);
+    serve(handleGetLogs, HTTP_GET, "/logs", MSGPACK_MIME, false);
+    serve(handleGetLogs, HTTP_GET, "/logs", nullptr, true);
+    serve(handleStatus, HTTP_GET, "/status", nullptr, false);
+    held = serve(handleGetConfig, HTTP_GET, "/config", nullptr, false);
+  }
+
+  // Chamado na virada do dia, antes do tick: fora de qualquer requisição
+  void sampleDay()
+  {
+    size_t largest = hal::native::heapModelLargestFree();
+    size_t freeBytes = hal::native::heapModelFree();
+    size_t low = hal::native::heapModelTakeLargestLow();
+    if (++days == 1)
+    {
+      firstLargest = largest;
+      firstFree = freeBytes;
+      firstLow = low;
+    }
+    lastLow = low;
+    if (low < minLow) minLow = low;
+    if (largest < minLargest) minLargest = largest;
+    if (freeBytes < minFree) minFree = freeBytes;
+    // Vazamento pequeno cai nos buracos antes de encolher o maior bloco
+    if (freeBytes < firstFree)
+    {
+      shrinks++;
+      fprintf(stderr, "[soak] Dia %u: %u bytes livres, abaixo dos %u do primeiro dia\n", days,
+              static_cast<unsigned int>(freeBytes), static_cast<unsigned int>(firstFree));
+    }
+    if (largest < firstLargest)
+    {
+      shrinks++;
+      fprintf(stderr, "[soak] Dia %u: maior bloco livre %u bytes, abaixo dos %u do primeiro dia\n", days,
+              static_cast<unsigned int>(largest), static_cast<unsigned int>(firstLargest));
+    }
+    if (low + SOAK_PEAK_MARGIN < firstLow)
+    {
+      shrinks++;
+      fprintf(stderr, "[soak] Dia %u: maior bloco livre no pico %u bytes, abaixo dos %u do primeiro dia\n", days,
+              static_cast<unsigned int>(low), static_cast<unsigned int>(firstLow));
+    }
+  }
+
+  bool ok() const { return errors == 0 && shrinks == 0 && hal::native::heapModelFailures() == 0; }
+};
@@ -0,0 +1,706 @@
+#include "dosing.h"
+#include "hal_native.h"
+#include "http_api.h"
+#include "native_checks.h"
+
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+// Executor do núcleo no Linux (ambiente `native` do PlatformIO).
+// As conferências automáticas estão em test/ (pio test -e native); os modos
+// abaixo ficam para rodadas longas e diagnóstico.
+//
+// Roda scheduler, fila de bombas, configuração e logs sobre a HAL fake
+// com relógio manual: um dia simulado leva poucos segundos, o que deixa
+// o núcleo acessível a sanitizers, gdb e perf.
+//
+//   .pio/build/native/program --config test/fixtures/config.json --days 7 --manual-per-hour 2
+//   perf record -g .pio/build/native_perf/program --days 30 --quiet
+//
+// --check-stock confere o estoque em µL a cada dose e a cada virada de dia
+// (recarregando a config da NVS, ida e volta pelo JSON); sai com 1 se
+// divergir. Ex.: um ano simulado
+//   .pio/build/native/program --config test/fixtures/config.json --days 365 --tick 1000 --check-stock --quiet
+//
+// --reset-every N simula um reset no meio de cada N-ésima dose: a RAM da
+// fila se perde e o boot reconcilia pelo diário de doses (journal.cpp).
+//
+// --program arquivo.json envia o mesmo body do POST /program no começo de
+// cada dia simulado; --cancel-program-after S cancela cada um S segundos
+// depois do envio (exercita o descarte da fila e o corte da dose ativa).
+//
+// --check-schedules conta os agendamentos que vencem a cada minuto e confere
+// que cada um virou dose (ou foi segurado pelo piso de estoque) em até
+// SCHEDULE_WAIT_MAX_S; sai com 1 se não. Com um programa de espera longa
+// garante que o programa não segura a fila:
+//   program --config test/fixtures/config.json --program test/fixtures/program_long.json --days 7 --tick 1000 --check-schedules --quiet
+//
+// Os logs vão para a imagem "<fs>.doselog" (partição crua, mapeada com
+// mmap); --log-partition-kb muda o tamanho e 0 simula placa sem a
+// partição (logs no LittleFS, como antes).
+//
+// Hub com vários controladores, cada um num processo (tools/hub_sim.py):
+// --serve PORTA responde GET /logs?afterSeq= e GET /hub/logs como a
+// firmware; --linger S continua servindo S segundos (reais) depois da
+// simulação; --hub-peer URL (repetível) faz deste processo o hub, que no
+// fim puxa até alcançar cada controlador; --device-id muda o id.
+//   program --fs /tmp/a --device-id doser-a --serve 8081 --linger 60 --quiet
+//   program --fs /tmp/h --device-id hub --hub-peer http://127.0.0.1:8081 --quiet
+//
+// --soak faz o teste de fragmentação: o new/delete da simulação vai para um
+// heap modelado de --heap-kb (first-fit, native/heap_native.cpp) e a cada
+// hora simulada um app aberto passa pelos handlers de src/api (POST /config
+// com a config atual, GET /logs em JSON, MessagePack e gzip, GET /status e
+// um GET /config que fica vivo até a hora seguinte). O maior bloco livre e
+// o total livre são lidos a cada virada de dia, fora de requisições, e não
+// podem cair abaixo do primeiro dia; sai com 1 se cair, se algum new não
+// couber ou se uma requisição não der 200. Um mês de doses:
+//   program --config test/fixtures/config.json --days 30 --tick 1000 --manual-per-hour 2 --soak --quiet
+
+namespace
+{
+struct FlashOpStats
+{
+  uint32_t count;
+  uint64_t totalUs;
+  uint32_t maxUs;
+};
+
+const char *const FLASH_OP_NAMES[] = {"saveBombasConfig", "loadBombasConfig", "appendLocalLog", "trimLogFile",
+                                      "outboxAppend",     "journalWrite",     "logErase",       "traceWrite",
+                                      "hubMerge"};
+const int FLASH_OP_COUNT = sizeof(FLASH_OP_NAMES) / sizeof(FLASH_OP_NAMES[0]);
+
+FlashOpStats flashStats[FLASH_OP_COUNT] = {};
+uint32_t maxStartDelayMs = 0;
+uint32_t maxCutoffDelayMs = 0;
+uint32_t jobsQueued = 0;
+
+// Nas suítes de test/ (pio test -e native, PIO_UNIT_TESTING) ficam só os
+// ganchos do núcleo; o executor de linha de comando sai da compilação
+#ifndef PIO_UNIT_TESTING
+StockCheck stockCheck;
+ScheduleCheck scheduleCheck;
+SoakCheck soakCheck;
+
+struct Options
+{
+  const char *configPath = nullptr;
+  const char *fsRoot = "native_fs";
+  const char *start = "01/01/2026 00:00:00";
+  uint32_t days = 1;
+  uint32_t tickMs = 100;
+  uint32_t manualPerHour = 0;
+  const char *syncUrl = nullptr;
+  uint32_t linkFlapHours = 0;
+  bool quiet = false;
+  bool keepLogs = false;
+  bool checkStock = false;
+  bool checkSchedules = false;
+  uint32_t resetEvery = 0;
+  const char *programPath = nullptr;
+  uint32_t cancelProgramAfterS = 0;
+  long logPartitionKb = -1;
+  const char *deviceId = nullptr;
+  uint16_t servePort = 0;
+  uint32_t lingerS = 0;
+  std::vector<const char *> hubPeers;
+  bool soak = false;
+  uint32_t heapKb = 160;
+};
+
+void usage()
+{
+  printf("uso: program [--config arquivo.json] [--fs dir] [--start \"dd/mm/aaaa hh:mm:ss\"]\n"
+         "               [--days N] [--tick ms] [--manual-per-hour N] [--keep-logs] [--quiet]\n"
+         "               [--sync-url url] [--link-flap-hours N] [--check-stock] [--check-schedules]\n"
+         "               [--reset-every N]\n"
+         "               [--program arquivo.json] [--cancel-program-after S] [--log-partition-kb N]\n"
+         "               [--device-id id] [--serve porta] [--linger S] [--hub-peer url]...\n"
+         "               [--soak] [--heap-kb N]\n");
+}
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+    if (strcmp(arg, "--quiet") == 0) options.quiet = true;
+    else if (strcmp(arg, "--keep-logs") == 0) options.keepLogs = true;
+    else if (strcmp(arg, "--check-stock") == 0) options.checkStock = true;
+    else if (strcmp(arg, "--check-schedules") == 0) options.checkSchedules = true;
+    else if (strcmp(arg, "--soak") == 0) options.soak = true;
+    else if (value == nullptr) return false;
+    else if (strcmp(arg, "--config") == 0) options.configPath = argv[++i];
+    else if (strcmp(arg, "--fs") == 0) options.fsRoot = argv[++i];
+    else if (strcmp(arg, "--start") == 0) options.start = argv[++i];
+    else if (strcmp(arg, "--days") == 0) options.days = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(arg, "--tick") == 0) options.tickMs = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(arg, "--manual-per-hour") == 0) options.manualPerHour = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(arg, "--sync-url") == 0) options.syncUrl = argv[++i];
+    else if (strcmp(arg, "--link-flap-hours") == 0) options.linkFlapHours = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(arg, "--reset-every") == 0) options.resetEvery = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(arg, "--program") == 0) options.programPath = argv[++i];
+    else if (strcmp(arg, "--cancel-program-after") == 0) options.cancelProgramAfterS = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(arg, "--log-partition-kb") == 0) options.logPartitionKb = strtol(argv[++i], nullptr, 10);
+    else if (strcmp(arg, "--device-id") == 0) options.deviceId = argv[++i];
+    else if (strcmp(arg, "--serve") == 0) options.servePort = static_cast<uint16_t>(strtoul(argv[++i], nullptr, 10));
+    else if (strcmp(arg, "--linger") == 0) options.lingerS = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(arg, "--hub-peer") == 0) options.hubPeers.push_back(argv[++i]);
+    else if (strcmp(arg, "--heap-kb") == 0) options.heapKb = strtoul(argv[++i], nullptr, 10);
+    else return false;
+  }
+  // Reset perde a fila em RAM: a contagem de agendamentos não fecharia
+  if (options.checkSchedules && options.resetEvery > 0) return false;
+  return options.tickMs > 0 && options.hubPeers.size() <= HUB_PEERS_MAX;
+}
+
+// --serve: as duas rotas que um hub usa, com Content-Length e uma conexão
+// por pedido. O socket de escuta não bloqueia: o laço da simulação passa
+// por poll() a cada tick.
+struct PageServer
+{
+  int fd = -1;
+  uint32_t served = 0;
+
+  bool begin(uint16_t port)
+  {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, 8) != 0 ||
+        fcntl(fd, F_SETFL, O_NONBLOCK) != 0)
+    {
+      fprintf(stderr, "nao foi possivel servir na porta %u\n", port);
+      return false;
+    }
+    return true;
+  }
+
+  void poll()
+  {
+    int client;
+    while (fd >= 0 && (client = accept(fd, nullptr, nullptr)) >= 0)
+    {
+      answer(client);
+      close(client);
+    }
+  }
+
+  void answer(int client)
+  {
+    timeval timeout = {2, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    std::string request;
+    char chunk[512];
+    ssize_t received;
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 4096 &&
+           (received = recv(client, chunk, sizeof(chunk), 0)) > 0)
+      request.append(chunk, received);
+
+    char path[256] = "";
+    sscanf(request.c_str(), "GET %255s", path);
+    int status = 200;
+    const char *type = "application/x-ndjson";
+    std::string body;
+    unsigned long afterSeq = 0;
+    if (sscanf(path, "/logs?afterSeq=%lu", &afterSeq) == 1)
+    {
+      std::vector<char> page(HUB_PAGE_BODY_MAX);
+      body.assign(page.data(), buildLogPage(static_cast<uint32_t>(afterSeq), page.data(), page.size()));
+    }
+    else if (strcmp(path, "/hub/logs") == 0)
+    {
+      type = "application/json";
+      body = "[";
+      forEachMergedLog(
+          [](void *context, const char *line, size_t length) {
+            std::string &out = *static_cast<std::string *>(context);
+            if (out.size() > 1) out += ",";
+            out.append(line, length);
+          },
+          &body);
+      body += "]";
+    }
+    else
+    {
+      status = 404;
+      type = "application/json";
+      body = "{\"ok\":false,\"message\":\"rota nao encontrada\"}";
+    }
+
+    char header[160];
+    int headerLength = snprintf(header, sizeof(header),
+                                "HTTP/1.0 %d %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: close\r\n\r\n",
+                                status, status == 200 ? "OK" : "Not Found", type, static_cast<unsigned int>(body.size()));
+    std::string response(header, headerLength);
+    response += body;
+    for (size_t sent = 0; sent < response.size();)
+    {
+      ssize_t written = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+      if (written <= 0) break;
+      sent += written;
+    }
+    served++;
+  }
+};
+
+// Hub alcançou todos: última página ok e cursor no último seq do controlador
+bool hubCaughtUp()
+{
+  HubPeer peer;
+  for (uint8_t i = 0; copyHubPeer(i, peer); i++)
+  {
+    if (peer.lastStatus != 200 || peer.lastSeq < peer.remoteSeq) return false;
+  }
+  return true;
+}
+
+bool readTextFile(const char *path, std::string &text)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+  {
+    fprintf(stderr, "nao foi possivel abrir %s\n", path);
+    return false;
+  }
+
+  char chunk[1024];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    text.append(chunk, read);
+  fclose(file);
+  return true;
+}
+
+bool readJsonFile(const char *path, JsonDocument &doc)
+{
+  std::string text;
+  if (!readTextFile(path, text)) return false;
+
+  if (deserializeJson(doc, text))
+  {
+    fprintf(stderr, "JSON invalido em %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+// Mesmo caminho do POST /config em JSON (mais a gravação que o loop faria)
+bool applyConfigFile(const char *path)
+{
+  std::string text;
+  if (!readTextFile(path, text)) return false;
+  if (applyConfigJson(text.c_str(), text.size()) == CONFIG_APPLY_OK)
+  {
+    serviceConfig();
+    return true;
+  }
+  fprintf(stderr, "config recusada: %s\n", path);
+  return false;
+}
+
+// Reset da placa: saídas desligadas, fila e dose ativa perdidas da RAM;
+// depois o mesmo boot do setup() (config, logs, outbox, consumo, programas, diário)
+void simulateReset()
+{
+  pumpBank.begin();
+  pumpActive = false;
+  pumpHead = 0;
+  pumpTail = 0;
+
+  loadBombasConfig();
+  initLogStorage();
+  initOutbox();
+  initHub();
+  loadConsumption();
+  initDosePrograms();
+  initJournal();
+}
+#endif
+} // namespace
+
+// --- Ganchos do núcleo ---
+DateTime clockNow()
+{
+  uint32_t now = 0;
+  hal::rtcRead(now);
+  return DateTime(now);
+}
+
+void onPumpJobQueued()
+{
+  jobsQueued++;
+}
+
+void reportDoseStartDelay(uint32_t delayUs)
+{
+  if (delayUs / 1000 > maxStartDelayMs) maxStartDelayMs = delayUs / 1000;
+}
+
+void reportDoseCutoffDelay(uint32_t delayUs)
+{
+  if (delayUs / 1000 > maxCutoffDelayMs) maxCutoffDelayMs = delayUs / 1000;
+}
+
+// Sem task no host: o POST (fake, em memória) roda na hora
+void onOutboxBatchReady()
+{
+  outboxUpload();
+}
+
+// Idem para o GET do hub (este sim, por TCP)
+void onHubFetchReady()
+{
+  hubFetch();
+}
+
+// --- Ganchos de src/api (requisições do --soak) ---
+void wakeLoop() {}
+
+// O gzip decide pelo heap modelado, como pelo ESP.getMaxAllocHeap() na placa
+size_t largestFreeBlock()
+{
+  return hal::native::heapModelActive() ? hal::native::heapModelLargestFree() : SIZE_MAX;
+}
+
+// O adaptador entrega todo body como "plain"
+bool admittedRequestBody(AsyncWebServerRequest *, const char *&, size_t &)
+{
+  return false;
+}
+
+void noteBulkResponse(AsyncWebServerRequest *, bool, size_t) {}
+
+// Rede e relógio da placa não existem aqui; só o heap modelado
+void fillPlatformStatus(JsonDocument &doc)
+{
+  if (!hal::native::heapModelActive()) return;
+  JsonObject http = doc["http"].to<JsonObject>();
+  http["freeHeap"] = hal::native::heapModelFree();
+  http["largestFreeBlock"] = hal::native::heapModelLargestFree();
+}
+
+void recordFlashOp(FlashOp op, uint32_t elapsedUs)
+{
+  FlashOpStats &stats = flashStats[op];
+  stats.count++;
+  stats.totalUs += elapsedUs;
+  if (elapsedUs > stats.maxUs) stats.maxUs = elapsedUs;
+}
+
+#ifndef PIO_UNIT_TESTING
+int main(int argc, char **argv)
+{
+  Options options;
+  if (!parseOptions(argc, argv, options))
+  {
+    usage();
+    return 2;
+  }
+
+  DateTime start;
+  if (!parseDateTime(options.start, start))
+  {
+    fprintf(stderr, "data invalida: %s\n", options.start);
+    return 2;
+  }
+
+  hal::setLogEnabled(!options.quiet);
+  hal::native::setManualClock(true);
+  hal::native::setFsRoot(options.fsRoot);
+  if (options.logPartitionKb >= 0)
+    hal::native::setPartitionSize(static_cast<size_t>(options.logPartitionKb) * 1024);
+  hal::native::setRtc(start.unixtime());
+  if (options.soak)
+    hal::native::heapModelBegin(static_cast<size_t>(options.heapKb) * 1024);
+  if (options.deviceId)
+    hal::native::setDeviceId(options.deviceId);
+
+  // Mesma ordem do setup() da firmware
+  inicializarBombas();
+  rtcReady = hal::rtcBegin();
+  prefsReady = hal::kvBegin("bomb-config");
+  loadBombasConfig();
+  initLogStorage();
+  if (!options.keepLogs)
+  {
+    clearLocalLogs();
+    hal::fsRemove(OUTBOX_FILE);
+    hal::fsRemove(HUB_FILE);
+  }
+  initOutbox();
+  initHub();
+  // Sem os logs antigos o hub também recomeça os cursores
+  if (!options.keepLogs)
+    setHubPeers(nullptr, 0);
+  if (!options.hubPeers.empty() &&
+      !setHubPeers(options.hubPeers.data(), static_cast<uint8_t>(options.hubPeers.size())))
+  {
+    fprintf(stderr, "--hub-peer invalido\n");
+    return 2;
+  }
+  PageServer server;
+  if (options.servePort && !server.begin(options.servePort))
+    return 1;
+  loadConsumption();
+  initDosePrograms();
+  initJournal();
+  if (options.syncUrl)
+    setOutboxUrl(options.syncUrl);
+  if (options.configPath && !applyConfigFile(options.configPath))
+    return 1;
+
+  DoseProgram program;
+  if (options.programPath)
+  {
+    JsonDocument body;
+    if (!readJsonFile(options.programPath, body)) return 1;
+    if (parseDoseProgram(body.as<JsonVariantConst>(), program) != PROGRAM_OK)
+    {
+      fprintf(stderr, "programa invalido em %s\n", options.programPath);
+      return 1;
+    }
+  }
+  uint32_t programsSubmitted = 0;
+  uint32_t programsRefused = 0;
+  uint32_t programsCancelled = 0;
+  uint16_t lastProgramId = 0;
+
+  int32_t stockBefore[BOMBA_COUNT];
+  uint32_t actuations[BOMBA_COUNT] = {};
+  uint32_t lastMask = pumpBank.onMask();
+  for (int i = 0; i < BOMBA_COUNT; i++)
+    stockBefore[i] = bombas[i].estoqueUl;
+  stockCheck.begin();
+  uint32_t dosesStarted = 0;
+  uint32_t resets = 0;
+  int64_t resetAtUs = -1;
+
+  // Acionamentos pelo banco: vale para GPIO e para o MCP23017 fake. A
+  // borda de descida é o fim da dose (activeJob ainda tem o volume).
+  auto observeBank = [&]() {
+    uint32_t mask = pumpBank.onMask();
+    for (int i = 0; i < BOMBA_COUNT; i++)
+    {
+      uint32_t bit = 1UL << i;
+      if ((mask & bit) && !(lastMask & bit))
+      {
+        actuations[i]++;
+        if (options.checkSchedules) scheduleCheck.onDoseStarted();
+        // Reset no meio desta dose
+        if (options.resetEvery > 0 && ++dosesStarted % options.resetEvery == 0)
+          resetAtUs = pumpStartUs + pumpDurationUs / 2;
+      }
+      if (options.checkStock && !(mask & bit) && (lastMask & bit))
+        stockCheck.onDoseFinished(i, activeJob.dosagemUl);
+    }
+    lastMask = mask;
+  };
+
+  const uint64_t totalTicks = static_cast<uint64_t>(options.days) * 86400000ULL / options.tickMs;
+  const uint64_t ticksPerDay = 86400000ULL / options.tickMs;
+  const uint64_t ticksPerHour = 3600000ULL / options.tickMs;
+  const uint64_t flapEvery = static_cast<uint64_t>(options.linkFlapHours) * 3600000ULL / options.tickMs;
+  const uint64_t manualEvery = options.manualPerHour > 0 ? 3600000ULL / options.manualPerHour / options.tickMs : 0;
+  const uint64_t cancelAfter = static_cast<uint64_t>(options.cancelProgramAfterS) * 1000ULL / options.tickMs;
+  int manualPump = 0;
+
+  for (uint64_t tick = 0; tick < totalTicks; tick++)
+  {
+    // Com --soak o new/delete daqui em diante vai para o heap modelado
+    hal::native::HeapScope heapScope;
+    if (options.soak && tick > 0 && tick % ticksPerDay == 0)
+      soakCheck.sampleDay();
+    if (options.soak && tick % ticksPerHour == ticksPerHour / 2)
+      soakCheck.hour();
+
+    // Virada do dia: simula um boot relendo a config gravada (JSON na NVS)
+    if (options.checkStock && tick > 0 && tick % ticksPerDay == 0 && pumpQueueIdle())
+    {
+      loadBombasConfig();
+      stockCheck.verify("recarga da config");
+    }
+
+    if (manualEvery > 0 && tick % manualEvery == 0)
+    {
+      enqueuePumpJob(manualPump, 1 * UL_PER_ML, "Manual");
+      manualPump = (manualPump + 1) % BOMBA_COUNT;
+    }
+
+    if (options.programPath && tick % ticksPerDay == 0)
+    {
+      DoseProgram submitted = program;
+      int detail = 0;
+      if (submitDoseProgram(submitted, detail) == PROGRAM_OK)
+      {
+        programsSubmitted++;
+        lastProgramId = submitted.id;
+      }
+      else
+      {
+        programsRefused++;
+      }
+    }
+    if (cancelAfter > 0 && lastProgramId != 0 && tick % ticksPerDay == cancelAfter)
+    {
+      if (cancelDoseProgram(lastProgramId) == PROGRAM_OK) programsCancelled++;
+      lastProgramId = 0;
+    }
+
+    // Rede cai e volta a cada N horas: exercita backoff e retomada do outbox
+    if (flapEvery > 0 && tick % flapEvery == 0)
+      hal::native::setLinkUp((tick / flapEvery) % 2 == 0);
+
+    if (options.checkSchedules) scheduleCheck.onTick(clockNow());
+    checkSchedules();
+    processPumpQueue();
+    serviceOutbox();
+    serviceHub();
+    serviceConfig();
+    server.poll();
+    observeBank();
+
+    if (resetAtUs >= 0 && hal::uptimeUs() >= resetAtUs)
+    {
+      resetAtUs = -1;
+      resets++;
+      simulateReset();
+      lastMask = pumpBank.onMask();
+      // A dose cortada entra no estoque esperado pelo volume que o diário estimou
+      if (options.checkStock && journalStats.partialDose)
+        stockCheck.onDoseFinished(activeJob.bombaIndex, journalStats.recoveredUl);
+    }
+    hal::native::advanceUs(static_cast<int64_t>(options.tickMs) * 1000);
+  }
+
+  // Termina a dose em andamento para o resumo fechar com o estoque
+  while (!pumpQueueIdle())
+  {
+    processPumpQueue();
+    observeBank();
+    hal::native::advanceUs(static_cast<int64_t>(options.tickMs) * 1000);
+  }
+
+  // O hub puxa até alcançar cada controlador (ou desistir)
+  for (int round = 0; round < 1000 && hubPeerCount() > 0 && !hubCaughtUp(); round++)
+  {
+    pullHubNow();
+    serviceHub();
+    server.poll();
+  }
+
+  printf("\n=== %u dia(s) simulados a partir de %s, tick %u ms ===\n",
+         options.days, options.start, options.tickMs);
+  printf("Jobs enfileirados: %u, linhas de log: %u (limite %u)\n",
+         jobsQueued, static_cast<unsigned int>(logCount), LOG_LIMIT);
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    printf("Bomba %d (%s): %u acionamentos, estoque %s -> %s ml\n", i + 1, bombas[i].name.c_str(),
+           actuations[i], MlText(stockBefore[i]).c_str(), MlText(bombas[i].estoqueUl).c_str());
+  }
+  printf("Atraso maximo: inicio %u ms, corte %u ms\n", maxStartDelayMs, maxCutoffDelayMs);
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    PumpForecast forecast = forecastPump(i, clockNow());
+    printf("Previsao bomba %d: %s ml/dia (EWMA %s, programado %s, %u dias), restam %s dias\n", i + 1,
+           MlText(forecast.dailyUl).c_str(), MlText(forecast.ewmaDailyUl).c_str(),
+           MlText(forecast.scheduledDailyUl).c_str(), forecast.daysObserved,
+           forecast.secondsRemaining < 0 ? "-" : FixedText(static_cast<int32_t>(forecast.secondsRemaining / 8640), 1).c_str());
+  }
+  if (options.resetEvery > 0)
+    printf("Resets simulados: %u; diario: %u gravacoes, %u checkpoints, %u erros\n", resets, journalStats.writes,
+           journalStats.checkpoints, journalStats.writeErrors);
+  if (options.programPath)
+    printf("Programas: %u enviados, %u recusados, %u cancelados\n", programsSubmitted, programsRefused,
+           programsCancelled);
+  if (logPartitionReady)
+    printf("Particao de logs: %u setores apagados\n", hal::native::partitionErases());
+  printf("Log: ultimo seq %u (%s)\n", logNextSeq - 1, hal::deviceId());
+  if (hubPeerCount() > 0)
+  {
+    printf("Hub: %u linhas guardadas, %u novas, %u repetidas, %u GETs, %u falhas\n", hubStats.stored,
+           hubStats.merged, hubStats.duplicates, hubStats.polls, hubStats.failures);
+    HubPeer peer;
+    for (uint8_t i = 0; copyHubPeer(i, peer); i++)
+    {
+      printf("  %s (%s): seq %u de %u, %u puxadas, %u lacunas, %u falhas, status %d\n", peer.url.c_str(),
+             peer.device.c_str(), peer.lastSeq, peer.remoteSeq, peer.pulled, peer.gaps, peer.failures,
+             peer.lastStatus);
+    }
+  }
+  printf("Sync: %u eventos enviados em %u lotes, %u pendentes, %u falhas, ultimo seq %u\n",
+         outboxStats.sent, outboxStats.batches, outboxStats.pending, outboxStats.failures, outboxStats.ackedSeq);
+  for (int op = 0; op < FLASH_OP_COUNT; op++)
+  {
+    const FlashOpStats &stats = flashStats[op];
+    printf("%-18s %6u chamadas, media %8.1f us, max %6u us\n", FLASH_OP_NAMES[op], stats.count,
+           stats.count ? static_cast<double>(stats.totalUs) / stats.count : 0.0, stats.maxUs);
+  }
+
+  if (options.servePort && options.lingerS > 0)
+  {
+    printf("Servindo na porta %u por %u s\n", options.servePort, options.lingerS);
+    fflush(stdout);
+    int64_t until = hal::micros64() + static_cast<int64_t>(options.lingerS) * 1000000LL;
+    while (hal::micros64() < until)
+    {
+      server.poll();
+      usleep(10000);
+    }
+  }
+
+  int exitCode = 0;
+  if (options.soak)
+  {
+    soakCheck.sampleDay();
+    printf("Soak: %u dias, %u requisicoes, %u erros; heap modelado de %u KB: maior bloco livre %u bytes no dia 1, "
+           "minimo %u; livre %u no dia 1, minimo %u; no pico do dia %u no primeiro, minimo %u, %u no ultimo; "
+           "%u falhas de alocacao\n",
+           soakCheck.days, soakCheck.requests, soakCheck.errors, options.heapKb,
+           static_cast<unsigned int>(soakCheck.firstLargest), static_cast<unsigned int>(soakCheck.minLargest),
+           static_cast<unsigned int>(soakCheck.firstFree), static_cast<unsigned int>(soakCheck.minFree),
+           static_cast<unsigned int>(soakCheck.firstLow), static_cast<unsigned int>(soakCheck.minLow),
+           static_cast<unsigned int>(soakCheck.lastLow),
+           hal::native::heapModelFailures());
+    soakCheck.held.reset();
+    if (!soakCheck.ok()) exitCode = 1;
+  }
+  if (options.checkSchedules)
+  {
+    printf("Agendamentos: %u vencidos, %u doses iniciadas, %u seguradas, espera maxima %u s, %u atrasadas\n",
+           scheduleCheck.due, scheduleCheck.started, heldScheduledDoses, scheduleCheck.maxWaitS, scheduleCheck.late);
+    if (!scheduleCheck.ok()) exitCode = 1;
+  }
+
+  if (!options.checkStock) return exitCode;
+
+  stockCheck.verify("fim");
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    int32_t floatUl = static_cast<int32_t>(stockCheck.floatMl[i] * UL_PER_ML + 0.5f);
+    printf("Estoque bomba %d: %lld uL dosados, final %d uL (em float: %d uL, deriva %d uL)\n", i + 1,
+           static_cast<long long>(stockCheck.dosedUl[i]), bombas[i].estoqueUl, floatUl,
+           floatUl - bombas[i].estoqueUl);
+  }
+  printf("Conferencia de estoque: %u doses, %u verificacoes, %u divergencias\n", stockCheck.doses,
+         stockCheck.checks, stockCheck.mismatches);
+  return stockCheck.mismatches == 0 ? exitCode : 1;
+}
+#endif
@@ -0,0 +1,532 @@
+#include "dosing.h"
+#include "hal_native.h"
+#include "latency_histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// Replay de uma gravação de entradas (trace.cpp) no Linux (ambiente
+// `replay` do PlatformIO).
+//
+// Lê o arquivo baixado de GET /trace e reaplica, na mesma ordem e com as
+// mesmas distâncias de tempo (relógio manual), as requisições, os eventos
+// do WiFi e os ajustes de relógio sobre o núcleo e a HAL fake. Entre os
+// registros o loop roda a cada --tick ms. No fim sai uma tabela de tempos
+// por fase (rota HTTP, etapas do loop, boot) e das operações de flash:
+//
+//   .pio/build/replay/program inputs.trc
+//   perf record -g .pio/build/replay/program inputs.trc --quiet
+//
+// Os handlers HTTP da firmware dependem do Arduino: aqui cada rota chama
+// as mesmas funções do núcleo que o handler chamaria. Rotas só de leitura
+// da placa (métricas, incidentes, NTP, energia) e bodies cortados pelo
+// gravador são contados como ignorados.
+//
+// Cada START com flag de boot simula um reset (como --reset-every no
+// executor); todo START compara a config gravada com a do replay e aplica
+// a gravada se divergirem.
+
+namespace
+{
+struct FlashOpStats
+{
+  uint32_t count;
+  uint64_t totalUs;
+  uint32_t maxUs;
+};
+
+const char *const FLASH_OP_NAMES[] = {"saveBombasConfig", "loadBombasConfig", "appendLocalLog", "trimLogFile",
+                                      "outboxAppend",     "journalWrite",     "logErase",       "traceWrite",
+                                      "hubMerge"};
+const int FLASH_OP_COUNT = sizeof(FLASH_OP_NAMES) / sizeof(FLASH_OP_NAMES[0]);
+
+FlashOpStats flashStats[FLASH_OP_COUNT] = {};
+uint32_t jobsQueued = 0;
+
+// Tempo real de cada fase, em µs; std::map deixa a tabela em ordem alfabética
+std::map<std::string, LatencyHistogram<2>> phases;
+
+struct Options
+{
+  const char *tracePath = nullptr;
+  const char *fsRoot = "replay_fs";
+  uint32_t tickMs = 100;
+  bool quiet = false;
+};
+
+struct ReplayStats
+{
+  uint32_t sessions;
+  uint32_t resets;
+  uint32_t configDiverged;
+  uint32_t http;
+  uint32_t httpSkipped;
+  uint32_t wifi;
+  uint32_t clock;
+};
+
+ReplayStats replayStats = {};
+
+void usage()
+{
+  printf("uso: program arquivo.trc [--fs dir] [--tick ms] [--quiet]\n");
+}
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+    if (strcmp(arg, "--quiet") == 0) options.quiet = true;
+    else if (arg[0] != '-' && options.tracePath == nullptr) options.tracePath = arg;
+    else if (value == nullptr) return false;
+    else if (strcmp(arg, "--fs") == 0) options.fsRoot = argv[++i];
+    else if (strcmp(arg, "--tick") == 0) options.tickMs = strtoul(argv[++i], nullptr, 10);
+    else return false;
+  }
+  return options.tracePath != nullptr && options.tickMs > 0;
+}
+
+bool readBinaryFile(const char *path, std::vector<uint8_t> &data)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+  {
+    fprintf(stderr, "nao foi possivel abrir %s\n", path);
+    return false;
+  }
+
+  uint8_t chunk[4096];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    data.insert(data.end(), chunk, chunk + read);
+  fclose(file);
+  return true;
+}
+
+void recordPhase(const std::string &name, int64_t startUs)
+{
+  int64_t elapsedUs = hal::micros64() - startUs;
+  phases[name].record(static_cast<uint32_t>(elapsedUs > 0xFFFFFFFFLL ? 0xFFFFFFFFLL : elapsedUs));
+}
+
+// Mede `work` em tempo real e soma na fase `name`
+template <typename Work>
+void timed(const std::string &name, Work work)
+{
+  int64_t startUs = hal::micros64();
+  work();
+  recordPhase(name, startUs);
+}
+
+// Mesma ordem do setup() da firmware, a partir de NVS e arquivos vazios
+void firstBoot(uint32_t unixTime)
+{
+  hal::native::kvClear();
+  hal::native::setRtc(unixTime);
+  inicializarBombas();
+  rtcReady = hal::rtcBegin();
+  prefsReady = hal::kvBegin("bomb-config");
+  loadBombasConfig();
+  initLogStorage();
+  clearLocalLogs();
+  hal::fsRemove(OUTBOX_FILE);
+  hal::fsRemove(HUB_FILE);
+  initOutbox();
+  initHub();
+  loadConsumption();
+  initDosePrograms();
+  initJournal();
+}
+
+// Reset da placa: como no executor (main_native.cpp)
+void simulateReset(uint32_t unixTime)
+{
+  pumpBank.begin();
+  pumpActive = false;
+  pumpHead = 0;
+  pumpTail = 0;
+  hal::native::setRtc(unixTime);
+
+  loadBombasConfig();
+  initLogStorage();
+  initOutbox();
+  initHub();
+  loadConsumption();
+  initDosePrograms();
+  initJournal();
+}
+
+// Config do START contra a do replay; diferente, vale a gravada
+void syncConfig(const TraceEvent &start)
+{
+  static char current[CONFIG_JSON_MAX];
+  size_t length = buildConfigJson(current, sizeof(current));
+  if (length == start.textLength && memcmp(current, start.text, length) == 0) return;
+
+  if (replayStats.sessions > 1) replayStats.configDiverged++;
+  if (applyConfigJson(start.text, start.textLength) != CONFIG_APPLY_OK)
+    fprintf(stderr, "[replay] Config do START recusada\n");
+}
+
+bool readBody(const TraceEvent &event, JsonDocument &doc)
+{
+  if (event.flags & TRACE_HTTP_MSGPACK_BODY) return !deserializeMsgPack(doc, event.body, event.bodyLength);
+  return !deserializeJson(doc, event.body, event.bodyLength);
+}
+
+// Valor de `key` na query gravada ("a=1&b=2"), 0 se ausente
+long queryLong(const TraceEvent &event, const char *key)
+{
+  std::string query(event.text, event.textLength);
+  std::string prefix = std::string(key) + "=";
+  size_t at = 0;
+  while (at < query.size())
+  {
+    size_t end = query.find('&', at);
+    if (end == std::string::npos) end = query.size();
+    if (query.compare(at, prefix.size(), prefix) == 0)
+      return strtol(query.c_str() + at + prefix.size(), nullptr, 10);
+    at = end + 1;
+  }
+  return 0;
+}
+
+// Percorre os logs como o GET /logs, sem serializar a resposta
+size_t readLogs()
+{
+  size_t count = 0;
+  if (logPartitionReady)
+  {
+    LogCursor cursor;
+    logCursorBegin(cursor);
+    char line[LOG_LINE_MAX];
+    size_t length;
+    while (logCursorNext(cursor, line, length))
+      count++;
+    return count;
+  }
+
+  hal::File file = hal::fsOpen(LOG_FILE, hal::FILE_MODE_READ);
+  return file ? countLogLines(file) : 0;
+}
+
+// As funções do núcleo que o handler da rota chamaria; false = ignorada
+bool replayHttp(const std::string &route, const TraceEvent &event)
+{
+  if (event.flags & TRACE_HTTP_TRUNCATED) return false;
+
+  JsonDocument doc;
+  if (route == "POST /config")
+  {
+    if (event.flags & TRACE_HTTP_MSGPACK_BODY)
+      applyConfigMsgPack(event.body, event.bodyLength);
+    else
+      applyConfigJson(event.body, event.bodyLength);
+  }
+  else if (route == "POST /config/rollback")
+  {
+    rollbackConfig();
+  }
+  else if (route == "GET /config")
+  {
+    static char buffer[CONFIG_JSON_MAX];
+    buildConfigJson(buffer, sizeof(buffer));
+  }
+  else if (route == "POST /dose")
+  {
+    if (!readBody(event, doc)) return true;
+    int bomba = doc["bomb"] | 0;
+    int32_t dosagemUl = jsonMl(doc["dosagem"], 0);
+    if (bomba >= 1 && bomba <= BOMBA_COUNT && dosagemUl > 0)
+      enqueuePumpJob(bomba - 1, dosagemUl, doc["origem"] | "Teste");
+  }
+  else if (route == "GET /logs")
+  {
+    readLogs();
+  }
+  else if (route == "DELETE /logs")
+  {
+    requestClearLocalLogs();
+  }
+  else if (route == "POST /time")
+  {
+    DateTime parsed;
+    if (readBody(event, doc) && parseDateTime(doc["time"] | "", parsed))
+      hal::rtcWrite(parsed.unixtime());
+  }
+  else if (route == "POST /sync")
+  {
+    if (!readBody(event, doc)) return true;
+    if (doc["url"].is<const char *>()) setOutboxUrl(doc["url"]);
+    if (doc["flush"] | false) flushOutbox();
+  }
+  else if (route == "POST /forecast")
+  {
+    if (!readBody(event, doc)) return true;
+    ForecastSettings updated = forecastSettings;
+    updated.floorUl = jsonMl(doc["floorMl"], updated.floorUl);
+    updated.hold = (doc["hold"] | (updated.hold != 0)) ? 1 : 0;
+    if (updated.floorUl >= 0) setForecastSettings(updated);
+  }
+  else if (route == "POST /program")
+  {
+    DoseProgram program;
+    int detail;
+    if (readBody(event, doc) && parseDoseProgram(doc.as<JsonVariantConst>(), program) == PROGRAM_OK)
+      submitDoseProgram(program, detail);
+  }
+  else if (route == "GET /program")
+  {
+    DoseProgram program;
+    for (uint8_t slot = 0; slot < PROGRAM_SLOTS; slot++)
+      if (copyDoseProgram(slot, program)) doseProgramDurationUs(program);
+  }
+  else if (route == "DELETE /program")
+  {
+    long id = queryLong(event, "id");
+    if (id > 0 && id <= 0xFFFF) cancelDoseProgram(static_cast<uint16_t>(id));
+  }
+  else if (route == "GET /status")
+  {
+    DateTime now = clockNow();
+    for (int i = 0; i < BOMBA_COUNT; i++)
+      forecastPump(i, now);
+    pumpQueueDepth();
+    secondsUntilNextDose();
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+void replayWifi(const TraceEvent &event)
+{
+  switch (event.code)
+  {
+  case TRACE_WIFI_STA_GOT_IP:
+    hal::native::setLinkUp(true);
+    break;
+  case TRACE_WIFI_STA_LOST_IP:
+  case TRACE_WIFI_STA_DISCONNECTED:
+    hal::native::setLinkUp(false);
+    break;
+  default:
+    break; // AP: não muda nada no núcleo
+  }
+}
+
+void runLoopOnce()
+{
+  timed("loop checkSchedules", checkSchedules);
+  timed("loop processPumpQueue", processPumpQueue);
+  timed("loop serviceOutbox", serviceOutbox);
+  timed("loop serviceHub", serviceHub);
+  timed("loop serviceLocalLogs", serviceLocalLogs);
+  timed("loop serviceConfig", serviceConfig);
+}
+
+// Loop a cada tick até o instante `targetUs` do relógio manual
+void runLoopUntil(int64_t targetUs, uint32_t tickMs)
+{
+  const int64_t tickUs = static_cast<int64_t>(tickMs) * 1000;
+  while (hal::uptimeUs() < targetUs)
+  {
+    runLoopOnce();
+    int64_t step = targetUs - hal::uptimeUs();
+    hal::native::advanceUs(step < tickUs ? step : tickUs);
+  }
+}
+
+void printPhases()
+{
+  printf("%-26s %8s %10s %8s %8s %8s\n", "fase", "n", "media us", "p50", "p99", "max");
+  for (const auto &entry : phases)
+  {
+    const LatencyHistogram<2> &histogram = entry.second;
+    printf("%-26s %8u %10.1f %8u %8u %8u\n", entry.first.c_str(), histogram.count(),
+           histogram.count() ? static_cast<double>(histogram.sum()) / histogram.count() : 0.0,
+           histogram.percentile(50), histogram.percentile(99), histogram.max());
+  }
+}
+} // namespace
+
+// --- Ganchos do núcleo ---
+DateTime clockNow()
+{
+  uint32_t now = 0;
+  hal::rtcRead(now);
+  return DateTime(now);
+}
+
+void onPumpJobQueued()
+{
+  jobsQueued++;
+}
+
+void reportDoseStartDelay(uint32_t) {}
+
+void reportDoseCutoffDelay(uint32_t) {}
+
+// Sem task no host: o POST (fake, em memória) roda na hora
+void onOutboxBatchReady()
+{
+  outboxUpload();
+}
+
+void onHubFetchReady()
+{
+  hubFetch();
+}
+
+void recordFlashOp(FlashOp op, uint32_t elapsedUs)
+{
+  FlashOpStats &stats = flashStats[op];
+  stats.count++;
+  stats.totalUs += elapsedUs;
+  if (elapsedUs > stats.maxUs) stats.maxUs = elapsedUs;
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  if (!parseOptions(argc, argv, options))
+  {
+    usage();
+    return 2;
+  }
+
+  std::vector<uint8_t> data;
+  if (!readBinaryFile(options.tracePath, data)) return 1;
+
+  TraceReader reader;
+  if (!traceReaderBegin(reader, data.data(), data.size()))
+  {
+    fprintf(stderr, "%s nao e uma gravacao de entradas\n", options.tracePath);
+    return 1;
+  }
+  if (reader.bombaCount != BOMBA_COUNT)
+  {
+    fprintf(stderr, "gravacao com %u bombas, este build tem %d\n", reader.bombaCount, BOMBA_COUNT);
+    return 1;
+  }
+
+  hal::setLogEnabled(!options.quiet);
+  hal::native::setManualClock(true);
+  hal::native::setFsRoot(options.fsRoot);
+
+  // Rotas da sessão atual (índice gravado -> nome) e deslocamento entre o
+  // uptime da placa e o do replay
+  std::vector<std::string> routes;
+  int64_t sessionOffsetUs = 0;
+  int64_t firstUs = -1;
+  uint32_t firstUnix = 0;
+  TraceEvent event;
+
+  while (traceReaderNext(reader, event))
+  {
+    if (event.type == TRACE_START)
+    {
+      replayStats.sessions++;
+      if (replayStats.sessions == 1)
+      {
+        timed("boot", [&]() { firstBoot(event.unixTime); });
+        firstUs = hal::uptimeUs();
+        firstUnix = event.unixTime;
+      }
+      else if (event.flags & TRACE_START_BOOT)
+      {
+        replayStats.resets++;
+        timed("boot", [&]() { simulateReset(event.unixTime); });
+      }
+      sessionOffsetUs = hal::uptimeUs() - event.atUs;
+      timed("config do START", [&]() { syncConfig(event); });
+
+      routes.clear();
+      for (uint8_t i = 0; i < event.code; i++)
+      {
+        const char *name;
+        size_t length;
+        if (traceRouteName(event, i, name, length)) routes.push_back(std::string(name, length));
+      }
+      continue;
+    }
+    if (replayStats.sessions == 0) break; // registro antes de qualquer START
+
+    runLoopUntil(event.atUs + sessionOffsetUs, options.tickMs);
+
+    switch (event.type)
+    {
+    case TRACE_HTTP:
+    {
+      replayStats.http++;
+      std::string route = event.code < routes.size() ? routes[event.code] : "rota " + std::to_string(event.code);
+      int64_t startUs = hal::micros64();
+      if (replayHttp(route, event))
+      {
+        recordPhase("http " + route, startUs);
+      }
+      else
+      {
+        replayStats.httpSkipped++;
+        recordPhase("ignorada " + route, startUs);
+      }
+      break;
+    }
+    case TRACE_WIFI:
+      replayStats.wifi++;
+      timed("wifi", [&]() { replayWifi(event); });
+      break;
+    case TRACE_CLOCK:
+      replayStats.clock++;
+      hal::native::setRtc(event.unixTime);
+      break;
+    default:
+      break;
+    }
+  }
+  if (reader.offset < reader.size)
+    fprintf(stderr, "[replay] Registro cortado em %u de %u bytes\n", static_cast<unsigned int>(reader.offset),
+            static_cast<unsigned int>(reader.size));
+  if (replayStats.sessions == 0)
+  {
+    fprintf(stderr, "gravacao sem sessao (START)\n");
+    return 1;
+  }
+
+  // Termina o que ficou na fila para o resumo fechar com o estoque
+  while (!pumpQueueIdle())
+  {
+    runLoopOnce();
+    hal::native::advanceUs(static_cast<int64_t>(options.tickMs) * 1000);
+  }
+
+  char startText[32];
+  formatTimestamp(DateTime(firstUnix), startText, sizeof(startText));
+  printf("\n=== replay de %s: %u sessao(oes), %u reset(s), %lld s simulados a partir de %s ===\n",
+         options.tracePath, replayStats.sessions, replayStats.resets,
+         static_cast<long long>((hal::uptimeUs() - firstUs) / 1000000), startText);
+  printf("Registros: %u HTTP (%u ignorados), %u WiFi, %u relogio; config divergiu em %u START\n",
+         replayStats.http, replayStats.httpSkipped, replayStats.wifi, replayStats.clock, replayStats.configDiverged);
+  printf("Jobs enfileirados: %u, linhas de log: %u\n", jobsQueued, static_cast<unsigned int>(logCount));
+  for (int i = 0; i < BOMBA_COUNT; i++)
+    printf("Bomba %d (%s): estoque %s ml\n", i + 1, bombas[i].name.c_str(), MlText(bombas[i].estoqueUl).c_str());
+  printf("\n");
+  printPhases();
+  printf("\n");
+  for (int op = 0; op < FLASH_OP_COUNT; op++)
+  {
+    const FlashOpStats &stats = flashStats[op];
+    printf("%-18s %6u chamadas, media %8.1f us, max %6u us\n", FLASH_OP_NAMES[op], stats.count,
+           stats.count ? static_cast<double>(stats.totalUs) / stats.count : 0.0, stats.maxUs);
+  }
+  return 0;
+}
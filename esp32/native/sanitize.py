@@ -0,0 +1,6 @@
+# Liga AddressSanitizer e UBSan no ambiente `native` (compilação e link)
+Import("env")
+
+SANITIZE_FLAGS = ["-fsanitize=address,undefined", "-fno-omit-frame-pointer"]
+
+env.Append(CCFLAGS=SANITIZE_FLAGS, LINKFLAGS=SANITIZE_FLAGS)
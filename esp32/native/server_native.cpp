@@ -0,0 +1,557 @@
+#include "dosing.h"
+#include "hal_native.h"
+#include "http_api.h"
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <new>
+#include <string>
+
+// Servidor HTTP no Linux (ambiente `native_server` do PlatformIO).
+//
+// Os handlers de src/api (GET /status, GET e POST /config, POST /dose e
+// GET /logs) rodam atrás do adaptador do ESPAsyncWebServer
+// (native/include), sobre a HAL fake com o relógio real. Entre uma conexão
+// e outra roda o mesmo loop da firmware (agenda, fila, logs, config), e a
+// dose do POST /dose liga a bomba fake pelo tempo de verdade.
+//
+//   .pio/build/native_server/program --fs /tmp/srv --config config.json --seed-logs 300
+//   python3 tools/loadgen.py --host 127.0.0.1 --port 8080 --allow-dose --mix status=40,config=20,logs=20,postconfig=10,dose=10
+//
+// O heap é contado em operator new/delete: cada rota guarda o maior pico
+// de bytes vivos acima do que havia antes do pedido, da montagem da
+// requisição até a resposta pronta em memória ("heapPeak" em /status,
+// http.routes, e no resumo impresso ao sair com Ctrl+C).
+
+#define SERVER_DEFAULT_PORT 8080
+#define SERVER_REQUEST_MAX (CONFIG_JSON_MAX + 2048)
+#define SERVER_LOOP_TICK_MS 20
+
+namespace
+{
+// --- Heap contado ---
+// Cada bloco leva o tamanho num cabeçalho; um processo, uma thread
+const size_t HEAP_HEADER = alignof(max_align_t);
+size_t heapLive = 0;
+size_t heapHigh = 0; // maior heapLive desde o último markHeap()
+
+void *countedAlloc(size_t size)
+{
+  char *block = static_cast<char *>(malloc(size + HEAP_HEADER));
+  if (block == nullptr) return nullptr;
+  *reinterpret_cast<size_t *>(block) = size;
+  heapLive += size;
+  if (heapLive > heapHigh) heapHigh = heapLive;
+  return block + HEAP_HEADER;
+}
+
+void countedFree(void *pointer)
+{
+  if (pointer == nullptr) return;
+  char *block = static_cast<char *>(pointer) - HEAP_HEADER;
+  heapLive -= *reinterpret_cast<size_t *>(block);
+  free(block);
+}
+
+void markHeap()
+{
+  heapHigh = heapLive;
+}
+
+// --- Rotas ---
+// Mesmos nomes do ROUTE_LIMITS da firmware (loadgen.py procura por eles)
+struct NativeRoute
+{
+  const char *name;
+  WebRequestMethodComposite method;
+  const char *path;
+  void (*handler)(AsyncWebServerRequest *request);
+  uint32_t requests;
+  size_t heapPeak;
+};
+
+NativeRoute routes[] = {
+    {"GET /status", HTTP_GET, "/status", handleStatus, 0, 0},
+    {"GET /config", HTTP_GET, "/config", handleGetConfig, 0, 0},
+    {"POST /config", HTTP_POST, "/config", handlePostConfig, 0, 0},
+    {"POST /dose", HTTP_POST, "/dose", handlePostDose, 0, 0},
+    {"GET /logs", HTTP_GET, "/logs", handleGetLogs, 0, 0},
+};
+
+volatile sig_atomic_t stopRequested = 0;
+
+void onSignal(int)
+{
+  stopRequested = 1;
+}
+
+struct Options
+{
+  const char *fsRoot = "native_server_fs";
+  const char *configPath = nullptr;
+  uint16_t port = SERVER_DEFAULT_PORT;
+  uint32_t seedLogs = 0;
+  long logPartitionKb = -1;
+  bool quiet = false;
+};
+
+void usage()
+{
+  printf("uso: program [--fs dir] [--config arquivo.json] [--port porta] [--seed-logs N]\n"
+         "               [--log-partition-kb N] [--quiet]\n");
+}
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+    if (strcmp(arg, "--quiet") == 0) options.quiet = true;
+    else if (value == nullptr) return false;
+    else if (strcmp(arg, "--fs") == 0) options.fsRoot = argv[++i];
+    else if (strcmp(arg, "--config") == 0) options.configPath = argv[++i];
+    else if (strcmp(arg, "--port") == 0) options.port = static_cast<uint16_t>(strtoul(argv[++i], nullptr, 10));
+    else if (strcmp(arg, "--seed-logs") == 0) options.seedLogs = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(arg, "--log-partition-kb") == 0) options.logPartitionKb = strtol(argv[++i], nullptr, 10);
+    else return false;
+  }
+  return options.port > 0;
+}
+
+bool applyConfigFile(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file)
+  {
+    fprintf(stderr, "nao foi possivel abrir %s\n", path);
+    return false;
+  }
+  std::string text;
+  char chunk[1024];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    text.append(chunk, read);
+  fclose(file);
+
+  if (applyConfigJson(text.c_str(), text.size()) != CONFIG_APPLY_OK)
+  {
+    fprintf(stderr, "config recusada: %s\n", path);
+    return false;
+  }
+  serviceConfig();
+  return true;
+}
+
+// Mesmas fases do loop() da firmware que existem no núcleo
+void runLoopOnce()
+{
+  checkSchedules();
+  processPumpQueue();
+  serviceOutbox();
+  serviceHub();
+  flushInputTrace();
+  serviceLocalLogs();
+  serviceConfig();
+}
+
+int listenOn(uint16_t port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+      bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, 16) != 0)
+  {
+    fprintf(stderr, "nao foi possivel servir na porta %u\n", port);
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+WebRequestMethodComposite parseMethod(const std::string &text)
+{
+  if (text == "GET") return HTTP_GET;
+  if (text == "POST") return HTTP_POST;
+  if (text == "DELETE") return HTTP_DELETE;
+  if (text == "PUT") return HTTP_PUT;
+  if (text == "OPTIONS") return HTTP_OPTIONS;
+  return 0;
+}
+
+// Query "a=1&b=2" vira parâmetros GET (sem decodificar %xx: a API não usa)
+void addQueryParams(AsyncWebServerRequest &request, const std::string &query)
+{
+  size_t start = 0;
+  while (start < query.size())
+  {
+    size_t end = query.find('&', start);
+    if (end == std::string::npos) end = query.size();
+    std::string pair = query.substr(start, end - start);
+    size_t equals = pair.find('=');
+    std::string name = pair.substr(0, equals);
+    std::string value = equals == std::string::npos ? "" : pair.substr(equals + 1);
+    if (!name.empty()) request.addParam(name.c_str(), value.c_str(), false);
+    start = end + 1;
+  }
+}
+
+bool sendAll(int client, const char *data, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t written = send(client, data, length, MSG_NOSIGNAL);
+    if (written <= 0) return false;
+    data += written;
+    length -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+const char *reasonPhrase(int code)
+{
+  switch (code)
+  {
+  case 200: return "OK";
+  case 400: return "Bad Request";
+  case 404: return "Not Found";
+  case 409: return "Conflict";
+  case 413: return "Payload Too Large";
+  case 500: return "Internal Server Error";
+  case 503: return "Service Unavailable";
+  default:  return "Status";
+  }
+}
+
+// Segmento TCP do AsyncTCP: o maior pedido de cada filler
+const size_t CHUNK_MAX = 1436;
+
+void writeResponse(int client, AsyncWebServerResponse &response)
+{
+  std::string head = "HTTP/1.1 " + std::to_string(response.code()) + " " + reasonPhrase(response.code()) + "\r\n";
+  if (!response.contentType().empty())
+    head += "Content-Type: " + response.contentType() + "\r\n";
+  if (response.chunked())
+    head += "Transfer-Encoding: chunked\r\nConnection: close\r\n";
+  else
+    head += "Content-Length: " + std::to_string(response.content().size()) + "\r\nConnection: close\r\n";
+  for (const AsyncWebServerResponse::Header &header : response.headers())
+    head += header.first + ": " + header.second + "\r\n";
+  head += "\r\n";
+  if (!sendAll(client, head.data(), head.size())) return;
+  if (!response.chunked())
+  {
+    sendAll(client, response.content().data(), response.content().size());
+    return;
+  }
+
+  // Como o AsyncTCP: pede até um segmento por vez até o filler devolver 0
+  uint8_t chunk[CHUNK_MAX];
+  size_t index = 0;
+  for (;;)
+  {
+    size_t length = response.fill(chunk, sizeof(chunk), index);
+    char size[16];
+    int sizeLength = snprintf(size, sizeof(size), "%zx\r\n", length);
+    if (!sendAll(client, size, static_cast<size_t>(sizeLength))) return;
+    if (length == 0) break;
+    if (!sendAll(client, reinterpret_cast<const char *>(chunk), length) || !sendAll(client, "\r\n", 2)) return;
+    index += length;
+  }
+  sendAll(client, "\r\n", 2);
+}
+
+void writeSimple(int client, int code, const char *body)
+{
+  AsyncWebServerResponse response(code, "application/json", body);
+  writeResponse(client, response);
+}
+
+// Uma requisição por conexão, como o app e o loadgen usam a API
+void serveClient(int client)
+{
+  timeval timeout = {5, 0};
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  std::string raw;
+  char chunk[2048];
+  size_t headerEnd;
+  ssize_t received;
+  while ((headerEnd = raw.find("\r\n\r\n")) == std::string::npos)
+  {
+    if (raw.size() > 8192 || (received = recv(client, chunk, sizeof(chunk), 0)) <= 0) return;
+    raw.append(chunk, static_cast<size_t>(received));
+  }
+
+  size_t lineEnd = raw.find("\r\n");
+  std::string requestLine = raw.substr(0, lineEnd);
+  size_t firstSpace = requestLine.find(' ');
+  size_t secondSpace = requestLine.find(' ', firstSpace + 1);
+  if (firstSpace == std::string::npos || secondSpace == std::string::npos)
+  {
+    writeSimple(client, 400, "{\"ok\":false,\"message\":\"requisicao invalida\"}");
+    return;
+  }
+  WebRequestMethodComposite method = parseMethod(requestLine.substr(0, firstSpace));
+  std::string target = requestLine.substr(firstSpace + 1, secondSpace - firstSpace - 1);
+  size_t question = target.find('?');
+  std::string path = target.substr(0, question);
+
+  size_t contentLength = 0;
+  std::vector<std::pair<std::string, std::string>> headers;
+  for (size_t at = lineEnd + 2; at < headerEnd;)
+  {
+    size_t end = raw.find("\r\n", at);
+    std::string line = raw.substr(at, end - at);
+    size_t colon = line.find(':');
+    if (colon != std::string::npos)
+    {
+      size_t valueStart = line.find_first_not_of(' ', colon + 1);
+      std::string name = line.substr(0, colon);
+      std::string value = valueStart == std::string::npos ? "" : line.substr(valueStart);
+      if (strcasecmp(name.c_str(), "Content-Length") == 0) contentLength = strtoul(value.c_str(), nullptr, 10);
+      headers.emplace_back(name, value);
+    }
+    at = end + 2;
+  }
+
+  if (contentLength > SERVER_REQUEST_MAX)
+  {
+    writeSimple(client, 413, "{\"ok\":false,\"message\":\"body muito grande\"}");
+    return;
+  }
+  std::string body = raw.substr(headerEnd + 4);
+  while (body.size() < contentLength && (received = recv(client, chunk, sizeof(chunk), 0)) > 0)
+    body.append(chunk, static_cast<size_t>(received));
+  body.resize(contentLength < body.size() ? contentLength : body.size());
+
+  NativeRoute *route = nullptr;
+  for (NativeRoute &candidate : routes)
+  {
+    if (candidate.method == method && path == candidate.path) route = &candidate;
+  }
+  if (route == nullptr)
+  {
+    if (method == HTTP_GET && path == "/ping")
+    {
+      AsyncWebServerResponse pong(200, "text/plain", "pong");
+      writeResponse(client, pong);
+      return;
+    }
+    writeSimple(client, 404, "{\"ok\":false,\"message\":\"rota nao encontrada\"}");
+    return;
+  }
+
+  // Pico medido do request montado até o último byte da resposta: as
+  // chunked geram o corpo durante o envio
+  size_t heapBefore = heapLive;
+  markHeap();
+  {
+    AsyncWebServerRequest request(method, path.c_str());
+    for (const auto &header : headers)
+      request.addHeader(header.first, header.second);
+    if (question != std::string::npos)
+      addQueryParams(request, target.substr(question + 1));
+    if (!body.empty())
+      request.setBody(body.data(), body.size());
+
+    route->handler(&request);
+    route->requests++;
+
+    if (request.response())
+      writeResponse(client, *request.response());
+    else
+      writeSimple(client, 500, "{\"ok\":false,\"message\":\"handler sem resposta\"}");
+    size_t peak = heapHigh - heapBefore;
+    if (peak > route->heapPeak) route->heapPeak = peak;
+  }
+}
+
+void printSummary()
+{
+  printf("\n%-14s %8s %12s\n", "rota", "pedidos", "heap pico");
+  for (const NativeRoute &route : routes)
+    printf("%-14s %8u %12u\n", route.name, route.requests, static_cast<unsigned int>(route.heapPeak));
+  printf("Heap vivo: %u bytes, %u fallbacks de gzip\n", static_cast<unsigned int>(heapLive), gzipFallbackCount);
+}
+} // namespace
+
+void *operator new(size_t size)
+{
+  void *pointer = countedAlloc(size);
+  if (pointer == nullptr) throw std::bad_alloc();
+  return pointer;
+}
+
+void *operator new[](size_t size)
+{
+  void *pointer = countedAlloc(size);
+  if (pointer == nullptr) throw std::bad_alloc();
+  return pointer;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+  return countedAlloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+  return countedAlloc(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+  countedFree(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+  countedFree(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+  countedFree(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept
+{
+  countedFree(pointer);
+}
+
+// --- Ganchos do núcleo ---
+DateTime clockNow()
+{
+  uint32_t now = 0;
+  hal::rtcRead(now);
+  return DateTime(now);
+}
+
+void onPumpJobQueued() {}
+
+void reportDoseStartDelay(uint32_t) {}
+
+void reportDoseCutoffDelay(uint32_t) {}
+
+// Sem task no host: o POST (fake, em memória) roda na hora
+void onOutboxBatchReady()
+{
+  outboxUpload();
+}
+
+void onHubFetchReady()
+{
+  hubFetch();
+}
+
+void recordFlashOp(FlashOp, uint32_t) {}
+
+// --- Ganchos de src/api ---
+// O loop roda depois de cada conexão
+void wakeLoop() {}
+
+// Sem limite prático no host: o gzip sempre cabe
+size_t largestFreeBlock()
+{
+  return SIZE_MAX;
+}
+
+// O adaptador entrega todo body como "plain"
+bool admittedRequestBody(AsyncWebServerRequest *, const char *&, size_t &)
+{
+  return false;
+}
+
+void noteBulkResponse(AsyncWebServerRequest *, bool, size_t) {}
+
+void fillPlatformStatus(JsonDocument &doc)
+{
+  JsonObject http = doc["http"].to<JsonObject>();
+  http["heapLive"] = heapLive;
+  http["gzipFallbacks"] = gzipFallbackCount;
+
+  JsonObject list = http["routes"].to<JsonObject>();
+  for (const NativeRoute &route : routes)
+  {
+    JsonObject entry = list[route.name].to<JsonObject>();
+    entry["accepted"] = route.requests;
+    entry["heapPeak"] = route.heapPeak;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  if (!parseOptions(argc, argv, options))
+  {
+    usage();
+    return 2;
+  }
+
+  hal::setLogEnabled(!options.quiet);
+  hal::native::setFsRoot(options.fsRoot);
+  if (options.logPartitionKb >= 0)
+    hal::native::setPartitionSize(static_cast<size_t>(options.logPartitionKb) * 1024);
+  // Hora local do host no RTC fake
+  time_t now = time(nullptr);
+  struct tm local;
+  localtime_r(&now, &local);
+  hal::native::setRtc(static_cast<uint32_t>(now + local.tm_gmtoff));
+
+  // Mesma ordem do setup() da firmware; logs recomeçam a cada execução
+  inicializarBombas();
+  rtcReady = hal::rtcBegin();
+  prefsReady = hal::kvBegin("bomb-config");
+  loadBombasConfig();
+  initLogStorage();
+  clearLocalLogs();
+  initOutbox();
+  initHub();
+  loadConsumption();
+  initDosePrograms();
+  initJournal();
+  if (options.configPath && !applyConfigFile(options.configPath))
+    return 1;
+  for (uint32_t i = 0; i < options.seedLogs; i++)
+    appendLocalLog(i % BOMBA_COUNT, 1 * UL_PER_ML, "Seed", clockNow());
+
+  int listenFd = listenOn(options.port);
+  if (listenFd < 0) return 1;
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  printf("Servindo na porta %u (127.0.0.1), %u linhas de log\n", options.port, static_cast<unsigned int>(logCount));
+  fflush(stdout);
+  while (!stopRequested)
+  {
+    pollfd listener = {listenFd, POLLIN, 0};
+    if (poll(&listener, 1, SERVER_LOOP_TICK_MS) > 0)
+    {
+      int client = accept(listenFd, nullptr, nullptr);
+      if (client >= 0)
+      {
+        serveClient(client);
+        close(client);
+      }
+    }
+    runLoopOnce();
+  }
+
+  close(listenFd);
+  printSummary();
+  return 0;
+}
@@ -0,0 +1,784 @@
+#include "http_api.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <memory>
+#include <new>
+
+JsonArenaPool *const JSON_POOLS[JSON_POOL_COUNT] = {&jsonSmallPool, &jsonLargePool};
+
+uint32_t gzipFallbackCount = 0;
+
+// =========================================================
+// Handlers
+// =========================================================
+void handleStatus(AsyncWebServerRequest *request)
+{
+  hal::logf("[http] Recebido: GET /status\n");
+  JsonLease lease(jsonLargePool);
+  JsonDocument &doc = lease.doc();
+  buildStatusDocument(doc, responseFormat(request));
+  sendDocument(request, 200, doc);
+}
+
+void buildStatusDocument(JsonDocument &doc, WireFormat format)
+{
+  char timestamp[TIMESTAMP_SIZE];
+  formatTimestamp(clockNow(), timestamp, sizeof(timestamp));
+  doc["time"] = timestamp;
+
+  fillPlatformStatus(doc);
+  fillSyncStatus(doc["sync"].to<JsonObject>());
+  fillForecastStatus(doc["forecast"].to<JsonObject>(), format);
+  fillJournalStatus(doc["journal"].to<JsonObject>(), format);
+  fillConfigStatus(doc["config"].to<JsonObject>());
+  fillTraceStatus(doc["trace"].to<JsonObject>());
+  fillHubStatus(doc["hub"].to<JsonObject>());
+  fillJsonArenaStatus(doc["jsonArenas"].to<JsonObject>());
+}
+
+void handleGetConfig(AsyncWebServerRequest *request)
+{
+  hal::logf("[http] Recebido: GET /config\n");
+  WireFormat format = responseFormat(request);
+
+  // Config inteira num buffer, enviada em trechos; JSON ou MessagePack
+  // escrito pelo esquema direto no buffer, sem JsonDocument (o MessagePack
+  // é menor que o JSON, então cabe no mesmo teto)
+  std::unique_ptr<char[]> data(new (std::nothrow) char[CONFIG_JSON_MAX]);
+  size_t size = 0;
+  if (data)
+    size = format == WIRE_MSGPACK ? buildConfigMsgPack(data.get(), CONFIG_JSON_MAX)
+                                  : buildConfigJson(data.get(), CONFIG_JSON_MAX);
+
+  BulkBody *body = size > 0 ? new (std::nothrow) BufferBody(std::move(data), size) : nullptr;
+  if (body == nullptr)
+  {
+    request->send(500, "application/json", "{\"ok\":false,\"message\":\"config indisponivel\"}");
+    return;
+  }
+  sendBulkBody(request, format, body);
+}
+
+void handlePostConfig(AsyncWebServerRequest *request)
+{
+  hal::logf("[http] Recebido: POST /config\n");
+
+  const char *body;
+  size_t length;
+  if (!readRequestBody(request, body, length))
+  {
+    hal::logf("[http] ERRO: Body ausente em /config\n");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"body ausente\"}");
+    return;
+  }
+
+  // Parser do esquema: uma passada sobre o body, sem JsonDocument
+  hal::logf("[http] Body recebido: %u bytes\n", static_cast<unsigned int>(length));
+  ConfigApply result =
+      requestFormat(request) == WIRE_MSGPACK ? applyConfigMsgPack(body, length) : applyConfigJson(body, length);
+  switch (result)
+  {
+  case CONFIG_APPLY_OK:
+    // Geração nova gravada na NVS pelo loop
+    wakeLoop();
+    hal::logf("[http] Config aplicada com sucesso.\n");
+    request->send(200, "application/json", "{\"ok\":true}");
+    break;
+  case CONFIG_APPLY_BUSY:
+    request->send(503, "application/json", "{\"ok\":false,\"message\":\"config em uso, tente de novo\"}");
+    break;
+  default:
+    hal::logf("[http] Falha ao aplicar config.\n");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"json invalido\"}");
+    break;
+  }
+}
+
+void handlePostDose(AsyncWebServerRequest *request)
+{
+  hal::logf("[http] Recebido: POST /dose\n");
+
+  JsonLease lease(jsonSmallPool);
+  JsonDocument &doc = lease.doc();
+  DeserializationError error;
+  if (!readRequestDocument(request, doc, error))
+  {
+    hal::logf("[http] ERRO: Body ausente em /dose\n");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"body ausente\"}");
+    return;
+  }
+
+  if (error)
+  {
+    hal::logf("[http] JSON Invalido em /dose\n");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"json invalido\"}");
+    return;
+  }
+
+  int bomba = doc["bomb"] | 0;
+  int32_t dosagemUl = jsonMl(doc["dosagem"], 0);
+  const char *origem = doc["origem"] | "Teste";
+
+  if (bomba < 1 || bomba > BOMBA_COUNT || dosagemUl <= 0)
+  {
+    hal::logf("[http] Dados invalidos para dosagem\n");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"dados invalidos\"}");
+    return;
+  }
+
+  hal::logf("[http] Solicitacao valida: Bomba %d, %s ml\n", bomba, MlText(dosagemUl).c_str());
+
+  bool queued = enqueuePumpJob(bomba - 1, dosagemUl, origem);
+  if (!queued)
+  {
+    request->send(409, "application/json", "{\"ok\":false,\"message\":\"fila cheia\"}");
+    return;
+  }
+
+  request->send(200, "application/json", "{\"ok\":true}");
+}
+
+void handleGetLogs(AsyncWebServerRequest *request)
+{
+  hal::logf("[http] Recebido: GET /logs\n");
+  if (request->hasParam("afterSeq"))
+  {
+    sendLogPage(request, strtoul(request->getParam("afterSeq")->value().c_str(), nullptr, 10));
+    return;
+  }
+
+  WireFormat format = responseFormat(request);
+  if (!logPartitionReady && !fsReady)
+  {
+    request->send(503, "application/json", "{\"ok\":false,\"message\":\"filesystem indisponivel\"}");
+    return;
+  }
+
+  hal::File file;
+  if (!logPartitionReady && hal::fsExists(LOG_FILE))
+  {
+    file = hal::fsOpen(LOG_FILE, hal::FILE_MODE_READ);
+    if (!file)
+    {
+      request->send(500, "application/json", "{\"ok\":false,\"message\":\"falha ao abrir logs\"}");
+      return;
+    }
+  }
+
+  // Uma linha por chunk, da flash para a rede: sem o log inteiro em RAM
+  BulkBody *body = new (std::nothrow) LogsBody(format, std::move(file));
+  if (body == nullptr)
+  {
+    request->send(500, "application/json", "{\"ok\":false,\"message\":\"memoria insuficiente\"}");
+    return;
+  }
+  sendBulkBody(request, format, body);
+}
+
+// Cabeçalho e até HUB_PAGE_MAX linhas com seq > N, em NDJSON
+void sendLogPage(AsyncWebServerRequest *request, uint32_t afterSeq)
+{
+  std::unique_ptr<char[]> page(new (std::nothrow) char[HUB_PAGE_BODY_MAX]);
+  size_t size = page ? buildLogPage(afterSeq, page.get(), HUB_PAGE_BODY_MAX) : 0;
+  if (size == 0)
+  {
+    request->send(500, "application/json", "{\"ok\":false,\"message\":\"pagina indisponivel\"}");
+    return;
+  }
+
+  AsyncResponseStream *response = request->beginResponseStream("application/x-ndjson");
+  response->write(reinterpret_cast<const uint8_t *>(page.get()), size);
+  request->send(response);
+}
+
+// =========================================================
+// Formato, compressão e body
+// =========================================================
+namespace
+{
+bool tokenIs(const char *token, size_t length, const char *name)
+{
+  return strlen(name) == length && strncasecmp(token, name, length) == 0;
+}
+
+bool isListSpace(char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+// q de um item ("gzip;q=0.5"), em milésimos sem float; sem q vale 1000
+uint16_t itemQuality(const char *params, const char *end)
+{
+  while (params < end)
+  {
+    const char *param = params + 1; // pula o ';'
+    while (param < end && isListSpace(*param))
+      param++;
+    const char *next = param;
+    while (next < end && *next != ';')
+      next++;
+
+    if (next - param >= 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+    {
+      const char *digit = param + 2;
+      uint32_t quality = 0;
+      if (digit < next && *digit >= '0' && *digit <= '9')
+        quality = static_cast<uint32_t>(*digit++ - '0') * 1000;
+      if (digit < next && *digit == '.')
+      {
+        digit++;
+        for (uint32_t place = 100; place > 0 && digit < next && *digit >= '0' && *digit <= '9'; place /= 10)
+          quality += static_cast<uint32_t>(*digit++ - '0') * place;
+      }
+      return quality > 1000 ? 1000 : static_cast<uint16_t>(quality);
+    }
+    params = next;
+  }
+  return 1000;
+}
+
+// Lista "item;q=0.5, item2" do Accept/Accept-Encoding: q (milésimos) do
+// item mais específico que casa (rank() > 0); 0 = ausente ou recusado
+uint16_t listQuality(const char *header, uint8_t (*rank)(const char *token, size_t length))
+{
+  uint8_t bestRank = 0;
+  uint16_t bestQuality = 0;
+  const char *cursor = header;
+  while (*cursor != '\0')
+  {
+    const char *end = strchr(cursor, ',');
+    if (end == nullptr) end = cursor + strlen(cursor);
+
+    while (cursor < end && isListSpace(*cursor))
+      cursor++;
+    const char *tokenEnd = cursor;
+    while (tokenEnd < end && *tokenEnd != ';' && !isListSpace(*tokenEnd))
+      tokenEnd++;
+    const char *params = tokenEnd;
+    while (params < end && *params != ';')
+      params++;
+
+    uint8_t itemRank = rank(cursor, static_cast<size_t>(tokenEnd - cursor));
+    if (itemRank > 0)
+    {
+      uint16_t quality = itemQuality(params, end);
+      if (itemRank > bestRank || (itemRank == bestRank && quality > bestQuality))
+      {
+        bestRank = itemRank;
+        bestQuality = quality;
+      }
+    }
+    cursor = *end != '\0' ? end + 1 : end;
+  }
+  return bestQuality;
+}
+
+// 3 = o tipo do formato, 2 = application/*, 1 = */*
+uint8_t mediaRank(const char *type, size_t length, WireFormat format)
+{
+  if (tokenIs(type, length, "*/*")) return 1;
+  if (tokenIs(type, length, "application/*")) return 2;
+  if (format == WIRE_JSON) return tokenIs(type, length, JSON_MIME) ? 3 : 0;
+  // application/msgpack, application/x-msgpack e application/vnd.msgpack
+  if (tokenIs(type, length, MSGPACK_MIME) || tokenIs(type, length, "application/x-msgpack") ||
+      tokenIs(type, length, "application/vnd.msgpack"))
+    return 3;
+  return 0;
+}
+
+uint8_t jsonRank(const char *type, size_t length)
+{
+  return mediaRank(type, length, WIRE_JSON);
+}
+
+uint8_t msgpackRank(const char *type, size_t length)
+{
+  return mediaRank(type, length, WIRE_MSGPACK);
+}
+
+// 2 = gzip, 1 = "*"
+uint8_t gzipRank(const char *coding, size_t length)
+{
+  if (tokenIs(coding, length, "gzip") || tokenIs(coding, length, "x-gzip")) return 2;
+  return tokenIs(coding, length, "*") ? 1 : 0;
+}
+} // namespace
+
+const char *wireFormatMime(WireFormat format)
+{
+  return format == WIRE_MSGPACK ? MSGPACK_MIME : JSON_MIME;
+}
+
+// MessagePack só quando o Accept o prefere a JSON (q maior); empate,
+// q=0 ou header ausente ficam em JSON
+WireFormat responseFormat(AsyncWebServerRequest *request)
+{
+  if (!request->hasHeader("Accept")) return WIRE_JSON;
+  String accept = request->header("Accept");
+  return listQuality(accept.c_str(), msgpackRank) > listQuality(accept.c_str(), jsonRank) ? WIRE_MSGPACK : WIRE_JSON;
+}
+
+WireFormat requestFormat(AsyncWebServerRequest *request)
+{
+  if (request->contentType().indexOf("msgpack") >= 0) return WIRE_MSGPACK;
+  return WIRE_JSON;
+}
+
+void sendDocument(AsyncWebServerRequest *request, int code, JsonDocument &doc)
+{
+  WireFormat format = responseFormat(request);
+  int64_t start = hal::micros64();
+
+  AsyncResponseStream *response = request->beginResponseStream(wireFormatMime(format));
+  response->setCode(code);
+  response->addHeader("Vary", "Accept");
+
+  size_t size = (format == WIRE_MSGPACK)
+                    ? serializeMsgPack(doc, *response)
+                    : serializeJson(doc, *response);
+
+  hal::logf("[http] %s (%s): %u bytes em %ld us\n", request->url().c_str(), wireFormatMime(format),
+            static_cast<unsigned int>(size), static_cast<long>(hal::micros64() - start));
+  request->send(response);
+}
+
+bool acceptsGzip(AsyncWebServerRequest *request)
+{
+  if (!request->hasHeader("Accept-Encoding")) return false;
+  // "gzip;q=0" recusa; "*" vale para gzip quando não há item próprio
+  String encoding = request->header("Accept-Encoding");
+  return listQuality(encoding.c_str(), gzipRank) > 0;
+}
+
+GzipEncoder *beginGzip(AsyncWebServerRequest *request, Print &out)
+{
+  if (!acceptsGzip(request)) return nullptr;
+
+  size_t largest = largestFreeBlock();
+  if (largest < GzipEncoder::memoryFootprint() + GZIP_HEAP_RESERVE)
+  {
+    gzipFallbackCount++;
+    hal::logf("[http] Memoria baixa (maior bloco: %u bytes), resposta sem gzip\n",
+              static_cast<unsigned int>(largest));
+    return nullptr;
+  }
+
+  GzipEncoder *gzip = new (std::nothrow) GzipEncoder(out);
+  if (gzip == nullptr)
+  {
+    gzipFallbackCount++;
+    hal::logf("[http] ERRO: Falha ao alocar compressor, resposta sem gzip\n");
+    return nullptr;
+  }
+  return gzip;
+}
+
+void finishBulkResponse(AsyncWebServerRequest *request, GzipEncoder *gzip, size_t plainSize)
+{
+  size_t wireSize = plainSize;
+  bool compressed = (gzip != nullptr);
+
+  if (compressed)
+  {
+    gzip->finish();
+    wireSize = gzip->totalOut();
+    hal::logf("[http] %s gzip: %u -> %u bytes (%u%%)\n", request->url().c_str(),
+              static_cast<unsigned int>(plainSize), static_cast<unsigned int>(wireSize),
+              plainSize > 0 ? static_cast<unsigned int>(wireSize * 100 / plainSize) : 100);
+    delete gzip;
+  }
+
+  noteBulkResponse(request, compressed, wireSize);
+}
+
+// =========================================================
+// Corpo em chunks
+// =========================================================
+BulkBody::~BulkBody()
+{
+  delete gzip_;
+}
+
+bool BulkBody::begin(GzipEncoder *gzip)
+{
+  gzip_ = gzip;
+  burst_ = gzip ? GZIP_BURST_MAX : BULK_ITEM_MAX;
+  capacity_ = burst_ + BULK_CHUNK_SIZE;
+  pending_.reset(new (std::nothrow) uint8_t[capacity_]);
+  return pending_ != nullptr;
+}
+
+size_t BulkBody::fill(uint8_t *buffer, size_t maxLen)
+{
+  // Só gera mais quando o pior next() ainda cabe no pendente
+  while (!done_ && tail_ - head_ < maxLen)
+  {
+    if (capacity_ - tail_ < burst_ && head_ > 0)
+    {
+      memmove(pending_.get(), pending_.get() + head_, tail_ - head_);
+      tail_ -= head_;
+      head_ = 0;
+    }
+    if (capacity_ - tail_ < burst_) break;
+
+    if (!next(gzip_ ? static_cast<Print &>(*gzip_) : static_cast<Print &>(*this)))
+    {
+      if (gzip_) gzip_->finish();
+      done_ = true;
+    }
+  }
+
+  size_t chunk = tail_ - head_;
+  if (chunk > maxLen) chunk = maxLen;
+  memcpy(buffer, pending_.get() + head_, chunk);
+  head_ += chunk;
+  wireSize_ += chunk;
+  return chunk;
+}
+
+size_t BulkBody::write(const uint8_t *data, size_t length)
+{
+  // Não acontece com next() dentro de BULK_ITEM_MAX; truncar quebraria o
+  // corpo, então o excedente fica registrado no log
+  if (length > capacity_ - tail_)
+  {
+    hal::logf("[http] ERRO: Pedaco de %u bytes maior que o buffer pendente\n", static_cast<unsigned int>(length));
+    length = capacity_ - tail_;
+  }
+  memcpy(pending_.get() + tail_, data, length);
+  tail_ += length;
+  return length;
+}
+
+GzipEncoder *BulkBody::releaseGzip()
+{
+  GzipEncoder *gzip = gzip_;
+  gzip_ = nullptr;
+  return gzip;
+}
+
+LogsBody::LogsBody(WireFormat format, hal::File file)
+    : format_(format), partition_(logPartitionReady), file_(std::move(file))
+{
+  // Um append durante o envio não pode furar a contagem do cabeçalho
+  if (partition_)
+  {
+    logCursorBegin(cursor_);
+    count_ = logCount;
+  }
+  else if (file_ && format_ == WIRE_MSGPACK)
+  {
+    count_ = countLogLines(file_);
+    file_.seek(0);
+  }
+}
+
+bool LogsBody::nextLine(char *line, size_t &length)
+{
+  if (partition_) return logCursorNext(cursor_, line, length);
+  while (file_ && file_.readLine(line, LOG_LINE_MAX, length))
+  {
+    if (length > 0) return true;
+  }
+  file_.close();
+  return false;
+}
+
+bool LogsBody::next(Print &out)
+{
+  if (!started_)
+  {
+    started_ = true;
+    if (format_ == WIRE_MSGPACK)
+      writeMsgPackArrayHeader(out, count_);
+    else
+      out.print("[");
+  }
+
+  char line[LOG_LINE_MAX];
+  size_t length;
+  if (format_ == WIRE_MSGPACK)
+  {
+    if (sent_ == count_) return false;
+    sent_++;
+
+    JsonLease lease(jsonSmallPool);
+    JsonDocument &entry = lease.doc();
+    // Linha sumida (setor reaproveitado, arquivo aparado) ou corrompida
+    // vira nil para manter a contagem
+    if (!nextLine(line, length) || deserializeJson(entry, line, length))
+      out.write(static_cast<uint8_t>(0xC0));
+    else
+      serializeMsgPack(entry, out);
+    return true;
+  }
+
+  if (closed_) return false;
+  if (!nextLine(line, length))
+  {
+    out.print("]");
+    closed_ = true;
+    return true;
+  }
+  if (sent_++ > 0) out.print(",");
+  out.write(reinterpret_cast<const uint8_t *>(line), length);
+  return true;
+}
+
+bool HubLogsBody::next(Print &out)
+{
+  if (closed_) return false;
+  if (!started_)
+  {
+    started_ = true;
+    out.print("[");
+  }
+
+  char merged[MERGED_LINE_MAX + 1];
+  size_t length;
+  if (!mergedLogNext(cursor_, merged, length))
+  {
+    out.print("]");
+    closed_ = true;
+    return true;
+  }
+  if (sent_++ > 0) out.print(",");
+  out.write(reinterpret_cast<const uint8_t *>(merged), length);
+  return true;
+}
+
+bool BufferBody::next(Print &out)
+{
+  if (offset_ == size_) return false;
+  size_t slice = size_ - offset_ < BULK_ITEM_MAX ? size_ - offset_ : BULK_ITEM_MAX;
+  out.write(reinterpret_cast<const uint8_t *>(data_.get() + offset_), slice);
+  offset_ += slice;
+  return true;
+}
+
+void sendBulkBody(AsyncWebServerRequest *request, WireFormat format, BulkBody *body)
+{
+  std::shared_ptr<BulkBody> stream(body);
+  GzipEncoder *gzip = beginGzip(request, *body);
+  bool compressed = (gzip != nullptr);
+  if (!body->begin(gzip))
+  {
+    request->send(500, "application/json", "{\"ok\":false,\"message\":\"memoria insuficiente\"}");
+    return;
+  }
+
+  int64_t start = hal::micros64();
+  AsyncWebServerResponse *response = request->beginChunkedResponse(
+      wireFormatMime(format),
+      [stream, request, format, start](uint8_t *buffer, size_t maxLen, size_t) -> size_t {
+        size_t chunk = stream->fill(buffer, maxLen);
+        if (chunk == 0)
+        {
+          hal::logf("[http] %s (%s): %u bytes em %ld us\n", request->url().c_str(), wireFormatMime(format),
+                    static_cast<unsigned int>(stream->plainSize()), static_cast<long>(hal::micros64() - start));
+          GzipEncoder *gzip = stream->releaseGzip();
+          if (gzip)
+            finishBulkResponse(request, gzip, stream->plainSize());
+          else
+            noteBulkResponse(request, false, stream->wireSize());
+        }
+        return chunk;
+      });
+  response->addHeader("Vary", "Accept, Accept-Encoding");
+  if (compressed) response->addHeader("Content-Encoding", "gzip");
+  noteBulkResponse(request, compressed, 0);
+  request->send(response);
+}
+
+// "plain" do AsyncWebServer ou o body guardado na admissão
+bool readRequestBody(AsyncWebServerRequest *request, const char *&body, size_t &length)
+{
+  if (request->hasParam("plain", true))
+  {
+    const String &plain = request->getParam("plain", true)->value();
+    body = plain.c_str();
+    length = plain.length();
+    return true;
+  }
+
+  return admittedRequestBody(request, body, length);
+}
+
+bool readRequestDocument(AsyncWebServerRequest *request, JsonDocument &doc, DeserializationError &error)
+{
+  const char *body;
+  size_t length;
+  if (!readRequestBody(request, body, length)) return false;
+
+  if (requestFormat(request) == WIRE_MSGPACK)
+  {
+    hal::logf("[http] Body recebido: %u bytes (msgpack)\n", static_cast<unsigned int>(length));
+    error = deserializeMsgPack(doc, body, length);
+  }
+  else
+  {
+    hal::logf("[http] Body recebido: %s\n", body);
+    error = deserializeJson(doc, body, length);
+  }
+
+  return true;
+}
+
+// MessagePack não tem array "aberto": o cabeçalho já leva a contagem de itens.
+size_t writeMsgPackArrayHeader(Print &out, size_t count)
+{
+  uint8_t header[5];
+  size_t length;
+
+  if (count < 16)
+  {
+    header[0] = static_cast<uint8_t>(0x90 | count);
+    length = 1;
+  }
+  else if (count <= 0xFFFF)
+  {
+    header[0] = 0xDC;
+    header[1] = static_cast<uint8_t>(count >> 8);
+    header[2] = static_cast<uint8_t>(count);
+    length = 3;
+  }
+  else
+  {
+    header[0] = 0xDD;
+    for (int i = 0; i < 4; i++)
+      header[1 + i] = static_cast<uint8_t>(count >> (24 - 8 * i));
+    length = 5;
+  }
+
+  return out.write(header, length);
+}
+
+// =========================================================
+// Blocos do GET /status
+// =========================================================
+void fillSyncStatus(JsonObject status)
+{
+  char url[OUTBOX_URL_SIZE];
+  outboxUrl(url, sizeof(url));
+
+  status["enabled"] = outboxEnabled();
+  status["url"] = url;
+  status["device"] = hal::deviceId();
+  status["pending"] = outboxStats.pending;
+  status["oldestPendingSec"] = outboxOldestPendingSec();
+  status["nextSeq"] = outboxStats.nextSeq;
+  status["ackedSeq"] = outboxStats.ackedSeq;
+  status["sent"] = outboxStats.sent;
+  status["batches"] = outboxStats.batches;
+  status["failures"] = outboxStats.failures;
+  status["rejected"] = outboxStats.rejected;
+  status["dropped"] = outboxStats.dropped;
+  status["backoffSec"] = outboxStats.backoffMs / 1000;
+  status["lastStatus"] = outboxStats.lastStatus;
+  status["lastUploadMs"] = outboxStats.lastUploadMs;
+}
+
+void fillForecastStatus(JsonObject status, WireFormat format)
+{
+  DateTime now = clockNow();
+
+  jsonSetMl(status["floorMl"], forecastSettings.floorUl, format);
+  status["hold"] = forecastSettings.hold != 0;
+  status["held"] = heldScheduledDoses;
+
+  JsonArray pumps = status["bombas"].to<JsonArray>();
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    PumpForecast forecast = forecastPump(i, now);
+    JsonObject pump = pumps.add<JsonObject>();
+    pump["bombaId"] = i + 1;
+    jsonSetMl(pump["estoqueMl"], bombas[i].estoqueUl, format);
+    jsonSetMl(pump["dailyMl"], forecast.dailyUl, format);
+    jsonSetMl(pump["ewmaDailyMl"], forecast.ewmaDailyUl, format);
+    jsonSetMl(pump["scheduledDailyMl"], forecast.scheduledDailyUl, format);
+    pump["daysObserved"] = forecast.daysObserved;
+
+    // Dias com uma casa decimal, direto dos segundos
+    if (forecast.secondsRemaining < 0 || forecast.emptyAt == 0)
+      pump["daysRemaining"] = nullptr;
+    else
+      jsonSetFixed(pump["daysRemaining"], static_cast<int32_t>(forecast.secondsRemaining / 8640), 1, format);
+
+    if (forecast.emptyAt == 0)
+    {
+      pump["emptyDate"] = nullptr;
+    }
+    else
+    {
+      // Pior caso dos campos (dia e mês uint8_t, ano uint16_t): "255/255/65535"
+      DateTime empty(forecast.emptyAt);
+      char date[14];
+      snprintf(date, sizeof(date), "%02d/%02d/%04d", empty.day(), empty.month(), empty.year());
+      pump["emptyDate"] = date;
+    }
+  }
+}
+
+void fillJournalStatus(JsonObject status, WireFormat format)
+{
+  status["writes"] = journalStats.writes;
+  status["checkpoints"] = journalStats.checkpoints;
+  status["writeErrors"] = journalStats.writeErrors;
+
+  // Reconciliação feita no boot
+  JsonObject boot = status["boot"].to<JsonObject>();
+  boot["replayed"] = journalStats.replayed;
+  boot["partialDose"] = journalStats.partialDose;
+  jsonSetMl(boot["recoveredMl"], journalStats.recoveredUl, format);
+  boot["requeued"] = journalStats.requeued;
+  boot["discarded"] = journalStats.discarded;
+}
+
+// Geração da config na NVS (slots A/B)
+void fillConfigStatus(JsonObject status)
+{
+  ConfigGenerations generations = copyConfigGenerations();
+  status["generation"] = generations.active;
+  status["slot"] = generations.activeSlot == 0 ? "A" : "B";
+  status["previous"] = generations.previous;
+}
+
+void fillTraceStatus(JsonObject status)
+{
+  status["recording"] = inputTraceEnabled();
+  status["full"] = traceStats.full;
+  status["records"] = traceStats.records;
+  status["dropped"] = traceStats.dropped;
+  status["bytes"] = traceStats.bytes;
+}
+
+void fillHubStatus(JsonObject status)
+{
+  status["peers"] = hubPeerCount();
+  status["logSeq"] = logNextSeq - 1;
+  status["stored"] = hubStats.stored;
+  status["merged"] = hubStats.merged;
+  status["duplicates"] = hubStats.duplicates;
+  status["polls"] = hubStats.polls;
+  status["failures"] = hubStats.failures;
+}
+
+void fillJsonArenaStatus(JsonObject arenas)
+{
+  for (JsonArenaPool *pool : JSON_POOLS)
+  {
+    JsonArenaStats stats = pool->stats();
+    JsonObject entry = arenas[pool->name()].to<JsonObject>();
+    entry["count"] = pool->count();
+    entry["size"] = pool->arenaSize();
+    entry["inUse"] = stats.inUse;
+    entry["peakInUse"] = stats.peakInUse;
+    entry["peakBytes"] = stats.peakBytes;
+    entry["leases"] = stats.leases;
+    entry["exhausted"] = stats.exhausted;
+    entry["overflows"] = stats.overflows;
+  }
+}
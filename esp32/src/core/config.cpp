@@ -0,0 +1,507 @@
+#include "dosing.h"
+
+#include <memory>
+#include <string.h>
+#include <new>
+
+// =========================================================
+// Estado
+// =========================================================
+Bomb configBanks[2][BOMBA_COUNT];
+Bomb *bombas = configBanks[0];
+ConfigGenerations configGenerations; // sob pumpQueueLock
+AppliedDose appliedDose;             // sob pumpQueueLock
+DosingPumpBank pumpBank;
+
+bool rtcReady = false;
+bool prefsReady = false;
+
+// =========================================================
+// Helpers
+// =========================================================
+void formatTimestamp(const DateTime &now, char *buffer, size_t size)
+{
+  snprintf(buffer, size, "%02d/%02d/%04d %02d:%02d",
+           now.day(), now.month(), now.year(), now.hour(), now.minute());
+}
+
+// CRC-8 (polinômio 0x07) dos registros gravados direto na flash
+uint8_t crc8(const void *data, size_t length)
+{
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  uint8_t crc = 0;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= bytes[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0x07) : static_cast<uint8_t>(crc << 1);
+  }
+  return crc;
+}
+
+// CRC-32 (IEEE, refletido) dos slots de config na NVS
+uint32_t crc32(const void *data, size_t length)
+{
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  uint32_t crc = 0xFFFFFFFFUL;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= bytes[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320UL : crc >> 1;
+  }
+  return ~crc;
+}
+
+bool parseDateTime(const char *value, DateTime &output)
+{
+  int dia, mes, ano, hora, minuto, segundo;
+
+  int parsed = sscanf(value, "%d/%d/%d %d:%d:%d",
+                      &dia, &mes, &ano, &hora, &minuto, &segundo);
+  if (parsed == 6)
+  {
+    output = DateTime(ano, mes, dia, hora, minuto, segundo);
+    return true;
+  }
+
+  parsed = sscanf(value, "%d/%d/%d %d:%d",
+                  &dia, &mes, &ano, &hora, &minuto);
+  if (parsed == 5)
+  {
+    output = DateTime(ano, mes, dia, hora, minuto, 0);
+    return true;
+  }
+
+  return false;
+}
+
+// =========================================================
+// Config / JSON
+// =========================================================
+void inicializarBombas()
+{
+  if (!pumpBank.begin())
+    hal::logf("[system] ERRO: Driver das bombas nao respondeu.\n");
+
+  hal::logf("[system] %d bombas inicializadas.\n", BOMBA_COUNT);
+}
+
+void resetSchedule(Schedule &schedule)
+{
+  schedule = Schedule();
+}
+
+// =========================================================
+// Commit A/B
+// =========================================================
+// Config nova (POST /config, rollback, boot) é montada e validada no banco
+// fora de uso; só então bombas passa a apontar para ele, dentro de
+// pumpQueueLock. Scheduler e fila nunca veem uma config pela metade, e uma
+// config recusada não toca o banco vivo. Quem monta config é o handler
+// HTTP (um por vez na task do servidor) ou o setup(). O único outro uso do
+// banco fora de uso é a varredura do scheduler que começou antes da troca
+// (acquireScheduleBank): enquanto ela não sai, montar config nele é
+// recusado (CONFIG_APPLY_BUSY) em vez de reescrever o banco sob ela.
+//
+// Na NVS a config fica em dois slots: {cabeçalho, JSON}. Cada commit grava
+// o slot que não está ativo com a geração seguinte; o boot lê a maior
+// geração íntegra (CRC) e, se ela falhar no parse, cai na anterior. Baixa
+// de estoque depois das doses regrava o slot ativo com a mesma geração: o
+// slot anterior guarda o último commit, não a última dose.
+//
+// Só o loop (ou o setup) grava slots: o commit do HTTP conta em commitSeq
+// e serviceConfig() grava a geração nova. O JSON de um slot é conferido
+// contra commitSeq depois de montado, então o slot ativo nunca recebe a
+// config de um commit que ainda não virou geração.
+namespace
+{
+const char *const CONFIG_SLOT_KEYS[2] = {"cfgA", "cfgB"};
+
+// Slot: cabeçalho, JSON e a AppliedDose. Slots gravados antes dela terminam
+// no JSON e são lidos com a dose zerada
+struct ConfigSlotHeader
+{
+  uint32_t magic;
+  uint32_t generation;
+  uint32_t length; // bytes de JSON depois do cabeçalho
+  uint32_t crc;    // CRC-32 do JSON e da AppliedDose
+};
+
+const size_t CONFIG_SLOT_MAX = sizeof(ConfigSlotHeader) + CONFIG_JSON_MAX + sizeof(AppliedDose);
+const uint32_t ALL_CHANNELS = 0xFFFFFFFFUL >> (32 - BOMBA_COUNT);
+
+// Sob pumpQueueLock
+uint32_t commitSeq = 0;      // trocas de banco
+uint32_t persistedSeq = 0;   // troca já gravada como geração
+Bomb *scheduleBank = nullptr; // banco lido pela varredura do scheduler
+
+Bomb *stagingBank()
+{
+  return bombas == configBanks[0] ? configBanks[1] : configBanks[0];
+}
+
+// Banco de trabalho começa como cópia do vivo: bombas fora do documento
+// não mudam. nullptr: a varredura do scheduler ainda lê o banco de trabalho
+Bomb *stageBombas()
+{
+  hal::ScopedCritical lock(pumpQueueLock);
+  Bomb *staged = stagingBank();
+  if (staged == scheduleBank) return nullptr;
+  for (int i = 0; i < BOMBA_COUNT; i++)
+    staged[i] = bombas[i];
+  return staged;
+}
+
+// Bombas fora de channels seguem o banco vivo (estoque e lastRunMinute
+// podem ter mudado durante o parse); keepStock mantém o estoque vivo de
+// todas (rollback). Depois disso, a troca é só o ponteiro.
+void commitBombas(Bomb *staged, uint32_t channels, bool keepStock)
+{
+  hal::ScopedCritical lock(pumpQueueLock);
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    if (!(channels & (1UL << i)))
+      staged[i] = bombas[i];
+    else if (keepStock)
+      staged[i].estoqueUl = bombas[i].estoqueUl;
+  }
+  bombas = staged;
+  commitSeq++;
+}
+
+bool commitPending()
+{
+  hal::ScopedCritical lock(pumpQueueLock);
+  return commitSeq != persistedSeq;
+}
+
+// JSON do slot (sem copiar, dentro de buffer) ou nullptr se vazio ou
+// corrompido; applied recebe a dose gravada junto com o estoque
+const char *readConfigSlot(uint8_t slot, char *buffer, size_t &length, uint32_t &generation,
+                           AppliedDose *applied = nullptr)
+{
+  generation = 0;
+  size_t size = hal::kvGetBytes(CONFIG_SLOT_KEYS[slot], buffer, CONFIG_SLOT_MAX);
+  ConfigSlotHeader header;
+  if (size < sizeof(header)) return nullptr;
+
+  memcpy(&header, buffer, sizeof(header));
+  const char *json = buffer + sizeof(header);
+  size_t tail = header.length <= size - sizeof(header) ? size - sizeof(header) - header.length : 1;
+  if (header.magic != CONFIG_SLOT_MAGIC || header.generation == 0 ||
+      (tail != 0 && tail != sizeof(AppliedDose)) || crc32(json, header.length + tail) != header.crc)
+  {
+    hal::logf("[config] Slot %s corrompido, ignorado.\n", CONFIG_SLOT_KEYS[slot]);
+    return nullptr;
+  }
+
+  length = header.length;
+  generation = header.generation;
+  if (applied)
+  {
+    memset(applied, 0, sizeof(*applied));
+    if (tail != 0) memcpy(applied, json + header.length, sizeof(*applied));
+  }
+  return json;
+}
+
+// seq: commitSeq lido junto com a geração; se um commit entrou enquanto o
+// JSON era montado, o slot não é gravado (fica para a próxima geração)
+bool writeConfigSlot(uint8_t slot, uint32_t generation, uint32_t seq)
+{
+  std::unique_ptr<char[]> buffer(new (std::nothrow) char[CONFIG_SLOT_MAX]);
+  char *json = buffer ? buffer.get() + sizeof(ConfigSlotHeader) : nullptr;
+  size_t length = json ? buildConfigJson(json, CONFIG_JSON_MAX) : 0;
+  if (length == 0)
+  {
+    hal::logf("[config] ERRO: Configuracao nao coube em %u bytes\n", CONFIG_JSON_MAX);
+    return false;
+  }
+  pumpQueueLock.enter();
+  bool stale = commitSeq != seq;
+  // Lida com o estoque que o JSON acabou de copiar (baixa é sob o lock)
+  memcpy(json + length, &appliedDose, sizeof(appliedDose));
+  pumpQueueLock.exit();
+  if (stale) return false;
+
+  ConfigSlotHeader header = {CONFIG_SLOT_MAGIC, generation, static_cast<uint32_t>(length),
+                             crc32(json, length + sizeof(AppliedDose))};
+  memcpy(buffer.get(), &header, sizeof(header));
+  size_t size = sizeof(header) + length + sizeof(AppliedDose);
+  if (hal::kvPutBytes(CONFIG_SLOT_KEYS[slot], buffer.get(), size) != size)
+  {
+    hal::logf("[config] ERRO: Falha ao gravar slot %s\n", CONFIG_SLOT_KEYS[slot]);
+    return false;
+  }
+  return true;
+}
+
+// Commit de config: geração nova no slot inativo; a ativa vira a anterior
+void saveConfigGeneration()
+{
+  FlashOpTimer timer(FLASH_OP_CONFIG_SAVE);
+  if (!prefsReady) return;
+
+  pumpQueueLock.enter();
+  ConfigGenerations current = configGenerations;
+  uint32_t seq = commitSeq;
+  pumpQueueLock.exit();
+
+  uint8_t slot = current.active == 0 ? 0 : 1 - current.activeSlot;
+  uint32_t generation = current.active + 1;
+  if (!writeConfigSlot(slot, generation, seq)) return;
+
+  pumpQueueLock.enter();
+  configGenerations.previous = current.active;
+  configGenerations.active = generation;
+  configGenerations.activeSlot = slot;
+  persistedSeq = seq;
+  pumpQueueLock.exit();
+  hal::logf("[config] Geracao %lu gravada no slot %s.\n", static_cast<unsigned long>(generation),
+            CONFIG_SLOT_KEYS[slot]);
+}
+
+// Config gravada antes dos slots A/B (chave única, sem geração)
+size_t readLegacyConfig(char *buffer)
+{
+  if (CONFIG_KV_BLOB) return hal::kvGetBytes("bombasBlob", buffer, CONFIG_JSON_MAX);
+  return hal::kvGetString("bombas", buffer, CONFIG_JSON_MAX);
+}
+} // namespace
+
+// Baixa de estoque e migrações: regrava o slot ativo, mesma geração. Com
+// um commit ainda não gravado, o banco vivo já é a geração nova
+void saveBombasConfig()
+{
+  pumpQueueLock.enter();
+  ConfigGenerations current = configGenerations;
+  uint32_t seq = commitSeq;
+  bool pending = commitSeq != persistedSeq;
+  pumpQueueLock.exit();
+
+  if (current.active == 0 || pending)
+  {
+    saveConfigGeneration();
+    return;
+  }
+
+  FlashOpTimer timer(FLASH_OP_CONFIG_SAVE);
+  if (!prefsReady) return;
+  hal::logf("[config] Salvando configuracoes na memoria (Preferences)...\n");
+  writeConfigSlot(current.activeSlot, current.active, seq);
+}
+
+// Loop: commit feito pelo HTTP vira geração nova na NVS
+void serviceConfig()
+{
+  if (prefsReady && commitPending()) saveConfigGeneration();
+}
+
+ConfigGenerations copyConfigGenerations()
+{
+  hal::ScopedCritical lock(pumpQueueLock);
+  return configGenerations;
+}
+
+// Varredura do scheduler: banco vivo de agora até releaseScheduleBank(),
+// mesmo que um commit troque bombas no meio
+Bomb *acquireScheduleBank()
+{
+  hal::ScopedCritical lock(pumpQueueLock);
+  scheduleBank = bombas;
+  return scheduleBank;
+}
+
+void releaseScheduleBank()
+{
+  hal::ScopedCritical lock(pumpQueueLock);
+  scheduleBank = nullptr;
+}
+
+void initDefaultBombasConfig()
+{
+  hal::logf("[config] Inicializando configuracao padrao de bombas...\n");
+  Bomb *staged = stageBombas();
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    staged[i] = Bomb();
+    staged[i].name.printf("Bomba %d", i + 1);
+    staged[i].estoqueUl = 1000 * UL_PER_ML;
+  }
+  commitBombas(staged, ALL_CHANNELS, false);
+  saveConfigGeneration();
+  hal::logf("[config] Configuracao padrao salva e aplicada.\n");
+}
+
+void loadBombasConfig()
+{
+  FlashOpTimer timer(FLASH_OP_CONFIG_LOAD);
+  hal::logf("[config] Lendo configuracoes salvas...\n");
+  pumpQueueLock.enter();
+  configGenerations = ConfigGenerations();
+  pumpQueueLock.exit();
+
+  std::unique_ptr<char[]> buffer(new (std::nothrow) char[CONFIG_SLOT_MAX]);
+  if (!buffer)
+  {
+    hal::logf("[config] ERRO critico ao ler JSON salvo.\n");
+    initDefaultBombasConfig();
+    return;
+  }
+
+  // Maior geração primeiro; a outra é a anterior (ou o fallback)
+  uint32_t generations[2];
+  size_t length = 0;
+  for (uint8_t slot = 0; slot < 2; slot++)
+    readConfigSlot(slot, buffer.get(), length, generations[slot]);
+  uint8_t newest = generations[1] > generations[0] ? 1 : 0;
+
+  bool loaded = false;
+  for (uint8_t attempt = 0; attempt < 2 && !loaded; attempt++)
+  {
+    uint8_t slot = attempt == 0 ? newest : 1 - newest;
+    if (generations[slot] == 0) continue;
+    uint32_t generation;
+    AppliedDose applied;
+    const char *json = readConfigSlot(slot, buffer.get(), length, generation, &applied);
+    if (json == nullptr) continue;
+
+    // Gravada por outra versão: valor fora da faixa de hoje é saturado
+    uint32_t channels;
+    Bomb *staged = stageBombas();
+    if (staged == nullptr || !parseConfigJson(json, length, staged, channels, true))
+    {
+      hal::logf("[config] Geracao %lu recusada, tentando a anterior.\n", static_cast<unsigned long>(generation));
+      continue;
+    }
+    commitBombas(staged, channels, false);
+
+    // O banco carregado é a própria geração: nada a gravar
+    pumpQueueLock.enter();
+    appliedDose = applied;
+    configGenerations.active = generation;
+    configGenerations.activeSlot = slot;
+    configGenerations.previous = attempt == 0 && generations[1 - slot] < generation ? generations[1 - slot] : 0;
+    persistedSeq = commitSeq;
+    pumpQueueLock.exit();
+    loaded = true;
+  }
+
+  if (!loaded)
+  {
+    length = readLegacyConfig(buffer.get());
+    if (length == 0)
+    {
+      hal::logf("[config] Nenhuma config encontrada. Usando padrao.\n");
+      initDefaultBombasConfig();
+      return;
+    }
+
+    uint32_t channels;
+    Bomb *staged = stageBombas();
+    if (staged == nullptr || !parseConfigJson(buffer.get(), length, staged, channels, true))
+    {
+      hal::logf("[config] ERRO critico ao ler JSON salvo.\n");
+      initDefaultBombasConfig();
+      return;
+    }
+    commitBombas(staged, channels, false);
+    hal::logf("[config] Config antiga migrada para os slots A/B.\n");
+  }
+
+  // Migração NVS: preencher bombas que não existiam na config salva (ex: upgrade de 3→4)
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    if (bombas[i].name.isEmpty())
+    {
+      hal::logf("[config] Slot %d vazio, preenchendo com valores padrao (upgrade).\n", i + 1);
+      bombas[i].name.printf("Bomba %d", i + 1);
+      bombas[i].calibrPpm = CALIBR_PPM_ONE;
+      bombas[i].estoqueUl = 1000 * UL_PER_ML;
+      for (int j = 0; j < SCHEDULE_COUNT; j++)
+        resetSchedule(bombas[i].schedules[j]);
+    }
+  }
+
+  saveBombasConfig();
+  hal::logf("[config] Configuracoes carregadas com sucesso (geracao %lu).\n",
+            static_cast<unsigned long>(copyConfigGenerations().active));
+}
+
+namespace
+{
+// POST /config: parse direto do body (JSON ou MessagePack), sem
+// JsonDocument. A geração nova é gravada pelo loop (serviceConfig)
+ConfigApply applyConfigBody(const char *body, size_t length, WireFormat format)
+{
+  hal::logf("[config] Aplicando nova configuracao recebida...\n");
+
+  uint32_t channels;
+  Bomb *staged = stageBombas();
+  if (staged == nullptr)
+  {
+    hal::logf("[config] Banco de trabalho em uso pelo scheduler, nada foi alterado.\n");
+    return CONFIG_APPLY_BUSY;
+  }
+  bool parsed = format == WIRE_MSGPACK ? parseConfigMsgPack(body, length, staged, channels)
+                                       : parseConfigJson(body, length, staged, channels, false);
+  if (!parsed)
+  {
+    hal::logf("[config] Configuracao recusada, nada foi alterado.\n");
+    return CONFIG_APPLY_INVALID;
+  }
+
+  commitBombas(staged, channels, false);
+  return CONFIG_APPLY_OK;
+}
+} // namespace
+
+ConfigApply applyConfigJson(const char *json, size_t length)
+{
+  return applyConfigBody(json, length, WIRE_JSON);
+}
+
+ConfigApply applyConfigMsgPack(const char *data, size_t length)
+{
+  return applyConfigBody(data, length, WIRE_MSGPACK);
+}
+
+// Volta para a geração anterior gravando-a (pelo loop) como uma geração
+// nova: a que estava ativa vira a anterior, então um segundo rollback
+// desfaz o primeiro. O estoque não volta (segue o vivo). Com um commit
+// ainda não gravado, a config de antes dele é a do slot ativo.
+ConfigRollback rollbackConfig()
+{
+  pumpQueueLock.enter();
+  ConfigGenerations current = configGenerations;
+  bool pending = commitSeq != persistedSeq;
+  pumpQueueLock.exit();
+
+  uint8_t slot = pending ? current.activeSlot : 1 - current.activeSlot;
+  uint32_t target = pending ? current.active : current.previous;
+  if (target == 0) return CONFIG_ROLLBACK_NONE;
+
+  std::unique_ptr<char[]> buffer(new (std::nothrow) char[CONFIG_SLOT_MAX]);
+  if (!buffer) return CONFIG_ROLLBACK_INVALID;
+
+  size_t length;
+  uint32_t generation;
+  const char *json = readConfigSlot(slot, buffer.get(), length, generation);
+  if (json == nullptr || generation != target)
+  {
+    pumpQueueLock.enter();
+    if (!pending && configGenerations.previous == target) configGenerations.previous = 0;
+    pumpQueueLock.exit();
+    return CONFIG_ROLLBACK_NONE;
+  }
+
+  uint32_t channels;
+  Bomb *staged = stageBombas();
+  if (staged == nullptr) return CONFIG_ROLLBACK_BUSY;
+  if (!parseConfigJson(json, length, staged, channels, true)) return CONFIG_ROLLBACK_INVALID;
+
+  commitBombas(staged, channels, true);
+  hal::logf("[config] Rollback para a geracao %lu.\n", static_cast<unsigned long>(generation));
+  return CONFIG_ROLLBACK_OK;
+}
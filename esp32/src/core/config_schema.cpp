@@ -0,0 +1,1411 @@
+#include "dosing.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// =========================================================
+// Esquema da configuração
+// =========================================================
+// Os campos de Bomb e Schedule no JSON ("bomb1": {...}) ficam descritos
+// uma única vez, em tabelas constexpr: chave, tipo, posição no struct,
+// casas decimais, faixa válida e padrão. Delas saem todos os caminhos da
+// configuração:
+//   - ConfigWriter: escreve JSON ou MessagePack direto no buffer, sem
+//     JsonDocument
+//   - ConfigReader: parser de uma passada sobre o texto, sem documento;
+//     confere tipo e faixa de cada campo e pula chaves desconhecidas
+//   - ConfigPackReader: o mesmo sobre o body em MessagePack
+// Campo ausente ou null fica com o padrão, como no parse antigo; tipo
+// errado ou valor fora da faixa recusa a configuração inteira.
+namespace
+{
+enum FieldType : uint8_t
+{
+  FIELD_TEXT,    // InlineString<BOMBA_NAME_SIZE>; padrão "Bomba N"
+  FIELD_INT,     // int
+  FIELD_FIXED,   // int32_t em ponto fixo, `decimals` casas no JSON
+  FIELD_BOOL,    // bool
+  FIELD_FLAGS,   // bool[count] <-> array de booleanos
+  FIELD_OBJECT,  // objeto aninhado cujos campos estão no mesmo struct
+  FIELD_LIST,    // count structs de `stride` bytes <-> array de objetos
+  FIELD_ORDINAL  // só na saída: posição na lista + 1 ("id")
+};
+
+struct FieldSchema;
+
+struct Field
+{
+  const char *key;
+  uint8_t keyLength;
+  FieldType type;
+  uint16_t offset;
+  uint16_t size; // sizeof do membro, conferido contra o tipo em compilação
+  uint8_t decimals;
+  uint8_t count;
+  int32_t min;
+  int32_t max;
+  int32_t fallback;
+  const FieldSchema *nested;
+};
+
+struct FieldSchema
+{
+  const Field *fields;
+  uint8_t count;
+  uint16_t stride;
+};
+
+constexpr uint8_t keyLength(const char *key)
+{
+  return *key == '\0' ? 0 : 1 + keyLength(key + 1);
+}
+
+#define FIELD_KEY(key) key, keyLength(key)
+#define FIELD_AT(Struct, member) offsetof(Struct, member), sizeof(static_cast<Struct *>(nullptr)->member)
+
+// Limites aceitos do app (ponto fixo): ml com 3 casas, coeficiente com 6
+constexpr Field TIME_FIELDS[] = {
+    {FIELD_KEY("hour"), FIELD_INT, FIELD_AT(Schedule, hour), 0, 0, 0, 23, 0, nullptr},
+    {FIELD_KEY("minute"), FIELD_INT, FIELD_AT(Schedule, minute), 0, 0, 0, 59, 0, nullptr},
+};
+constexpr FieldSchema TIME_SCHEMA = {TIME_FIELDS, 2, sizeof(Schedule)};
+
+constexpr Field SCHEDULE_FIELDS[] = {
+    {FIELD_KEY("id"), FIELD_ORDINAL, 0, 0, 0, 0, 0, 0, 0, nullptr},
+    {FIELD_KEY("time"), FIELD_OBJECT, 0, 0, 0, 0, 0, 0, 0, &TIME_SCHEMA},
+    {FIELD_KEY("dosagem"), FIELD_FIXED, FIELD_AT(Schedule, dosagemUl), 3, 0, 0, 2000 * UL_PER_ML, 0, nullptr},
+    {FIELD_KEY("status"), FIELD_BOOL, FIELD_AT(Schedule, status), 0, 0, 0, 1, 0, nullptr},
+    {FIELD_KEY("diasSemanaSelecionados"), FIELD_FLAGS, FIELD_AT(Schedule, diasSemana), 0, 7, 0, 1, 0, nullptr},
+};
+constexpr FieldSchema SCHEDULE_SCHEMA = {SCHEDULE_FIELDS, 5, sizeof(Schedule)};
+
+constexpr Field BOMB_FIELDS[] = {
+    {FIELD_KEY("name"), FIELD_TEXT, FIELD_AT(Bomb, name), 0, 0, 0, 0, 0, nullptr},
+    {FIELD_KEY("calibrCoef"), FIELD_FIXED, FIELD_AT(Bomb, calibrPpm), 6, 0, CALIBR_PPM_ONE / 1000,
+     100 * CALIBR_PPM_ONE, CALIBR_PPM_ONE, nullptr},
+    {FIELD_KEY("quantidadeEstoque"), FIELD_FIXED, FIELD_AT(Bomb, estoqueUl), 3, 0, 0, 2000000 * UL_PER_ML, 0,
+     nullptr},
+    {FIELD_KEY("schedules"), FIELD_LIST, FIELD_AT(Bomb, schedules), 0, SCHEDULE_COUNT, 0, 0, 0, &SCHEDULE_SCHEMA},
+};
+constexpr FieldSchema BOMB_SCHEMA = {BOMB_FIELDS, 4, sizeof(Bomb)};
+
+#undef FIELD_AT
+#undef FIELD_KEY
+
+// --- Conferência da tabela em compilação ---
+constexpr bool fieldMatches(const Field &field)
+{
+  return field.type == FIELD_TEXT    ? field.size == sizeof(InlineString<BOMBA_NAME_SIZE>)
+         : field.type == FIELD_INT   ? field.size == sizeof(int)
+         : field.type == FIELD_FIXED ? field.size == sizeof(int32_t)
+         : field.type == FIELD_BOOL  ? field.size == sizeof(bool)
+         : field.type == FIELD_FLAGS ? field.size == sizeof(bool) * field.count
+         : field.type == FIELD_LIST  ? field.size == field.nested->stride * field.count
+                                     : true;
+}
+
+constexpr bool schemaMatches(const Field *fields, size_t count)
+{
+  return count == 0 || (fieldMatches(*fields) && fields->min <= fields->fallback &&
+                        ((fields->type != FIELD_INT && fields->type != FIELD_FIXED) || fields->fallback <= fields->max) &&
+                        schemaMatches(fields + 1, count - 1));
+}
+
+static_assert(schemaMatches(TIME_FIELDS, TIME_SCHEMA.count), "TIME_FIELDS nao bate com Schedule");
+static_assert(schemaMatches(SCHEDULE_FIELDS, SCHEDULE_SCHEMA.count), "SCHEDULE_FIELDS nao bate com Schedule");
+static_assert(schemaMatches(BOMB_FIELDS, BOMB_SCHEMA.count), "BOMB_FIELDS nao bate com Bomb");
+static_assert(sizeof(TIME_FIELDS) / sizeof(Field) == TIME_SCHEMA.count, "contagem de TIME_FIELDS");
+static_assert(sizeof(SCHEDULE_FIELDS) / sizeof(Field) == SCHEDULE_SCHEMA.count, "contagem de SCHEDULE_FIELDS");
+static_assert(sizeof(BOMB_FIELDS) / sizeof(Field) == BOMB_SCHEMA.count, "contagem de BOMB_FIELDS");
+
+// --- Acesso aos membros pelo descritor ---
+typedef InlineString<BOMBA_NAME_SIZE> NameText;
+
+template <typename T>
+T &member(uint8_t *base, const Field &field)
+{
+  return *reinterpret_cast<T *>(base + field.offset);
+}
+
+template <typename T>
+const T &member(const uint8_t *base, const Field &field)
+{
+  return *reinterpret_cast<const T *>(base + field.offset);
+}
+
+void applyDefaults(const FieldSchema &schema, uint8_t *base, int channel);
+
+void applyDefault(const Field &field, uint8_t *base, int channel)
+{
+  switch (field.type)
+  {
+  case FIELD_TEXT:
+    member<NameText>(base, field).printf("Bomba %d", channel + 1);
+    break;
+  case FIELD_INT:
+    member<int>(base, field) = field.fallback;
+    break;
+  case FIELD_FIXED:
+    member<int32_t>(base, field) = field.fallback;
+    break;
+  case FIELD_BOOL:
+    member<bool>(base, field) = field.fallback != 0;
+    break;
+  case FIELD_FLAGS:
+    for (uint8_t i = 0; i < field.count; i++)
+      (&member<bool>(base, field))[i] = field.fallback != 0;
+    break;
+  case FIELD_OBJECT:
+    applyDefaults(*field.nested, base + field.offset, channel);
+    break;
+  case FIELD_LIST:
+    for (uint8_t i = 0; i < field.count; i++)
+      applyDefaults(*field.nested, base + field.offset + i * field.nested->stride, channel);
+    break;
+  case FIELD_ORDINAL:
+    break;
+  }
+}
+
+void applyDefaults(const FieldSchema &schema, uint8_t *base, int channel)
+{
+  for (uint8_t i = 0; i < schema.count; i++)
+    applyDefault(schema.fields[i], base, channel);
+}
+
+const Field *findField(const FieldSchema &schema, const char *key, size_t length)
+{
+  for (uint8_t i = 0; i < schema.count; i++)
+  {
+    const Field &field = schema.fields[i];
+    if (field.keyLength == length && memcmp(field.key, key, length) == 0) return &field;
+  }
+  return nullptr;
+}
+
+int channelOf(const char *key, size_t length)
+{
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    const char *channelKey = DosingPumpBank::key(i);
+    if (strlen(channelKey) == length && memcmp(channelKey, key, length) == 0) return i;
+  }
+  return -1;
+}
+
+int32_t powerOfTen(uint8_t exponent)
+{
+  int32_t result = 1;
+  while (exponent-- > 0)
+    result *= 10;
+  return result;
+}
+
+// Fora da faixa: recusa, ou (config já salva por outra versão) satura
+bool fitRange(const Field &field, int32_t &value, bool clamp)
+{
+  if (value >= field.min && value <= field.max) return true;
+  if (!clamp) return false;
+  value = value < field.min ? field.min : field.max;
+  return true;
+}
+
+// Parse e validação terminam em bombas[] só no fim (dosagem e scheduler
+// nunca veem uma bomba pela metade); lastRunMinute não está no esquema
+void finishChannel(Bomb &bomba)
+{
+  for (int j = 0; j < SCHEDULE_COUNT; j++)
+    bomba.schedules[j].lastRunMinute = -1;
+}
+
+// =========================================================
+// Escrita: JSON ou MessagePack direto no buffer
+// =========================================================
+// JSON: mesma saída do serializeJson, sem espaços, texto escapado como no
+// ArduinoJson e números pelo FixedText. MessagePack: contagem no cabeçalho
+// de cada mapa/array (vem do esquema), inteiros no menor tipo e ponto fixo
+// como inteiro quando exato ou float64, como o jsonSetFixed().
+class ConfigWriter
+{
+public:
+  ConfigWriter(char *buffer, size_t size, WireFormat format)
+      : buffer_(buffer), size_(size), length_(0), format_(format)
+  {
+  }
+
+  void put(char c)
+  {
+    if (length_ + 1 < size_) buffer_[length_] = c;
+    length_++;
+  }
+
+  void put(const char *text, size_t length)
+  {
+    if (length_ + length < size_) memcpy(buffer_ + length_, text, length);
+    length_ += length;
+  }
+
+  void beginObject(size_t count)
+  {
+    if (format_ == WIRE_MSGPACK)
+      header(0x80, 0xDE, count);
+    else
+      put('{');
+  }
+
+  void endObject()
+  {
+    if (format_ == WIRE_JSON) put('}');
+  }
+
+  void beginArray(size_t count)
+  {
+    if (format_ == WIRE_MSGPACK)
+      header(0x90, 0xDC, count);
+    else
+      put('[');
+  }
+
+  void endArray()
+  {
+    if (format_ == WIRE_JSON) put(']');
+  }
+
+  // Antes de cada item depois do primeiro
+  void separator(size_t index)
+  {
+    if (format_ == WIRE_JSON && index > 0) put(',');
+  }
+
+  void key(const char *key, size_t length)
+  {
+    if (format_ == WIRE_MSGPACK)
+    {
+      stringHeader(length);
+      put(key, length);
+      return;
+    }
+    put('"');
+    put(key, length);
+    put("\":", 2);
+  }
+
+  void text(const char *value)
+  {
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    if (format_ == WIRE_MSGPACK)
+    {
+      size_t length = strlen(value);
+      stringHeader(length);
+      put(value, length);
+      return;
+    }
+    put('"');
+    for (const char *c = value; *c; c++)
+    {
+      uint8_t byte = static_cast<uint8_t>(*c);
+      const char *escape = nullptr;
+      switch (*c)
+      {
+      case '"': escape = "\\\""; break;
+      case '\\': escape = "\\\\"; break;
+      case '\b': escape = "\\b"; break;
+      case '\f': escape = "\\f"; break;
+      case '\n': escape = "\\n"; break;
+      case '\r': escape = "\\r"; break;
+      case '\t': escape = "\\t"; break;
+      }
+      if (escape != nullptr)
+      {
+        put(escape, 2);
+      }
+      else if (byte < 0x20)
+      {
+        char unicode[6] = {'\\', 'u', '0', '0', HEX_DIGITS[byte >> 4], HEX_DIGITS[byte & 0xF]};
+        put(unicode, sizeof(unicode));
+      }
+      else
+      {
+        put(*c);
+      }
+    }
+    put('"');
+  }
+
+  void number(int32_t value, uint8_t decimals)
+  {
+    if (format_ == WIRE_MSGPACK)
+    {
+      int32_t scale = powerOfTen(decimals);
+      if (value % scale == 0)
+        integer(value / scale);
+      else
+        float64(static_cast<double>(value) / scale);
+      return;
+    }
+    FixedText text(value, decimals);
+    put(text.c_str(), text.length());
+  }
+
+  void boolean(bool value)
+  {
+    if (format_ == WIRE_MSGPACK)
+      put(value ? '\xC3' : '\xC2');
+    else if (value)
+      put("true", 4);
+    else
+      put("false", 5);
+  }
+
+  void fields(const FieldSchema &schema, const uint8_t *base, int ordinal)
+  {
+    beginObject(schema.count);
+    for (uint8_t i = 0; i < schema.count; i++)
+    {
+      const Field &field = schema.fields[i];
+      separator(i);
+      key(field.key, field.keyLength);
+      value(field, base, ordinal);
+    }
+    endObject();
+  }
+
+  // Tamanho sem o '\0', ou 0 se não coube
+  size_t finish()
+  {
+    if (length_ + 1 > size_) return 0;
+    buffer_[length_] = '\0';
+    return length_;
+  }
+
+private:
+  void bigEndian(uint64_t value, uint8_t bytes)
+  {
+    while (bytes-- > 0)
+      put(static_cast<char>(value >> (bytes * 8)));
+  }
+
+  // fixmap/fixarray até 15 itens, map16/array16 acima
+  void header(uint8_t fixType, uint8_t type16, size_t count)
+  {
+    if (count < 16)
+    {
+      put(static_cast<char>(fixType | count));
+      return;
+    }
+    put(static_cast<char>(type16));
+    bigEndian(count, 2);
+  }
+
+  void stringHeader(size_t length)
+  {
+    if (length < 32)
+    {
+      put(static_cast<char>(0xA0 | length));
+    }
+    else if (length < 256)
+    {
+      put('\xD9');
+      bigEndian(length, 1);
+    }
+    else
+    {
+      put('\xDA');
+      bigEndian(length, 2);
+    }
+  }
+
+  // Menor codificação que cabe, como o serializeMsgPack: fixint, ou
+  // uint/int de 1, 2 ou 4 bytes
+  void integer(int32_t value)
+  {
+    uint64_t bits = static_cast<uint32_t>(value);
+    if (value >= -32 && value < 0x80)
+    {
+      put(static_cast<char>(bits));
+      return;
+    }
+    uint8_t order;
+    if (value >= 0)
+      order = value <= 0xFF ? 0 : value <= 0xFFFF ? 1 : 2;
+    else
+      order = value >= -128 ? 0 : value >= -32768 ? 1 : 2;
+    put(static_cast<char>((value >= 0 ? 0xCC : 0xD0) + order));
+    bigEndian(bits, static_cast<uint8_t>(1 << order));
+  }
+
+  void float64(double value)
+  {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put('\xCB');
+    bigEndian(bits, 8);
+  }
+
+  void value(const Field &field, const uint8_t *base, int ordinal)
+  {
+    switch (field.type)
+    {
+    case FIELD_TEXT:
+      text(member<NameText>(base, field).c_str());
+      break;
+    case FIELD_INT:
+      number(member<int>(base, field), 0);
+      break;
+    case FIELD_FIXED:
+      number(member<int32_t>(base, field), field.decimals);
+      break;
+    case FIELD_BOOL:
+      boolean(member<bool>(base, field));
+      break;
+    case FIELD_FLAGS:
+      beginArray(field.count);
+      for (uint8_t i = 0; i < field.count; i++)
+      {
+        separator(i);
+        boolean((&member<bool>(base, field))[i]);
+      }
+      endArray();
+      break;
+    case FIELD_OBJECT:
+      fields(*field.nested, base + field.offset, ordinal);
+      break;
+    case FIELD_LIST:
+      beginArray(field.count);
+      for (uint8_t i = 0; i < field.count; i++)
+      {
+        separator(i);
+        fields(*field.nested, base + field.offset + i * field.nested->stride, i);
+      }
+      endArray();
+      break;
+    case FIELD_ORDINAL:
+      number(ordinal + 1, 0);
+      break;
+    }
+  }
+
+  char *buffer_;
+  size_t size_;
+  size_t length_;
+  WireFormat format_;
+};
+
+// =========================================================
+// Leitura: parser de uma passada
+// =========================================================
+// Desce pelo texto guiado pelas tabelas e grava cada valor direto no
+// Bomb de destino; chaves fora do esquema são puladas sem alocar nada.
+// Números viram ponto fixo a partir dos dígitos (sem float), com
+// arredondamento para o mais próximo como fixed::scaleRound.
+class ConfigReader
+{
+public:
+  ConfigReader(const char *json, size_t length, bool clamp)
+      : begin_(json), cursor_(json), end_(json + length), error_(nullptr), errorAt_(json), clamp_(clamp)
+  {
+  }
+
+  bool root(Bomb *staged, uint32_t &channels)
+  {
+    channels = 0;
+    skipSpace();
+    if (!consume('{')) return fail("objeto esperado");
+    if (!consume('}'))
+    {
+      do
+      {
+        const char *key;
+        size_t length;
+        if (!readKey(key, length)) return false;
+
+        int channel = channelOf(key, length);
+        if (channel < 0)
+        {
+          if (!skipValue(0)) return false;
+        }
+        else if (!readNull())
+        {
+          // Bomba presente: o que não vier fica com o padrão
+          uint8_t *base = reinterpret_cast<uint8_t *>(&staged[channel]);
+          applyDefaults(BOMB_SCHEMA, base, channel);
+          if (!object(BOMB_SCHEMA, base, channel)) return false;
+          finishChannel(staged[channel]);
+          channels |= 1UL << channel;
+        }
+      } while (consume(','));
+      if (!consume('}')) return fail("',' ou '}' esperado");
+    }
+
+    skipSpace();
+    if (cursor_ < end_ && *cursor_ != '\0') return fail("conteudo depois do objeto");
+    return true;
+  }
+
+  const char *error() const { return error_; }
+  size_t errorOffset() const { return static_cast<size_t>(errorAt_ - begin_); }
+
+private:
+  static const uint8_t MAX_DEPTH = 10; // mesmo limite de aninhamento do ArduinoJson
+
+  bool fail(const char *reason)
+  {
+    if (error_ == nullptr)
+    {
+      error_ = reason;
+      errorAt_ = cursor_;
+    }
+    return false;
+  }
+
+  void skipSpace()
+  {
+    while (cursor_ < end_ && (*cursor_ == ' ' || *cursor_ == '\n' || *cursor_ == '\r' || *cursor_ == '\t'))
+      cursor_++;
+  }
+
+  bool consume(char c)
+  {
+    skipSpace();
+    if (cursor_ >= end_ || *cursor_ != c) return false;
+    cursor_++;
+    return true;
+  }
+
+  bool literal(const char *word, size_t length)
+  {
+    skipSpace();
+    if (static_cast<size_t>(end_ - cursor_) < length || memcmp(cursor_, word, length) != 0) return false;
+    cursor_ += length;
+    return true;
+  }
+
+  bool readNull() { return literal("null", 4); }
+
+  bool readBool(bool &value)
+  {
+    if (literal("true", 4))
+      value = true;
+    else if (literal("false", 5))
+      value = false;
+    else
+      return fail("booleano esperado");
+    return true;
+  }
+
+  // Chave crua (sem decodificar escapes: as do esquema são ASCII simples)
+  bool readKey(const char *&key, size_t &length)
+  {
+    if (!consume('"')) return fail("chave esperada");
+    key = cursor_;
+    while (cursor_ < end_ && *cursor_ != '"')
+    {
+      if (*cursor_ == '\\') cursor_++;
+      cursor_++;
+    }
+    if (cursor_ >= end_) return fail("texto sem fim");
+    length = static_cast<size_t>(cursor_ - key);
+    cursor_++;
+    if (!consume(':')) return fail("':' esperado");
+    return true;
+  }
+
+  static int hexValue(char c)
+  {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  bool readHex4(uint32_t &code)
+  {
+    if (end_ - cursor_ < 4) return fail("escape invalido");
+    code = 0;
+    for (int i = 0; i < 4; i++)
+    {
+      int digit = hexValue(*cursor_++);
+      if (digit < 0) return fail("escape invalido");
+      code = (code << 4) | static_cast<uint32_t>(digit);
+    }
+    return true;
+  }
+
+  // Texto decodificado em out (truncado em capacity - 1 bytes, como o
+  // InlineString); out == nullptr só valida
+  bool readText(char *out, size_t capacity)
+  {
+    if (!consume('"')) return fail("texto esperado");
+    size_t length = 0;
+    char utf8[4];
+
+    while (cursor_ < end_ && *cursor_ != '"')
+    {
+      size_t count = 1;
+      char c = *cursor_++;
+      utf8[0] = c;
+      if (static_cast<uint8_t>(c) < 0x20) return fail("caractere de controle no texto");
+      if (c == '\\')
+      {
+        if (cursor_ >= end_) return fail("texto sem fim");
+        char escape = *cursor_++;
+        switch (escape)
+        {
+        case '"': utf8[0] = '"'; break;
+        case '\\': utf8[0] = '\\'; break;
+        case '/': utf8[0] = '/'; break;
+        case 'b': utf8[0] = '\b'; break;
+        case 'f': utf8[0] = '\f'; break;
+        case 'n': utf8[0] = '\n'; break;
+        case 'r': utf8[0] = '\r'; break;
+        case 't': utf8[0] = '\t'; break;
+        case 'u':
+        {
+          uint32_t code;
+          if (!readHex4(code)) return false;
+          // Par de surrogates vira um só código; surrogate solto vira '?'
+          if (code >= 0xD800 && code <= 0xDBFF && end_ - cursor_ >= 6 && cursor_[0] == '\\' && cursor_[1] == 'u')
+          {
+            cursor_ += 2;
+            uint32_t low;
+            if (!readHex4(low)) return false;
+            code = (low >= 0xDC00 && low <= 0xDFFF) ? 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00) : '?';
+          }
+          else if (code >= 0xD800 && code <= 0xDFFF)
+          {
+            code = '?';
+          }
+          count = encodeUtf8(code, utf8);
+          break;
+        }
+        default:
+          return fail("escape invalido");
+        }
+      }
+
+      if (out != nullptr && length + count < capacity)
+      {
+        memcpy(out + length, utf8, count);
+        length += count;
+      }
+      else if (out != nullptr)
+      {
+        capacity = length + 1; // cheio: os bytes seguintes só são validados
+      }
+    }
+    if (cursor_ >= end_) return fail("texto sem fim");
+    cursor_++;
+    if (out != nullptr) out[length] = '\0';
+    return true;
+  }
+
+  static size_t encodeUtf8(uint32_t code, char *out)
+  {
+    if (code < 0x80)
+    {
+      out[0] = static_cast<char>(code);
+      return 1;
+    }
+    if (code < 0x800)
+    {
+      out[0] = static_cast<char>(0xC0 | (code >> 6));
+      out[1] = static_cast<char>(0x80 | (code & 0x3F));
+      return 2;
+    }
+    if (code < 0x10000)
+    {
+      out[0] = static_cast<char>(0xE0 | (code >> 12));
+      out[1] = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      out[2] = static_cast<char>(0x80 | (code & 0x3F));
+      return 3;
+    }
+    out[0] = static_cast<char>(0xF0 | (code >> 18));
+    out[1] = static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+    out[2] = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    out[3] = static_cast<char>(0x80 | (code & 0x3F));
+    return 4;
+  }
+
+  static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+  // Número JSON -> inteiro com `decimals` casas; fora de int32 é recusado
+  bool readNumber(int32_t &value, uint8_t decimals)
+  {
+    skipSpace();
+    const char *start = cursor_;
+    bool negative = cursor_ < end_ && *cursor_ == '-';
+    if (negative) cursor_++;
+    if (cursor_ >= end_ || !isDigit(*cursor_)) return fail("numero esperado");
+
+    const int64_t LIMIT = 100000000000LL; // bem acima de int32 com qualquer escala
+    int64_t scaled = 0;
+    while (cursor_ < end_ && isDigit(*cursor_))
+    {
+      if (scaled < LIMIT) scaled = scaled * 10 + (*cursor_ - '0');
+      cursor_++;
+    }
+
+    uint8_t kept = 0;
+    bool roundUp = false;
+    if (cursor_ < end_ && *cursor_ == '.')
+    {
+      cursor_++;
+      if (cursor_ >= end_ || !isDigit(*cursor_)) return fail("numero invalido");
+      while (cursor_ < end_ && isDigit(*cursor_))
+      {
+        int digit = *cursor_ - '0';
+        if (kept < decimals)
+        {
+          if (scaled < LIMIT) scaled = scaled * 10 + digit;
+          kept++;
+        }
+        else if (kept == decimals)
+        {
+          roundUp = digit >= 5;
+          kept++;
+        }
+        cursor_++;
+      }
+    }
+
+    if (cursor_ < end_ && (*cursor_ == 'e' || *cursor_ == 'E'))
+    {
+      // Expoente (raro vindo do app): conta em double a partir do texto
+      cursor_++;
+      if (cursor_ < end_ && (*cursor_ == '+' || *cursor_ == '-')) cursor_++;
+      if (!skipDigits()) return fail("numero invalido");
+
+      char text[32];
+      size_t length = static_cast<size_t>(cursor_ - start);
+      if (length >= sizeof(text)) return fail("numero fora da faixa");
+      memcpy(text, start, length);
+      text[length] = '\0';
+      double parsed = strtod(text, nullptr);
+      double limit = 2147483647.0;
+      for (uint8_t i = 0; i < decimals; i++)
+        limit /= 10;
+      if (parsed > limit || parsed < -limit) return fail("numero fora da faixa");
+      value = fixed::scaleRound(parsed, powerOfTen(decimals));
+      return true;
+    }
+
+    for (; kept < decimals; kept++)
+    {
+      if (scaled < LIMIT) scaled *= 10;
+    }
+    if (roundUp) scaled++;
+    if (scaled > INT32_MAX) return fail("numero fora da faixa");
+    value = static_cast<int32_t>(negative ? -scaled : scaled);
+    return true;
+  }
+
+  bool skipValue(uint8_t depth)
+  {
+    if (depth >= MAX_DEPTH) return fail("aninhamento demais");
+    skipSpace();
+    if (cursor_ >= end_) return fail("valor esperado");
+
+    switch (*cursor_)
+    {
+    case '"':
+      return readText(nullptr, 0);
+    case '{':
+      cursor_++;
+      if (consume('}')) return true;
+      do
+      {
+        const char *key;
+        size_t length;
+        if (!readKey(key, length) || !skipValue(depth + 1)) return false;
+      } while (consume(','));
+      return consume('}') || fail("',' ou '}' esperado");
+    case '[':
+      cursor_++;
+      if (consume(']')) return true;
+      do
+      {
+        if (!skipValue(depth + 1)) return false;
+      } while (consume(','));
+      return consume(']') || fail("',' ou ']' esperado");
+    case 't':
+    case 'f':
+    {
+      bool ignored;
+      return readBool(ignored);
+    }
+    case 'n':
+      return readNull() || fail("valor invalido");
+    default:
+      return skipNumber();
+    }
+  }
+
+  // Só a sintaxe: número fora do esquema pode ter qualquer tamanho
+  bool skipNumber()
+  {
+    if (cursor_ < end_ && *cursor_ == '-') cursor_++;
+    if (!skipDigits()) return fail("valor invalido");
+    if (cursor_ < end_ && *cursor_ == '.')
+    {
+      cursor_++;
+      if (!skipDigits()) return fail("numero invalido");
+    }
+    if (cursor_ < end_ && (*cursor_ == 'e' || *cursor_ == 'E'))
+    {
+      cursor_++;
+      if (cursor_ < end_ && (*cursor_ == '+' || *cursor_ == '-')) cursor_++;
+      if (!skipDigits()) return fail("numero invalido");
+    }
+    return true;
+  }
+
+  bool skipDigits()
+  {
+    const char *start = cursor_;
+    while (cursor_ < end_ && isDigit(*cursor_))
+      cursor_++;
+    return cursor_ > start;
+  }
+
+  bool object(const FieldSchema &schema, uint8_t *base, int channel)
+  {
+    if (!consume('{')) return fail("objeto esperado");
+    if (consume('}')) return true;
+    do
+    {
+      const char *key;
+      size_t length;
+      if (!readKey(key, length)) return false;
+
+      const Field *field = findField(schema, key, length);
+      if (field == nullptr || field->type == FIELD_ORDINAL)
+      {
+        if (!skipValue(1)) return false;
+      }
+      else if (readNull())
+      {
+        applyDefault(*field, base, channel);
+      }
+      else if (!value(*field, base, channel))
+      {
+        return false;
+      }
+    } while (consume(','));
+    return consume('}') || fail("',' ou '}' esperado");
+  }
+
+  bool value(const Field &field, uint8_t *base, int channel)
+  {
+    switch (field.type)
+    {
+    case FIELD_TEXT:
+    {
+      char text[BOMBA_NAME_SIZE];
+      if (!readText(text, sizeof(text))) return false;
+      member<NameText>(base, field) = text;
+      return true;
+    }
+    case FIELD_INT:
+    case FIELD_FIXED:
+    {
+      int32_t number;
+      if (!readNumber(number, field.decimals)) return false;
+      if (!fitRange(field, number, clamp_)) return fail("valor fora da faixa");
+      if (field.type == FIELD_INT)
+        member<int>(base, field) = number;
+      else
+        member<int32_t>(base, field) = number;
+      return true;
+    }
+    case FIELD_BOOL:
+      return readBool(member<bool>(base, field));
+    case FIELD_FLAGS:
+    {
+      if (!consume('[')) return fail("array esperado");
+      if (consume(']')) return true;
+      uint8_t index = 0;
+      do
+      {
+        bool flag = false;
+        if (!readNull() && !readBool(flag)) return false;
+        if (index < field.count) (&member<bool>(base, field))[index] = flag;
+        index++;
+      } while (consume(','));
+      return consume(']') || fail("',' ou ']' esperado");
+    }
+    case FIELD_OBJECT:
+      return object(*field.nested, base + field.offset, channel);
+    case FIELD_LIST:
+    {
+      if (!consume('[')) return fail("array esperado");
+      if (consume(']')) return true;
+      uint8_t index = 0;
+      do
+      {
+        if (index >= field.count)
+        {
+          if (!skipValue(2)) return false;
+        }
+        else if (!readNull())
+        {
+          // Item presente recomeça do padrão, como o resetSchedule() antigo
+          uint8_t *item = base + field.offset + index * field.nested->stride;
+          applyDefaults(*field.nested, item, channel);
+          if (!object(*field.nested, item, channel)) return false;
+        }
+        index++;
+      } while (consume(','));
+      return consume(']') || fail("',' ou ']' esperado");
+    }
+    case FIELD_ORDINAL:
+      return skipValue(1);
+    }
+    return false;
+  }
+
+  const char *begin_;
+  const char *cursor_;
+  const char *end_;
+  const char *error_;
+  const char *errorAt_;
+  bool clamp_;
+};
+
+// =========================================================
+// Leitura: MessagePack de uma passada
+// =========================================================
+// O percurso do ConfigReader sobre o body binário: as contagens de mapas
+// e arrays vêm nos cabeçalhos, inteiro ou float vira ponto fixo e o que
+// está fora do esquema é pulado pelo tamanho, sem alocar nada.
+class ConfigPackReader
+{
+public:
+  ConfigPackReader(const char *data, size_t length)
+      : begin_(reinterpret_cast<const uint8_t *>(data)), cursor_(begin_), end_(begin_ + length), error_(nullptr),
+        errorAt_(begin_)
+  {
+  }
+
+  bool root(Bomb *staged, uint32_t &channels)
+  {
+    channels = 0;
+    uint32_t count;
+    if (!readMap(count)) return fail("mapa esperado");
+    for (uint32_t i = 0; i < count; i++)
+    {
+      const char *key;
+      uint32_t length;
+      if (!readKey(key, length)) return false;
+
+      int channel = channelOf(key, length);
+      if (channel < 0)
+      {
+        if (!skipValue(0)) return false;
+      }
+      else if (!readNil())
+      {
+        // Bomba presente: o que não vier fica com o padrão
+        uint8_t *base = reinterpret_cast<uint8_t *>(&staged[channel]);
+        applyDefaults(BOMB_SCHEMA, base, channel);
+        if (!object(BOMB_SCHEMA, base, channel)) return false;
+        finishChannel(staged[channel]);
+        channels |= 1UL << channel;
+      }
+    }
+    if (cursor_ < end_) return fail("conteudo depois do mapa");
+    return true;
+  }
+
+  const char *error() const { return error_; }
+  size_t errorOffset() const { return static_cast<size_t>(errorAt_ - begin_); }
+
+private:
+  static const uint8_t MAX_DEPTH = 10;
+
+  bool fail(const char *reason)
+  {
+    if (error_ == nullptr)
+    {
+      error_ = reason;
+      errorAt_ = cursor_;
+    }
+    return false;
+  }
+
+  bool skip(uint64_t count)
+  {
+    if (static_cast<uint64_t>(end_ - cursor_) < count) return fail("dados truncados");
+    cursor_ += count;
+    return true;
+  }
+
+  bool readUint(uint8_t bytes, uint64_t &value)
+  {
+    if (end_ - cursor_ < bytes) return fail("dados truncados");
+    value = 0;
+    while (bytes-- > 0)
+      value = (value << 8) | *cursor_++;
+    return true;
+  }
+
+  // Cabeçalho de mapa ou array (fix, 16 ou 32 bits); outro tipo devolve
+  // false sem consumir nada
+  bool readHeader(uint8_t fixType, uint8_t type16, uint32_t &count)
+  {
+    if (cursor_ >= end_) return false;
+    uint8_t type = *cursor_;
+    if ((type & 0xF0) == fixType)
+    {
+      cursor_++;
+      count = type & 0x0F;
+      return true;
+    }
+    if (type != type16 && type != type16 + 1) return false;
+    cursor_++;
+    uint64_t value;
+    if (!readUint(type == type16 ? 2 : 4, value)) return false;
+    count = static_cast<uint32_t>(value);
+    return true;
+  }
+
+  bool readMap(uint32_t &count) { return readHeader(0x80, 0xDE, count); }
+  bool readArray(uint32_t &count) { return readHeader(0x90, 0xDC, count); }
+
+  bool readNil()
+  {
+    if (cursor_ >= end_ || *cursor_ != 0xC0) return false;
+    cursor_++;
+    return true;
+  }
+
+  bool readBool(bool &value)
+  {
+    if (cursor_ >= end_ || (*cursor_ != 0xC2 && *cursor_ != 0xC3)) return fail("booleano esperado");
+    value = *cursor_++ == 0xC3;
+    return true;
+  }
+
+  // fixstr, str8, str16 ou str32; os bytes ficam no body
+  bool readString(const char *&text, uint32_t &length)
+  {
+    if (cursor_ >= end_) return false;
+    uint8_t type = *cursor_;
+    if ((type & 0xE0) == 0xA0)
+    {
+      cursor_++;
+      length = type & 0x1F;
+    }
+    else if (type >= 0xD9 && type <= 0xDB)
+    {
+      cursor_++;
+      uint64_t value;
+      if (!readUint(static_cast<uint8_t>(1 << (type - 0xD9)), value)) return false;
+      length = static_cast<uint32_t>(value);
+    }
+    else
+    {
+      return false;
+    }
+    text = reinterpret_cast<const char *>(cursor_);
+    return skip(length);
+  }
+
+  bool readKey(const char *&key, uint32_t &length) { return readString(key, length) || fail("chave esperada"); }
+
+  // Truncado em capacity - 1 bytes, como o InlineString
+  bool readText(char *out, size_t capacity)
+  {
+    const char *text;
+    uint32_t length;
+    if (!readString(text, length)) return fail("texto esperado");
+    size_t kept = length < capacity - 1 ? length : capacity - 1;
+    memcpy(out, text, kept);
+    out[kept] = '\0';
+    return true;
+  }
+
+  // Inteiro (qualquer largura) ou float -> inteiro com `decimals` casas;
+  // fora de int32 é recusado
+  bool readNumber(int32_t &value, uint8_t decimals)
+  {
+    if (cursor_ >= end_) return fail("numero esperado");
+    uint8_t type = *cursor_;
+    int32_t scale = powerOfTen(decimals);
+    int64_t integer;
+
+    if (type < 0x80 || type >= 0xE0)
+    {
+      cursor_++;
+      integer = static_cast<int8_t>(type);
+    }
+    else if (type >= 0xCC && type <= 0xD3)
+    {
+      // uint8..uint64 (0xCC-0xCF) e int8..int64 (0xD0-0xD3)
+      cursor_++;
+      uint8_t bytes = static_cast<uint8_t>(1 << ((type - 0xCC) & 3));
+      uint64_t raw;
+      if (!readUint(bytes, raw)) return false;
+      bool isSigned = type >= 0xD0;
+      uint64_t sign = 1ULL << (bytes * 8 - 1);
+      if (isSigned && (raw & sign))
+      {
+        // Negativo: estende o sinal; abaixo de int32 já está fora
+        if (bytes < 8) raw |= ~((sign << 1) - 1);
+        if (raw < static_cast<uint64_t>(INT32_MIN)) return fail("numero fora da faixa");
+        integer = static_cast<int32_t>(static_cast<uint32_t>(raw));
+      }
+      else
+      {
+        if (raw > INT32_MAX) return fail("numero fora da faixa");
+        integer = static_cast<int64_t>(raw);
+      }
+    }
+    else if (type == 0xCA || type == 0xCB)
+    {
+      cursor_++;
+      uint64_t raw;
+      double parsed;
+      if (!readUint(type == 0xCA ? 4 : 8, raw)) return false;
+      if (type == 0xCA)
+      {
+        uint32_t bits = static_cast<uint32_t>(raw);
+        float single;
+        memcpy(&single, &bits, sizeof(single));
+        parsed = single;
+      }
+      else
+      {
+        memcpy(&parsed, &raw, sizeof(parsed));
+      }
+      double limit = 2147483647.0 / scale;
+      if (!(parsed <= limit && parsed >= -limit)) return fail("numero fora da faixa"); // NaN também
+      value = fixed::scaleRound(parsed, scale);
+      return true;
+    }
+    else
+    {
+      return fail("numero esperado");
+    }
+
+    if (integer > INT32_MAX / scale || integer < -(INT32_MAX / scale)) return fail("numero fora da faixa");
+    value = static_cast<int32_t>(integer * scale);
+    return true;
+  }
+
+  bool skipItems(uint64_t count, uint8_t depth)
+  {
+    for (uint64_t i = 0; i < count; i++)
+    {
+      if (!skipValue(depth + 1)) return false;
+    }
+    return true;
+  }
+
+  bool skipValue(uint8_t depth)
+  {
+    if (depth >= MAX_DEPTH) return fail("aninhamento demais");
+    if (cursor_ >= end_) return fail("valor esperado");
+
+    uint8_t type = *cursor_++;
+    if (type < 0x80 || type >= 0xE0) return true;           // fixint
+    if ((type & 0xF0) == 0x80) return skipItems(2 * (type & 0x0F), depth); // fixmap
+    if ((type & 0xF0) == 0x90) return skipItems(type & 0x0F, depth);       // fixarray
+    if ((type & 0xE0) == 0xA0) return skip(type & 0x1F);                   // fixstr
+
+    uint64_t length;
+    switch (type)
+    {
+    case 0xC0: // nil
+    case 0xC2: // false
+    case 0xC3: // true
+      return true;
+    case 0xCC:
+    case 0xD0:
+      return skip(1);
+    case 0xCD:
+    case 0xD1:
+      return skip(2);
+    case 0xCA:
+    case 0xCE:
+    case 0xD2:
+      return skip(4);
+    case 0xCB:
+    case 0xCF:
+    case 0xD3:
+      return skip(8);
+    case 0xD4: // fixext: tipo + 1, 2, 4, 8 ou 16 bytes
+    case 0xD5:
+    case 0xD6:
+    case 0xD7:
+    case 0xD8:
+      return skip(1 + (1U << (type - 0xD4)));
+    case 0xC4: // bin e str com tamanho de 8, 16 ou 32 bits
+    case 0xD9:
+      return readUint(1, length) && skip(length);
+    case 0xC5:
+    case 0xDA:
+      return readUint(2, length) && skip(length);
+    case 0xC6:
+    case 0xDB:
+      return readUint(4, length) && skip(length);
+    case 0xC7: // ext: tamanho, tipo e dados
+      return readUint(1, length) && skip(length + 1);
+    case 0xC8:
+      return readUint(2, length) && skip(length + 1);
+    case 0xC9:
+      return readUint(4, length) && skip(length + 1);
+    case 0xDC:
+      return readUint(2, length) && skipItems(length, depth);
+    case 0xDD:
+      return readUint(4, length) && skipItems(length, depth);
+    case 0xDE:
+      return readUint(2, length) && skipItems(2 * length, depth);
+    case 0xDF:
+      return readUint(4, length) && skipItems(2 * length, depth);
+    }
+    cursor_--;
+    return fail("tipo invalido");
+  }
+
+  bool object(const FieldSchema &schema, uint8_t *base, int channel)
+  {
+    uint32_t count;
+    if (!readMap(count)) return fail("mapa esperado");
+    for (uint32_t i = 0; i < count; i++)
+    {
+      const char *key;
+      uint32_t length;
+      if (!readKey(key, length)) return false;
+
+      const Field *field = findField(schema, key, length);
+      if (field == nullptr || field->type == FIELD_ORDINAL)
+      {
+        if (!skipValue(1)) return false;
+      }
+      else if (readNil())
+      {
+        applyDefault(*field, base, channel);
+      }
+      else if (!value(*field, base, channel))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool value(const Field &field, uint8_t *base, int channel)
+  {
+    switch (field.type)
+    {
+    case FIELD_TEXT:
+    {
+      char text[BOMBA_NAME_SIZE];
+      if (!readText(text, sizeof(text))) return false;
+      member<NameText>(base, field) = text;
+      return true;
+    }
+    case FIELD_INT:
+    case FIELD_FIXED:
+    {
+      int32_t number;
+      if (!readNumber(number, field.decimals)) return false;
+      if (!fitRange(field, number, false)) return fail("valor fora da faixa");
+      if (field.type == FIELD_INT)
+        member<int>(base, field) = number;
+      else
+        member<int32_t>(base, field) = number;
+      return true;
+    }
+    case FIELD_BOOL:
+      return readBool(member<bool>(base, field));
+    case FIELD_FLAGS:
+    {
+      uint32_t count;
+      if (!readArray(count)) return fail("array esperado");
+      for (uint32_t index = 0; index < count; index++)
+      {
+        bool flag = false;
+        if (!readNil() && !readBool(flag)) return false;
+        if (index < field.count) (&member<bool>(base, field))[index] = flag;
+      }
+      return true;
+    }
+    case FIELD_OBJECT:
+      return object(*field.nested, base + field.offset, channel);
+    case FIELD_LIST:
+    {
+      uint32_t count;
+      if (!readArray(count)) return fail("array esperado");
+      for (uint32_t index = 0; index < count; index++)
+      {
+        if (index >= field.count)
+        {
+          if (!skipValue(2)) return false;
+        }
+        else if (!readNil())
+        {
+          // Item presente recomeça do padrão, como no JSON
+          uint8_t *item = base + field.offset + index * field.nested->stride;
+          applyDefaults(*field.nested, item, channel);
+          if (!object(*field.nested, item, channel)) return false;
+        }
+      }
+      return true;
+    }
+    case FIELD_ORDINAL:
+      return skipValue(1);
+    }
+    return false;
+  }
+
+  const uint8_t *begin_;
+  const uint8_t *cursor_;
+  const uint8_t *end_;
+  const char *error_;
+  const uint8_t *errorAt_;
+};
+
+size_t buildConfig(char *buffer, size_t size, WireFormat format)
+{
+  ConfigWriter writer(buffer, size, format);
+  writer.beginObject(BOMBA_COUNT);
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    writer.separator(i);
+    const char *key = DosingPumpBank::key(i);
+    writer.key(key, strlen(key));
+    writer.fields(BOMB_SCHEMA, reinterpret_cast<const uint8_t *>(&bombas[i]), 0);
+  }
+  writer.endObject();
+  return writer.finish();
+}
+} // namespace
+
+size_t buildConfigJson(char *buffer, size_t size)
+{
+  return buildConfig(buffer, size, WIRE_JSON);
+}
+
+size_t buildConfigMsgPack(char *buffer, size_t size)
+{
+  return buildConfig(buffer, size, WIRE_MSGPACK);
+}
+
+bool parseConfigJson(const char *json, size_t length, Bomb *staged, uint32_t &channels, bool clampRanges)
+{
+  ConfigReader reader(json, length, clampRanges);
+  if (reader.root(staged, channels)) return true;
+  hal::logf("[config] JSON de configuracao recusado (posicao %u): %s\n",
+            static_cast<unsigned int>(reader.errorOffset()), reader.error());
+  return false;
+}
+
+bool parseConfigMsgPack(const char *data, size_t length, Bomb *staged, uint32_t &channels)
+{
+  ConfigPackReader reader(data, length);
+  if (reader.root(staged, channels)) return true;
+  hal::logf("[config] MessagePack de configuracao recusado (byte %u): %s\n",
+            static_cast<unsigned int>(reader.errorOffset()), reader.error());
+  return false;
+}
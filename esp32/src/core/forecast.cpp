@@ -0,0 +1,161 @@
+#include "dosing.h"
+
+// =========================================================
+// Consumo e previsão de estoque
+// =========================================================
+// Por bomba: volume do dia corrente e uma EWMA do volume diário, fechada
+// na virada do dia (O(1) por dose, sem reler os logs). A previsão mistura
+// a EWMA com o volume programado em Bomb::schedules: no começo só o
+// programado vale, e a EWMA ganha peso conforme acumula dias observados.
+// Tudo em µL inteiros: alfa = 1 / CONSUMPTION_EWMA_DIVISOR.
+PumpConsumption pumpConsumption[BOMBA_COUNT];
+ForecastSettings forecastSettings = {FORECAST_FLOOR_DEFAULT_UL, 0};
+uint32_t heldScheduledDoses = 0;
+
+namespace
+{
+long dayKeyOf(const DateTime &time)
+{
+  return static_cast<long>(time.unixtime() / 86400UL);
+}
+
+// Um passo da EWMA: ewma + (amostra - ewma) / divisor. Trunca (erro < 1 µL
+// por passo), então a decadência dos dias parados chega a zero.
+int32_t ewmaStep(int32_t ewma, int32_t sample)
+{
+  int64_t scaled = static_cast<int64_t>(ewma) * (CONSUMPTION_EWMA_DIVISOR - 1) + sample;
+  return static_cast<int32_t>(scaled / CONSUMPTION_EWMA_DIVISOR);
+}
+
+// EWMA com os dias fechados até `today` (dias sem dose entram como zero)
+int32_t ewmaAt(const PumpConsumption &consumption, long today)
+{
+  if (consumption.day < 0 || today <= consumption.day) return consumption.ewmaDailyUl;
+
+  int32_t ewma = consumption.daysObserved == 0
+                     ? consumption.todayUl
+                     : ewmaStep(consumption.ewmaDailyUl, consumption.todayUl);
+  // Cada dia parado multiplica por (1 - alfa): chega a zero em poucas dezenas
+  for (long idleDays = today - consumption.day - 1; idleDays > 0 && ewma > 0; idleDays--)
+    ewma = ewmaStep(ewma, 0);
+  return ewma;
+}
+
+uint16_t observedAt(const PumpConsumption &consumption, long today)
+{
+  if (consumption.day < 0 || today <= consumption.day) return consumption.daysObserved;
+  long days = consumption.daysObserved + (today - consumption.day);
+  return days > 0xFFFF ? 0xFFFF : static_cast<uint16_t>(days);
+}
+
+void saveConsumption()
+{
+  if (prefsReady)
+    hal::kvPutBytes("consumoUl", pumpConsumption, sizeof(pumpConsumption));
+}
+} // namespace
+
+void loadConsumption()
+{
+  for (int i = 0; i < BOMBA_COUNT; i++)
+    pumpConsumption[i] = PumpConsumption();
+
+  if (!prefsReady) return;
+  // Tamanho muda com BOMBA_COUNT: blob de outro banco é descartado. As
+  // chaves antigas ("consumo", "forecast") guardavam float e são ignoradas.
+  if (hal::kvGetBytes("consumoUl", pumpConsumption, sizeof(pumpConsumption)) != sizeof(pumpConsumption))
+  {
+    for (int i = 0; i < BOMBA_COUNT; i++)
+      pumpConsumption[i] = PumpConsumption();
+  }
+
+  ForecastSettings saved;
+  if (hal::kvGetBytes("forecastUl", &saved, sizeof(saved)) == sizeof(saved))
+    forecastSettings = saved;
+}
+
+void setForecastSettings(const ForecastSettings &settings)
+{
+  forecastSettings = settings;
+  if (prefsReady)
+    hal::kvPutBytes("forecastUl", &forecastSettings, sizeof(forecastSettings));
+}
+
+void recordConsumption(int bombaIndex, int32_t ul, const DateTime &when)
+{
+  if (bombaIndex < 0 || bombaIndex >= BOMBA_COUNT || ul <= 0) return;
+
+  PumpConsumption &consumption = pumpConsumption[bombaIndex];
+  long today = dayKeyOf(when);
+
+  if (consumption.day >= 0 && today > consumption.day)
+  {
+    // Virada do dia: fecha o anterior na EWMA (uma gravação na NVS por dia)
+    consumption.ewmaDailyUl = ewmaAt(consumption, today);
+    consumption.daysObserved = observedAt(consumption, today);
+    consumption.todayUl = 0;
+    consumption.day = today;
+    saveConsumption();
+  }
+  else if (consumption.day < 0 || today < consumption.day)
+  {
+    // Primeira dose ou relógio voltou: recomeça o dia corrente
+    consumption.day = today;
+    consumption.todayUl = 0;
+  }
+
+  if (consumption.todayUl > INT32_MAX - ul)
+    consumption.todayUl = INT32_MAX;
+  else
+    consumption.todayUl += ul;
+}
+
+int32_t scheduledDailyUl(int bombaIndex)
+{
+  int64_t weekly = 0;
+  for (int j = 0; j < SCHEDULE_COUNT; j++)
+  {
+    const Schedule &schedule = bombas[bombaIndex].schedules[j];
+    if (!schedule.status) continue;
+    for (int d = 0; d < 7; d++)
+      if (schedule.diasSemana[d]) weekly += schedule.dosagemUl;
+  }
+  return static_cast<int32_t>((weekly + 3) / 7);
+}
+
+PumpForecast forecastPump(int bombaIndex, const DateTime &now)
+{
+  const PumpConsumption &consumption = pumpConsumption[bombaIndex];
+  long today = dayKeyOf(now);
+
+  PumpForecast forecast;
+  forecast.ewmaDailyUl = ewmaAt(consumption, today);
+  forecast.scheduledDailyUl = scheduledDailyUl(bombaIndex);
+  forecast.daysObserved = observedAt(consumption, today);
+
+  // Peso da EWMA = dias observados / CONSUMPTION_WARMUP_DAYS (até 1)
+  int64_t weight = forecast.daysObserved < CONSUMPTION_WARMUP_DAYS ? forecast.daysObserved : CONSUMPTION_WARMUP_DAYS;
+  forecast.dailyUl = static_cast<int32_t>((weight * forecast.ewmaDailyUl +
+                                           (CONSUMPTION_WARMUP_DAYS - weight) * forecast.scheduledDailyUl +
+                                           CONSUMPTION_WARMUP_DAYS / 2) /
+                                          CONSUMPTION_WARMUP_DAYS);
+
+  int64_t stock = bombas[bombaIndex].estoqueUl;
+  forecast.secondsRemaining = forecast.dailyUl > 0 ? stock * 86400 / forecast.dailyUl : -1;
+  forecast.emptyAt = 0;
+  if (forecast.secondsRemaining >= 0 && forecast.secondsRemaining < FORECAST_HORIZON_DAYS * 86400LL)
+    forecast.emptyAt = now.unixtime() + static_cast<uint32_t>(forecast.secondsRemaining);
+  return forecast;
+}
+
+// Dose programada que deixaria o estoque abaixo do piso: segura (manual não)
+bool holdScheduledDose(int bombaIndex, int32_t dosagemUl)
+{
+  if (!forecastSettings.hold) return false;
+  if (static_cast<int64_t>(bombas[bombaIndex].estoqueUl) - dosagemUl >= forecastSettings.floorUl) return false;
+
+  heldScheduledDoses++;
+  hal::logf("[stock] Dose programada SEGURADA: Bomba %d, estoque %s ml, piso %s ml\n", bombaIndex + 1,
+            MlText(bombas[bombaIndex].estoqueUl).c_str(), MlText(forecastSettings.floorUl).c_str());
+  return true;
+}
@@ -0,0 +1,626 @@
+#include "dosing.h"
+
+#include <string.h>
+#include <new>
+
+// =========================================================
+// Hub (logs de vários controladores)
+// =========================================================
+// Vários dosadores no mesmo aquário: um deles (o hub) puxa dos outros, pela
+// rede, as doses e o estoque e serve tudo junto, então o app conversa com
+// um controlador só.
+//
+// Protocolo: cada linha de log tem um seq crescente por controlador
+// (logs.cpp). GET /logs?afterSeq=N devolve uma página em NDJSON: a primeira
+// linha é o cabeçalho {"device", "seq" (último do controlador), "bombas"
+// (nome e estoque)}; as seguintes, até HUB_PAGE_MAX linhas de log com
+// seq > N, como estão gravadas. O hub guarda o último seq recebido de cada
+// controlador e pede a partir dele; página cheia puxa de novo em seguida.
+//
+// No hub cada linha ganha o "device" na frente e vai para HUB_FILE
+// ({"device":"...","seq":N,...}). Seq já guardado é descartado, então uma
+// página repetida (queda entre a gravação e o cursor na NVS) não duplica
+// nada; no boot o cursor também é conferido contra o próprio HUB_FILE.
+// Um controlador novo na mesma URL, ou que recomeçou a numeração, é puxado
+// de novo desde o começo.
+//
+// Como no outbox: o loop monta o GET e grava a resposta (só com as bombas
+// paradas); o GET em si roda na task de envio (hubFetch).
+HubStats hubStats;
+
+namespace
+{
+// Cursor de cada URL, num blob só na NVS
+struct HubCursor
+{
+  char url[HUB_URL_SIZE];
+  char device[HUB_DEVICE_SIZE];
+  uint32_t lastSeq;
+};
+
+struct HubSchedule
+{
+  unsigned long nextPollAt;
+  uint32_t backoffMs;
+};
+
+const char DEVICE_PREFIX[] = "{\"device\":\"";
+const char SEQ_KEY[] = "\"seq\":";
+static_assert(MERGED_LINE_MAX == LOG_LINE_MAX + HUB_DEVICE_SIZE + sizeof(DEVICE_PREFIX) + 2,
+              "MERGED_LINE_MAX fora do formato da linha agregada");
+
+enum MergedPhase : uint8_t
+{
+  MERGED_LOCAL,
+  MERGED_HUB,
+  MERGED_DONE
+};
+
+hal::CriticalSection hubLock; // peers[] também é lido e trocado pelo HTTP
+HubPeer peers[HUB_PEERS_MAX];
+HubSchedule schedule[HUB_PEERS_MAX];
+uint32_t peersVersion = 0;
+uint8_t lastPolled = HUB_PEERS_MAX - 1;
+
+volatile HubState hubState = HUB_IDLE;
+char *pageBuffer = nullptr;
+size_t pageLength = 0;
+int fetchStatus = 0;
+uint8_t fetchPeer = 0;
+uint32_t fetchVersion = 0;
+char fetchUrl[HUB_URL_SIZE + 32];
+
+bool validDeviceId(const char *device)
+{
+  size_t length = strlen(device);
+  if (length == 0 || length >= HUB_DEVICE_SIZE) return false;
+  for (size_t i = 0; i < length; i++)
+    if (device[i] == '"' || device[i] == '\\' || static_cast<uint8_t>(device[i]) < 0x20) return false;
+  return true;
+}
+
+// Linha do log local ({"seq":N,...}) com o device na frente
+size_t mergeLine(const char *device, const char *line, size_t length, char *out)
+{
+  if (length < 2 || line[0] != '{') return 0;
+  size_t used = snprintf(out, MERGED_LINE_MAX, "%s%s\",", DEVICE_PREFIX, device);
+  if (used + length - 1 > MERGED_LINE_MAX) return 0;
+  memcpy(out + used, line + 1, length - 1);
+  return used + length - 1;
+}
+
+// {"device":"X","seq":N,...} -> device e seq, sem parse
+bool parseMergedLine(const char *line, size_t length, const char *&device, size_t &deviceLength, uint32_t &seq)
+{
+  const size_t prefixLength = sizeof(DEVICE_PREFIX) - 1;
+  if (length <= prefixLength || strncmp(line, DEVICE_PREFIX, prefixLength) != 0) return false;
+  const char *end = static_cast<const char *>(memchr(line + prefixLength, '"', length - prefixLength));
+  if (end == nullptr) return false;
+  device = line + prefixLength;
+  deviceLength = end - device;
+
+  size_t at = (end - line) + 2; // '"' e ','
+  const size_t keyLength = sizeof(SEQ_KEY) - 1;
+  if (at + keyLength >= length || strncmp(line + at, SEQ_KEY, keyLength) != 0) return false;
+  seq = 0;
+  for (at += keyLength; at < length && line[at] >= '0' && line[at] <= '9'; at++)
+    seq = seq * 10 + static_cast<uint32_t>(line[at] - '0');
+  return seq > 0;
+}
+
+void saveCursors()
+{
+  if (!prefsReady) return;
+  HubCursor cursors[HUB_PEERS_MAX];
+  memset(cursors, 0, sizeof(cursors));
+  {
+    hal::ScopedCritical lock(hubLock);
+    for (uint8_t i = 0; i < hubStats.peers; i++)
+    {
+      snprintf(cursors[i].url, sizeof(cursors[i].url), "%s", peers[i].url.c_str());
+      snprintf(cursors[i].device, sizeof(cursors[i].device), "%s", peers[i].device.c_str());
+      cursors[i].lastSeq = peers[i].lastSeq;
+    }
+  }
+  hal::kvPutBytes("hubPeers", cursors, sizeof(cursors));
+}
+
+bool sameDevice(const char *device, const char *text, size_t length)
+{
+  return strlen(device) == length && strncmp(device, text, length) == 0;
+}
+
+// Boot: conta as linhas e puxa cada cursor até o maior seq já guardado
+void scanHubFile()
+{
+  hubStats.stored = 0;
+  recoverTempFile(HUB_TEMP_FILE, HUB_FILE);
+  if (!fsReady || !hal::fsExists(HUB_FILE)) return;
+
+  hal::File file = hal::fsOpen(HUB_FILE, hal::FILE_MODE_READ);
+  char line[MERGED_LINE_MAX + 1];
+  size_t length;
+  while (file.readLine(line, sizeof(line), length))
+  {
+    const char *device;
+    size_t deviceLength;
+    uint32_t seq;
+    if (!parseMergedLine(line, length, device, deviceLength, seq)) continue;
+    hubStats.stored++;
+    for (uint8_t i = 0; i < hubStats.peers; i++)
+    {
+      if (sameDevice(peers[i].device.c_str(), device, deviceLength) && seq > peers[i].lastSeq)
+        peers[i].lastSeq = seq;
+    }
+  }
+}
+
+// Maior seq já guardado de um controlador (0 se nenhum)
+uint32_t storedSeq(const char *device)
+{
+  uint32_t last = 0;
+  if (!fsReady || !hal::fsExists(HUB_FILE)) return last;
+
+  hal::File file = hal::fsOpen(HUB_FILE, hal::FILE_MODE_READ);
+  char line[MERGED_LINE_MAX + 1];
+  size_t length;
+  while (file.readLine(line, sizeof(line), length))
+  {
+    const char *text;
+    size_t textLength;
+    uint32_t seq;
+    if (parseMergedLine(line, length, text, textLength, seq) && seq > last && sameDevice(device, text, textLength))
+      last = seq;
+  }
+  return last;
+}
+
+// Mantém as HUB_LOG_LIMIT linhas mais novas
+void trimHubFile()
+{
+  uint32_t removeCount = hubStats.stored - HUB_LOG_LIMIT;
+  hal::File input = hal::fsOpen(HUB_FILE, hal::FILE_MODE_READ);
+  hal::File output = hal::fsOpen(HUB_TEMP_FILE, hal::FILE_MODE_WRITE);
+  if (!input || !output)
+  {
+    hal::logf("[hub] ERRO: Falha ao abrir %s para limpar\n", HUB_FILE);
+    return;
+  }
+
+  char line[MERGED_LINE_MAX + 1];
+  size_t length;
+  uint32_t skipped = 0;
+  uint32_t kept = 0;
+  while (input.readLine(line, MERGED_LINE_MAX, length))
+  {
+    if (length == 0) continue;
+    if (skipped < removeCount)
+    {
+      skipped++;
+      continue;
+    }
+    line[length] = '\n';
+    output.write(line, length + 1);
+    kept++;
+  }
+  input.close();
+  output.close();
+
+  // Direto por cima: um reset antes do rename deixa o arquivo antigo inteiro
+  if (!hal::fsRename(HUB_TEMP_FILE, HUB_FILE))
+  {
+    hal::logf("[hub] ERRO: Falha ao substituir %s\n", HUB_FILE);
+    return;
+  }
+  hubStats.stored = kept;
+}
+
+void fetchFailed(HubPeer &peer, HubSchedule &slot, int status)
+{
+  uint32_t backoff = slot.backoffMs == 0 ? HUB_POLL_MS : slot.backoffMs * 2;
+  if (backoff > HUB_BACKOFF_MAX_MS) backoff = HUB_BACKOFF_MAX_MS;
+  slot.backoffMs = backoff;
+  slot.nextPollAt = hal::millis() + backoff;
+
+  {
+    hal::ScopedCritical lock(hubLock);
+    peer.failures++;
+    peer.lastStatus = status;
+  }
+  hubStats.failures++;
+  hal::logf("[hub] Falha ao puxar %s (status %d), nova tentativa em %u s\n", peer.url.c_str(), status,
+            backoff / 1000);
+}
+
+// Loop, com as bombas paradas: confere a página e grava as linhas novas
+void finishFetch()
+{
+  // Lista trocada durante o GET: a resposta não é mais de ninguém
+  if (fetchVersion != peersVersion || fetchPeer >= hubStats.peers) return;
+  HubPeer &peer = peers[fetchPeer];
+  HubSchedule &slot = schedule[fetchPeer];
+
+  if (fetchStatus != 200)
+  {
+    fetchFailed(peer, slot, fetchStatus);
+    return;
+  }
+
+  const char *end = pageBuffer + pageLength;
+  const char *newline = static_cast<const char *>(memchr(pageBuffer, '\n', pageLength));
+  size_t headerLength = newline ? newline - pageBuffer : pageLength;
+
+  JsonLease lease(jsonSmallPool);
+  JsonDocument &header = lease.doc();
+  const char *device = "";
+  if (!deserializeJson(header, pageBuffer, headerLength)) device = header["device"] | "";
+  if (!validDeviceId(device))
+  {
+    fetchFailed(peer, slot, 0);
+    return;
+  }
+  uint32_t remoteSeq = header["seq"] | 0UL;
+
+  // Outro controlador na URL (ou URL nova): segue do que já está guardado
+  // dele. Numeração recomeçada (log apagado): de novo do começo.
+  uint32_t cursor = peer.lastSeq;
+  bool moved = strcmp(peer.device.c_str(), device) != 0;
+  if (moved || remoteSeq < cursor)
+  {
+    cursor = moved ? storedSeq(device) : 0;
+    if (cursor > remoteSeq) cursor = 0;
+    hal::logf("[hub] %s: controlador %s (seq %u), puxando depois do seq %u\n", peer.url.c_str(), device,
+              remoteSeq, cursor);
+    {
+      hal::ScopedCritical lock(hubLock);
+      peer.device = device;
+      peer.lastSeq = cursor;
+    }
+    saveCursors();
+    slot.backoffMs = 0;
+    slot.nextPollAt = hal::millis();
+    return;
+  }
+
+  uint32_t merged = 0;
+  uint32_t gaps = 0;
+  uint8_t received = 0;
+  if (newline != nullptr)
+  {
+    FlashOpTimer timer(FLASH_OP_HUB_MERGE);
+    hal::File file = hal::fsOpen(HUB_FILE, hal::FILE_MODE_APPEND);
+    char line[MERGED_LINE_MAX + 1];
+    for (const char *at = newline + 1; at < end && file;)
+    {
+      const char *next = static_cast<const char *>(memchr(at, '\n', end - at));
+      size_t length = (next ? next : end) - at;
+      const char *text = at;
+      at = next ? next + 1 : end;
+      if (length == 0) continue;
+
+      received++;
+      uint32_t seq = logLineSeq(text, length);
+      if (seq == 0) continue;
+      if (seq <= cursor)
+      {
+        hubStats.duplicates++;
+        continue;
+      }
+      size_t mergedLength = mergeLine(device, text, length, line);
+      if (mergedLength == 0) continue;
+      line[mergedLength] = '\n';
+      if (file.write(line, mergedLength + 1) != mergedLength + 1)
+      {
+        hal::logf("[hub] ERRO: Falha ao gravar %s\n", HUB_FILE);
+        break;
+      }
+
+      if (cursor > 0 && seq > cursor + 1) gaps += seq - cursor - 1;
+      cursor = seq;
+      merged++;
+    }
+  }
+  hubStats.merged += merged;
+  hubStats.stored += merged;
+
+  {
+    hal::ScopedCritical lock(hubLock);
+    peer.lastSeq = cursor;
+    peer.remoteSeq = remoteSeq;
+    peer.pulled += merged;
+    peer.gaps += gaps;
+    peer.lastStatus = fetchStatus;
+    peer.lastPullAt = clockNow().unixtime();
+    size_t written = serializeJson(header["bombas"], peer.bombas, sizeof(peer.bombas));
+    if (written == 0 || written >= sizeof(peer.bombas)) strcpy(peer.bombas, "[]");
+  }
+  if (merged > 0)
+  {
+    saveCursors();
+    hal::logf("[hub] %s (%s): %u doses novas, seq %u de %u\n", peer.url.c_str(), device, merged, cursor,
+              remoteSeq);
+  }
+  if (hubStats.stored > HUB_LOG_LIMIT + HUB_PAGE_MAX)
+  {
+    FlashOpTimer timer(FLASH_OP_HUB_MERGE);
+    trimHubFile();
+  }
+
+  // Página cheia: ainda há linhas depois dela
+  slot.backoffMs = 0;
+  slot.nextPollAt = hal::millis() + (received >= HUB_PAGE_MAX ? 0 : HUB_POLL_MS);
+}
+} // namespace
+
+// --- Lado do controlador puxado ---
+
+// Cabeçalho da página e "self" do GET /hub
+void buildHubSelf(JsonDocument &doc, WireFormat format)
+{
+  doc["device"] = hal::deviceId();
+  doc["seq"] = logNextSeq - 1;
+  JsonArray list = doc["bombas"].to<JsonArray>();
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    JsonObject pump = list.add<JsonObject>();
+    pump["bombaId"] = i + 1;
+    pump["bomba"] = bombas[i].name.c_str();
+    jsonSetMl(pump["estoque"], bombas[i].estoqueUl, format);
+  }
+}
+
+// Cabeçalho + até HUB_PAGE_MAX linhas com seq > afterSeq, uma por linha
+size_t buildLogPage(uint32_t afterSeq, char *buffer, size_t size)
+{
+  size_t used;
+  {
+    JsonLease lease(jsonSmallPool);
+    JsonDocument &doc = lease.doc();
+    buildHubSelf(doc);
+    used = serializeJson(doc, buffer, size);
+  }
+  if (used == 0 || used + 1 >= size) return 0;
+  buffer[used++] = '\n';
+
+  uint8_t lines = 0;
+  char line[LOG_LINE_MAX];
+  size_t length;
+  if (logPartitionReady)
+  {
+    LogCursor cursor;
+    logCursorBegin(cursor);
+    while (lines < HUB_PAGE_MAX && logCursorNext(cursor, line, length))
+    {
+      if (logLineSeq(line, length) <= afterSeq) continue;
+      if (used + length + 1 > size) break;
+      memcpy(buffer + used, line, length);
+      used += length;
+      buffer[used++] = '\n';
+      lines++;
+    }
+    return used;
+  }
+
+  if (!fsReady) return used;
+  hal::File file = hal::fsOpen(LOG_FILE, hal::FILE_MODE_READ);
+  while (file && lines < HUB_PAGE_MAX && file.readLine(line, sizeof(line), length))
+  {
+    if (logLineSeq(line, length) <= afterSeq) continue;
+    if (used + length + 1 > size) break;
+    memcpy(buffer + used, line, length);
+    used += length;
+    buffer[used++] = '\n';
+    lines++;
+  }
+  return used;
+}
+
+// --- Hub ---
+
+void initHub()
+{
+  memset(&hubStats, 0, sizeof(hubStats));
+  hubState = HUB_IDLE;
+  for (uint8_t i = 0; i < HUB_PEERS_MAX; i++)
+  {
+    peers[i] = HubPeer();
+    strcpy(peers[i].bombas, "[]");
+    schedule[i].nextPollAt = hal::millis();
+    schedule[i].backoffMs = 0;
+  }
+
+  HubCursor cursors[HUB_PEERS_MAX];
+  bool saved = prefsReady && hal::kvGetBytes("hubPeers", cursors, sizeof(cursors)) == sizeof(cursors);
+  for (uint8_t i = 0; saved && i < HUB_PEERS_MAX; i++)
+  {
+    cursors[i].url[HUB_URL_SIZE - 1] = '\0';
+    cursors[i].device[HUB_DEVICE_SIZE - 1] = '\0';
+    if (cursors[i].url[0] == '\0') continue;
+    HubPeer &peer = peers[hubStats.peers++];
+    peer.url = cursors[i].url;
+    peer.device = cursors[i].device;
+    peer.lastSeq = cursors[i].lastSeq;
+  }
+  scanHubFile();
+  if (hubStats.peers == 0) return;
+
+  if (pageBuffer == nullptr) pageBuffer = new (std::nothrow) char[HUB_PAGE_BODY_MAX];
+  if (pageBuffer == nullptr)
+    hal::logf("[hub] ERRO: Sem memoria para a pagina de %u bytes\n", HUB_PAGE_BODY_MAX);
+  hal::logf("[hub] Hub: %u controladores, %u linhas guardadas\n", hubStats.peers, hubStats.stored);
+}
+
+// URLs base ("http://192.168.1.20"); a que continua na lista mantém o cursor
+bool setHubPeers(const char *const *urls, uint8_t count)
+{
+  if (count > HUB_PEERS_MAX) return false;
+  HubPeer updated[HUB_PEERS_MAX];
+  for (uint8_t i = 0; i < count; i++)
+  {
+    size_t length = strlen(urls[i]);
+    while (length > 0 && urls[i][length - 1] == '/')
+      length--;
+    if (strncmp(urls[i], "http://", 7) != 0 || length <= 7 || length >= HUB_URL_SIZE) return false;
+
+    char url[HUB_URL_SIZE];
+    memcpy(url, urls[i], length);
+    url[length] = '\0';
+    updated[i] = HubPeer();
+    updated[i].url = url;
+    strcpy(updated[i].bombas, "[]");
+  }
+
+  if (count > 0 && pageBuffer == nullptr)
+  {
+    pageBuffer = new (std::nothrow) char[HUB_PAGE_BODY_MAX];
+    if (pageBuffer == nullptr) return false;
+  }
+
+  {
+    hal::ScopedCritical lock(hubLock);
+    for (uint8_t i = 0; i < count; i++)
+    {
+      for (uint8_t j = 0; j < hubStats.peers; j++)
+      {
+        if (strcmp(peers[j].url.c_str(), updated[i].url.c_str()) == 0) updated[i] = peers[j];
+      }
+    }
+    for (uint8_t i = 0; i < HUB_PEERS_MAX; i++)
+    {
+      peers[i] = i < count ? updated[i] : HubPeer();
+      if (i >= count) strcpy(peers[i].bombas, "[]");
+      schedule[i].nextPollAt = hal::millis();
+      schedule[i].backoffMs = 0;
+    }
+    hubStats.peers = count;
+    peersVersion++;
+  }
+  saveCursors();
+  hal::logf("[hub] Hub: %u controladores\n", count);
+  return true;
+}
+
+uint8_t hubPeerCount()
+{
+  return hubStats.peers;
+}
+
+bool copyHubPeer(uint8_t index, HubPeer &out)
+{
+  hal::ScopedCritical lock(hubLock);
+  if (index >= hubStats.peers) return false;
+  out = peers[index];
+  return true;
+}
+
+void pullHubNow()
+{
+  for (uint8_t i = 0; i < HUB_PEERS_MAX; i++)
+  {
+    schedule[i].nextPollAt = hal::millis();
+    schedule[i].backoffMs = 0;
+  }
+}
+
+// Loop: grava a página recebida e monta o próximo GET, um controlador por
+// vez, em rodízio
+void serviceHub()
+{
+  if (hubState == HUB_DONE)
+  {
+    if (!pumpQueueIdle()) return;
+    finishFetch();
+    hal::ScopedCritical lock(hubLock);
+    hubState = HUB_IDLE;
+  }
+
+  if (hubState != HUB_IDLE || hubStats.peers == 0 || pageBuffer == nullptr) return;
+  if (!pumpQueueIdle() || !hal::netLinkUp()) return;
+
+  unsigned long now = hal::millis();
+  for (uint8_t step = 1; step <= hubStats.peers; step++)
+  {
+    uint8_t index = (lastPolled + step) % hubStats.peers;
+    if (static_cast<long>(now - schedule[index].nextPollAt) < 0) continue;
+
+    {
+      hal::ScopedCritical lock(hubLock);
+      snprintf(fetchUrl, sizeof(fetchUrl), "%s/logs?afterSeq=%u", peers[index].url.c_str(), peers[index].lastSeq);
+      fetchPeer = index;
+      fetchVersion = peersVersion;
+      hubState = HUB_FETCHING;
+    }
+    lastPolled = index;
+    hubStats.polls++;
+    onHubFetchReady();
+    return;
+  }
+}
+
+// Task de envio (ou chamada direta no host): bloqueia no GET, fora do loop
+void hubFetch()
+{
+  if (hubState != HUB_FETCHING) return;
+
+  size_t length = 0;
+  int status = hal::httpGet(fetchUrl, pageBuffer, HUB_PAGE_BODY_MAX, length);
+
+  hal::ScopedCritical lock(hubLock);
+  fetchStatus = status;
+  pageLength = length;
+  hubState = HUB_DONE;
+}
+
+// Visão agregada: doses deste controlador e depois as guardadas dos outros,
+// todas com o "device" na frente
+void mergedLogBegin(MergedLogCursor &cursor)
+{
+  cursor.phase = MERGED_LOCAL;
+  cursor.partition = logPartitionReady;
+  cursor.file.close();
+  if (cursor.partition)
+    logCursorBegin(cursor.log);
+  else if (fsReady)
+    cursor.file = hal::fsOpen(LOG_FILE, hal::FILE_MODE_READ);
+}
+
+bool mergedLogNext(MergedLogCursor &cursor, char *merged, size_t &length)
+{
+  char line[LOG_LINE_MAX];
+  size_t lineLength;
+  while (cursor.phase == MERGED_LOCAL)
+  {
+    bool more = cursor.partition ? logCursorNext(cursor.log, line, lineLength)
+                                 : (cursor.file && cursor.file.readLine(line, sizeof(line), lineLength));
+    if (!more)
+    {
+      cursor.phase = MERGED_HUB;
+      cursor.file.close();
+      if (fsReady && hal::fsExists(HUB_FILE)) cursor.file = hal::fsOpen(HUB_FILE, hal::FILE_MODE_READ);
+      break;
+    }
+    length = mergeLine(hal::deviceId(), line, lineLength, merged);
+    if (length > 0) return true;
+  }
+
+  while (cursor.phase == MERGED_HUB)
+  {
+    if (!cursor.file || !cursor.file.readLine(merged, MERGED_LINE_MAX + 1, length))
+    {
+      cursor.phase = MERGED_DONE;
+      cursor.file.close();
+      break;
+    }
+    if (length > 0) return true;
+  }
+  return false;
+}
+
+void forEachMergedLog(LogLineSink sink, void *context)
+{
+  char merged[MERGED_LINE_MAX + 1];
+  size_t length;
+  MergedLogCursor cursor;
+  mergedLogBegin(cursor);
+  while (mergedLogNext(cursor, merged, length)) sink(context, merged, length);
+}
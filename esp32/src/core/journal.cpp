@@ -0,0 +1,441 @@
+#include "dosing.h"
+
+#include <string.h>
+
+// =========================================================
+// Diário de doses (write-ahead log)
+// =========================================================
+// Cada mudança de estado da fila vira um registro de 16 bytes gravado no
+// lugar, num anel de JOURNAL_SLOTS posições de um arquivo pré-alocado (o
+// arquivo nunca cresce): job enfileirado, início da dose (hora e duração),
+// progresso a cada JOURNAL_PROGRESS_MS e fim. A cada meia volta do anel um
+// checkpoint regrava o estado vivo (dose ativa + fila), então o último
+// checkpoint e tudo depois dele nunca são sobrescritos.
+//
+// No boot, initJournal() relê a partir do último checkpoint: a dose que
+// estava em andamento é debitada do estoque e registrada nos logs pelo
+// tempo estimado de bomba ligada (ou, se o seq do START dela não passa do
+// appliedDose gravado com o estoque, só ganha a linha de log que faltar),
+// e os jobs que não começaram voltam para
+// a fila se o reset foi há menos de JOURNAL_REQUEUE_MAX_AGE_S (passos de
+// programa não: as esperas entre eles se perderam).
+JournalStats journalStats;
+
+namespace
+{
+enum JournalRecordType : uint8_t
+{
+  JOURNAL_CHECKPOINT = 1,
+  JOURNAL_ENQUEUE,  // value = dosagemUl, time = hora do job
+  JOURNAL_START,    // value = duração em ms, time = hora do início
+  JOURNAL_PROGRESS, // value = ms de bomba ligada
+  JOURNAL_DONE,
+  JOURNAL_DROP      // job da frente saiu da fila sem ligar a bomba
+};
+
+struct JournalRecord
+{
+  uint32_t seq;
+  uint8_t type;
+  uint8_t pump;
+  uint8_t origin; // índice em JOURNAL_ORIGINS
+  uint8_t crc;    // CRC-8 dos outros 15 bytes (slot apagado = 0xFF... falha)
+  int32_t value;
+  uint32_t time;
+};
+static_assert(sizeof(JournalRecord) == 16, "registro do diario com 16 bytes");
+
+// Origens conhecidas ficam num byte; as outras voltam como "Retomado"
+const char *const JOURNAL_ORIGINS[] = {"Retomado", "Programado", "Manual", "Teste", "Calibracao", PROGRAM_ORIGIN};
+const uint8_t JOURNAL_ORIGIN_COUNT = sizeof(JOURNAL_ORIGINS) / sizeof(JOURNAL_ORIGINS[0]);
+
+hal::File journalFile;
+uint16_t nextSlot = 0;
+uint16_t sinceCheckpoint = 0;
+int journaledTail = 0; // jobs de pumpHead até aqui já estão no diário
+
+// Dose ativa, para os checkpoints
+uint32_t activeStartSeq = 0; // seq do START mais recente dela
+uint32_t activeStartTime = 0;
+int32_t activeDurationMs = 0;
+int32_t activeProgressMs = 0;
+
+uint8_t recordCrc(const JournalRecord &record)
+{
+  JournalRecord copy = record;
+  copy.crc = 0;
+  return crc8(&copy, sizeof(copy));
+}
+
+bool recordValid(const JournalRecord &record)
+{
+  return record.type >= JOURNAL_CHECKPOINT && record.type <= JOURNAL_DROP && record.crc == recordCrc(record);
+}
+
+uint8_t originCode(const char *origem)
+{
+  for (uint8_t i = 1; i < JOURNAL_ORIGIN_COUNT; i++)
+    if (strcmp(origem, JOURNAL_ORIGINS[i]) == 0) return i;
+  return 0;
+}
+
+void takeCheckpoint();
+
+bool writeRecord(uint8_t type, uint8_t pump, uint8_t origin, int32_t value, uint32_t time)
+{
+  FlashOpTimer timer(FLASH_OP_JOURNAL_WRITE);
+  if (!journalFile) return false;
+
+  JournalRecord record = {journalStats.nextSeq, type, pump, origin, 0, value, time};
+  record.crc = recordCrc(record);
+
+  if (!journalFile.seek(nextSlot * sizeof(JournalRecord)) ||
+      journalFile.write(&record, sizeof(record)) != sizeof(record))
+  {
+    journalStats.writeErrors++;
+    return false;
+  }
+  journalFile.flush();
+
+  journalStats.nextSeq++;
+  journalStats.writes++;
+  nextSlot = (nextSlot + 1) % JOURNAL_SLOTS;
+  if (++sinceCheckpoint >= JOURNAL_SLOTS / 2) takeCheckpoint();
+  return true;
+}
+
+bool writeEnqueue(const PumpJob &job)
+{
+  return writeRecord(JOURNAL_ENQUEUE, job.bombaIndex, originCode(job.origem.c_str()), job.dosagemUl,
+                     job.timestamp.unixtime());
+}
+
+// Regrava o estado vivo depois de um marcador: a releitura começa aqui.
+// Quem chama já atualizou o estado do módulo antes do registro que disparou.
+void takeCheckpoint()
+{
+  sinceCheckpoint = 0;
+  journalStats.checkpoints++;
+  writeRecord(JOURNAL_CHECKPOINT, 0, 0, 0, clockNow().unixtime());
+
+  if (pumpActive)
+  {
+    writeEnqueue(activeJob);
+    activeStartSeq = journalStats.nextSeq;
+    writeRecord(JOURNAL_START, activeJob.bombaIndex, 0, activeDurationMs, activeStartTime);
+    if (activeProgressMs > 0)
+      writeRecord(JOURNAL_PROGRESS, activeJob.bombaIndex, 0, activeProgressMs, 0);
+  }
+
+  for (int index = pumpHead; index != journaledTail; index = (index + 1) % MAX_PUMP_QUEUE)
+  {
+    pumpQueueLock.enter();
+    PumpJob job = pumpQueue[index];
+    pumpQueueLock.exit();
+    writeEnqueue(job);
+  }
+}
+
+bool preallocate()
+{
+  hal::File file = hal::fsOpen(JOURNAL_FILE, hal::FILE_MODE_WRITE);
+  if (!file) return false;
+
+  uint8_t erased[64];
+  memset(erased, 0xFF, sizeof(erased));
+  for (size_t written = 0; written < JOURNAL_SLOTS * sizeof(JournalRecord); written += sizeof(erased))
+  {
+    if (file.write(erased, sizeof(erased)) != sizeof(erased)) return false;
+  }
+  return true;
+}
+
+// --- Releitura no boot ---
+struct ReplayJob
+{
+  uint8_t pump;
+  uint8_t origin;
+  int32_t dosagemUl;
+  uint32_t time;
+};
+
+struct ReplayState
+{
+  ReplayJob pending[MAX_PUMP_QUEUE];
+  uint8_t pendingCount;
+  bool active;
+  ReplayJob activeJob;
+  uint32_t startSeq;
+  uint32_t startTime;
+  int32_t durationMs;
+  int32_t progressMs;
+};
+
+void applyRecord(ReplayState &state, const JournalRecord &record)
+{
+  switch (record.type)
+  {
+  case JOURNAL_ENQUEUE:
+    if (state.pendingCount < MAX_PUMP_QUEUE && record.pump < BOMBA_COUNT)
+    {
+      ReplayJob job = {record.pump, record.origin, record.value, record.time};
+      state.pending[state.pendingCount++] = job;
+    }
+    break;
+  case JOURNAL_START:
+    if (state.pendingCount == 0) break;
+    state.active = true;
+    state.activeJob = state.pending[0];
+    memmove(state.pending, state.pending + 1, (state.pendingCount - 1) * sizeof(ReplayJob));
+    state.pendingCount--;
+    state.startSeq = record.seq;
+    state.startTime = record.time;
+    state.durationMs = record.value;
+    state.progressMs = 0;
+    break;
+  case JOURNAL_PROGRESS:
+    if (state.active) state.progressMs = record.value;
+    break;
+  case JOURNAL_DONE:
+    state.active = false;
+    break;
+  case JOURNAL_DROP:
+    if (state.pendingCount == 0) break;
+    memmove(state.pending, state.pending + 1, (state.pendingCount - 1) * sizeof(ReplayJob));
+    state.pendingCount--;
+    break;
+  default:
+    break;
+  }
+}
+
+// Tempo de bomba ligada até o reset: último progresso + meio intervalo,
+// limitado pela duração e pelo RTC (o reset foi antes do boot; +1 s pela
+// resolução do RTC)
+int32_t estimateOnTimeMs(const ReplayState &state)
+{
+  int64_t elapsed = state.progressMs + JOURNAL_PROGRESS_MS / 2;
+  if (rtcReady)
+  {
+    uint32_t now = clockNow().unixtime();
+    if (now >= state.startTime)
+    {
+      int64_t upper = (static_cast<int64_t>(now - state.startTime) + 1) * 1000;
+      if (upper < elapsed) elapsed = upper > state.progressMs ? upper : state.progressMs;
+    }
+  }
+  if (elapsed > state.durationMs) elapsed = state.durationMs;
+  return static_cast<int32_t>(elapsed);
+}
+
+void reconcilePartialDose(const ReplayState &state)
+{
+  const ReplayJob &job = state.activeJob;
+  int32_t onTimeMs = estimateOnTimeMs(state);
+  int32_t dosedUl = state.durationMs > 0
+                        ? static_cast<int32_t>(static_cast<int64_t>(job.dosagemUl) * onTimeMs / state.durationMs)
+                        : 0;
+
+  journalStats.partialDose = true;
+  journalStats.recoveredUl = dosedUl;
+  hal::logf("[journal] Dose interrompida: Bomba %d, ~%ld de %ld ms, %s de %s ml\n", job.pump + 1,
+            static_cast<long>(onTimeMs), static_cast<long>(state.durationMs), MlText(dosedUl).c_str(),
+            MlText(job.dosagemUl).c_str());
+  if (dosedUl <= 0) return;
+
+  // Mesma contabilidade de finishPumpJob(), na mesma ordem
+  Bomb &bomba = bombas[job.pump];
+  if (bomba.estoqueUl > 0)
+  {
+    bomba.estoqueUl -= dosedUl;
+    if (bomba.estoqueUl < 0) bomba.estoqueUl = 0;
+  }
+  appliedDose = {state.startSeq, logNextSeq, dosedUl};
+  DateTime timestamp(job.time);
+  recordConsumption(job.pump, dosedUl, timestamp);
+  saveBombasConfig();
+  appendLocalLog(job.pump, dosedUl, JOURNAL_ORIGINS[job.origin < JOURNAL_ORIGIN_COUNT ? job.origin : 0],
+                 timestamp);
+}
+
+// Reset depois da baixa gravada e antes do DONE: o estoque já tem a dose.
+// Falta só a linha de log, se o seq reservado para ela ainda não foi usado
+void completeAppliedDose(const ReplayState &state)
+{
+  const ReplayJob &job = state.activeJob;
+  bool logged = logNextSeq > appliedDose.logSeq;
+  hal::logf("[journal] Dose ja debitada no reset: Bomba %d, %s ml, log %s\n", job.pump + 1,
+            MlText(appliedDose.dosedUl).c_str(), logged ? "gravado" : "refeito");
+  if (logged) return;
+
+  appendLocalLog(job.pump, appliedDose.dosedUl, JOURNAL_ORIGINS[job.origin < JOURNAL_ORIGIN_COUNT ? job.origin : 0],
+                 DateTime(job.time));
+}
+
+void requeuePending(const ReplayState &state)
+{
+  uint32_t now = rtcReady ? clockNow().unixtime() : 0;
+  uint8_t programOrigin = originCode(PROGRAM_ORIGIN);
+  for (uint8_t i = 0; i < state.pendingCount; i++)
+  {
+    const ReplayJob &job = state.pending[i];
+    // Passos de programa não voltam: as esperas entre eles se perderam
+    bool fresh = JOURNAL_REQUEUE_PENDING && rtcReady && now >= job.time &&
+                 now - job.time <= JOURNAL_REQUEUE_MAX_AGE_S && job.origin != programOrigin;
+    const char *origem = JOURNAL_ORIGINS[job.origin < JOURNAL_ORIGIN_COUNT ? job.origin : 0];
+
+    if (fresh && enqueuePumpJob(job.pump, job.dosagemUl, origem))
+    {
+      journalStats.requeued++;
+      continue;
+    }
+    journalStats.discarded++;
+    hal::logf("[journal] Job pendente descartado: Bomba %d, %s ml, Origem: %s\n", job.pump + 1,
+              MlText(job.dosagemUl).c_str(), origem);
+  }
+}
+
+// Lê o slot; false = fora do arquivo ou registro inválido
+bool readSlot(hal::File &file, uint16_t slot, JournalRecord &record)
+{
+  return file.seek(slot * sizeof(JournalRecord)) && file.read(&record, sizeof(record)) == sizeof(record) &&
+         recordValid(record);
+}
+} // namespace
+
+void initJournal()
+{
+  journalFile.close();
+  memset(&journalStats, 0, sizeof(journalStats));
+  journalStats.nextSeq = 1;
+  nextSlot = 0;
+  sinceCheckpoint = 0;
+  journaledTail = pumpTail;
+  activeStartSeq = 0;
+  activeStartTime = 0;
+  activeDurationMs = 0;
+  activeProgressMs = 0;
+  if (!fsReady) return;
+
+  ReplayState state;
+  memset(&state, 0, sizeof(state));
+
+  hal::File file = hal::fsOpen(JOURNAL_FILE, hal::FILE_MODE_READ);
+  bool sized = file && file.size() == JOURNAL_SLOTS * sizeof(JournalRecord);
+  if (sized)
+  {
+    // Passo 1: registro mais novo (próximo slot) e último checkpoint
+    uint32_t newestSeq = 0;
+    uint32_t checkpointSeq = 0;
+    uint16_t checkpointSlot = 0;
+    JournalRecord record;
+    for (uint16_t slot = 0; slot < JOURNAL_SLOTS; slot++)
+    {
+      if (!readSlot(file, slot, record)) continue;
+      if (record.seq >= newestSeq)
+      {
+        newestSeq = record.seq;
+        nextSlot = (slot + 1) % JOURNAL_SLOTS;
+      }
+      if (record.type == JOURNAL_CHECKPOINT && record.seq >= checkpointSeq)
+      {
+        checkpointSeq = record.seq;
+        checkpointSlot = slot;
+      }
+    }
+    journalStats.nextSeq = newestSeq + 1;
+
+    // Passo 2: registros contínuos depois do checkpoint
+    if (checkpointSeq > 0)
+    {
+      uint32_t expected = checkpointSeq + 1;
+      for (uint16_t step = 1; step < JOURNAL_SLOTS; step++, expected++)
+      {
+        if (!readSlot(file, (checkpointSlot + step) % JOURNAL_SLOTS, record) || record.seq != expected) break;
+        applyRecord(state, record);
+        journalStats.replayed++;
+      }
+    }
+  }
+  file.close();
+
+  // Diário recriado: o seq não pode voltar para trás da dose já debitada
+  if (journalStats.nextSeq <= appliedDose.journalSeq) journalStats.nextSeq = appliedDose.journalSeq + 1;
+
+  if (!sized && !preallocate())
+  {
+    hal::logf("[journal] ERRO: Falha ao pre-alocar %s\n", JOURNAL_FILE);
+    return;
+  }
+
+  journalFile = hal::fsOpen(JOURNAL_FILE, hal::FILE_MODE_UPDATE);
+  if (!journalFile)
+  {
+    hal::logf("[journal] ERRO: Falha ao abrir %s\n", JOURNAL_FILE);
+    return;
+  }
+
+  if (state.active && state.startSeq <= appliedDose.journalSeq)
+    completeAppliedDose(state);
+  else if (state.active)
+    reconcilePartialDose(state);
+
+  // Estado reconciliado: novo ponto de partida antes de reenfileirar
+  takeCheckpoint();
+  requeuePending(state);
+
+  hal::logf("[journal] Diario pronto: %u registros relidos, dose parcial: %s, %u reenfileirados, %u descartados\n",
+            journalStats.replayed, journalStats.partialDose ? "sim" : "nao", journalStats.requeued,
+            journalStats.discarded);
+}
+
+void journalQueuedJobs()
+{
+  for (;;)
+  {
+    pumpQueueLock.enter();
+    bool pending = journaledTail != pumpTail;
+    PumpJob job;
+    if (pending) job = pumpQueue[journaledTail];
+    pumpQueueLock.exit();
+    if (!pending) return;
+
+    // Avança antes de gravar: um checkpoint disparado aqui já inclui o job
+    journaledTail = (journaledTail + 1) % MAX_PUMP_QUEUE;
+    writeEnqueue(job);
+  }
+}
+
+void journalStart(int64_t durationUs)
+{
+  activeStartTime = activeJob.timestamp.unixtime();
+  if (rtcReady) activeStartTime = clockNow().unixtime();
+  activeDurationMs = static_cast<int32_t>(durationUs / 1000);
+  activeProgressMs = 0;
+  activeStartSeq = journalStats.nextSeq;
+  writeRecord(JOURNAL_START, activeJob.bombaIndex, 0, activeDurationMs, activeStartTime);
+}
+
+void journalProgress(int64_t elapsedUs)
+{
+  int32_t elapsedMs = static_cast<int32_t>(elapsedUs / 1000);
+  if (elapsedMs - activeProgressMs < JOURNAL_PROGRESS_MS) return;
+  activeProgressMs = elapsedMs;
+  writeRecord(JOURNAL_PROGRESS, activeJob.bombaIndex, 0, elapsedMs, 0);
+}
+
+void journalDone()
+{
+  activeProgressMs = 0;
+  writeRecord(JOURNAL_DONE, activeJob.bombaIndex, 0, 0, 0);
+}
+
+uint32_t journalActiveSeq()
+{
+  return activeStartSeq;
+}
+
+void journalDropped(const PumpJob &job)
+{
+  writeRecord(JOURNAL_DROP, job.bombaIndex, 0, 0, 0);
+}
@@ -0,0 +1,7 @@
+#include "dosing.h"
+
+// =========================================================
+// Arenas JSON (compartilhadas entre núcleo e handlers HTTP)
+// =========================================================
+StaticJsonArenaPool<JSON_ARENA_SMALL_COUNT, JSON_ARENA_SMALL_SIZE> jsonSmallPool("small");
+StaticJsonArenaPool<JSON_ARENA_LARGE_COUNT, JSON_ARENA_LARGE_SIZE> jsonLargePool("large");
@@ -0,0 +1,617 @@
+#include "dosing.h"
+
+#include <string.h>
+
+// =========================================================
+// Logs locais (partição crua ou LittleFS)
+// =========================================================
+bool fsReady = false;
+size_t logCount = 0;
+bool logPartitionReady = false;
+uint32_t logNextSeq = 1;
+
+// Cada linha começa com {"seq":N: o seq sai sem parse (logs, outbox, hub).
+// 0 = linha sem seq (gravada antes dele existir, ou cortada)
+uint32_t logLineSeq(const char *line, size_t length)
+{
+  static const char prefix[] = "{\"seq\":";
+  const size_t prefixLength = sizeof(prefix) - 1;
+  if (length <= prefixLength || strncmp(line, prefix, prefixLength) != 0) return 0;
+
+  uint32_t seq = 0;
+  for (size_t i = prefixLength; i < length && line[i] >= '0' && line[i] <= '9'; i++)
+    seq = seq * 10 + static_cast<uint32_t>(line[i] - '0');
+  return seq;
+}
+
+// --- Partição crua ---
+// A partição LOG_PARTITION_LABEL é um anel de setores de LOG_SECTOR_SIZE.
+// Cada setor começa com um cabeçalho (seq crescente) e guarda registros
+// {tamanho, CRC-8, marcador} + a linha JSON, alinhados a 4 bytes e sem
+// atravessar setores. O append grava no setor da frente; cheio, passa ao
+// próximo do anel, apagando-o (e descartando os registros mais antigos),
+// então todos os setores são apagados no mesmo ritmo: uma volta do anel
+// por apagamento. A leitura não copia nada: as linhas são ponteiros para
+// a janela mapeada da partição.
+//
+// A linha vai para a flash antes do cabeçalho do registro: um leitor
+// concorrente (ou um reset no meio) vê o cabeçalho ainda apagado e para
+// ali. No boot, registro com CRC errado recebe marcador zerado (só zera
+// bits, sem apagar) e some das leituras; setor com lixo depois do último
+// registro é dado como cheio.
+//
+// O cabeçalho do setor guarda o próximo seq de log no momento em que o
+// setor foi aberto: depois de um DELETE /logs (setor marcado) o boot
+// continua a numeração em vez de voltar a 1.
+//
+// Só o loop grava e gira o anel (o DELETE /logs só pede a limpeza); os
+// leitores no HTTP copiam o estado do anel sob logRingLock, copiam cada
+// registro para o buffer deles e só então conferem o seq do cabeçalho do
+// setor: setor reaproveitado (ou apagado) no meio da cópia encerra o cursor
+// sem entregar a linha.
+namespace
+{
+const uint32_t LOG_SECTOR_MAGIC = 0x474F4C44; // "DLOG"
+const uint32_t LOG_SECTOR_CLEARED = 0x1;      // DELETE /logs: setores anteriores não contam
+const uint8_t LOG_RECORD_VALID = 0xA5;
+const uint8_t LOG_RECORD_DEAD = 0x00;
+
+struct LogSectorHeader
+{
+  uint32_t magic;
+  uint32_t seq;
+  uint32_t flags;
+  uint32_t firstSeq; // logNextSeq na abertura (0xFFFFFFFF em setores antigos)
+};
+
+struct LogRecordHeader
+{
+  uint16_t length;
+  uint8_t crc;
+  uint8_t marker;
+};
+
+const uint8_t *logFlash = nullptr;
+uint16_t logSectors = 0;
+uint16_t headSector = 0;   // setor recebendo appends
+uint32_t headOffset = 0;
+uint32_t headSeq = 0;
+uint16_t firstSector = 0;  // setor mais antigo ainda no log
+uint16_t sectorRecords[LOG_PARTITION_MAX_SECTORS];
+size_t liveRecords = 0;
+uint32_t scannedMaxSeq = 0; // maior seq visto por scanSector() no boot
+hal::CriticalSection logRingLock; // firstSector, head*, liveRecords, sectorRecords
+volatile bool clearPending = false;
+
+uint32_t alignedRecordSize(size_t length)
+{
+  return static_cast<uint32_t>((sizeof(LogRecordHeader) + length + 3) & ~static_cast<size_t>(3));
+}
+
+const LogSectorHeader &sectorHeader(uint16_t sector)
+{
+  return *reinterpret_cast<const LogSectorHeader *>(logFlash + static_cast<size_t>(sector) * LOG_SECTOR_SIZE);
+}
+
+const LogRecordHeader &recordHeader(uint16_t sector, uint32_t offset)
+{
+  return *reinterpret_cast<const LogRecordHeader *>(logFlash + static_cast<size_t>(sector) * LOG_SECTOR_SIZE +
+                                                    offset);
+}
+
+// Registro inteiro dentro do setor? (cabeçalho apagado ou torto = fim)
+bool recordFits(const LogRecordHeader &record, uint32_t offset)
+{
+  return record.marker != 0xFF && record.length > 0 && record.length <= LOG_LINE_MAX &&
+         offset + alignedRecordSize(record.length) <= LOG_SECTOR_SIZE;
+}
+
+void updateLogCount()
+{
+  logCount = liveRecords < LOG_LIMIT ? liveRecords : LOG_LIMIT;
+}
+
+// Conta os registros válidos do setor (marcando os corrompidos) e devolve
+// onde o próximo append pode gravar
+uint32_t scanSector(uint16_t sector, uint16_t &valid)
+{
+  size_t base = static_cast<size_t>(sector) * LOG_SECTOR_SIZE;
+  uint32_t offset = sizeof(LogSectorHeader);
+  valid = 0;
+
+  while (offset + sizeof(LogRecordHeader) <= LOG_SECTOR_SIZE)
+  {
+    const LogRecordHeader &record = recordHeader(sector, offset);
+    if (!recordFits(record, offset)) break;
+
+    const uint8_t *line = logFlash + base + offset + sizeof(LogRecordHeader);
+    if (record.marker == LOG_RECORD_VALID && record.crc == crc8(line, record.length))
+    {
+      valid++;
+      uint32_t seq = logLineSeq(reinterpret_cast<const char *>(line), record.length);
+      if (seq > scannedMaxSeq) scannedMaxSeq = seq;
+    }
+    else if (record.marker != LOG_RECORD_DEAD)
+    {
+      LogRecordHeader dead = record;
+      dead.marker = LOG_RECORD_DEAD;
+      hal::partitionWrite(base + offset, &dead, sizeof(dead));
+    }
+    offset += alignedRecordSize(record.length);
+  }
+
+  // Depois do último registro tudo tem de estar apagado; senão o setor
+  // não recebe mais nada (gravar por cima de bits já zerados corrompe)
+  for (uint32_t i = offset; i < LOG_SECTOR_SIZE; i++)
+  {
+    if (logFlash[base + i] != 0xFF) return LOG_SECTOR_SIZE;
+  }
+  return offset;
+}
+
+bool startSector(uint16_t sector, uint32_t flags)
+{
+  FlashOpTimer timer(FLASH_OP_LOG_ERASE);
+  if (!hal::partitionErase(static_cast<size_t>(sector) * LOG_SECTOR_SIZE, LOG_SECTOR_SIZE)) return false;
+
+  LogSectorHeader header = {LOG_SECTOR_MAGIC, headSeq + 1, flags, logNextSeq};
+  if (!hal::partitionWrite(static_cast<size_t>(sector) * LOG_SECTOR_SIZE, &header, sizeof(header))) return false;
+
+  hal::ScopedCritical lock(logRingLock);
+  headSeq = header.seq;
+  headSector = sector;
+  headOffset = sizeof(LogSectorHeader);
+  sectorRecords[sector] = 0;
+  return true;
+}
+
+// Próximo setor do anel; o mais antigo sai do log quando o anel dá a volta
+// (antes do apagamento, para nenhum cursor novo começar nele)
+bool rotateSector(bool cleared)
+{
+  uint16_t next = (headSector + 1) % logSectors;
+  logRingLock.enter();
+  if (cleared)
+  {
+    liveRecords = 0;
+    firstSector = next;
+  }
+  else if (next == firstSector)
+  {
+    liveRecords -= sectorRecords[next];
+    firstSector = (next + 1) % logSectors;
+  }
+  sectorRecords[next] = 0;
+  updateLogCount();
+  logRingLock.exit();
+  return startSector(next, cleared ? LOG_SECTOR_CLEARED : 0);
+}
+
+bool partitionAppend(const char *line, size_t length)
+{
+  if (length == 0 || length > LOG_LINE_MAX) return false;
+
+  uint32_t size = alignedRecordSize(length);
+  if (headOffset + size > LOG_SECTOR_SIZE && !rotateSector(false))
+  {
+    hal::logf("[log] ERRO: Falha ao apagar setor %u da particao\n", (headSector + 1) % logSectors);
+    return false;
+  }
+
+  size_t base = static_cast<size_t>(headSector) * LOG_SECTOR_SIZE + headOffset;
+  LogRecordHeader record = {static_cast<uint16_t>(length), crc8(line, length), LOG_RECORD_VALID};
+  // Linha primeiro, cabeçalho por último (ver acima); o alinhamento fica 0xFF
+  bool written = hal::partitionWrite(base + sizeof(record), line, length) &&
+                 hal::partitionWrite(base, &record, sizeof(record));
+  // Mesmo com falha o espaço foi tocado: o próximo append vai adiante
+  hal::ScopedCritical lock(logRingLock);
+  headOffset += size;
+  if (!written) return false;
+
+  sectorRecords[headSector]++;
+  liveRecords++;
+  updateLogCount();
+  return true;
+}
+
+// Setores válidos do mais novo para trás, parando no primeiro salto de
+// seq, setor apagado ou marca de limpeza
+bool initLogPartition()
+{
+  size_t size = 0;
+  if (!hal::partitionBegin(LOG_PARTITION_LABEL, logFlash, size)) return false;
+
+  logSectors = static_cast<uint16_t>(size / LOG_SECTOR_SIZE);
+  if (logSectors > LOG_PARTITION_MAX_SECTORS) logSectors = LOG_PARTITION_MAX_SECTORS;
+  if (logSectors < 2)
+  {
+    hal::logf("[log] ERRO: Particao %s pequena demais\n", LOG_PARTITION_LABEL);
+    return false;
+  }
+
+  int newest = -1;
+  for (uint16_t sector = 0; sector < logSectors; sector++)
+  {
+    const LogSectorHeader &header = sectorHeader(sector);
+    if (header.magic != LOG_SECTOR_MAGIC) continue;
+    if (newest < 0 || header.seq > sectorHeader(newest).seq) newest = sector;
+  }
+
+  memset(sectorRecords, 0, sizeof(sectorRecords));
+  liveRecords = 0;
+  scannedMaxSeq = 0;
+
+  if (newest < 0)
+  {
+    // Partição virgem (ou de outro formato): começa no setor 0
+    headSeq = 0;
+    headSector = logSectors - 1;
+    firstSector = 0;
+    if (!startSector(0, LOG_SECTOR_CLEARED)) return false;
+  }
+  else
+  {
+    headSector = static_cast<uint16_t>(newest);
+    headSeq = sectorHeader(headSector).seq;
+    firstSector = headSector;
+    for (uint16_t steps = 1; steps < logSectors; steps++)
+    {
+      if (sectorHeader(firstSector).flags & LOG_SECTOR_CLEARED) break;
+      uint16_t previous = (firstSector + logSectors - 1) % logSectors;
+      const LogSectorHeader &header = sectorHeader(previous);
+      if (header.magic != LOG_SECTOR_MAGIC || header.seq + 1 != sectorHeader(firstSector).seq) break;
+      firstSector = previous;
+    }
+
+    for (uint16_t sector = firstSector;; sector = (sector + 1) % logSectors)
+    {
+      uint32_t end = scanSector(sector, sectorRecords[sector]);
+      liveRecords += sectorRecords[sector];
+      if (sector == headSector)
+      {
+        headOffset = end;
+        break;
+      }
+    }
+
+    uint32_t sectorSeq = sectorHeader(headSector).firstSeq;
+    logNextSeq = scannedMaxSeq + 1;
+    if (sectorSeq != 0xFFFFFFFF && sectorSeq > logNextSeq) logNextSeq = sectorSeq;
+  }
+  updateLogCount();
+  return true;
+}
+
+// Logs de antes da partição (LittleFS) entram no anel uma vez
+void importLogFile()
+{
+  if (!fsReady || !hal::fsExists(LOG_FILE)) return;
+
+  hal::File file = hal::fsOpen(LOG_FILE, hal::FILE_MODE_READ);
+  if (!file) return;
+
+  char line[LOG_LINE_MAX];
+  size_t length;
+  size_t imported = 0;
+  while (file.readLine(line, sizeof(line), length))
+  {
+    if (length > 0 && partitionAppend(line, length)) imported++;
+  }
+  file.close();
+  hal::fsRemove(LOG_FILE);
+  hal::logf("[log] %u logs migrados do LittleFS para a particao\n", static_cast<unsigned int>(imported));
+}
+
+// Setor do cursor ainda é o que ele começou a ler?
+bool cursorSectorCurrent(const LogCursor &cursor)
+{
+  const LogSectorHeader &header = sectorHeader(cursor.sector);
+  return header.magic == LOG_SECTOR_MAGIC && header.seq == cursor.sectorSeq;
+}
+} // namespace
+
+void logCursorBegin(LogCursor &cursor)
+{
+  hal::ScopedCritical lock(logRingLock);
+  cursor.sector = firstSector;
+  // Limpeza pedida e ainda não feita pelo loop: nada para ler
+  cursor.sectorsLeft = logPartitionReady && !clearPending ? logSectors : 0;
+  cursor.sectorSeq = logPartitionReady ? sectorHeader(firstSector).seq : 0;
+  cursor.offset = sizeof(LogSectorHeader);
+  cursor.skip = liveRecords > LOG_LIMIT ? liveRecords - LOG_LIMIT : 0;
+}
+
+bool logCursorNext(LogCursor &cursor, char *line, size_t &length)
+{
+  if (!logPartitionReady) return false;
+
+  while (cursor.sectorsLeft > 0)
+  {
+    if (!cursorSectorCurrent(cursor)) break;
+
+    const LogRecordHeader *record = nullptr;
+    if (cursor.offset + sizeof(LogRecordHeader) <= LOG_SECTOR_SIZE)
+    {
+      record = &recordHeader(cursor.sector, cursor.offset);
+      if (!recordFits(*record, cursor.offset)) record = nullptr;
+    }
+
+    if (record == nullptr)
+    {
+      // Fim do setor: o da frente (ou um aberto por DELETE /logs depois
+      // do começo da leitura) encerra a leitura
+      logRingLock.enter();
+      bool atHead = (cursor.sector == headSector);
+      logRingLock.exit();
+      if (atHead) break;
+      cursor.sector = (cursor.sector + 1) % logSectors;
+      cursor.sectorsLeft--;
+      cursor.sectorSeq++;
+      cursor.offset = sizeof(LogSectorHeader);
+      if (sectorHeader(cursor.sector).flags & LOG_SECTOR_CLEARED) break;
+      continue;
+    }
+
+    uint32_t offset = cursor.offset;
+    uint16_t recordLength = record->length;
+    cursor.offset += alignedRecordSize(recordLength);
+    if (record->marker != LOG_RECORD_VALID) continue;
+    if (cursor.skip > 0)
+    {
+      cursor.skip--;
+      continue;
+    }
+
+    memcpy(line, logFlash + static_cast<size_t>(cursor.sector) * LOG_SECTOR_SIZE + offset + sizeof(LogRecordHeader),
+           recordLength);
+    // Cabeçalho conferido depois da cópia: um apagamento no meio dela
+    // trocou o seq, e a linha (talvez 0xFF) não sai
+    if (!cursorSectorCurrent(cursor)) break;
+    length = recordLength;
+    return true;
+  }
+  return false;
+}
+
+// --- LittleFS ---
+
+size_t countLogLines(hal::File &file)
+{
+  char line[LOG_LINE_MAX];
+  size_t length;
+  size_t count = 0;
+  while (file.readLine(line, sizeof(line), length))
+  {
+    if (length > 0) count++;
+  }
+  return count;
+}
+
+// Temporário de uma compactação (trim de logs, outbox, hub) que sobrou de
+// um reset. O rename do LittleFS troca o destino de forma atômica, então
+// com o destino presente o temporário é só lixo; sem ele, é uma compactação
+// que apagou o destino antes de renomear e o temporário já está completo
+void recoverTempFile(const char *tempPath, const char *path)
+{
+  if (!fsReady || !hal::fsExists(tempPath)) return;
+  if (hal::fsExists(path))
+  {
+    hal::fsRemove(tempPath);
+    hal::logf("[fs] %s descartado (compactacao interrompida)\n", tempPath);
+  }
+  else if (hal::fsRename(tempPath, path))
+  {
+    hal::logf("[fs] %s recuperado de %s\n", path, tempPath);
+  }
+}
+
+bool trimLogFile(size_t removeCount)
+{
+  FlashOpTimer timer(FLASH_OP_LOG_TRIM);
+  if (removeCount == 0) return true;
+  if (!hal::fsExists(LOG_FILE)) return true;
+
+  hal::File input = hal::fsOpen(LOG_FILE, hal::FILE_MODE_READ);
+  if (!input)
+  {
+    hal::logf("[log] ERRO: Falha ao abrir arquivo de logs para trim\n");
+    return false;
+  }
+
+  hal::File output = hal::fsOpen(LOG_TEMP_FILE, hal::FILE_MODE_WRITE);
+  if (!output)
+  {
+    hal::logf("[log] ERRO: Falha ao criar arquivo temporario de logs\n");
+    input.close();
+    return false;
+  }
+
+  char line[LOG_LINE_MAX + 1];
+  size_t length;
+  size_t skipped = 0;
+  while (input.readLine(line, LOG_LINE_MAX, length))
+  {
+    if (length == 0) continue;
+    if (skipped < removeCount)
+    {
+      skipped++;
+      continue;
+    }
+    line[length] = '\n';
+    output.write(line, length + 1);
+  }
+
+  input.close();
+  output.close();
+
+  // Direto por cima: um reset antes do rename deixa o arquivo antigo inteiro
+  if (!hal::fsRename(LOG_TEMP_FILE, LOG_FILE))
+  {
+    hal::logf("[log] ERRO: Falha ao substituir arquivo de logs\n");
+    return false;
+  }
+
+  return true;
+}
+
+bool initLogStorage()
+{
+  fsReady = hal::fsBegin();
+  if (!fsReady)
+    hal::logf("[log] ERRO: Falha ao iniciar LittleFS\n");
+
+  // Partição própria tem preferência; o LittleFS fica com outbox e diário
+  logPartitionReady = initLogPartition();
+  if (logPartitionReady)
+  {
+    importLogFile();
+    hal::logf("[log] Logs na particao %s: %u (%u setores)\n", LOG_PARTITION_LABEL,
+              static_cast<unsigned int>(liveRecords), logSectors);
+    return true;
+  }
+  if (!fsReady) return false;
+
+  recoverTempFile(LOG_TEMP_FILE, LOG_FILE);
+  if (!hal::fsExists(LOG_FILE))
+  {
+    hal::File file = hal::fsOpen(LOG_FILE, hal::FILE_MODE_WRITE);
+    if (!file)
+    {
+      hal::logf("[log] ERRO: Falha ao criar arquivo de logs\n");
+      return false;
+    }
+    file.close();
+    logCount = 0;
+    return true;
+  }
+
+  hal::File file = hal::fsOpen(LOG_FILE, hal::FILE_MODE_READ);
+  if (!file)
+  {
+    hal::logf("[log] ERRO: Falha ao abrir arquivo de logs\n");
+    return false;
+  }
+
+  // Contagem e último seq numa passada; o piso da NVS cobre um DELETE /logs
+  char line[LOG_LINE_MAX];
+  size_t length;
+  uint32_t lastSeq = 0;
+  logCount = 0;
+  while (file.readLine(line, sizeof(line), length))
+  {
+    if (length == 0) continue;
+    logCount++;
+    uint32_t seq = logLineSeq(line, length);
+    if (seq > lastSeq) lastSeq = seq;
+  }
+  file.close();
+
+  uint32_t floorSeq = 0;
+  if (prefsReady && hal::kvGetBytes("logSeq", &floorSeq, sizeof(floorSeq)) != sizeof(floorSeq)) floorSeq = 0;
+  logNextSeq = lastSeq + 1 > floorSeq ? lastSeq + 1 : floorSeq;
+
+  if (logCount > LOG_LIMIT)
+  {
+    size_t removeCount = logCount - LOG_LIMIT;
+    if (trimLogFile(removeCount))
+      logCount = LOG_LIMIT;
+  }
+
+  hal::logf("[log] Logs carregados: %u\n", static_cast<unsigned int>(logCount));
+  return true;
+}
+
+void appendLocalLog(int bombaIndex, int32_t dosagemUl, const char *origem, const DateTime &timestamp)
+{
+  FlashOpTimer timer(FLASH_OP_LOG_APPEND);
+  if (!fsReady && !logPartitionReady) return;
+  if (bombaIndex < 0 || bombaIndex >= BOMBA_COUNT) return;
+  if (dosagemUl <= 0) return;
+
+  char timestampText[TIMESTAMP_SIZE];
+  formatTimestamp(timestamp, timestampText, sizeof(timestampText));
+
+  JsonLease lease(jsonSmallPool);
+  JsonDocument &doc = lease.doc();
+  // Primeiro campo: lido sem parse em logLineSeq(). O seq só avança depois
+  // da gravação, para o setor aberto por ela registrar a linha como sua
+  doc["seq"] = logNextSeq;
+  doc["bombaId"] = bombaIndex + 1;
+  doc["timestamp"] = timestampText;
+  doc["bomba"] = bombas[bombaIndex].name.c_str();
+  jsonSetMl(doc["dosagem"], dosagemUl);
+  doc["origem"] = origem;
+
+  // Uma linha por dose: serializa no buffer e grava de uma vez
+  char line[LOG_LINE_MAX + 1];
+  size_t length = serializeJson(doc, line, LOG_LINE_MAX);
+
+  if (logPartitionReady)
+  {
+    if (!partitionAppend(line, length))
+      hal::logf("[log] ERRO: Falha ao gravar log na particao\n");
+    logNextSeq++;
+    outboxAppend(bombaIndex, dosagemUl, origem, timestampText);
+    return;
+  }
+
+  if (logCount >= LOG_LIMIT)
+  {
+    size_t removeCount = (logCount - LOG_LIMIT) + 1;
+    if (!trimLogFile(removeCount))
+    {
+      hal::logf("[log] ERRO: Falha ao limpar logs antigos\n");
+      logNextSeq++;
+      return;
+    }
+    logCount = (logCount > removeCount) ? (logCount - removeCount) : 0;
+  }
+
+  hal::File file = hal::fsOpen(LOG_FILE, hal::FILE_MODE_APPEND);
+  if (!file)
+  {
+    hal::logf("[log] ERRO: Falha ao abrir arquivo de logs para escrita\n");
+    logNextSeq++;
+    return;
+  }
+
+  line[length] = '\n';
+  file.write(line, length + 1);
+  file.close();
+
+  logNextSeq++;
+  logCount++;
+  outboxAppend(bombaIndex, dosagemUl, origem, timestampText);
+}
+
+// DELETE /logs (HTTP): a limpeza é feita pelo loop em serviceLocalLogs(),
+// o único que grava no anel e no arquivo
+void requestClearLocalLogs()
+{
+  clearPending = true;
+}
+
+void serviceLocalLogs()
+{
+  if (!clearPending) return;
+  clearLocalLogs();
+  clearPending = false;
+  hal::logf("[log] Logs locais apagados\n");
+}
+
+void clearLocalLogs()
+{
+  // Na partição basta abrir um setor marcado: os anteriores deixam de contar
+  if (logPartitionReady)
+  {
+    rotateSector(true);
+    return;
+  }
+
+  if (hal::fsExists(LOG_FILE))
+    hal::fsRemove(LOG_FILE);
+
+  // Sem linhas para reler no boot: o seq continua pela NVS
+  if (prefsReady) hal::kvPutBytes("logSeq", &logNextSeq, sizeof(logNextSeq));
+  logCount = 0;
+}
@@ -0,0 +1,405 @@
+#include "dosing.h"
+
+#include <string.h>
+
+// =========================================================
+// Outbox (sincronização com a nuvem)
+// =========================================================
+// Cada dose registrada vira uma linha em OUTBOX_FILE com um número de
+// sequência crescente por dispositivo. O loop monta lotes a partir do
+// flash (só com as bombas paradas) e uma task envia por hal::httpPost();
+// o último seq confirmado fica na NVS, então depois de um reboot o envio
+// recomeça do primeiro evento não confirmado. Um lote reenviado (queda
+// entre o 2xx e a gravação na NVS) repete os mesmos seq: o destino
+// descarta pelo par (device, seq).
+OutboxStats outboxStats;
+
+namespace
+{
+hal::CriticalSection outboxLock;
+InlineString<OUTBOX_URL_SIZE> outboxUrlSetting;
+bool outboxReady = false;
+
+volatile OutboxState outboxState = OUTBOX_IDLE;
+InlineString<OUTBOX_URL_SIZE> batchUrl;
+char batchBody[OUTBOX_BODY_MAX];
+size_t batchLength = 0;
+uint32_t batchLastSeq = 0;
+uint32_t batchCount = 0;
+size_t batchEndOffset = 0;
+int batchStatus = 0;
+
+size_t readOffset = 0; // primeiro byte do primeiro evento não confirmado
+uint32_t fileLines = 0;
+uint32_t pendingSince = 0;
+unsigned long nextAttemptAt = 0;
+bool attemptScheduled = false;
+
+void persistAck()
+{
+  if (prefsReady)
+    hal::kvPutBytes("outboxAck", &outboxStats.ackedSeq, sizeof(outboxStats.ackedSeq));
+}
+
+void scheduleAttempt(unsigned long delayMs)
+{
+  unsigned long at = hal::millis() + delayMs;
+  if (!attemptScheduled || static_cast<long>(at - nextAttemptAt) < 0)
+    nextAttemptAt = at;
+  attemptScheduled = true;
+}
+
+void resetOutboxFile()
+{
+  hal::fsRemove(OUTBOX_FILE);
+  readOffset = 0;
+  fileLines = 0;
+  outboxStats.pending = 0;
+}
+
+// Reescreve o arquivo só com os pendentes, descartando os dropOldest mais
+// antigos (outbox cheio, sem rede há muito tempo)
+bool compactOutbox(uint32_t dropOldest)
+{
+  hal::File input = hal::fsOpen(OUTBOX_FILE, hal::FILE_MODE_READ);
+  hal::File output = hal::fsOpen(OUTBOX_TEMP_FILE, hal::FILE_MODE_WRITE);
+  if (!input || !output || !input.seek(readOffset))
+  {
+    hal::logf("[sync] ERRO: Falha ao compactar outbox\n");
+    return false;
+  }
+
+  char line[LOG_LINE_MAX + 2];
+  size_t length;
+  uint32_t dropped = 0;
+  uint32_t kept = 0;
+  uint32_t lastDroppedSeq = 0;
+  while (input.readLine(line, sizeof(line), length))
+  {
+    uint32_t seq = logLineSeq(line, length);
+    if (seq == 0) continue;
+    if (dropped < dropOldest)
+    {
+      dropped++;
+      lastDroppedSeq = seq;
+      continue;
+    }
+    line[length] = '\n';
+    output.write(line, length + 1);
+    kept++;
+  }
+  input.close();
+  output.close();
+
+  // Direto por cima: um reset antes do rename deixa o outbox antigo inteiro
+  if (!hal::fsRename(OUTBOX_TEMP_FILE, OUTBOX_FILE))
+  {
+    hal::logf("[sync] ERRO: Falha ao substituir outbox\n");
+    return false;
+  }
+
+  readOffset = 0;
+  fileLines = kept;
+  outboxStats.pending = kept;
+  if (dropped > 0)
+  {
+    // Os descartados contam como confirmados: o destino vê o salto de seq
+    outboxStats.dropped += dropped;
+    outboxStats.ackedSeq = lastDroppedSeq;
+    persistAck();
+    hal::logf("[sync] Outbox cheio: %u eventos antigos descartados\n", dropped);
+  }
+  return true;
+}
+
+// Lê até OUTBOX_BATCH_MAX eventos a partir de readOffset e monta o corpo:
+// {"device":"...","events":[{...},{...}]}
+bool prepareBatch()
+{
+  hal::File file = hal::fsOpen(OUTBOX_FILE, hal::FILE_MODE_READ);
+  if (!file || !file.seek(readOffset)) return false;
+
+  size_t used = snprintf(batchBody, sizeof(batchBody), "{\"device\":\"%s\",\"events\":[", hal::deviceId());
+  const size_t closing = 2; // "]}"
+  char line[LOG_LINE_MAX + 2];
+  size_t length;
+  size_t offset = readOffset;
+  batchCount = 0;
+
+  while (batchCount < OUTBOX_BATCH_MAX && file.readLine(line, sizeof(line), length))
+  {
+    uint32_t seq = logLineSeq(line, length);
+    if (seq == 0 || seq <= outboxStats.ackedSeq)
+    {
+      offset += length + 1;
+      continue;
+    }
+    if (used + length + 1 + closing >= sizeof(batchBody)) break;
+
+    if (batchCount > 0) batchBody[used++] = ',';
+    memcpy(batchBody + used, line, length);
+    used += length;
+    offset += length + 1;
+    batchLastSeq = seq;
+    batchCount++;
+  }
+  file.close();
+
+  // Só linhas inválidas ou já confirmadas até o fim: nada pendente
+  readOffset = batchCount == 0 ? offset : readOffset;
+  if (batchCount == 0) return false;
+
+  memcpy(batchBody + used, "]}", closing);
+  batchLength = used + closing;
+  batchEndOffset = offset;
+  return true;
+}
+
+void finishBatch(int status)
+{
+  outboxStats.lastStatus = status;
+  bool delivered = status >= 200 && status < 300;
+  // 4xx (exceto 408/429) não melhora com retry: o lote é descartado
+  bool rejected = status >= 400 && status < 500 && status != 408 && status != 429;
+
+  if (delivered || rejected)
+  {
+    if (delivered)
+      outboxStats.sent += batchCount;
+    else
+    {
+      outboxStats.rejected += batchCount;
+      hal::logf("[sync] Lote recusado pelo destino (HTTP %d), %u eventos descartados\n", status, batchCount);
+    }
+
+    outboxStats.batches++;
+    outboxStats.ackedSeq = batchLastSeq;
+    persistAck();
+    readOffset = batchEndOffset;
+    outboxStats.pending = outboxStats.pending > batchCount ? outboxStats.pending - batchCount : 0;
+    outboxStats.backoffMs = 0;
+    attemptScheduled = false;
+
+    if (outboxStats.pending == 0)
+      resetOutboxFile();
+    else
+      scheduleAttempt(0);
+    return;
+  }
+
+  // Falha de transporte ou 5xx: backoff exponencial com um pouco de jitter
+  outboxStats.failures++;
+  uint32_t backoff = outboxStats.backoffMs == 0 ? OUTBOX_BACKOFF_MIN_MS : outboxStats.backoffMs * 2;
+  if (backoff > OUTBOX_BACKOFF_MAX_MS) backoff = OUTBOX_BACKOFF_MAX_MS;
+  outboxStats.backoffMs = backoff;
+  attemptScheduled = false;
+  scheduleAttempt(backoff + static_cast<uint32_t>(hal::micros64() % (backoff / 8 + 1)));
+  hal::logf("[sync] Falha no envio (status %d), nova tentativa em %u s\n", status, backoff / 1000);
+}
+} // namespace
+
+void initOutbox()
+{
+  memset(&outboxStats, 0, sizeof(outboxStats));
+  outboxReady = fsReady;
+  outboxState = OUTBOX_IDLE;
+  readOffset = 0;
+  fileLines = 0;
+  attemptScheduled = false;
+
+  if (prefsReady)
+  {
+    char url[OUTBOX_URL_SIZE];
+    if (hal::kvGetString("syncUrl", url, sizeof(url)) > 0)
+      outboxUrlSetting = url;
+    if (hal::kvGetBytes("outboxAck", &outboxStats.ackedSeq, sizeof(outboxStats.ackedSeq)) != sizeof(outboxStats.ackedSeq))
+      outboxStats.ackedSeq = 0;
+  }
+
+  if (outboxReady) recoverTempFile(OUTBOX_TEMP_FILE, OUTBOX_FILE);
+
+  uint32_t lastSeq = outboxStats.ackedSeq;
+  if (outboxReady && hal::fsExists(OUTBOX_FILE))
+  {
+    hal::File file = hal::fsOpen(OUTBOX_FILE, hal::FILE_MODE_READ);
+    char line[LOG_LINE_MAX + 2];
+    size_t length;
+    size_t offset = 0;
+    bool foundPending = false;
+    while (file.readLine(line, sizeof(line), length))
+    {
+      uint32_t seq = logLineSeq(line, length);
+      if (seq != 0) fileLines++;
+      if (seq > lastSeq) lastSeq = seq;
+      if (seq > outboxStats.ackedSeq)
+      {
+        outboxStats.pending++;
+        foundPending = true;
+      }
+      else if (!foundPending)
+      {
+        offset += length + 1;
+      }
+    }
+    readOffset = offset;
+
+    // Linha cortada no fim (queda durante o append): fecha com '\n' para o
+    // próximo evento não colar nela
+    size_t size = file.size();
+    char last = '\n';
+    if (size > 0 && file.seek(size - 1)) file.read(&last, 1);
+    file.close();
+    if (last != '\n')
+    {
+      hal::File append = hal::fsOpen(OUTBOX_FILE, hal::FILE_MODE_APPEND);
+      append.write("\n", 1);
+    }
+
+    if (outboxStats.pending == 0) resetOutboxFile();
+  }
+
+  outboxStats.nextSeq = lastSeq + 1;
+  if (outboxStats.pending > 0)
+  {
+    pendingSince = hal::millis();
+    scheduleAttempt(OUTBOX_LINGER_MS);
+  }
+
+  hal::logf("[sync] Outbox: %u eventos pendentes, proximo seq %u, destino %s\n", outboxStats.pending,
+            outboxStats.nextSeq, outboxUrlSetting.isEmpty() ? "(desabilitado)" : outboxUrlSetting.c_str());
+}
+
+bool outboxEnabled()
+{
+  hal::ScopedCritical guard(outboxLock);
+  return outboxReady && !outboxUrlSetting.isEmpty();
+}
+
+void setOutboxUrl(const char *url)
+{
+  {
+    hal::ScopedCritical guard(outboxLock);
+    outboxUrlSetting = url;
+  }
+  if (prefsReady) hal::kvPutString("syncUrl", url);
+}
+
+void outboxUrl(char *buffer, size_t size)
+{
+  hal::ScopedCritical guard(outboxLock);
+  snprintf(buffer, size, "%s", outboxUrlSetting.c_str());
+}
+
+void flushOutbox()
+{
+  outboxStats.backoffMs = 0;
+  attemptScheduled = false;
+  scheduleAttempt(0);
+}
+
+void outboxAppend(int bombaIndex, int32_t dosagemUl, const char *origem, const char *timestamp)
+{
+  FlashOpTimer timer(FLASH_OP_OUTBOX_APPEND);
+  if (!outboxEnabled()) return;
+
+  // Outbox cheio: descarta os mais antigos (nunca com um lote em voo, que
+  // aponta para offsets do arquivo atual)
+  if (fileLines >= OUTBOX_LIMIT && outboxState == OUTBOX_IDLE)
+  {
+    uint32_t drop = outboxStats.pending >= OUTBOX_LIMIT ? outboxStats.pending - OUTBOX_LIMIT + OUTBOX_BATCH_MAX : 0;
+    compactOutbox(drop);
+  }
+
+  JsonLease lease(jsonSmallPool);
+  JsonDocument &doc = lease.doc();
+  doc["seq"] = outboxStats.nextSeq; // primeiro campo: lido sem parse em logLineSeq()
+  doc["bombaId"] = bombaIndex + 1;
+  doc["timestamp"] = timestamp;
+  doc["bomba"] = bombas[bombaIndex].name.c_str();
+  jsonSetMl(doc["dosagem"], dosagemUl);
+  doc["origem"] = origem;
+  jsonSetMl(doc["estoque"], bombas[bombaIndex].estoqueUl);
+
+  char line[LOG_LINE_MAX + 1];
+  size_t length = serializeJson(doc, line, LOG_LINE_MAX);
+  line[length] = '\n';
+
+  hal::File file = hal::fsOpen(OUTBOX_FILE, hal::FILE_MODE_APPEND);
+  if (!file || file.write(line, length + 1) != length + 1)
+  {
+    hal::logf("[sync] ERRO: Falha ao gravar evento no outbox\n");
+    return;
+  }
+  file.close();
+
+  outboxStats.nextSeq++;
+  fileLines++;
+  if (outboxStats.pending++ == 0) pendingSince = hal::millis();
+
+  // Doses próximas viajam juntas; lote cheio sai já (fora de backoff)
+  if (outboxStats.pending >= OUTBOX_BATCH_MAX && outboxStats.backoffMs == 0)
+    scheduleAttempt(0);
+  else
+    scheduleAttempt(OUTBOX_LINGER_MS);
+}
+
+// Loop: trata o resultado do lote anterior e monta o próximo. Nunca com
+// bomba ligada, para a leitura do flash não atrasar o corte da dose.
+void serviceOutbox()
+{
+  if (outboxState == OUTBOX_DONE)
+  {
+    int status;
+    {
+      hal::ScopedCritical guard(outboxLock);
+      status = batchStatus;
+      outboxState = OUTBOX_IDLE;
+    }
+    finishBatch(status);
+  }
+
+  if (outboxState != OUTBOX_IDLE || !attemptScheduled) return;
+  if (outboxStats.pending == 0 || !outboxEnabled())
+  {
+    attemptScheduled = false;
+    return;
+  }
+  if (static_cast<long>(hal::millis() - nextAttemptAt) < 0) return;
+  if (!pumpQueueIdle() || !hal::netLinkUp()) return;
+
+  if (!prepareBatch())
+  {
+    // Pendentes eram só linhas inválidas
+    resetOutboxFile();
+    attemptScheduled = false;
+    return;
+  }
+
+  {
+    hal::ScopedCritical guard(outboxLock);
+    batchUrl = outboxUrlSetting;
+    outboxState = OUTBOX_SENDING;
+  }
+  onOutboxBatchReady();
+}
+
+// Task de envio (ou chamada direta no host): bloqueia no POST, fora do loop
+void outboxUpload()
+{
+  if (outboxState != OUTBOX_SENDING) return;
+
+  int64_t startUs = hal::micros64();
+  int status = hal::httpPost(batchUrl.c_str(), "application/json",
+                             reinterpret_cast<const uint8_t *>(batchBody), batchLength);
+  outboxStats.lastUploadMs = static_cast<uint32_t>((hal::micros64() - startUs) / 1000);
+
+  hal::ScopedCritical guard(outboxLock);
+  batchStatus = status;
+  outboxState = OUTBOX_DONE;
+}
+
+uint32_t outboxOldestPendingSec()
+{
+  if (outboxStats.pending == 0) return 0;
+  return (hal::millis() - pendingSince) / 1000;
+}
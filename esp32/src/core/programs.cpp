@@ -0,0 +1,411 @@
+#include "dosing.h"
+
+// =========================================================
+// Programas de dose
+// =========================================================
+// Um programa é uma lista de passos (bomba, volume, espera) validada de
+// uma vez e guardada na tabela. Os passos entram na fila em lotes: um
+// grupo com espera mais os grupos seguintes sem espera. O loop
+// (releaseProgramSteps) grava o lote seguinte contíguo no fim da fila,
+// numa seção crítica, só depois que o lote anterior terminou e a espera
+// venceu; enquanto isso a fila segue livre para doses programadas e
+// manuais. Um lote também nunca ocupa as PROGRAM_QUEUE_RESERVE últimas
+// vagas da fila.
+//
+// O banco liga uma bomba por vez, então um grupo "parallel" roda em
+// sequência imediata, sem espera e sem outro job no meio.
+//
+// A tabela (PROGRAM_SLOTS) guarda os programas em andamento e os últimos
+// terminados, só em RAM: depois de um reset o diário descarta os passos
+// que não começaram e os lotes que esperavam na tabela se perdem.
+namespace
+{
+DoseProgram programs[PROGRAM_SLOTS];
+uint16_t nextProgramId = 1;
+
+// Chamar com pumpQueueLock
+DoseProgram *findProgram(uint16_t id)
+{
+  if (id == 0) return nullptr;
+  for (int i = 0; i < PROGRAM_SLOTS; i++)
+    if (programs[i].id == id) return &programs[i];
+  return nullptr;
+}
+
+bool programFinished(const DoseProgram &program)
+{
+  return program.state == PROGRAM_DONE || program.state == PROGRAM_CANCELLED;
+}
+
+// Slot nunca usado ou o programa terminado mais antigo (chamar com o lock)
+int freeProgramSlot()
+{
+  int slot = -1;
+  for (int i = 0; i < PROGRAM_SLOTS; i++)
+  {
+    if (programs[i].id == 0) return i;
+    if (!programFinished(programs[i])) continue;
+    if (slot < 0 || programs[i].finishedAt < programs[slot].finishedAt) slot = i;
+  }
+  return slot;
+}
+
+// Fim (exclusivo) do lote que começa em first: o grupo de first e os
+// grupos seguintes sem espera, que rodam colados nele
+uint8_t batchEnd(const DoseProgram &program, uint8_t first)
+{
+  uint8_t end = first + 1;
+  while (end < program.stepCount && program.steps[end].delayMs == 0) end++;
+  return end;
+}
+
+// Vagas que um lote pode ocupar sem tocar na reserva (chamar com o lock)
+int freeProgramJobs()
+{
+  int freeJobs = MAX_PUMP_QUEUE - 1 - (pumpTail - pumpHead + MAX_PUMP_QUEUE) % MAX_PUMP_QUEUE;
+  return freeJobs > PROGRAM_QUEUE_RESERVE ? freeJobs - PROGRAM_QUEUE_RESERVE : 0;
+}
+
+// Lote anterior terminado e ainda há passos na tabela
+bool programWaiting(const DoseProgram &program)
+{
+  return program.id != 0 && !programFinished(program) && program.stepsQueued < program.stepCount &&
+         program.stepsDone >= program.stepsQueued;
+}
+
+// Grava o próximo lote contíguo no fim da fila se couber (chamar com o
+// lock); devolve quantos passos entraram
+uint8_t queueBatch(DoseProgram &program, const DateTime &now, int64_t nowUs)
+{
+  uint8_t first = program.stepsQueued;
+  uint8_t end = batchEnd(program, first);
+  if (end - first > freeProgramJobs()) return 0;
+
+  for (uint8_t i = first; i < end; i++)
+  {
+    const ProgramStep &step = program.steps[i];
+    pumpQueue[pumpTail] = {step.bombaIndex, step.dosagemUl, PROGRAM_ORIGIN, now, nowUs, program.id, i};
+    pumpTail = (pumpTail + 1) % MAX_PUMP_QUEUE;
+  }
+  program.stepsQueued = end;
+  return end - first;
+}
+
+bool addStep(DoseProgram &program, uint8_t group, JsonVariantConst entry, uint32_t delayMs)
+{
+  if (program.stepCount >= PROGRAM_MAX_STEPS) return false;
+
+  int bomba = entry["bomb"] | 0;
+  int32_t dosagemUl = jsonMl(entry["dosagem"], 0);
+  if (bomba < 1 || bomba > BOMBA_COUNT || dosagemUl <= 0) return false;
+  if (program.plannedUl > INT32_MAX - dosagemUl) return false;
+
+  ProgramStep &step = program.steps[program.stepCount++];
+  step.bombaIndex = static_cast<uint8_t>(bomba - 1);
+  step.group = group;
+  step.dosagemUl = dosagemUl;
+  step.delayMs = delayMs;
+  program.plannedUl += dosagemUl;
+  return true;
+}
+} // namespace
+
+// Tabela vazia no boot: programas não sobrevivem a um reset
+void initDosePrograms()
+{
+  hal::ScopedCritical lock(pumpQueueLock);
+  for (int i = 0; i < PROGRAM_SLOTS; i++)
+    programs[i] = DoseProgram();
+}
+
+// {"name": "...", "steps": [{"bomb": 1, "dosagem": 5},
+//   {"delay": 300, "parallel": [{"bomb": 2, "dosagem": 3}, {"bomb": 3, "dosagem": 2}]}]}
+// delay em segundos, contado do fim do passo (ou grupo) anterior
+ProgramVerdict parseDoseProgram(JsonVariantConst body, DoseProgram &program)
+{
+  program = DoseProgram();
+  program.name = body["name"] | "Programa";
+
+  uint8_t group = 0;
+  JsonArrayConst entries = body["steps"];
+  for (JsonVariantConst entry : entries)
+  {
+    long delayS = entry["delay"] | 0L;
+    if (delayS < 0 || delayS > PROGRAM_MAX_DELAY_S) return PROGRAM_INVALID;
+    uint32_t delayMs = static_cast<uint32_t>(delayS) * 1000;
+
+    JsonArrayConst parallel = entry["parallel"];
+    if (parallel.isNull())
+    {
+      if (!addStep(program, group, entry, delayMs)) return PROGRAM_INVALID;
+    }
+    else
+    {
+      uint8_t before = program.stepCount;
+      for (JsonVariantConst member : parallel)
+      {
+        if (!addStep(program, group, member, program.stepCount == before ? delayMs : 0)) return PROGRAM_INVALID;
+      }
+      if (program.stepCount == before) return PROGRAM_INVALID;
+    }
+    group++;
+  }
+  if (program.stepCount == 0) return PROGRAM_INVALID;
+
+  // Cada lote precisa caber de uma vez fora da reserva da fila
+  for (uint8_t first = 0; first < program.stepCount; first = batchEnd(program, first))
+  {
+    if (batchEnd(program, first) - first > PROGRAM_BATCH_MAX) return PROGRAM_INVALID;
+  }
+  return PROGRAM_OK;
+}
+
+ProgramVerdict submitDoseProgram(DoseProgram &program, int &detail)
+{
+  DateTime now = clockNow();
+  int64_t nowUs = hal::uptimeUs();
+  detail = 0;
+
+  // Volume pedido por bomba (64 bits: até PROGRAM_MAX_STEPS doses de ~2 L)
+  int64_t neededUl[BOMBA_COUNT] = {};
+  for (uint8_t i = 0; i < program.stepCount; i++)
+    neededUl[program.steps[i].bombaIndex] += program.steps[i].dosagemUl;
+
+  program.state = PROGRAM_QUEUED;
+  program.stepsQueued = 0;
+  program.stepsDone = 0;
+  program.currentStep = -1;
+  program.dosedUl = 0;
+  program.submittedAt = now.unixtime();
+  program.finishedAt = 0;
+  program.waitFromUs = nowUs;
+
+  // Primeiro lote sem espera entra já, junto com a validação
+  bool queueNow = program.steps[0].delayMs == 0;
+  uint8_t firstBatch = batchEnd(program, 0);
+
+  ProgramVerdict verdict = PROGRAM_OK;
+  pumpQueueLock.enter();
+  int slot = freeProgramSlot();
+  int freeJobs = freeProgramJobs();
+
+  if (slot < 0)
+  {
+    verdict = PROGRAM_TABLE_FULL;
+  }
+  else if (queueNow && firstBatch > freeJobs)
+  {
+    verdict = PROGRAM_QUEUE_FULL;
+    detail = freeJobs;
+  }
+  else
+  {
+    // Estoque: o que já está na fila (e a dose ativa) e os passos que
+    // outros programas ainda guardam na tabela saem antes deste
+    int64_t committedUl[BOMBA_COUNT] = {};
+    if (pumpActive) committedUl[activeJob.bombaIndex] += activeJob.dosagemUl;
+    for (int index = pumpHead; index != pumpTail; index = (index + 1) % MAX_PUMP_QUEUE)
+      committedUl[pumpQueue[index].bombaIndex] += pumpQueue[index].dosagemUl;
+    for (int p = 0; p < PROGRAM_SLOTS; p++)
+    {
+      if (programs[p].id == 0 || programFinished(programs[p])) continue;
+      for (uint8_t i = programs[p].stepsQueued; i < programs[p].stepCount; i++)
+        committedUl[programs[p].steps[i].bombaIndex] += programs[p].steps[i].dosagemUl;
+    }
+    for (int i = 0; i < BOMBA_COUNT; i++)
+    {
+      if (neededUl[i] > 0 && neededUl[i] + committedUl[i] > bombas[i].estoqueUl)
+      {
+        verdict = PROGRAM_NO_STOCK;
+        detail = i;
+        break;
+      }
+    }
+  }
+
+  if (verdict == PROGRAM_OK)
+  {
+    program.id = nextProgramId++;
+    if (nextProgramId == 0) nextProgramId = 1;
+    if (queueNow) queueBatch(program, now, nowUs);
+    programs[slot] = program;
+  }
+  pumpQueueLock.exit();
+
+  if (verdict != PROGRAM_OK)
+  {
+    hal::logf("[program] Programa recusado (%s): motivo %d\n", program.name.c_str(), verdict);
+    return verdict;
+  }
+
+  if (queueNow) onPumpJobQueued();
+  hal::logf("[program] Programa %u ADICIONADO (%s): %u passos, %s ml\n", program.id, program.name.c_str(),
+            program.stepCount, MlText(program.plannedUl).c_str());
+  return PROGRAM_OK;
+}
+
+ProgramVerdict cancelDoseProgram(uint16_t id)
+{
+  uint32_t now = clockNow().unixtime();
+  ProgramVerdict verdict = PROGRAM_OK;
+
+  pumpQueueLock.enter();
+  DoseProgram *program = findProgram(id);
+  if (program == nullptr)
+  {
+    verdict = PROGRAM_NOT_FOUND;
+  }
+  else if (programFinished(*program))
+  {
+    verdict = PROGRAM_FINISHED;
+  }
+  else
+  {
+    program->state = PROGRAM_CANCELLED;
+    program->finishedAt = now;
+  }
+  pumpQueueLock.exit();
+
+  if (verdict != PROGRAM_OK) return verdict;
+
+  // O loop tira os passos da fila e corta a dose em andamento
+  hal::logf("[program] Programa %u CANCELADO\n", id);
+  onPumpJobQueued();
+  return PROGRAM_OK;
+}
+
+bool copyDoseProgram(uint8_t slot, DoseProgram &out)
+{
+  if (slot >= PROGRAM_SLOTS) return false;
+  hal::ScopedCritical lock(pumpQueueLock);
+  if (programs[slot].id == 0) return false;
+  out = programs[slot];
+  return true;
+}
+
+// Doses (com a calibração atual) mais as esperas
+int64_t doseProgramDurationUs(const DoseProgram &program)
+{
+  int64_t totalUs = 0;
+  for (uint8_t i = 0; i < program.stepCount; i++)
+  {
+    const ProgramStep &step = program.steps[i];
+    totalUs += static_cast<int64_t>(step.delayMs) * 1000;
+    totalUs += static_cast<int64_t>(step.dosagemUl) * TEMPO_POR_ML * bombas[step.bombaIndex].calibrPpm /
+               CALIBR_PPM_ONE;
+  }
+  return totalUs;
+}
+
+const char *programStateName(ProgramState state)
+{
+  switch (state)
+  {
+  case PROGRAM_QUEUED: return "queued";
+  case PROGRAM_RUNNING: return "running";
+  case PROGRAM_DONE: return "done";
+  case PROGRAM_CANCELLED: return "cancelled";
+  }
+  return "unknown";
+}
+
+// Programa que sumiu da tabela (slot reaproveitado) já tinha terminado
+bool programJobCancelled(const PumpJob &job)
+{
+  if (job.programId == 0) return false;
+  hal::ScopedCritical lock(pumpQueueLock);
+  DoseProgram *program = findProgram(job.programId);
+  return program == nullptr || program->state == PROGRAM_CANCELLED;
+}
+
+void programStepStarted(const PumpJob &job)
+{
+  if (job.programId == 0) return;
+  hal::ScopedCritical lock(pumpQueueLock);
+  DoseProgram *program = findProgram(job.programId);
+  if (program == nullptr) return;
+  if (program->state == PROGRAM_QUEUED) program->state = PROGRAM_RUNNING;
+  program->currentStep = static_cast<int8_t>(job.programStep);
+}
+
+// activeJob.dosagemUl já traz o volume cortado, se o passo foi interrompido
+void programStepFinished(const PumpJob &job)
+{
+  if (job.programId == 0) return;
+  uint32_t now = clockNow().unixtime();
+  bool done = false;
+  DoseProgram snapshot;
+
+  pumpQueueLock.enter();
+  DoseProgram *program = findProgram(job.programId);
+  if (program != nullptr)
+  {
+    program->currentStep = -1;
+    program->stepsDone++;
+    program->dosedUl += job.dosagemUl;
+    // Lote terminado: a espera do próximo conta daqui
+    if (program->stepsDone == program->stepsQueued) program->waitFromUs = hal::uptimeUs();
+    if (program->state == PROGRAM_RUNNING && program->stepsDone >= program->stepCount)
+    {
+      program->state = PROGRAM_DONE;
+      program->finishedAt = now;
+      done = true;
+      snapshot = *program;
+    }
+  }
+  pumpQueueLock.exit();
+
+  if (done)
+    hal::logf("[program] Programa %u CONCLUIDO (%s): %u passos, %s ml\n", snapshot.id, snapshot.name.c_str(),
+              snapshot.stepCount, MlText(snapshot.dosedUl).c_str());
+}
+
+// Entrega à fila o lote de um programa cuja espera venceu. Se não couber
+// fora da reserva, tenta de novo na próxima volta do loop.
+void releaseProgramSteps()
+{
+  // Sem lote vencido não lê o relógio (sem âncora seria o RTC via I2C)
+  if (secondsUntilProgramStep() != 0) return;
+
+  DateTime now = clockNow();
+  int64_t nowUs = hal::uptimeUs();
+  uint16_t id = 0;
+  uint8_t first = 0;
+  uint8_t count = 0;
+
+  pumpQueueLock.enter();
+  for (int i = 0; i < PROGRAM_SLOTS && count == 0; i++)
+  {
+    DoseProgram &program = programs[i];
+    if (!programWaiting(program)) continue;
+    if (nowUs - program.waitFromUs < static_cast<int64_t>(program.steps[program.stepsQueued].delayMs) * 1000)
+      continue;
+    id = program.id;
+    first = program.stepsQueued;
+    count = queueBatch(program, now, nowUs);
+  }
+  pumpQueueLock.exit();
+
+  if (count == 0) return;
+  onPumpJobQueued();
+  hal::logf("[program] Programa %u: passos %u a %u na fila\n", id, first + 1, first + count);
+}
+
+// Segundos até o próximo lote vencer (0 = já venceu), para o modo ocioso
+uint32_t secondsUntilProgramStep()
+{
+  int64_t nowUs = hal::uptimeUs();
+  uint32_t best = NO_NEXT_DOSE;
+
+  hal::ScopedCritical lock(pumpQueueLock);
+  for (int i = 0; i < PROGRAM_SLOTS; i++)
+  {
+    const DoseProgram &program = programs[i];
+    if (!programWaiting(program)) continue;
+    int64_t leftUs = program.waitFromUs + static_cast<int64_t>(program.steps[program.stepsQueued].delayMs) * 1000 -
+                     nowUs;
+    uint32_t seconds = leftUs > 0 ? static_cast<uint32_t>((leftUs + 999999) / 1000000) : 0;
+    if (seconds < best) best = seconds;
+  }
+  return best;
+}
@@ -0,0 +1,203 @@
+#include "dosing.h"
+
+// =========================================================
+// Pump Queue
+// =========================================================
+PumpJob pumpQueue[MAX_PUMP_QUEUE];
+volatile int pumpHead = 0;
+volatile int pumpTail = 0;
+bool pumpActive = false;
+PumpJob activeJob;
+int64_t pumpStartUs = 0;
+int64_t pumpDurationUs = 0;
+int64_t pumpFinishedAtUs = 0;
+hal::CriticalSection pumpQueueLock;
+
+namespace
+{
+// TEMPO_POR_ML ms/ml = µs/µL; calibração em ppm (64 bits: 2 L * 700 * 1e6)
+int64_t doseDurationUs(int32_t dosagemUl, int32_t calibrPpm)
+{
+  return static_cast<int64_t>(dosagemUl) * TEMPO_POR_ML * calibrPpm / CALIBR_PPM_ONE;
+}
+} // namespace
+
+bool enqueuePumpJob(int bombaIndex, int32_t dosagemUl, const char *origem)
+{
+  if (bombaIndex < 0 || bombaIndex >= BOMBA_COUNT || dosagemUl <= 0)
+  {
+    hal::logf("[queue] ERRO: Tentativa invalida de dosagem. Bomba: %d, Dose: %s\n",
+              bombaIndex, MlText(dosagemUl).c_str());
+    return false;
+  }
+
+  DateTime now = clockNow();
+  bool queued = false;
+
+  pumpQueueLock.enter();
+  int nextTail = (pumpTail + 1) % MAX_PUMP_QUEUE;
+  if (nextTail != pumpHead)
+  {
+    // programId 0 e passo 0: dose avulsa, fora de programa
+    pumpQueue[pumpTail] = {bombaIndex, dosagemUl, origem, now, hal::uptimeUs(), 0, 0};
+    pumpTail = nextTail;
+    queued = true;
+  }
+  pumpQueueLock.exit();
+
+  if (queued)
+  {
+    onPumpJobQueued();
+    hal::logf("[queue] Job ADICIONADO: Bomba %d, %s ml, Origem: %s\n",
+              bombaIndex + 1, MlText(dosagemUl).c_str(), origem);
+  }
+  else
+  {
+    hal::logf("[queue] ERRO: Fila de bombas cheia! Ignorando comando.\n");
+  }
+
+  return queued;
+}
+
+int pumpQueueDepth()
+{
+  return (pumpTail - pumpHead + MAX_PUMP_QUEUE) % MAX_PUMP_QUEUE;
+}
+
+bool pumpQueueIdle()
+{
+  return !pumpActive && pumpHead == pumpTail;
+}
+
+void finishPumpJob()
+{
+  int bombaIndex = activeJob.bombaIndex;
+  pumpBank.set(bombaIndex, false);
+  pumpActive = false;
+  pumpFinishedAtUs = hal::uptimeUs();
+
+  reportDoseCutoffDelay(static_cast<uint32_t>(pumpFinishedAtUs - pumpStartUs - pumpDurationUs));
+
+  hal::logf("[pump] BOMBA %d DESLIGADA. Fim da dosagem.\n", bombaIndex + 1);
+
+  // Baixa sob o lock: um commit de config (troca de banco) no meio não a
+  // perde. A dose entra em appliedDose junto, para ir na mesma gravação
+  pumpQueueLock.enter();
+  int32_t anterior = bombas[bombaIndex].estoqueUl;
+  if (anterior > 0)
+  {
+    bombas[bombaIndex].estoqueUl -= activeJob.dosagemUl;
+    if (bombas[bombaIndex].estoqueUl < 0) bombas[bombaIndex].estoqueUl = 0;
+  }
+  int32_t atual = bombas[bombaIndex].estoqueUl;
+  appliedDose = {journalActiveSeq(), logNextSeq, activeJob.dosagemUl};
+  pumpQueueLock.exit();
+
+  if (anterior > 0)
+    hal::logf("[stock] Estoque Bomba %d atualizado: %s -> %s\n",
+              bombaIndex + 1, MlText(anterior).c_str(), MlText(atual).c_str());
+
+  recordConsumption(bombaIndex, activeJob.dosagemUl, activeJob.timestamp);
+  // Estoque e appliedDose, depois o log e só então o DONE: um reset em
+  // qualquer ponto deixa o diário com a dose aberta, e a releitura decide
+  // pelo appliedDose gravado (baixa feita?) e pelo logNextSeq (log feito?)
+  saveBombasConfig();
+  appendLocalLog(bombaIndex, activeJob.dosagemUl, activeJob.origem.c_str(), activeJob.timestamp);
+  journalDone();
+  programStepFinished(activeJob);
+}
+
+// Corta a dose ativa agora (programa cancelado): debita só o volume que
+// passou pela bomba até aqui
+void cutPumpJob()
+{
+  int64_t elapsedUs = hal::uptimeUs() - pumpStartUs;
+  if (elapsedUs < pumpDurationUs && pumpDurationUs > 0)
+  {
+    activeJob.dosagemUl = static_cast<int32_t>(activeJob.dosagemUl * elapsedUs / pumpDurationUs);
+    pumpDurationUs = elapsedUs;
+  }
+  hal::logf("[pump] Dose CORTADA: Bomba %d, %s ml\n", activeJob.bombaIndex + 1, MlText(activeJob.dosagemUl).c_str());
+  finishPumpJob();
+}
+
+void startNextPumpJob()
+{
+  if (pumpActive) return;
+
+  // Enfileirados pelo HTTP entram no diário antes de qualquer início
+  journalQueuedJobs();
+
+  // Só o loop tira da frente da fila: o job lido continua lá até o pop
+  PumpJob nextJob;
+  for (;;)
+  {
+    bool hasJob = false;
+    pumpQueueLock.enter();
+    if (pumpHead != pumpTail)
+    {
+      nextJob = pumpQueue[pumpHead];
+      hasJob = true;
+    }
+    pumpQueueLock.exit();
+
+    if (!hasJob) return;
+    if (!programJobCancelled(nextJob)) break;
+
+    // Passo de programa cancelado: sai da fila sem ligar a bomba
+    pumpQueueLock.enter();
+    pumpHead = (pumpHead + 1) % MAX_PUMP_QUEUE;
+    pumpQueueLock.exit();
+    journalDropped(nextJob);
+    hal::logf("[queue] Job DESCARTADO: Bomba %d, %s ml (programa %u cancelado)\n", nextJob.bombaIndex + 1,
+              MlText(nextJob.dosagemUl).c_str(), nextJob.programId);
+  }
+
+  // Job apto = já enfileirado e com a bomba livre (a espera atrás de
+  // outros jobs não conta contra o SLO)
+  int64_t readySinceUs = nextJob.enqueuedAtUs;
+  if (pumpFinishedAtUs > readySinceUs)
+    readySinceUs = pumpFinishedAtUs;
+
+  pumpQueueLock.enter();
+  pumpHead = (pumpHead + 1) % MAX_PUMP_QUEUE;
+  pumpQueueLock.exit();
+
+  activeJob = nextJob;
+  pumpDurationUs = doseDurationUs(activeJob.dosagemUl, bombas[activeJob.bombaIndex].calibrPpm);
+  pumpStartUs = hal::uptimeUs();
+  pumpActive = true;
+  journalStart(pumpDurationUs);
+  programStepStarted(activeJob);
+
+  reportDoseStartDelay(static_cast<uint32_t>(pumpStartUs - readySinceUs));
+
+  hal::logf("------------------------------------------------\n");
+  hal::logf("[pump] INICIANDO DOSAGEM!\n");
+  hal::logf("[pump] Bomba: %d\n", activeJob.bombaIndex + 1);
+  hal::logf("[pump] Origem: %s\n", activeJob.origem.c_str());
+  hal::logf("[pump] Volume: %s ml\n", MlText(activeJob.dosagemUl).c_str());
+  hal::logf("[pump] Tempo Calculado: %lu ms\n", static_cast<unsigned long>(pumpDurationUs / 1000));
+  hal::logf("------------------------------------------------\n");
+
+  pumpBank.set(activeJob.bombaIndex, true);
+}
+
+void processPumpQueue()
+{
+  // Lotes de programa com a espera vencida entram no fim da fila
+  releaseProgramSteps();
+
+  if (pumpActive)
+  {
+    int64_t elapsedUs = hal::uptimeUs() - pumpStartUs;
+    if (elapsedUs >= pumpDurationUs)
+      finishPumpJob();
+    else if (programJobCancelled(activeJob))
+      cutPumpJob();
+    else
+      journalProgress(elapsedUs);
+    return;
+  }
+  startNextPumpJob();
+}
@@ -0,0 +1,104 @@
+#include "dosing.h"
+
+// =========================================================
+// Scheduler
+// =========================================================
+void checkSchedules()
+{
+  static long lastCheckedMinuteKey = -1;
+  static int64_t lastCheckUs = 0;
+
+  int64_t nowUs = hal::uptimeUs();
+  if (nowUs - lastCheckUs < 1000000) return;
+  lastCheckUs = nowUs;
+
+  if (!rtcReady)
+  {
+    hal::logf("[scheduler] RTC nao pronto, pulando verificacao\n");
+    return;
+  }
+
+  DateTime rtcNow = clockNow();
+  long minuteKey = rtcNow.unixtime() / 60;
+
+  // Só processa uma vez por minuto real (não por "minute()")
+  if (minuteKey == lastCheckedMinuteKey) return;
+  lastCheckedMinuteKey = minuteKey;
+
+  runSchedulesAt(rtcNow);
+}
+
+// Enfileira os agendamentos que vencem no minuto de rtcNow; devolve quantos
+int runSchedulesAt(const DateTime &rtcNow)
+{
+  long minuteKey = rtcNow.unixtime() / 60;
+
+  hal::logf("\n----------------------------------------\n");
+  hal::logf("[scheduler] Verificando agendamentos para: %02d:%02d\n",
+            rtcNow.hour(), rtcNow.minute());
+
+  int diaSemana = rtcNow.dayOfTheWeek();
+
+  hal::logf("[scheduler] Dia da semana: %d, Chave de minuto: %ld\n", diaSemana, minuteKey);
+
+  // Banco vivo lido uma vez: um commit de config no meio da varredura não
+  // mistura os dois bancos, e o banco fica reservado até o fim dela (um
+  // segundo commit não monta config em cima dele)
+  Bomb(&bank)[BOMBA_COUNT] = *reinterpret_cast<Bomb(*)[BOMBA_COUNT]>(acquireScheduleBank());
+  auto onDue = [&bank](int i, int j) {
+    hal::logf("[scheduler] >>> HORARIO ATINGIDO! Bomba %d (Schedule %d) <<<\n", i + 1, j + 1);
+    int32_t dosagemUl = bank[i].schedules[j].dosagemUl;
+    if (holdScheduledDose(i, dosagemUl)) return false;
+    return enqueuePumpJob(i, dosagemUl, "Programado");
+  };
+  int queued = scanDueSchedules(bank, rtcNow, onDue);
+  releaseScheduleBank();
+
+  if (queued == 0)
+    hal::logf("[scheduler] Nenhum horario programado para este minuto.\n");
+
+  hal::logf("----------------------------------------\n\n");
+  return queued;
+}
+
+// Segundos até o próximo agendamento ativo (0 = vence neste minuto)
+uint32_t secondsUntilNextDose()
+{
+  if (!rtcReady) return NO_NEXT_DOSE;
+
+  DateTime now = clockNow();
+  long minuteKey = now.unixtime() / 60;
+  int32_t secondOfDay = now.hour() * 3600L + now.minute() * 60 + now.second();
+  int today = now.dayOfTheWeek();
+  uint32_t best = NO_NEXT_DOSE;
+
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    for (int j = 0; j < SCHEDULE_COUNT; j++)
+    {
+      const Schedule &schedule = bombas[i].schedules[j];
+      if (!schedule.status) continue;
+
+      int32_t at = schedule.hour * 3600L + schedule.minute * 60;
+      for (int day = 0; day <= 7; day++)
+      {
+        if (!schedule.diasSemana[(today + day) % 7]) continue;
+
+        int32_t delta = day * 86400L + at - secondOfDay;
+        if (delta < 0)
+        {
+          // Minuto em andamento que o scheduler ainda não processou
+          if (delta > -60 && schedule.lastRunMinute != minuteKey)
+            delta = 0;
+          else
+            continue;
+        }
+
+        if (static_cast<uint32_t>(delta) < best) best = delta;
+        break;
+      }
+    }
+  }
+
+  return best;
+}
@@ -0,0 +1,480 @@
+#include "dosing.h"
+
+#include <string.h>
+#include <new>
+
+// =========================================================
+// Gravador de entradas (trace)
+// =========================================================
+// Grava em TRACE_FILE, num formato binário compacto, tudo o que chega de
+// fora e muda o comportamento do núcleo: requisições HTTP admitidas (rota,
+// query e body), eventos do WiFi e mudanças do relógio. Com a config do
+// início da sessão, o replay (native/replay_native.cpp) reproduz a mesma
+// sequência no build Linux, com as mesmas distâncias de tempo.
+//
+// HTTP, evento do WiFi e relógio chegam de tasks diferentes: cada registro
+// entra num buffer em RAM sob traceLock, com o tempo lido dentro do lock
+// (os deltas nunca ficam negativos). Só o loop abre o arquivo: despeja o
+// buffer a cada TRACE_FLUSH_MS ou quando ele passa da metade.
+//
+// Arquivo: cabeçalho {"ITRC", versão, BOMBA_COUNT, 0} e registros
+// [tipo][delta em µs desde o registro anterior, varint][carga]:
+//   START: flags, uptime (varint), hora Unix (4 bytes), config, rotas
+//   HTTP:  rota, flags, query, body (texto com tamanho varint na frente)
+//   WIFI:  evento, detalhe (zigzag varint)
+//   CLOCK: diferença para a hora anterior (zigzag varint)
+// Uma sessão nova (boot ou gravação religada) começa com START e zera a
+// base dos deltas.
+TraceStats traceStats;
+
+namespace
+{
+const uint8_t TRACE_MAGIC[4] = {'I', 'T', 'R', 'C'};
+const uint8_t TRACE_VERSION = 1;
+const size_t TRACE_FILE_HEADER_SIZE = 8;
+// Maior cabeçalho de registro: tipo, delta, rota, flags e dois tamanhos
+const size_t TRACE_RECORD_HEAD_MAX = 1 + 10 + 2 + 5 + 5;
+
+hal::CriticalSection traceLock;
+uint8_t *traceBuffer = nullptr;
+size_t traceUsed = 0;
+volatile bool traceOn = false;
+int64_t traceLastUs = 0;
+uint32_t traceLastUnix = 0;
+int64_t traceClockUs = 0; // uptime em que traceLastUnix valia
+
+// Pedidos da API, atendidos pelo loop (dono do arquivo)
+volatile bool startPending = false;
+volatile bool clearPending = false;
+uint8_t startFlags = 0;
+const char *const *traceRoutes = nullptr;
+uint8_t traceRouteCount = 0;
+uint32_t lastFlushAt = 0;
+
+size_t putVarint(uint8_t *out, uint64_t value)
+{
+  size_t length = 0;
+  while (value >= 0x80)
+  {
+    out[length++] = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  out[length++] = static_cast<uint8_t>(value);
+  return length;
+}
+
+uint64_t zigzag(int64_t value)
+{
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+bool getVarint(TraceReader &reader, uint64_t &value)
+{
+  value = 0;
+  for (uint8_t shift = 0; shift < 64 && reader.offset < reader.size; shift += 7)
+  {
+    uint8_t byte = reader.data[reader.offset++];
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+int64_t unzigzag(uint64_t value)
+{
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+bool getBytes(TraceReader &reader, const char *&text, size_t &length)
+{
+  uint64_t size;
+  if (!getVarint(reader, size) || size > reader.size - reader.offset) return false;
+  text = reinterpret_cast<const char *>(reader.data + reader.offset);
+  length = static_cast<size_t>(size);
+  reader.offset += length;
+  return true;
+}
+
+// Tipo + delta desde o registro anterior (chamar com traceLock)
+size_t putRecordHead(uint8_t *out, TraceRecordType type)
+{
+  int64_t nowUs = hal::uptimeUs();
+  out[0] = type;
+  size_t length = 1 + putVarint(out + 1, static_cast<uint64_t>(nowUs - traceLastUs));
+  traceLastUs = nowUs;
+  return length;
+}
+
+// Cabeçalho e carga fixa montados num bloco só (chamar com traceLock)
+bool appendRecord(const uint8_t *record, size_t length)
+{
+  if (traceUsed + length > TRACE_BUFFER_SIZE)
+  {
+    traceStats.dropped++;
+    return false;
+  }
+  memcpy(traceBuffer + traceUsed, record, length);
+  traceUsed += length;
+  traceStats.records++;
+  return true;
+}
+
+void appendText(size_t &used, const char *text, size_t length)
+{
+  used += putVarint(traceBuffer + used, length);
+  memcpy(traceBuffer + used, text, length);
+  used += length;
+}
+
+// START no começo do buffer (vazio e sem gravadores: traceOn desligado)
+void beginSession()
+{
+  int64_t nowUs = hal::uptimeUs();
+  uint32_t nowUnix = rtcReady ? clockNow().unixtime() : 0;
+
+  size_t used = 0;
+  traceBuffer[used++] = TRACE_START;
+  traceBuffer[used++] = 0; // delta: a sessão é a nova base
+  traceBuffer[used++] = startFlags;
+  used += putVarint(traceBuffer + used, static_cast<uint64_t>(nowUs));
+  memcpy(traceBuffer + used, &nowUnix, sizeof(nowUnix));
+  used += sizeof(nowUnix);
+
+  // Config do início: o replay parte do mesmo estado (estoque incluso)
+  size_t lengthAt = used;
+  used += 3; // tamanho da config em varint de 3 bytes (até 2 MB)
+  size_t configLength = buildConfigJson(reinterpret_cast<char *>(traceBuffer + used), CONFIG_JSON_MAX);
+  for (int i = 0; i < 3; i++)
+    traceBuffer[lengthAt + i] = static_cast<uint8_t>((configLength >> (7 * i)) & 0x7F) | (i < 2 ? 0x80 : 0);
+  used += configLength;
+
+  // Tabela de rotas: o HTTP grava só o índice
+  traceBuffer[used++] = traceRouteCount;
+  for (uint8_t i = 0; i < traceRouteCount; i++)
+    appendText(used, traceRoutes[i], strlen(traceRoutes[i]));
+
+  startPending = false;
+  startFlags = 0;
+  hal::ScopedCritical lock(traceLock);
+  traceUsed = used;
+  traceLastUs = nowUs;
+  traceLastUnix = nowUnix;
+  traceClockUs = nowUs;
+  traceStats.records++;
+  traceOn = true;
+  traceStats.recording = true;
+}
+
+bool writeFileHeader(hal::File &file)
+{
+  uint8_t header[TRACE_FILE_HEADER_SIZE] = {TRACE_MAGIC[0], TRACE_MAGIC[1], TRACE_MAGIC[2], TRACE_MAGIC[3],
+                                            TRACE_VERSION, BOMBA_COUNT, 0, 0};
+  return file.write(header, sizeof(header)) == sizeof(header);
+}
+
+void stopRecording()
+{
+  hal::ScopedCritical lock(traceLock);
+  traceOn = false;
+  traceStats.recording = false;
+}
+} // namespace
+
+// Boot: a gravação ligada pela API continua depois de um reset (a sessão
+// nova já começa no setup, antes do primeiro request)
+void initInputTrace(const char *const *routeNames, uint8_t routeCount)
+{
+  traceRoutes = routeNames;
+  traceRouteCount = routeCount;
+
+  hal::File file = hal::fsOpen(TRACE_FILE, hal::FILE_MODE_READ);
+  traceStats.bytes = file ? static_cast<uint32_t>(file.size()) : 0;
+  file.close();
+
+  if (prefsReady && hal::kvGetU16("trace", 0) != 0)
+  {
+    startFlags = TRACE_START_BOOT;
+    setInputTrace(true);
+  }
+}
+
+bool inputTraceEnabled()
+{
+  return traceOn || startPending;
+}
+
+void setInputTrace(bool enabled)
+{
+  if (prefsReady) hal::kvPutU16("trace", enabled ? 1 : 0);
+
+  if (!enabled)
+  {
+    startPending = false;
+    stopRecording();
+    hal::logf("[trace] Gravacao de entradas DESLIGADA (%u registros)\n", traceStats.records);
+    return;
+  }
+  if (inputTraceEnabled()) return;
+
+  if (traceBuffer == nullptr)
+    traceBuffer = new (std::nothrow) uint8_t[TRACE_BUFFER_SIZE];
+  if (traceBuffer == nullptr)
+  {
+    hal::logf("[trace] ERRO: Sem memoria para o buffer de %u bytes\n", TRACE_BUFFER_SIZE);
+    return;
+  }
+  traceStats.full = false;
+  startPending = true;
+  hal::logf("[trace] Gravacao de entradas LIGADA\n");
+}
+
+void clearInputTrace()
+{
+  clearPending = true;
+}
+
+void traceHttp(uint8_t route, uint8_t flags, const char *query, size_t queryLength, const char *body,
+               size_t bodyLength)
+{
+  if (!traceOn) return;
+
+  hal::ScopedCritical lock(traceLock);
+  if (!traceOn) return;
+
+  // Body que não cabe no espaço livre é cortado (o replay não o aplica)
+  size_t fixed = TRACE_RECORD_HEAD_MAX + queryLength;
+  if (traceUsed + fixed > TRACE_BUFFER_SIZE)
+  {
+    traceStats.dropped++;
+    return;
+  }
+  size_t room = TRACE_BUFFER_SIZE - traceUsed - fixed;
+  if (bodyLength > room)
+  {
+    bodyLength = room;
+    flags |= TRACE_HTTP_TRUNCATED;
+  }
+
+  size_t used = traceUsed;
+  used += putRecordHead(traceBuffer + used, TRACE_HTTP);
+  traceBuffer[used++] = route;
+  traceBuffer[used++] = flags;
+  appendText(used, query, queryLength);
+  appendText(used, body, bodyLength);
+  traceUsed = used;
+  traceStats.records++;
+}
+
+void traceWifi(uint8_t event, int32_t detail)
+{
+  if (!traceOn) return;
+
+  uint8_t record[TRACE_RECORD_HEAD_MAX];
+  hal::ScopedCritical lock(traceLock);
+  if (!traceOn) return;
+  size_t length = putRecordHead(record, TRACE_WIFI);
+  record[length++] = event;
+  length += putVarint(record + length, zigzag(detail));
+  appendRecord(record, length);
+}
+
+// Chamado a cada leitura do relógio. O replay anda o relógio junto com o
+// uptime, então só vira registro o que foge disso por mais de 1 s (ajuste
+// manual, NTP, RTC corrigido)
+void traceClock(uint32_t unixTime)
+{
+  if (!traceOn) return;
+
+  uint8_t record[TRACE_RECORD_HEAD_MAX];
+  hal::ScopedCritical lock(traceLock);
+  if (!traceOn) return;
+  int64_t nowUs = hal::uptimeUs();
+  int64_t expected = traceLastUnix + (nowUs - traceClockUs) / 1000000;
+  int64_t drift = static_cast<int64_t>(unixTime) - expected;
+  if (drift >= -1 && drift <= 1) return;
+
+  size_t length = putRecordHead(record, TRACE_CLOCK);
+  length += putVarint(record + length, zigzag(static_cast<int64_t>(unixTime) - traceLastUnix));
+  if (appendRecord(record, length))
+  {
+    traceLastUnix = unixTime;
+    traceClockUs = nowUs;
+  }
+}
+
+// Loop: despeja o buffer no arquivo e atende os pedidos da API
+void flushInputTrace()
+{
+  if (clearPending)
+  {
+    clearPending = false;
+    hal::fsRemove(TRACE_FILE);
+    traceStats.bytes = 0;
+    traceStats.full = false;
+    hal::logf("[trace] Arquivo de entradas apagado\n");
+
+    // Gravando: o START foi junto com o arquivo, então a sessão recomeça
+    hal::ScopedCritical lock(traceLock);
+    traceUsed = 0;
+    if (traceOn)
+    {
+      traceOn = false;
+      startFlags = 0;
+      startPending = true;
+    }
+  }
+  if (traceBuffer == nullptr) return;
+
+  size_t pending;
+  {
+    hal::ScopedCritical lock(traceLock);
+    pending = traceUsed;
+  }
+  bool due = pending >= TRACE_BUFFER_SIZE / 2 || hal::millis() - lastFlushAt >= TRACE_FLUSH_MS ||
+             (!traceOn && pending > 0) || startPending;
+  if (pending > 0 && due)
+  {
+    lastFlushAt = hal::millis();
+    FlashOpTimer timer(FLASH_OP_TRACE_WRITE);
+    size_t header = traceStats.bytes == 0 ? TRACE_FILE_HEADER_SIZE : 0;
+    if (traceStats.bytes + header + pending > TRACE_FILE_MAX)
+    {
+      // Arquivo cheio: para de gravar e mantém o que já está lá
+      stopRecording();
+      startPending = false;
+      traceStats.full = true;
+      hal::logf("[trace] Arquivo de entradas cheio (%u bytes), gravacao parada\n", traceStats.bytes);
+      hal::ScopedCritical lock(traceLock);
+      traceUsed = 0;
+      return;
+    }
+
+    hal::File file = hal::fsOpen(TRACE_FILE, hal::FILE_MODE_APPEND);
+    if (!file || (header > 0 && !writeFileHeader(file)) || file.write(traceBuffer, pending) != pending)
+    {
+      hal::logf("[trace] ERRO: Falha ao gravar %s\n", TRACE_FILE);
+      return;
+    }
+    file.close();
+    traceStats.bytes += header + pending;
+
+    // O que entrou durante a escrita vai para o começo do buffer
+    hal::ScopedCritical lock(traceLock);
+    memmove(traceBuffer, traceBuffer + pending, traceUsed - pending);
+    traceUsed -= pending;
+  }
+
+  if (startPending && !traceOn)
+  {
+    hal::ScopedCritical lock(traceLock);
+    if (traceUsed > 0) return; // sobra da sessão anterior: sai no próximo flush
+  }
+  if (startPending && !traceOn) beginSession();
+}
+
+// =========================================================
+// Leitura (replay no host)
+// =========================================================
+bool traceReaderBegin(TraceReader &reader, const uint8_t *data, size_t size)
+{
+  reader.data = data;
+  reader.size = size;
+  reader.offset = TRACE_FILE_HEADER_SIZE;
+  reader.lastUs = 0;
+  reader.lastUnix = 0;
+  reader.bombaCount = size >= TRACE_FILE_HEADER_SIZE ? data[5] : 0;
+  return size >= TRACE_FILE_HEADER_SIZE && memcmp(data, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0 &&
+         data[4] == TRACE_VERSION;
+}
+
+// false no fim ou num registro cortado (reader.offset < reader.size)
+bool traceReaderNext(TraceReader &reader, TraceEvent &event)
+{
+  size_t start = reader.offset;
+  uint64_t delta;
+  if (reader.offset >= reader.size) return false;
+
+  event = TraceEvent();
+  event.type = static_cast<TraceRecordType>(reader.data[reader.offset++]);
+  if (!getVarint(reader, delta)) return false;
+
+  bool ok = true;
+  switch (event.type)
+  {
+  case TRACE_START:
+  {
+    uint64_t uptime;
+    ok = reader.offset < reader.size;
+    if (ok) event.flags = reader.data[reader.offset++];
+    ok = ok && getVarint(reader, uptime) && reader.size - reader.offset >= sizeof(event.unixTime);
+    if (!ok) break;
+    memcpy(&event.unixTime, reader.data + reader.offset, sizeof(event.unixTime));
+    reader.offset += sizeof(event.unixTime);
+    ok = getBytes(reader, event.text, event.textLength) && reader.offset < reader.size;
+    if (!ok) break;
+
+    // Rotas: nomes separados, o replay pega cada um por traceRouteName()
+    event.code = reader.data[reader.offset++];
+    event.body = reinterpret_cast<const char *>(reader.data + reader.offset);
+    for (uint8_t i = 0; ok && i < event.code; i++)
+    {
+      const char *name;
+      size_t length;
+      ok = getBytes(reader, name, length);
+    }
+    event.bodyLength = reinterpret_cast<const char *>(reader.data + reader.offset) - event.body;
+    reader.lastUs = static_cast<int64_t>(uptime);
+    reader.lastUnix = event.unixTime;
+    break;
+  }
+  case TRACE_HTTP:
+    ok = reader.size - reader.offset >= 2;
+    if (!ok) break;
+    event.code = reader.data[reader.offset++];
+    event.flags = reader.data[reader.offset++];
+    ok = getBytes(reader, event.text, event.textLength) && getBytes(reader, event.body, event.bodyLength);
+    break;
+  case TRACE_WIFI:
+  {
+    uint64_t detail;
+    ok = reader.offset < reader.size;
+    if (ok) event.code = reader.data[reader.offset++];
+    ok = ok && getVarint(reader, detail);
+    event.value = static_cast<int32_t>(unzigzag(detail));
+    break;
+  }
+  case TRACE_CLOCK:
+  {
+    uint64_t step;
+    ok = getVarint(reader, step);
+    reader.lastUnix = static_cast<uint32_t>(reader.lastUnix + unzigzag(step));
+    break;
+  }
+  default:
+    ok = false;
+    break;
+  }
+
+  if (!ok)
+  {
+    reader.offset = start;
+    return false;
+  }
+  if (event.type != TRACE_START) reader.lastUs += static_cast<int64_t>(delta);
+  event.atUs = reader.lastUs;
+  if (event.type == TRACE_CLOCK) event.unixTime = reader.lastUnix;
+  return true;
+}
+
+// Nome da rota `index` na tabela de um START
+bool traceRouteName(const TraceEvent &start, uint8_t index, const char *&name, size_t &length)
+{
+  if (start.type != TRACE_START || index >= start.code) return false;
+  TraceReader reader;
+  reader.data = reinterpret_cast<const uint8_t *>(start.body);
+  reader.size = start.bodyLength;
+  reader.offset = 0;
+  for (uint8_t i = 0; i <= index; i++)
+    if (!getBytes(reader, name, length)) return false;
+  return true;
+}
@@ -0,0 +1,344 @@
+#include "hal.h"
+
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <RTClib.h>
+#include <WiFi.h>
+#include <Wire.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+#include <new>
+
+// HAL da placa: core Arduino do ESP32-S3
+namespace
+{
+RTC_DS3231 rtc;
+Preferences preferences;
+bool logEnabled = true;
+const esp_partition_t *dataPartition = nullptr;
+spi_flash_mmap_handle_t dataPartitionMap;
+
+fs::File &fileOf(void *handle)
+{
+  return *static_cast<fs::File *>(handle);
+}
+} // namespace
+
+namespace hal
+{
+// --- Console ---
+void logf(const char *format, ...)
+{
+  if (!logEnabled) return;
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  Serial.print(buffer);
+}
+
+void setLogEnabled(bool enabled)
+{
+  logEnabled = enabled;
+}
+
+// --- Tempo monotônico ---
+uint32_t millis()
+{
+  return ::millis();
+}
+
+int64_t uptimeUs()
+{
+  return esp_timer_get_time();
+}
+
+int64_t micros64()
+{
+  return esp_timer_get_time();
+}
+
+// --- RTC ---
+bool rtcBegin()
+{
+  return rtc.begin();
+}
+
+bool rtcRead(uint32_t &unixTime)
+{
+  unixTime = rtc.now().unixtime();
+  return true;
+}
+
+bool rtcWrite(uint32_t unixTime)
+{
+  rtc.adjust(DateTime(unixTime));
+  return true;
+}
+
+// --- GPIO ---
+void gpioOutput(uint8_t pin)
+{
+  pinMode(pin, OUTPUT);
+}
+
+void gpioWrite(uint8_t pin, bool high)
+{
+#ifndef HAL_GPIO_DRY_RUN
+  digitalWrite(pin, high ? HIGH : LOW);
+#else
+  // Firmware de benchmark: nunca aciona as bombas de verdade
+  (void)pin;
+  (void)high;
+#endif
+}
+
+// --- I2C ---
+bool i2cWrite(uint8_t address, const uint8_t *data, size_t length)
+{
+#ifndef HAL_GPIO_DRY_RUN
+  Wire.beginTransmission(address);
+  Wire.write(data, length);
+  return Wire.endTransmission() == 0;
+#else
+  (void)address;
+  (void)data;
+  (void)length;
+  return true;
+#endif
+}
+
+// --- Chave/valor ---
+bool kvBegin(const char *space)
+{
+  return preferences.begin(space, false);
+}
+
+size_t kvGetBytes(const char *key, void *buffer, size_t size)
+{
+  return preferences.getBytes(key, buffer, size);
+}
+
+size_t kvPutBytes(const char *key, const void *data, size_t size)
+{
+  return preferences.putBytes(key, data, size);
+}
+
+size_t kvGetString(const char *key, char *buffer, size_t size)
+{
+  if (!preferences.isKey(key)) return 0;
+  return preferences.getString(key, buffer, size);
+}
+
+size_t kvPutString(const char *key, const char *value)
+{
+  return preferences.putString(key, value);
+}
+
+uint16_t kvGetU16(const char *key, uint16_t fallback)
+{
+  return preferences.getUShort(key, fallback);
+}
+
+size_t kvPutU16(const char *key, uint16_t value)
+{
+  return preferences.putUShort(key, value);
+}
+
+// --- Sistema de arquivos ---
+size_t File::read(void *buffer, size_t size)
+{
+  if (!handle_) return 0;
+  return fileOf(handle_).read(static_cast<uint8_t *>(buffer), size);
+}
+
+size_t File::write(const void *data, size_t size)
+{
+  if (!handle_) return 0;
+  return fileOf(handle_).write(static_cast<const uint8_t *>(data), size);
+}
+
+size_t File::print(const char *text)
+{
+  return write(text, strlen(text));
+}
+
+bool File::seek(size_t position)
+{
+  return handle_ && fileOf(handle_).seek(position);
+}
+
+size_t File::size()
+{
+  return handle_ ? fileOf(handle_).size() : 0;
+}
+
+void File::flush()
+{
+  if (handle_) fileOf(handle_).flush();
+}
+
+void File::close()
+{
+  if (!handle_) return;
+  fileOf(handle_).close();
+  delete static_cast<fs::File *>(handle_);
+  handle_ = nullptr;
+}
+
+bool File::readLine(char *buffer, size_t size, size_t &length)
+{
+  length = 0;
+  if (!handle_) return false;
+
+  fs::File &file = fileOf(handle_);
+  if (!file.available()) return false;
+
+  int c;
+  while ((c = file.read()) >= 0 && c != '\n')
+  {
+    if (length + 1 < size) buffer[length++] = static_cast<char>(c);
+  }
+  while (length > 0 && (buffer[length - 1] == '\r' || buffer[length - 1] == ' '))
+    length--;
+  buffer[length] = '\0';
+  return true;
+}
+
+bool fsBegin()
+{
+  return LittleFS.begin(true);
+}
+
+bool fsExists(const char *path)
+{
+  return LittleFS.exists(path);
+}
+
+bool fsRemove(const char *path)
+{
+  return LittleFS.remove(path);
+}
+
+bool fsRename(const char *from, const char *to)
+{
+  return LittleFS.rename(from, to);
+}
+
+File fsOpen(const char *path, FileMode mode)
+{
+  const char *flags = mode == FILE_MODE_READ     ? FILE_READ
+                      : mode == FILE_MODE_APPEND ? FILE_APPEND
+                      : mode == FILE_MODE_UPDATE ? "r+"
+                                                 : FILE_WRITE;
+  fs::File file = LittleFS.open(path, flags);
+  if (!file) return File();
+
+  fs::File *handle = new (std::nothrow) fs::File(file);
+  return File(handle);
+}
+
+// --- Partição de dados crua ---
+// Uma partição por vez; mapeada inteira no espaço de dados (cache da flash)
+bool partitionBegin(const char *label, const uint8_t *&mapped, size_t &size)
+{
+  if (dataPartition != nullptr)
+  {
+    spi_flash_munmap(dataPartitionMap);
+    dataPartition = nullptr;
+  }
+
+  const esp_partition_t *partition =
+      esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  if (partition == nullptr) return false;
+
+  const void *window = nullptr;
+  if (esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &window, &dataPartitionMap) != ESP_OK)
+    return false;
+
+  dataPartition = partition;
+  mapped = static_cast<const uint8_t *>(window);
+  size = partition->size;
+  return true;
+}
+
+bool partitionErase(size_t offset, size_t length)
+{
+  return dataPartition != nullptr && esp_partition_erase_range(dataPartition, offset, length) == ESP_OK;
+}
+
+// esp_partition_write invalida o cache da faixa gravada: a janela mapeada
+// já mostra os bytes novos
+bool partitionWrite(size_t offset, const void *data, size_t length)
+{
+  return dataPartition != nullptr && esp_partition_write(dataPartition, offset, data, length) == ESP_OK;
+}
+
+// --- Rede ---
+bool netLinkUp()
+{
+  return WiFi.status() == WL_CONNECTED;
+}
+
+const char *deviceId()
+{
+  static char id[20] = "";
+  if (id[0] == '\0')
+    snprintf(id, sizeof(id), "aqua-%012llx", static_cast<unsigned long long>(ESP.getEfuseMac()));
+  return id;
+}
+
+int httpPost(const char *url, const char *contentType, const uint8_t *body, size_t length)
+{
+  HTTPClient http;
+  if (!http.begin(url)) return -1;
+  http.addHeader("Content-Type", contentType);
+  int status = http.POST(const_cast<uint8_t *>(body), length);
+  http.end();
+  return status;
+}
+
+int httpGet(const char *url, char *buffer, size_t size, size_t &length)
+{
+  length = 0;
+  HTTPClient http;
+  if (!http.begin(url)) return -1;
+  int status = http.GET();
+  if (status <= 0)
+  {
+    http.end();
+    return status;
+  }
+
+  // Sem Content-Length lê até a conexão fechar; 5 s de margem para o resto
+  int expected = http.getSize();
+  if (expected > 0 && static_cast<size_t>(expected) > size)
+  {
+    http.end();
+    return -2;
+  }
+  WiFiClient *stream = http.getStreamPtr();
+  unsigned long deadline = millis() + 5000;
+  while ((expected < 0 || length < static_cast<size_t>(expected)) && static_cast<long>(millis() - deadline) < 0)
+  {
+    size_t available = stream->available();
+    if (available == 0)
+    {
+      if (!http.connected()) break;
+      delay(1);
+      continue;
+    }
+    if (length + available > size)
+    {
+      status = -2;
+      break;
+    }
+    length += stream->readBytes(buffer + length, available);
+  }
+  http.end();
+  return status;
+}
+} // namespace hal
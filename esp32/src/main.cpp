@@ -2,34 +2,96 @@
 #include <Wire.h>
 #include <RTClib.h>
 #include <WiFi.h>
-#include <Preferences.h>
-#include <LittleFS.h>
 #include <ArduinoJson.h>
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include <Adafruit_NeoPixel.h>
 #include <time.h>
+#include <new>
+#include "inline_string.h"
+#include "latency_histogram.h"
+#include "soft_clock.h"
+#include <esp_timer.h>
+#include <esp_task_wdt.h>
+#include <esp_idf_version.h>
+#include <AsyncUDP.h>
+#include <lwip/dns.h>
+#include <esp_pm.h>
+#include <memory>
+#include "dosing.h"
+#include "hal.h"
+#include "http_api.h"
 
 // --- Configurações Gerais ---
-#define TEMPO_POR_ML 700
-#define BOMBA1_PIN 4
-#define BOMBA2_PIN 5
-#define BOMBA3_PIN 6
-#define BOMBA4_PIN 7
 #define LED_PIN 48
 #define LED_COUNT 1
 #define I2C_SDA 21
 #define I2C_SCL 20
 
-#define BOMBA_COUNT 4
-#define SCHEDULE_COUNT 3
-#define MAX_PUMP_QUEUE 14
-#define CONFIG_DOC_SIZE 10240
-#define LOG_LIMIT 300
-#define LOG_FILE "/logs.jsonl"
-#define LOG_TEMP_FILE "/logs.tmp"
-
-const uint8_t PUMP_PINS[BOMBA_COUNT] = {BOMBA1_PIN, BOMBA2_PIN, BOMBA3_PIN, BOMBA4_PIN};
+#define IP_TEXT_SIZE 16
+
+// Admissão HTTP: orçamento de bodies em RAM, piso de heap e limite por cliente
+#define HTTP_BODY_BUDGET 12288
+#define HTTP_HEAP_FLOOR 32768
+#define HTTP_CLIENT_SLOTS 8
+#define HTTP_RATE_PER_SEC 4
+#define HTTP_RATE_BURST 8
+
+// Monitor de travamentos: SLOs padrão (ajustáveis via POST /slo) e watchdog do loop
+#define SLO_LOOP_PERIOD_MS 1000
+#define SLO_DOSE_START_MS 1000
+#define SLO_DOSE_CUTOFF_MS 250
+#define SLO_MAX_MS 60000
+#define INCIDENT_COUNT 8
+#define INCIDENT_FLUSH_INTERVAL 10000
+#define LOOP_WDT_TIMEOUT_S 30
+
+// Reconexão STA: backoff exponencial com jitter
+#define WIFI_BACKOFF_MIN 2000UL
+#define WIFI_BACKOFF_MAX 300000UL
+#define WIFI_CONNECT_TIMEOUT 20000UL
+#define WIFI_EVENT_QUEUE 16
+
+// Modo ocioso (economia de energia)
+#define POWER_ACTIVE_TICK_MS 100
+#define POWER_IDLE_TICK_DEFAULT 1000
+#define POWER_IDLE_TICK_MAX 5000
+#define POWER_AP_GRACE_DEFAULT 60
+#define POWER_AP_GRACE_MAX 3600
+#define POWER_DOSE_GUARD_MS 2000
+#define POWER_IDLE_CPU_MHZ 80
+
+// Sincronização com a nuvem: task de envio dos lotes do outbox (core 0)
+#define SYNC_TASK_STACK 6144
+#define SYNC_TASK_PRIORITY 1
+
+// SNTP: servidor padrão (ajustável via POST /ntp) e disciplina do DS3231
+#define NTP_DEFAULT_SERVER "pool.ntp.org"
+#define NTP_DEFAULT_PORT 123
+#define NTP_SERVER_SIZE 64
+#define NTP_PACKET_SIZE 48
+#define NTP_UNIX_OFFSET 2208988800UL
+#define NTP_SYNC_INTERVAL 21600000UL
+#define NTP_RETRY_MIN 60000UL
+#define NTP_RETRY_MAX 900000UL
+#define NTP_DNS_TIMEOUT 5000
+#define NTP_REPLY_TIMEOUT 2000
+#define NTP_ALIGN_TIMEOUT 15000
+#define NTP_STEP_THRESHOLD_US 50000
+#define NTP_DRIFT_MIN_WINDOW_S 10800
+#define NTP_DRIFT_MAX_OFFSET_US 10000000LL
+#define DS3231_ADDRESS 0x68
+#define DS3231_AGING_REG 0x10
+#define DS3231_PPM_PER_AGING_LSB 0.1f
+
+// Relógio de software (esp_timer ancorado no DS3231)
+#define CLOCK_MAX_SLEW_PPM 1000
+#define CLOCK_RESYNC_INTERVAL 900000UL
+#define CLOCK_RESYNC_RETRY 60000UL
+#define CLOCK_RESYNC_TIMEOUT 30000UL
+#define CLOCK_JUMP_THRESHOLD_US 1000000LL
+#define RTC_SPIN_MAX_US 30000
+#define RTC_EDGE_RESOLUTION_US 2000
 
 // --- Wi-Fi ---
 const char *AP_SSID = "AquaBalancePro";
@@ -48,191 +110,671 @@ bool isStaConfigured()
 }
 
 // --- Objetos Globais ---
-RTC_DS3231 rtc;
-Preferences preferences;
 AsyncWebServer server(80);
 Adafruit_NeoPixel statusLed(LED_COUNT, LED_PIN, NEO_GRB + NEO_KHZ800);
 
 // --- Variáveis de Controle ---
-unsigned long lastWifiAttempt = 0;
-const unsigned long wifiReconnectInterval = 15000;
-
 volatile uint8_t apClientCount = 0;
-bool staEnabled = false;
+bool systemReady = false;
 
-unsigned long lastTimeSyncAttempt = 0;
-const unsigned long timeSyncInterval = 60000;
 bool timeSynced = false;
 const long gmtOffsetSec = -3 * 3600;
 const int daylightOffsetSec = 0;
 
 // --- Estruturas ---
-struct Schedule
+enum LedMode
 {
-  int hour;
-  int minute;
-  float dosagem;
-  bool status;
-  bool diasSemana[7];
-  long lastRunMinute;
+  LED_MODE_BOOT,
+  LED_MODE_READY,
+  LED_MODE_NO_NET,
+  LED_MODE_DOSING
+};
 
-  Schedule()
-  {
-    hour = 0;
-    minute = 0;
-    dosagem = 0;
-    status = false;
-    lastRunMinute = -1;
-    for (int i = 0; i < 7; i++)
-      diasSemana[i] = false;
-  }
+LedMode ledMode = LED_MODE_BOOT;
+unsigned long ledLastToggle = 0;
+bool ledBlinkOn = true;
+unsigned long noNetBlinkStart = 0;
+unsigned long lastNoNetBlink = 0;
+bool noNetBlinkActive = false;
+uint32_t currentLedColor = 0;
+
+// --- Conectividade Wi-Fi ---
+// Os eventos chegam na task de eventos do Arduino; o loop consome a fila
+// na ordem de chegada e o prazo do timer, sem consultar WiFi.status().
+enum WifiLinkState : uint8_t
+{
+  WIFI_STA_DISABLED,    // STA não configurado: só AP
+  WIFI_STA_PAUSED,      // AP com clientes: STA desligado (prioridade do app)
+  WIFI_STA_CONNECTING,
+  WIFI_STA_CONNECTED,
+  WIFI_STA_BACKOFF      // esperando a próxima tentativa
+};
+
+const char *const WIFI_LINK_STATE_NAMES[] = {"disabled", "paused", "connecting", "connected", "backoff"};
+
+enum WifiEvent : uint8_t
+{
+  WIFI_EV_STA_GOT_IP,
+  WIFI_EV_STA_DISCONNECTED,
+  WIFI_EV_AP_CLIENTS,
+  WIFI_EV_AP_STOPPED
+};
+
+// Fila e não máscara: GOT_IP seguido de DISCONNECTED no mesmo passe do
+// loop tem que terminar desconectado. Cheia, marca overflow e o loop
+// reavalia os clientes do AP e trata o STA como caído (o backoff refaz a
+// conexão)
+struct WifiEventQueue
+{
+  WifiEvent items[WIFI_EVENT_QUEUE];
+  uint8_t head;
+  uint8_t count;
+  bool overflow;
+};
+
+struct WifiLink
+{
+  WifiLinkState state;
+  bool timerArmed;
+  unsigned long deadline;
+  unsigned long backoff;
+  unsigned long connectedSince;
+  uint64_t connectedMsTotal;
+  uint32_t reconnectAttempts;
+  uint32_t connects;
+  uint32_t disconnects;
+  uint8_t lastDisconnectReason;
+  bool staStarted;      // WiFi.begin() já chamado uma vez
+};
+
+WifiLink wifiLink = {};
+WifiEventQueue wifiEventQueue = {};
+portMUX_TYPE wifiEventMux = portMUX_INITIALIZER_UNLOCKED;
+volatile uint8_t wifiDisconnectReason = 0;
+
+// --- Admissão HTTP ---
+// Todos os callbacks do AsyncWebServer rodam na task do AsyncTCP, então
+// os contadores abaixo não precisam de lock.
+enum HttpRoute
+{
+  ROUTE_STATUS,
+  ROUTE_CONFIG_GET,
+  ROUTE_CONFIG_POST,
+  ROUTE_TIME,
+  ROUTE_DOSE,
+  ROUTE_LOGS_GET,
+  ROUTE_LOGS_DELETE,
+  ROUTE_METRICS,
+  ROUTE_INCIDENTS_GET,
+  ROUTE_INCIDENTS_DELETE,
+  ROUTE_SLO_POST,
+  ROUTE_NTP_POST,
+  ROUTE_POWER_POST,
+  ROUTE_SYNC_POST,
+  ROUTE_FORECAST_POST,
+  ROUTE_PROGRAM_POST,
+  ROUTE_PROGRAM_GET,
+  ROUTE_PROGRAM_DELETE,
+  ROUTE_CONFIG_ROLLBACK,
+  ROUTE_TRACE_GET,
+  ROUTE_TRACE_POST,
+  ROUTE_HUB_GET,
+  ROUTE_HUB_POST,
+  ROUTE_HUB_LOGS,
+  ROUTE_COUNT
+};
+
+enum AdmissionVerdict : uint8_t
+{
+  ADMISSION_OK,
+  ADMISSION_RATE_LIMITED,
+  ADMISSION_BUSY,
+  ADMISSION_NO_MEMORY,
+  ADMISSION_TOO_LARGE
+};
+
+struct RouteLimit
+{
+  const char *name;
+  uint8_t maxInFlight;
+  size_t maxBody;
+};
+
+const RouteLimit ROUTE_LIMITS[ROUTE_COUNT] = {
+    {"GET /status", 2, 0},
+    {"GET /config", 1, 0},
+    {"POST /config", 1, CONFIG_JSON_MAX},
+    {"POST /time", 1, 128},
+    {"POST /dose", 2, 256},
+    {"GET /logs", 1, 0},
+    {"DELETE /logs", 1, 0},
+    {"GET /metrics", 1, 0},
+    {"GET /incidents", 1, 0},
+    {"DELETE /incidents", 1, 0},
+    {"POST /slo", 1, 128},
+    {"POST /ntp", 1, 192},
+    {"POST /power", 1, 128},
+    {"POST /sync", 1, 256},
+    {"POST /forecast", 1, 128},
+    {"POST /program", 1, 1024},
+    {"GET /program", 1, 0},
+    {"DELETE /program", 1, 0},
+    {"POST /config/rollback", 1, 0},
+    {"GET /trace", 1, 0},
+    {"POST /trace", 1, 64},
+    {"GET /hub", 1, 0},
+    {"POST /hub", 1, 640},
+    {"GET /hub/logs", 1, 0},
+};
+
+// Nomes das rotas gravados no início de cada sessão do trace
+const char *traceRouteNames[ROUTE_COUNT];
+
+struct RouteStats
+{
+  uint8_t inFlight;
+  uint32_t accepted;
+  uint32_t rejected;
+  uint32_t heapLowWater;  // menor heap livre visto ao fim do handler
+};
+
+RouteStats routeStats[ROUTE_COUNT];
+
+struct AdmissionCounters
+{
+  uint32_t rateLimited;
+  uint32_t busy;
+  uint32_t noMemory;
+  uint32_t tooLarge;
+  uint32_t heapFloor;
+};
+
+AdmissionCounters admissionCounters = {};
+size_t bodyBytesInFlight = 0;
+
+struct ClientBucket
+{
+  uint32_t ip;
+  uint32_t milliTokens;
+  unsigned long lastRefill;
+};
+
+ClientBucket clientBuckets[HTTP_CLIENT_SLOTS];
+
+// Guardado em request->_tempObject (liberado pelo destrutor do request).
+// O body, quando existe, vem logo após o ticket no mesmo bloco.
+struct RequestTicket
+{
+  uint8_t route;
+  AdmissionVerdict verdict;
+  bool admitted;
+  bool transferTracked;
+  bool compressed;
+  size_t bodyReserved;
+  size_t wireSize;
+  unsigned long transferStart;
+};
+
+// --- Métricas ---
+// Histogramas em ciclos de CPU: fases do loop, handlers HTTP e operações de flash
+enum MetricId
+{
+  MET_LOOP_SERVICE_WIFI,
+  MET_LOOP_ENSURE_TIME_SYNCED,
+  MET_LOOP_MAINTAIN_CLOCK,
+  MET_LOOP_CHECK_SCHEDULES,
+  MET_LOOP_PROCESS_PUMP_QUEUE,
+  MET_LOOP_SERVICE_OUTBOX,
+  MET_LOOP_UPDATE_STATUS_LED,
+  MET_LOOP_SERVICE_HUB,
+  MET_LOOP_TOTAL,
+  MET_HTTP_FIRST,
+  MET_FLASH_CONFIG_SAVE = MET_HTTP_FIRST + ROUTE_COUNT,
+  MET_FLASH_CONFIG_LOAD,
+  MET_FLASH_LOG_APPEND,
+  MET_FLASH_LOG_TRIM,
+  MET_FLASH_OUTBOX_APPEND,
+  MET_FLASH_JOURNAL_WRITE,
+  MET_FLASH_LOG_ERASE,
+  MET_FLASH_TRACE_WRITE,
+  MET_FLASH_HUB_MERGE,
+  MET_COUNT
+};
+
+enum MetricFamily
+{
+  FAMILY_LOOP_PHASE,
+  FAMILY_HTTP_HANDLER,
+  FAMILY_FLASH_OP,
+  FAMILY_COUNT
 };
 
-struct Bomb
+struct MetricFamilyInfo
 {
-  String name;
-  float calibrCoef;
-  float quantidadeEstoque;
-  Schedule schedules[SCHEDULE_COUNT];
+  const char *name;
+  const char *label;
+  const char *help;
+};
+
+const MetricFamilyInfo METRIC_FAMILIES[FAMILY_COUNT] = {
+    {"aqua_loop_phase_seconds", "phase", "Duracao de cada fase do loop()"},
+    {"aqua_http_handler_seconds", "route", "Duracao dos handlers HTTP"},
+    {"aqua_flash_op_seconds", "op", "Duracao das operacoes em flash (NVS/LittleFS)"},
+};
+
+const char *const LOOP_METRIC_NAMES[MET_HTTP_FIRST] = {
+    "serviceWifi", "ensureTimeSynced", "maintainClock",
+    "checkSchedules", "processPumpQueue", "serviceOutbox", "updateStatusLed", "serviceHub", "total"};
+
+const char *const FLASH_METRIC_NAMES[MET_COUNT - MET_FLASH_CONFIG_SAVE] = {
+    "saveBombasConfig", "loadBombasConfig", "appendLocalLog", "trimLogFile", "outboxAppend", "journalWrite",
+    "logErase", "traceWrite", "hubMerge"};
+
+#define METRIC_GAUGE_ITEMS 3
+
+// Limites "le" exportados no /metrics, em microssegundos
+const uint32_t METRIC_BOUNDS_US[] = {10, 50, 100, 500, 1000, 5000, 10000, 50000,
+                                     100000, 500000, 1000000, 5000000};
+
+LatencyHistogram<2> metricHistograms[MET_COUNT];
+uint32_t cpuCyclesPerUs = 240;
+// Ciclos no clock atual -> ciclos no clock nominal (o modo ocioso reduz a CPU)
+uint32_t cpuCycleScale = 1;
+// O CCOUNT dá a volta em 2^32 ciclos (17,9 s a 240 MHz) e, escalado no modo
+// ocioso, estoura no mesmo ponto; a partir daqui vale o esp_timer
+#define METRIC_CCOUNT_MAX_US 8000000
+
+// µs -> ciclos do clock nominal, saturando em UINT32_MAX: uma medição longa
+// cai no último balde em vez de dar a volta
+uint32_t metricCyclesFromUs(int64_t elapsedUs)
+{
+  if (elapsedUs <= 0) return 0;
+  uint64_t cycles = static_cast<uint64_t>(elapsedUs) * cpuCyclesPerUs;
+  return cycles > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(cycles);
+}
+
+// Fases do loop: CCOUNT para a precisão, esp_timer para saber se deu a volta
+uint32_t metricCyclesSince(uint32_t startCycles, int64_t startUs)
+{
+  uint32_t cycles = (ESP.getCycleCount() - startCycles) * cpuCycleScale;
+  int64_t elapsedUs = esp_timer_get_time() - startUs;
+  return elapsedUs >= METRIC_CCOUNT_MAX_US ? metricCyclesFromUs(elapsedUs) : cycles;
+}
+
+// O contador de ciclos (CCOUNT) é por core. Só o loop() roda em task fixa,
+// então as demais medições usam esp_timer e convertem para ciclos.
+class MetricTimer
+{
+public:
+  explicit MetricTimer(MetricId id, bool pinnedTask = false)
+      : id_(id), pinned_(pinnedTask),
+        startCycles_(pinnedTask ? ESP.getCycleCount() : 0),
+        startUs_(esp_timer_get_time()) {}
 
-  Bomb()
+  ~MetricTimer()
   {
-    name = "";
-    calibrCoef = 1.0f;
-    quantidadeEstoque = 0.0f;
+    uint32_t cycles = pinned_ ? metricCyclesSince(startCycles_, startUs_)
+                              : metricCyclesFromUs(esp_timer_get_time() - startUs_);
+    metricHistograms[id_].record(cycles);
   }
+
+private:
+  MetricId id_;
+  bool pinned_;
+  uint32_t startCycles_;
+  int64_t startUs_;
 };
 
-Bomb bombas[BOMBA_COUNT];
+// --- Monitor de travamentos / SLO de dosagem ---
+#define NO_LOOP_PHASE 0xFF
 
-struct PumpJob
+enum IncidentType : uint8_t
 {
-  int bombaIndex;
-  float dosagem;
-  String origem;
-  DateTime timestamp;
+  INCIDENT_LOOP_PERIOD,
+  INCIDENT_DOSE_START,
+  INCIDENT_DOSE_CUTOFF,
+  INCIDENT_WATCHDOG,
+  INCIDENT_TYPE_COUNT
 };
 
-PumpJob pumpQueue[MAX_PUMP_QUEUE];
-volatile int pumpHead = 0;
-volatile int pumpTail = 0;
-bool pumpActive = false;
-PumpJob activeJob;
-unsigned long pumpStartTime = 0;
-unsigned long pumpDuration = 0;
-portMUX_TYPE pumpQueueMux = portMUX_INITIALIZER_UNLOCKED;
-
-bool rtcReady = false;
-bool prefsReady = false;
-bool fsReady = false;
-bool systemReady = false;
-size_t logCount = 0;
+const char *const INCIDENT_TYPE_NAMES[INCIDENT_TYPE_COUNT] = {
+    "loopPeriod", "doseStart", "doseCutoff", "watchdog"};
 
-enum LedMode
+struct SloConfig
 {
-  LED_MODE_BOOT,
-  LED_MODE_READY,
-  LED_MODE_NO_NET,
-  LED_MODE_DOSING
+  uint32_t loopPeriodMs;   // intervalo entre o início de duas iterações do loop()
+  uint32_t doseStartMs;    // job apto (enfileirado e bomba livre) até ligar a bomba
+  uint32_t doseCutoffMs;   // atraso do desligamento em relação ao tempo calculado
 };
 
-LedMode ledMode = LED_MODE_BOOT;
-unsigned long ledLastToggle = 0;
-bool ledBlinkOn = true;
-unsigned long noNetBlinkStart = 0;
-unsigned long lastNoNetBlink = 0;
-bool noNetBlinkActive = false;
-uint32_t currentLedColor = 0;
+SloConfig slo = {SLO_LOOP_PERIOD_MS, SLO_DOSE_START_MS, SLO_DOSE_CUTOFF_MS};
+
+// Gravados na NVS como bloco binário: não mudar o layout sem migrar
+struct StallIncident
+{
+  uint32_t uptimeSec;
+  uint32_t unixTime;   // 0 = hora desconhecida
+  uint32_t measuredMs;
+  uint32_t limitMs;
+  uint8_t type;
+  uint8_t phase;       // fase do loop mais lenta no momento (NO_LOOP_PHASE = nenhuma)
+  uint8_t reserved[2];
+};
+
+struct IncidentLog
+{
+  uint32_t total;
+  uint8_t next;
+  uint8_t reserved[3];
+  StallIncident items[INCIDENT_COUNT];
+};
+
+IncidentLog incidentLog = {};
+bool incidentsDirty = false;
+unsigned long lastIncidentFlush = 0;
+portMUX_TYPE incidentMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Fase mais lenta de cada iteração: a culpada provável de uma violação
+struct LoopIterationStats
+{
+  uint8_t slowestPhase;
+  uint32_t slowestCycles;
+};
+
+LoopIterationStats currentIteration = {NO_LOOP_PHASE, 0};
+LoopIterationStats previousIteration = {NO_LOOP_PHASE, 0};
+unsigned long lastLoopStart = 0;
+
+// Fora da inicialização da RAM: sobrevive ao reset do watchdog e indica
+// qual fase estava rodando quando o loop travou
+RTC_NOINIT_ATTR uint8_t runningLoopPhase;
+
+// --- Modo ocioso ---
+enum PowerMode : uint8_t
+{
+  POWER_ACTIVE,
+  POWER_IDLE,
+  POWER_MODE_COUNT
+};
+
+const char *const POWER_MODE_NAMES[POWER_MODE_COUNT] = {"active", "idle"};
+
+// Gravado na NVS (chave "power"): não mudar o layout sem migrar
+struct PowerConfig
+{
+  uint8_t enabled;
+  uint8_t lightSleep;     // só tem efeito com CONFIG_PM_ENABLE
+  uint8_t reserved[2];
+  uint32_t idleTickMs;    // período do loop() em modo ocioso
+  uint32_t apGraceSec;    // tempo sem clientes/requisições antes de entrar em ocioso
+};
+
+struct PowerStats
+{
+  PowerMode mode;
+  unsigned long modeSince;
+  uint64_t modeMs[POWER_MODE_COUNT];
+  uint32_t transitions;
+  uint32_t earlyWakes;       // loop acordado por evento antes do fim da espera
+  uint32_t plannedWaitMs;    // espera depois da última iteração
+  uint32_t nextDoseSec;
+};
+
+PowerConfig powerConfig = {0, 0, {0, 0}, POWER_IDLE_TICK_DEFAULT, POWER_AP_GRACE_DEFAULT};
+PowerStats powerStats = {POWER_ACTIVE, 0, {0, 0}, 0, 0, POWER_ACTIVE_TICK_MS, NO_NEXT_DOSE};
+TaskHandle_t loopTaskHandle = nullptr;
+TaskHandle_t syncTaskHandle = nullptr;
+// Último cliente no AP ou requisição HTTP (task de eventos / AsyncTCP)
+volatile unsigned long lastUserActivity = 0;
+
+// --- Relógio ---
+// Virada de segundo do DS3231 (o RTC só informa segundos inteiros)
+struct RtcEdgeSearch
+{
+  bool found;          // alguma virada já observada
+  uint32_t second;     // valor do RTC logo após a virada de referência
+  int64_t lowUs;       // a virada ocorreu em (lowUs, highUs] (esp_timer)
+  int64_t highUs;
+  uint32_t lastSecond;
+  int64_t lastReadUs;
+};
+
+struct ClockStats
+{
+  uint32_t rtcReads;
+  uint32_t readsThisHour;
+  uint32_t readsLastHour;
+  bool hourComplete;
+  unsigned long hourStart;
+  uint32_t resyncs;
+  uint32_t jumps;
+  int32_t lastErrorUs;
+};
+
+// Hora local (a mesma do RTC) em µs; lida pelo loop e pela task do AsyncTCP
+SoftClock<CLOCK_MAX_SLEW_PPM> wallClock;
+portMUX_TYPE clockMux = portMUX_INITIALIZER_UNLOCKED;
+ClockStats clockStats = {};
+RtcEdgeSearch clockSearch = {};
+bool clockResyncActive = false;
+unsigned long clockResyncStarted = 0;
+unsigned long nextClockResync = 0;
+
+// --- SNTP / disciplina do RTC ---
+enum NtpState : uint8_t
+{
+  NTP_IDLE,
+  NTP_RESOLVING,
+  NTP_WAIT_REPLY,
+  NTP_ALIGN_RTC,
+  NTP_SET_RTC
+};
+
+const char *const NTP_STATE_NAMES[] = {"idle", "resolving", "waitReply", "alignRtc", "setRtc"};
+
+enum NtpDnsResult : uint8_t
+{
+  NTP_DNS_PENDING,
+  NTP_DNS_OK,
+  NTP_DNS_FAILED
+};
+
+// Gravado na NVS (chave "ntp"): referência para medir a deriva do RTC
+struct RtcDiscipline
+{
+  uint32_t baselineUtc;       // 0 = sem referência (RTC nunca sincronizado ou ajustado à mão)
+  int32_t baselineOffsetUs;   // RTC - UTC naquele instante
+  float driftPpm;             // última deriva residual medida
+};
+
+RtcDiscipline rtcDiscipline = {};
+
+struct NtpClient
+{
+  NtpState state;
+  unsigned long stateSince;
+  unsigned long nextAttempt;
+  unsigned long retryDelay;
+  bool forceSync;
+
+  InlineString<NTP_SERVER_SIZE> server;
+  uint16_t port;
+  IPAddress serverIp;
+  volatile NtpDnsResult dnsResult;
+  volatile uint32_t dnsIp;
+
+  // Preenchidos pela task do AsyncUDP quando a resposta chega
+  volatile bool replyReady;
+  int64_t replyUs;
+  uint8_t reply[NTP_PACKET_SIZE];
+
+  uint8_t nonce[8];
+  int64_t sentUs;
+  int64_t utcAtReplyUs;
+  uint32_t roundTripUs;
+
+  RtcEdgeSearch edge;
+
+  int64_t lastOffsetUs;
+  int8_t agingOffset;
+  uint32_t syncCount;
+  uint32_t failCount;
+  uint32_t stepCount;
+  unsigned long lastSyncAt;
+};
+
+NtpClient ntp = {};
+AsyncUDP ntpUdp;
+
+// Alterações vindas do POST /ntp (task do AsyncTCP), aplicadas pelo loop
+portMUX_TYPE ntpSettingsMux = portMUX_INITIALIZER_UNLOCKED;
+InlineString<NTP_SERVER_SIZE> pendingNtpServer;
+uint16_t pendingNtpPort = 0;
+volatile bool ntpSettingsChanged = false;
 
 // =========================================================
 // Forward declarations
 // =========================================================
-String formatTimestamp(const DateTime &now);
-const char *wifiStatusToString(wl_status_t status);
+void formatIp(const IPAddress &ip, char *buffer, size_t size);
 const char *httpMethodToString(WebRequestMethodComposite method);
 
 // WiFi / sistema
 void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info);
 bool shouldPauseForAp();
-void applyApPriority();
-void enableSta();
-void disableSta();
+bool isStaConnected();
 void setupWifi();
-void ensureStaWifi();
-void ensureApIsUp();
+void startAp();
+void startWifiLink();
+void serviceWifi();
+void wifiEnterState(WifiLinkState state);
+void wifiArmTimer(unsigned long delayMs);
+void wifiConnect();
+void wifiPause();
+void wifiHandleEvent(WifiEvent event);
+void wifiScheduleRetry();
+void wifiLinkDown();
+uint64_t wifiConnectedMs();
+void fillWifiLinkStatus(JsonObject wifi);
+
+// Relógio (RTC + esp_timer)
+DateTime readRtc();
+void countRtcRead();
+uint32_t rtcReadsPerHour();
+void anchorClockAtBoot();
+DateTime clockNow();
+uint32_t clockUnixTime();
+void adjustClock(const DateTime &time);
+void maintainClock();
+void beginRtcEdgeSearch(RtcEdgeSearch &search);
+bool stepRtcEdgeSearch(RtcEdgeSearch &search);
+void fillClockStatus(JsonObject status);
 
 // Tempo / NTP
+void loadNtpSettings();
+bool ntpNetworkReady();
 void ensureTimeSynced();
+void ntpEnterState(NtpState state);
+void ntpStartSync();
+void ntpDnsFound(const char *name, const ip_addr_t *addr, void *arg);
+void ntpSendRequest();
+void onNtpPacket(AsyncUDPPacket &packet);
+void ntpHandleReply();
+int64_t ntpTimestampToUnixUs(const uint8_t *data);
+void ntpAlignRtc();
+void ntpEvaluateOffset();
+void ntpSetRtc();
+void ntpUpdateDrift(uint32_t utcSec, int64_t offsetUs);
+void ntpFinish(bool ok, const char *reason);
+long rtcUtcOffsetSec();
+void saveRtcDiscipline();
+bool readRtcAging(int8_t &value);
+bool writeRtcAging(int8_t value);
+void handlePostNtp(AsyncWebServerRequest *request);
+void fillNtpStatus(JsonObject status);
 
 // Server
 void setupServer();
-void handleStatus(AsyncWebServerRequest *request);
-void handleGetConfig(AsyncWebServerRequest *request);
-void handlePostConfig(AsyncWebServerRequest *request);
+void handlePostConfigRollback(AsyncWebServerRequest *request);
 void handlePostTime(AsyncWebServerRequest *request);
-void handlePostDose(AsyncWebServerRequest *request);
-void handleGetLogs(AsyncWebServerRequest *request);
 void handleDeleteLogs(AsyncWebServerRequest *request);
-void storeRequestBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
-bool readRequestBody(AsyncWebServerRequest *request, String &body);
-
-// Config / JSON
-void inicializarBombas();
-void saveBombasConfig();
-void loadBombasConfig();
-void initDefaultBombasConfig();
-String buildConfigJson();
-bool applyConfigJson(const String &json);
-void parseBombData(int i, JsonObject bomba);
-bool parseDateTime(const String &value, DateTime &output);
-void resetSchedule(Schedule &schedule);
-
-// Logs locais
-bool initLogStorage();
-size_t countLogLines(File &file);
-bool trimLogFile(size_t removeCount);
-void appendLocalLog(int bombaIndex, float dosagem, const String &origem, const DateTime &timestamp);
-
-// Scheduler
-void checkSchedules();
-
-// Pump queue
-bool enqueuePumpJob(int bombaIndex, float dosagem, const String &origem);
-int pumpPinForIndex(int bombaIndex);
-void processPumpQueue();
-void startNextPumpJob();
-void finishPumpJob();
+void storeRequestBody(AsyncWebServerRequest *request, HttpRoute route, uint8_t *data, size_t len, size_t index, size_t total);
+
+// Admissão HTTP
+ArRequestHandlerFunction guardedHandler(HttpRoute route, ArRequestHandlerFunction handler);
+ArBodyHandlerFunction guardedBodyHandler(HttpRoute route);
+RequestTicket *requestTicket(AsyncWebServerRequest *request);
+char *ticketBody(RequestTicket *ticket);
+RequestTicket *admitRequest(AsyncWebServerRequest *request, HttpRoute route, size_t bodySize);
+AdmissionVerdict checkAdmission(AsyncWebServerRequest *request, HttpRoute route, size_t bodySize);
+bool takeClientToken(uint32_t ip);
+void releaseRequest(AsyncWebServerRequest *request);
+void sendRejection(AsyncWebServerRequest *request, AdmissionVerdict verdict);
+void fillHttpStats(JsonObject http);
+
+// Métricas
+void timedLoopPhase(MetricId id, void (*phase)());
+MetricFamily metricFamily(int id);
+const char *metricLabel(int id);
+size_t appendf(char *buffer, size_t size, size_t used, const char *format, ...);
+size_t renderMetricsItem(size_t item, char *buffer, size_t size);
+void handleGetMetrics(AsyncWebServerRequest *request);
+
+// Monitor de travamentos
+void initStallMonitor();
+void startLoopWatchdog();
+void beginLoopIteration();
+uint8_t likelyStallPhase();
+void recordIncident(IncidentType type, uint8_t phase, uint32_t measuredMs, uint32_t limitMs);
+void flushIncidents();
+void handleGetIncidents(AsyncWebServerRequest *request);
+void handleDeleteIncidents(AsyncWebServerRequest *request);
+void handlePostSlo(AsyncWebServerRequest *request);
+
+// Modo ocioso
+void loadPowerConfig();
+void noteUserActivity();
+bool canIdle(uint32_t nextDoseSec);
+void idleUntilNextEvent();
+void setPowerMode(PowerMode mode);
+void setCpuClock(uint32_t mhz, bool lightSleep);
+uint64_t powerModeMs(PowerMode mode);
+void handlePostPower(AsyncWebServerRequest *request);
+void fillPowerStatus(JsonObject status);
+
+// Sincronização (outbox)
+void syncTask(void *arg);
+void startSyncTask();
+void handlePostSync(AsyncWebServerRequest *request);
+
+// Previsão de estoque
+void handlePostForecast(AsyncWebServerRequest *request);
+
+// Programas de dose
+void handlePostProgram(AsyncWebServerRequest *request);
+void handleGetProgram(AsyncWebServerRequest *request);
+void handleDeleteProgram(AsyncWebServerRequest *request);
+
+// Gravador de entradas
+void traceRequest(AsyncWebServerRequest *request, HttpRoute route);
+void handleGetTrace(AsyncWebServerRequest *request);
+void handlePostTrace(AsyncWebServerRequest *request);
+
+// Hub
+void handleGetHub(AsyncWebServerRequest *request);
+void handlePostHub(AsyncWebServerRequest *request);
+void handleGetHubLogs(AsyncWebServerRequest *request);
 
 // LED
 void setLedColor(uint8_t red, uint8_t green, uint8_t blue);
 void updateLedMode(LedMode mode);
 void updateStatusLed();
-void logWifiStatusChange();
 
 // =========================================================
 // Helpers
 // =========================================================
-String formatTimestamp(const DateTime &now)
-{
-  char buffer[20];
-  snprintf(buffer, sizeof(buffer), "%02d/%02d/%04d %02d:%02d",
-           now.day(), now.month(), now.year(), now.hour(), now.minute());
-  return String(buffer);
-}
-
-const char *wifiStatusToString(wl_status_t status)
+void formatIp(const IPAddress &ip, char *buffer, size_t size)
 {
-  switch (status)
-  {
-  case WL_IDLE_STATUS:      return "idle";
-  case WL_NO_SSID_AVAIL:    return "no ssid";
-  case WL_SCAN_COMPLETED:   return "scan completed";
-  case WL_CONNECTED:        return "connected";
-  case WL_CONNECT_FAILED:   return "connect failed";
-  case WL_CONNECTION_LOST:  return "connection lost";
-  case WL_DISCONNECTED:     return "disconnected";
-  default:                  return "unknown";
-  }
+  snprintf(buffer, size, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
 }
 
 const char *httpMethodToString(WebRequestMethodComposite method)
@@ -256,43 +798,81 @@ bool shouldPauseForAp()
 // =========================================================
 // Wi-Fi
 // =========================================================
+bool isStaConnected()
+{
+  return wifiLink.state == WIFI_STA_CONNECTED;
+}
+
+void pushWifiEvent(WifiEvent event)
+{
+  portENTER_CRITICAL(&wifiEventMux);
+  if (wifiEventQueue.count < WIFI_EVENT_QUEUE)
+  {
+    wifiEventQueue.items[(wifiEventQueue.head + wifiEventQueue.count) % WIFI_EVENT_QUEUE] = event;
+    wifiEventQueue.count++;
+  }
+  else
+  {
+    wifiEventQueue.overflow = true;
+  }
+  portEXIT_CRITICAL(&wifiEventMux);
+}
+
+// Roda na task de eventos do Arduino: só registra e sinaliza o loop
 void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
 {
   switch (event)
   {
-  case ARDUINO_EVENT_WIFI_STA_START:
-    Serial.println("[wifi] Evento: STA Start");
-    break;
-
-  case ARDUINO_EVENT_WIFI_STA_CONNECTED:
-    Serial.println("[wifi] Evento: STA Conectado ao AP");
-    break;
-
   case ARDUINO_EVENT_WIFI_STA_GOT_IP:
   {
     IPAddress ip(info.got_ip.ip_info.ip.addr);
     Serial.printf("[wifi] Evento: STA Ganhou IP: %s\n", ip.toString().c_str());
+    traceWifi(TRACE_WIFI_STA_GOT_IP, 0);
+    pushWifiEvent(WIFI_EV_STA_GOT_IP);
     break;
   }
 
+  case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+    Serial.println("[wifi] Evento: STA Perdeu IP");
+    traceWifi(TRACE_WIFI_STA_LOST_IP, 0);
+    pushWifiEvent(WIFI_EV_STA_DISCONNECTED);
+    break;
+
   case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
     Serial.printf("[wifi] Evento: STA Desconectado. Motivo: %d\n",
                   info.wifi_sta_disconnected.reason);
+    wifiDisconnectReason = info.wifi_sta_disconnected.reason;
+    traceWifi(TRACE_WIFI_STA_DISCONNECTED, info.wifi_sta_disconnected.reason);
+    pushWifiEvent(WIFI_EV_STA_DISCONNECTED);
     break;
 
   case ARDUINO_EVENT_WIFI_AP_STACONNECTED:
     apClientCount++;
+    noteUserActivity();
     Serial.printf("[wifi] Evento: Cliente conectou no AP Proprio (Total: %u)\n", apClientCount);
+    traceWifi(TRACE_WIFI_AP_CLIENT_JOINED, apClientCount);
+    pushWifiEvent(WIFI_EV_AP_CLIENTS);
     break;
 
   case ARDUINO_EVENT_WIFI_AP_STADISCONNECTED:
     if (apClientCount > 0) apClientCount--;
+    noteUserActivity();
     Serial.printf("[wifi] Evento: Cliente desconectou do AP Proprio (Total: %u)\n", apClientCount);
+    traceWifi(TRACE_WIFI_AP_CLIENT_LEFT, apClientCount);
+    pushWifiEvent(WIFI_EV_AP_CLIENTS);
+    break;
+
+  case ARDUINO_EVENT_WIFI_AP_STOP:
+    Serial.println("[wifi] Evento: AP parou");
+    traceWifi(TRACE_WIFI_AP_STOPPED, 0);
+    pushWifiEvent(WIFI_EV_AP_STOPPED);
     break;
 
   default:
     break;
   }
+
+  wakeLoop();
 }
 
 void setupWifi()
@@ -300,193 +880,975 @@ void setupWifi()
   WiFi.onEvent(onWiFiEvent);
   WiFi.mode(isStaConfigured() ? WIFI_AP_STA : WIFI_AP);
   WiFi.setSleep(false);
+  // Reconexão é da máquina de estados (backoff), não do core
+  WiFi.setAutoReconnect(false);
+  WiFi.persistent(false);
+
+  startAp();
+}
 
+void startAp()
+{
   WiFi.softAPConfig(IPAddress(192, 168, 4, 1),
                     IPAddress(192, 168, 4, 1),
                     IPAddress(255, 255, 255, 0));
-
   WiFi.softAP(AP_SSID, AP_PASSWORD);
   Serial.printf("[wifi] AP Iniciado: %s (%s)\n", AP_SSID, WiFi.softAPIP().toString().c_str());
-
-  staEnabled = false;
 }
 
-void enableSta()
+void startWifiLink()
 {
-  if (staEnabled) return;
-  if (!isStaConfigured()) return;
-  WiFi.persistent(false);
-  WiFi.begin(STA_SSID, STA_PASSWORD);
-  Serial.printf("[wifi] STA Habilitado. Tentando: %s\n", STA_SSID);
-  staEnabled = true;
+  wifiLink.backoff = WIFI_BACKOFF_MIN;
+  if (!isStaConfigured())
+    wifiEnterState(WIFI_STA_DISABLED);
+  else if (shouldPauseForAp())
+    wifiPause();
+  else
+    wifiConnect();
 }
 
-void disableSta()
+// Fase do loop: só age quando há evento pendente ou o timer venceu
+void serviceWifi()
 {
-  if (!staEnabled) return;
-  if (!isStaConfigured()) return;
-  Serial.println("[wifi] STA Pausado (Cliente AP detectado)");
-  WiFi.setAutoReconnect(false);
-  WiFi.disconnect();
-  staEnabled = false;
+  WifiEvent events[WIFI_EVENT_QUEUE];
+  portENTER_CRITICAL(&wifiEventMux);
+  uint8_t count = wifiEventQueue.count;
+  bool overflow = wifiEventQueue.overflow;
+  for (uint8_t i = 0; i < count; i++)
+    events[i] = wifiEventQueue.items[(wifiEventQueue.head + i) % WIFI_EVENT_QUEUE];
+  wifiEventQueue.head = (wifiEventQueue.head + count) % WIFI_EVENT_QUEUE;
+  wifiEventQueue.count = 0;
+  wifiEventQueue.overflow = false;
+  portEXIT_CRITICAL(&wifiEventMux);
+
+  for (uint8_t i = 0; i < count; i++)
+    wifiHandleEvent(events[i]);
+  if (overflow)
+  {
+    Serial.println("[wifi] Fila de eventos cheia: reavaliando AP e STA");
+    wifiHandleEvent(WIFI_EV_AP_CLIENTS);
+    wifiHandleEvent(WIFI_EV_STA_DISCONNECTED);
+  }
+
+  // O timer depois dos eventos: um GOT_IP na mesma passada já o desarmou
+  if (!wifiLink.timerArmed || static_cast<long>(millis() - wifiLink.deadline) < 0) return;
+
+  switch (wifiLink.state)
+  {
+  case WIFI_STA_CONNECTING:
+    Serial.println("[wifi] Tempo esgotado na conexao STA");
+    WiFi.disconnect();
+    wifiScheduleRetry();
+    break;
+
+  case WIFI_STA_BACKOFF:
+    wifiConnect();
+    break;
+
+  default:
+    break;
+  }
 }
 
-void applyApPriority()
+void wifiHandleEvent(WifiEvent event)
 {
-  if (shouldPauseForAp())
+  if (event == WIFI_EV_AP_STOPPED)
   {
-    disableSta();
+    Serial.println("[wifi] AP caiu! Reiniciando AP...");
+    startAp();
     return;
   }
-  enableSta();
-}
 
-void ensureStaWifi()
-{
-  if (!isStaConfigured()) return;
-  if (shouldPauseForAp()) return;
-  if (!staEnabled) return;
-  if (WiFi.status() == WL_CONNECTED) return;
-  if (apClientCount > 0) return;
+  if (wifiLink.state == WIFI_STA_DISABLED) return;
+
+  switch (event)
+  {
+  // Prioridade do AP: com cliente no AP o STA fica desligado
+  case WIFI_EV_AP_CLIENTS:
+    if (shouldPauseForAp() && wifiLink.state != WIFI_STA_PAUSED)
+    {
+      wifiPause();
+    }
+    else if (!shouldPauseForAp() && wifiLink.state == WIFI_STA_PAUSED)
+    {
+      Serial.println("[wifi] AP sem clientes. Religando STA.");
+      wifiLink.backoff = WIFI_BACKOFF_MIN;
+      wifiConnect();
+    }
+    break;
 
-  if (millis() - lastWifiAttempt < wifiReconnectInterval) return;
+  // No backoff também: o IP da tentativa anterior chegou depois da queda
+  // e religar seria uma reconexão à toa
+  case WIFI_EV_STA_GOT_IP:
+    if (wifiLink.state == WIFI_STA_CONNECTING || wifiLink.state == WIFI_STA_BACKOFF)
+    {
+      wifiLink.connects++;
+      wifiLink.connectedSince = millis();
+      wifiLink.backoff = WIFI_BACKOFF_MIN;
+      wifiEnterState(WIFI_STA_CONNECTED);
+      Serial.printf("[wifi] CONECTADO! IP: %s, RSSI: %d dBm\n",
+                    WiFi.localIP().toString().c_str(), WiFi.RSSI());
+    }
+    break;
 
-  lastWifiAttempt = millis();
-  Serial.printf("[wifi] Tentando reconectar STA: %s...\n", STA_SSID);
-  WiFi.reconnect();
-}
+  case WIFI_EV_STA_DISCONNECTED:
+    if (wifiLink.state == WIFI_STA_CONNECTED)
+    {
+      wifiLinkDown();
+      wifiScheduleRetry();
+    }
+    else if (wifiLink.state == WIFI_STA_CONNECTING)
+    {
+      wifiScheduleRetry();
+    }
+    break;
 
-void ensureApIsUp()
-{
-  if (WiFi.softAPIP().toString() == "0.0.0.0")
-  {
-    Serial.println("[wifi] AP caiu! Reiniciando AP...");
-    WiFi.softAPConfig(IPAddress(192, 168, 4, 1),
-                      IPAddress(192, 168, 4, 1),
-                      IPAddress(255, 255, 255, 0));
-    WiFi.softAP(AP_SSID, AP_PASSWORD);
+  default:
+    break;
   }
 }
 
-void logWifiStatusChange()
+void wifiEnterState(WifiLinkState state)
 {
-  static wl_status_t lastStatus = (wl_status_t)-1;
-  wl_status_t status = WiFi.status();
-  if (status == lastStatus) return;
-
-  lastStatus = status;
-  Serial.printf("[wifi] Status alterado: %s\n", wifiStatusToString(status));
+  wifiLink.state = state;
+  wifiLink.timerArmed = false;
+}
 
-  if (status == WL_CONNECTED)
-  {
-    Serial.printf("[wifi] CONECTADO! IP: %s, RSSI: %d dBm\n",
-                  WiFi.localIP().toString().c_str(),
-                  WiFi.RSSI());
-  }
+void wifiArmTimer(unsigned long delayMs)
+{
+  wifiLink.deadline = millis() + delayMs;
+  wifiLink.timerArmed = true;
 }
 
-// =========================================================
-// Tempo / NTP
-// =========================================================
-void ensureTimeSynced()
+void wifiConnect()
 {
-  if (timeSynced || WiFi.status() != WL_CONNECTED) return;
-  if (!isStaConfigured()) return;
-  if (shouldPauseForAp()) return;
-  if (millis() - lastTimeSyncAttempt < timeSyncInterval) return;
+  wifiLink.reconnectAttempts++;
+  Serial.printf("[wifi] Conectando STA: %s (tentativa %u)\n", STA_SSID, wifiLink.reconnectAttempts);
 
-  lastTimeSyncAttempt = millis();
-  Serial.println("[time] Tentando sincronizar via NTP...");
-  configTime(gmtOffsetSec, daylightOffsetSec, "pool.ntp.org", "time.nist.gov");
+  // begin() e não reconnect(): reconnect() desconecta antes e o evento
+  // resultante derrubaria a tentativa recém-iniciada
+  WiFi.begin(STA_SSID, STA_PASSWORD);
+  wifiLink.staStarted = true;
 
-  struct tm timeinfo;
-  if (getLocalTime(&timeinfo, 5000))
-  {
-    timeSynced = true;
-    Serial.printf("[time] Sincronizado com sucesso! Data: %02d/%02d/%04d %02d:%02d:%02d\n",
-                  timeinfo.tm_mday, timeinfo.tm_mon + 1, timeinfo.tm_year + 1900,
-                  timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
-  }
-  else
-  {
-    Serial.println("[time] Falha na sincronizacao NTP");
-  }
+  wifiEnterState(WIFI_STA_CONNECTING);
+  wifiArmTimer(WIFI_CONNECT_TIMEOUT);
 }
 
-// =========================================================
-// WebServer
-// =========================================================
-void handleStatus(AsyncWebServerRequest *request)
+void wifiPause()
 {
-  Serial.println("[http] Recebido: GET /status");
-  JsonDocument doc;
+  Serial.println("[wifi] STA Pausado (Cliente AP detectado)");
+  if (wifiLink.state == WIFI_STA_CONNECTED)
+    wifiLinkDown();
+  if (wifiLink.staStarted)
+    WiFi.disconnect();
+  wifiEnterState(WIFI_STA_PAUSED);
+}
 
-  DateTime now = rtc.now();
-  doc["time"] = formatTimestamp(now);
+// Backoff exponencial com "equal jitter": metade fixa + metade aleatória,
+// para vários dosadores não baterem no roteador ao mesmo tempo
+void wifiScheduleRetry()
+{
+  wifiLink.lastDisconnectReason = wifiDisconnectReason;
+  unsigned long delayMs = wifiLink.backoff / 2 + esp_random() % (wifiLink.backoff / 2 + 1);
+  wifiLink.backoff = wifiLink.backoff * 2 > WIFI_BACKOFF_MAX ? WIFI_BACKOFF_MAX : wifiLink.backoff * 2;
 
-  JsonObject wifi = doc["wifi"].to<JsonObject>();
-  wifi["connected"] = (WiFi.status() == WL_CONNECTED);
-  wifi["rssi"] = (WiFi.status() == WL_CONNECTED) ? WiFi.RSSI() : 0;
-  wifi["ip"] = (WiFi.status() == WL_CONNECTED) ? WiFi.localIP().toString() : "";
+  Serial.printf("[wifi] Nova tentativa em %lu ms (motivo: %u)\n", delayMs, wifiLink.lastDisconnectReason);
+  wifiEnterState(WIFI_STA_BACKOFF);
+  wifiArmTimer(delayMs);
+}
 
-  JsonObject ap = doc["ap"].to<JsonObject>();
-  ap["ssid"] = AP_SSID;
-  ap["ip"] = WiFi.softAPIP().toString();
+void wifiLinkDown()
+{
+  wifiLink.disconnects++;
+  wifiLink.connectedMsTotal += millis() - wifiLink.connectedSince;
+  Serial.printf("[wifi] STA desconectado apos %lu s conectado\n",
+                (millis() - wifiLink.connectedSince) / 1000);
+}
 
-  String payload;
-  serializeJson(doc, payload);
-  request->send(200, "application/json", payload);
+uint64_t wifiConnectedMs()
+{
+  uint64_t total = wifiLink.connectedMsTotal;
+  if (wifiLink.state == WIFI_STA_CONNECTED)
+    total += millis() - wifiLink.connectedSince;
+  return total;
+}
+
+void fillWifiLinkStatus(JsonObject wifi)
+{
+  wifi["state"] = WIFI_LINK_STATE_NAMES[wifiLink.state];
+  wifi["reconnectAttempts"] = wifiLink.reconnectAttempts;
+  wifi["connects"] = wifiLink.connects;
+  wifi["disconnects"] = wifiLink.disconnects;
+  wifi["connectedSec"] = static_cast<uint32_t>(wifiConnectedMs() / 1000);
+  wifi["lastDisconnectReason"] = wifiLink.lastDisconnectReason;
 }
 
-void handleGetConfig(AsyncWebServerRequest *request)
+// =========================================================
+// Relógio (RTC + esp_timer)
+// =========================================================
+// Única porta de leitura do DS3231: conta as transações I2C
+DateTime readRtc()
 {
-  Serial.println("[http] Recebido: GET /config");
-  request->send(200, "application/json", buildConfigJson());
+  countRtcRead();
+  uint32_t unixTime = 0;
+  hal::rtcRead(unixTime);
+  return DateTime(unixTime);
 }
 
-void handlePostConfig(AsyncWebServerRequest *request)
+void countRtcRead()
 {
-  Serial.println("[http] Recebido: POST /config");
+  clockStats.rtcReads++;
+  rtcReadsPerHour();
+  clockStats.readsThisHour++;
+}
 
-  String body;
-  if (!readRequestBody(request, body))
+// Leituras na última hora completa (ou na hora corrente, na primeira hora)
+uint32_t rtcReadsPerHour()
+{
+  while (millis() - clockStats.hourStart >= 3600000UL)
   {
-    Serial.println("[http] ERRO: Body ausente em /config");
-    request->send(400, "application/json", "{\"ok\":false,\"message\":\"body ausente\"}");
-    return;
+    clockStats.readsLastHour = clockStats.readsThisHour;
+    clockStats.readsThisHour = 0;
+    clockStats.hourStart += 3600000UL;
+    clockStats.hourComplete = true;
   }
+  return clockStats.hourComplete ? clockStats.readsLastHour : clockStats.readsThisHour;
+}
 
-  Serial.printf("[http] Body recebido: %s\n", body.c_str());
+// No boot ainda não há watchdog nem HTTP: pode esperar a virada do segundo
+// (até ~1 s) para ancorar o relógio com erro de poucos ms
+void anchorClockAtBoot()
+{
+  RtcEdgeSearch search;
+  beginRtcEdgeSearch(search);
 
-  bool ok = applyConfigJson(body);
-  if (ok)
+  unsigned long start = millis();
+  while (!search.found && millis() - start < 1500)
   {
-    Serial.println("[http] Config aplicada com sucesso.");
-    request->send(200, "application/json", "{\"ok\":true}");
+    stepRtcEdgeSearch(search);
+    delay(10);
   }
+
+  portENTER_CRITICAL(&clockMux);
+  if (search.found)
+    wallClock.anchor((search.lowUs + search.highUs) / 2, static_cast<int64_t>(search.second) * 1000000LL);
   else
-  {
-    Serial.println("[http] Falha ao aplicar config.");
-    request->send(400, "application/json", "{\"ok\":false,\"message\":\"json invalido\"}");
-  }
+    wallClock.anchor(esp_timer_get_time(), static_cast<int64_t>(search.lastSecond) * 1000000LL);
+  portEXIT_CRITICAL(&clockMux);
+
+  nextClockResync = millis() + CLOCK_RESYNC_RETRY;
 }
 
-void handlePostTime(AsyncWebServerRequest *request)
+DateTime clockNow()
+{
+  return DateTime(clockUnixTime());
+}
+
+uint32_t clockUnixTime()
+{
+  uint32_t unixTime;
+  if (!wallClock.isAnchored())
+  {
+    unixTime = readRtc().unixtime();
+  }
+  else
+  {
+    int64_t monoUs = esp_timer_get_time();
+    portENTER_CRITICAL(&clockMux);
+    int64_t nowUs = wallClock.now(monoUs);
+    portEXIT_CRITICAL(&clockMux);
+    unixTime = static_cast<uint32_t>(nowUs / 1000000);
+  }
+
+  traceClock(unixTime);
+  return unixTime;
+}
+
+// Toda escrita no RTC passa por aqui. Gravar os segundos zera o divisor do
+// DS3231, então o instante da gravação é exatamente o início do segundo.
+void adjustClock(const DateTime &time)
+{
+  int64_t writeUs = esp_timer_get_time();
+  hal::rtcWrite(time.unixtime());
+
+  portENTER_CRITICAL(&clockMux);
+  wallClock.anchor(writeUs, static_cast<int64_t>(time.unixtime()) * 1000000LL);
+  portEXIT_CRITICAL(&clockMux);
+
+  clockResyncActive = false;
+  nextClockResync = millis() + CLOCK_RESYNC_INTERVAL;
+}
+
+// Ressincroniza o relógio de software com o RTC a cada CLOCK_RESYNC_INTERVAL.
+// Erros pequenos (deriva do cristal do ESP32) são corrigidos por slew;
+// diferenças acima de 1 s significam que o RTC mudou por fora e o
+// relógio é reancorado (salto).
+void maintainClock()
+{
+  if (!rtcReady || !wallClock.isAnchored()) return;
+  // O NTP está lendo ou gravando o RTC
+  if (ntp.state == NTP_ALIGN_RTC || ntp.state == NTP_SET_RTC) return;
+
+  unsigned long now = millis();
+  if (!clockResyncActive)
+  {
+    if (static_cast<long>(now - nextClockResync) < 0) return;
+    beginRtcEdgeSearch(clockSearch);
+    clockResyncActive = true;
+    clockResyncStarted = now;
+  }
+
+  if (now - clockResyncStarted > CLOCK_RESYNC_TIMEOUT)
+  {
+    Serial.println("[clock] Ressincronizacao com o RTC nao convergiu, nova tentativa em 60 s");
+    clockResyncActive = false;
+    nextClockResync = now + CLOCK_RESYNC_RETRY;
+    return;
+  }
+
+  if (!stepRtcEdgeSearch(clockSearch)) return;
+
+  clockResyncActive = false;
+  nextClockResync = millis() + CLOCK_RESYNC_INTERVAL;
+
+  int64_t edgeUs = (clockSearch.lowUs + clockSearch.highUs) / 2;
+  int64_t referenceUs = static_cast<int64_t>(clockSearch.second) * 1000000LL;
+
+  portENTER_CRITICAL(&clockMux);
+  int64_t errorUs = referenceUs - wallClock.now(edgeUs);
+  bool jumped = llabs(errorUs) > CLOCK_JUMP_THRESHOLD_US;
+  if (jumped)
+    wallClock.anchor(edgeUs, referenceUs);
+  else
+    wallClock.slew(esp_timer_get_time(), errorUs);
+  portEXIT_CRITICAL(&clockMux);
+
+  clockStats.resyncs++;
+  clockStats.lastErrorUs = jumped ? 0 : static_cast<int32_t>(errorUs);
+  if (jumped)
+  {
+    clockStats.jumps++;
+    Serial.printf("[clock] SALTO no RTC: %+.3f s. Relogio reancorado.\n", errorUs / 1e6);
+  }
+  else
+  {
+    Serial.printf("[clock] Ressincronizado com o RTC: erro %+.1f ms (slew)\n", errorUs / 1000.0);
+  }
+}
+
+void beginRtcEdgeSearch(RtcEdgeSearch &search)
+{
+  memset(&search, 0, sizeof(search));
+}
+
+// Um passo da busca; true quando a virada está localizada com resolução
+// de RTC_EDGE_RESOLUTION_US.
+//
+// Fase grossa: uma leitura por chamada até o valor mudar, o que limita a
+// virada a (leitura anterior, leitura atual]. Depois, bissecção: como a
+// virada se repete a cada segundo, uma única leitura no meio da janela
+// (num segundo seguinte) diz de que lado ela está. A espera até o instante
+// da leitura é limitada a RTC_SPIN_MAX_US; se a iteração do loop cair
+// longe dele, tenta no próximo segundo.
+bool stepRtcEdgeSearch(RtcEdgeSearch &search)
+{
+  if (!search.found)
+  {
+    uint32_t second = readRtc().unixtime();
+    int64_t readUs = esp_timer_get_time();
+    if (search.lastReadUs != 0 && second != search.lastSecond)
+    {
+      search.found = true;
+      search.second = second;
+      search.lowUs = search.lastReadUs;
+      search.highUs = readUs;
+    }
+    search.lastSecond = second;
+    search.lastReadUs = readUs;
+    return search.found && search.highUs - search.lowUs <= RTC_EDGE_RESOLUTION_US;
+  }
+
+  int64_t width = search.highUs - search.lowUs;
+  if (width <= RTC_EDGE_RESOLUTION_US) return true;
+
+  int64_t midUs = search.lowUs + width / 2;
+  int64_t now = esp_timer_get_time();
+  int64_t periods = (now - midUs + 999999) / 1000000;
+  if (periods < 1) periods = 1;
+  int64_t probeUs = midUs + periods * 1000000;
+  if (probeUs - now > RTC_SPIN_MAX_US) return false;
+
+  while (esp_timer_get_time() < probeUs)
+  {
+  }
+  uint32_t second = readRtc().unixtime();
+  uint32_t expected = search.second + static_cast<uint32_t>(periods);
+
+  if (second == expected)
+    search.highUs = midUs;  // já virou: a virada é anterior ao meio
+  else if (second == expected - 1)
+    search.lowUs = midUs;
+  else
+    beginRtcEdgeSearch(search);  // RTC mudou no meio da busca: recomeça
+
+  return search.found && search.highUs - search.lowUs <= RTC_EDGE_RESOLUTION_US;
+}
+
+void fillClockStatus(JsonObject status)
+{
+  int64_t monoUs = esp_timer_get_time();
+  portENTER_CRITICAL(&clockMux);
+  int64_t pendingSlewUs = wallClock.pendingSlew(monoUs);
+  portEXIT_CRITICAL(&clockMux);
+
+  status["rtcReadsPerHour"] = rtcReadsPerHour();
+  status["rtcReads"] = clockStats.rtcReads;
+  status["resyncs"] = clockStats.resyncs;
+  status["jumps"] = clockStats.jumps;
+  status["lastErrorMs"] = clockStats.lastErrorUs / 1000.0;
+  status["pendingSlewMs"] = pendingSlewUs / 1000.0;
+}
+
+// =========================================================
+// Tempo / NTP
+// =========================================================
+void loadNtpSettings()
+{
+  ntp.server = NTP_DEFAULT_SERVER;
+  ntp.port = NTP_DEFAULT_PORT;
+  ntp.retryDelay = NTP_RETRY_MIN;
+
+  if (prefsReady)
+  {
+    char server[NTP_SERVER_SIZE];
+    if (hal::kvGetString("ntpServer", server, sizeof(server)) > 0)
+      ntp.server = server;
+    ntp.port = hal::kvGetU16("ntpPort", NTP_DEFAULT_PORT);
+    if (hal::kvGetBytes("ntp", &rtcDiscipline, sizeof(rtcDiscipline)) != sizeof(rtcDiscipline))
+      memset(&rtcDiscipline, 0, sizeof(rtcDiscipline));
+  }
+
+  int8_t aging = 0;
+  if (rtcReady && readRtcAging(aging))
+    ntp.agingOffset = aging;
+
+  ntpUdp.onPacket(onNtpPacket);
+
+  Serial.printf("[time] Servidor NTP: %s:%u, aging do RTC: %d, deriva medida: %+.2f ppm\n",
+                ntp.server.c_str(), ntp.port, ntp.agingOffset, rtcDiscipline.driftPpm);
+}
+
+bool ntpNetworkReady()
+{
+  // Servidor local na rede do AP (ex.: tools/sntp_standin.py num notebook conectado)
+  IPAddress literal;
+  if (apClientCount > 0 && literal.fromString(ntp.server.c_str()))
+  {
+    IPAddress apIp = WiFi.softAPIP();
+    if (literal[0] == apIp[0] && literal[1] == apIp[1] && literal[2] == apIp[2])
+      return true;
+  }
+
+  return isStaConnected();
+}
+
+// Máquina de estados SNTP: cada chamada faz um passo curto e retorna.
+// Espera ativa só existe para alinhar com o segundo do RTC e é limitada
+// a RTC_SPIN_MAX_US por iteração do loop.
+void ensureTimeSynced()
+{
+  unsigned long now = millis();
+
+  switch (ntp.state)
+  {
+  case NTP_IDLE:
+    if (ntpSettingsChanged)
+    {
+      portENTER_CRITICAL(&ntpSettingsMux);
+      ntp.server = pendingNtpServer.c_str();
+      ntp.port = pendingNtpPort;
+      ntpSettingsChanged = false;
+      portEXIT_CRITICAL(&ntpSettingsMux);
+      ntp.forceSync = true;
+    }
+    if (!rtcReady || !ntpNetworkReady()) return;
+    if (!ntp.forceSync && static_cast<long>(now - ntp.nextAttempt) < 0) return;
+    ntp.forceSync = false;
+    ntpStartSync();
+    return;
+
+  case NTP_RESOLVING:
+    if (ntp.dnsResult == NTP_DNS_OK)
+    {
+      ntp.serverIp = IPAddress(ntp.dnsIp);
+      ntpSendRequest();
+    }
+    else if (ntp.dnsResult == NTP_DNS_FAILED || now - ntp.stateSince > NTP_DNS_TIMEOUT)
+    {
+      ntpFinish(false, "DNS falhou");
+    }
+    return;
+
+  case NTP_WAIT_REPLY:
+    if (ntp.replyReady)
+      ntpHandleReply();
+    else if (now - ntp.stateSince > NTP_REPLY_TIMEOUT)
+      ntpFinish(false, "sem resposta");
+    return;
+
+  case NTP_ALIGN_RTC:
+    ntpAlignRtc();
+    return;
+
+  case NTP_SET_RTC:
+    ntpSetRtc();
+    return;
+  }
+}
+
+void ntpEnterState(NtpState state)
+{
+  ntp.state = state;
+  ntp.stateSince = millis();
+}
+
+void ntpStartSync()
+{
+  Serial.printf("[time] Sincronizando com %s:%u...\n", ntp.server.c_str(), ntp.port);
+
+  IPAddress literal;
+  if (literal.fromString(ntp.server.c_str()))
+  {
+    ntp.serverIp = literal;
+    ntpSendRequest();
+    return;
+  }
+
+  ip_addr_t addr;
+  ntp.dnsResult = NTP_DNS_PENDING;
+  err_t err = dns_gethostbyname(ntp.server.c_str(), &addr, ntpDnsFound, nullptr);
+  if (err == ERR_OK)
+  {
+    ntp.serverIp = IPAddress(ip4_addr_get_u32(ip_2_ip4(&addr)));
+    ntpSendRequest();
+  }
+  else if (err == ERR_INPROGRESS)
+  {
+    ntpEnterState(NTP_RESOLVING);
+  }
+  else
+  {
+    ntpFinish(false, "DNS falhou");
+  }
+}
+
+// Chamado pela task do lwIP
+void ntpDnsFound(const char *name, const ip_addr_t *addr, void *arg)
+{
+  if (addr != nullptr && IP_IS_V4(addr))
+  {
+    ntp.dnsIp = ip4_addr_get_u32(ip_2_ip4(addr));
+    ntp.dnsResult = NTP_DNS_OK;
+  }
+  else
+  {
+    ntp.dnsResult = NTP_DNS_FAILED;
+  }
+}
+
+void ntpSendRequest()
+{
+  if (!ntpUdp.connect(ntp.serverIp, ntp.port))
+  {
+    ntpFinish(false, "falha ao abrir socket UDP");
+    return;
+  }
+
+  uint8_t packet[NTP_PACKET_SIZE] = {};
+  packet[0] = 0x23;  // LI 0, versão 4, modo 3 (cliente)
+
+  // Transmit timestamp aleatório: o servidor devolve como "originate",
+  // o que descarta respostas atrasadas de tentativas anteriores
+  for (int i = 0; i < 8; i += 4)
+  {
+    uint32_t random = esp_random();
+    memcpy(ntp.nonce + i, &random, 4);
+  }
+  memcpy(packet + 40, ntp.nonce, sizeof(ntp.nonce));
+
+  ntp.replyReady = false;
+  ntpEnterState(NTP_WAIT_REPLY);
+  ntp.sentUs = esp_timer_get_time();
+  if (ntpUdp.write(packet, sizeof(packet)) != sizeof(packet))
+    ntpFinish(false, "falha no envio UDP");
+}
+
+// Roda na task do AsyncUDP: o instante de chegada (T4) é marcado aqui,
+// sem esperar a próxima iteração do loop
+void onNtpPacket(AsyncUDPPacket &packet)
+{
+  int64_t receivedUs = esp_timer_get_time();
+  if (ntp.state != NTP_WAIT_REPLY || ntp.replyReady) return;
+  if (packet.length() < NTP_PACKET_SIZE || packet.remoteIP() != ntp.serverIp) return;
+
+  memcpy(ntp.reply, packet.data(), NTP_PACKET_SIZE);
+  ntp.replyUs = receivedUs;
+  ntp.replyReady = true;
+}
+
+int64_t ntpTimestampToUnixUs(const uint8_t *data)
+{
+  uint32_t seconds = (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | data[3];
+  uint32_t fraction = (uint32_t(data[4]) << 24) | (uint32_t(data[5]) << 16) | (uint32_t(data[6]) << 8) | data[7];
+
+  // Era 1 do NTP começa em 2036: segundos "pequenos" já passaram da virada
+  int64_t unixSeconds = static_cast<int64_t>(seconds) - NTP_UNIX_OFFSET;
+  if (seconds < NTP_UNIX_OFFSET) unixSeconds += 4294967296LL;
+
+  return unixSeconds * 1000000LL + static_cast<int64_t>((static_cast<uint64_t>(fraction) * 1000000ULL) >> 32);
+}
+
+void ntpHandleReply()
+{
+  ntpUdp.close();
+
+  const uint8_t *reply = ntp.reply;
+  uint8_t leap = reply[0] >> 6;
+  uint8_t mode = reply[0] & 0x07;
+  uint8_t stratum = reply[1];
+
+  if (mode != 4 || stratum == 0 || stratum > 15 || leap == 3)
+  {
+    ntpFinish(false, "servidor recusou ou nao esta sincronizado");
+    return;
+  }
+  if (memcmp(reply + 24, ntp.nonce, sizeof(ntp.nonce)) != 0)
+  {
+    ntpFinish(false, "resposta nao corresponde ao pedido");
+    return;
+  }
+
+  // T2/T3 do servidor; T1/T4 locais (esp_timer)
+  int64_t receiveUs = ntpTimestampToUnixUs(reply + 32);
+  int64_t transmitUs = ntpTimestampToUnixUs(reply + 40);
+  int64_t roundTrip = (ntp.replyUs - ntp.sentUs) - (transmitUs - receiveUs);
+  if (roundTrip < 0) roundTrip = 0;
+
+  ntp.roundTripUs = static_cast<uint32_t>(roundTrip);
+  ntp.utcAtReplyUs = transmitUs + roundTrip / 2;
+
+  beginRtcEdgeSearch(ntp.edge);
+  ntpEnterState(NTP_ALIGN_RTC);
+}
+
+// Localiza a virada de segundo do RTC para medir o offset em milissegundos
+void ntpAlignRtc()
+{
+  if (millis() - ntp.stateSince > NTP_ALIGN_TIMEOUT)
+  {
+    if (ntp.edge.found)
+      ntpEvaluateOffset();
+    else
+      ntpFinish(false, "RTC nao respondeu");
+    return;
+  }
+
+  if (stepRtcEdgeSearch(ntp.edge))
+    ntpEvaluateOffset();
+}
+
+void ntpEvaluateOffset()
+{
+  int64_t edgeUs = (ntp.edge.lowUs + ntp.edge.highUs) / 2;
+  int64_t utcAtEdgeUs = ntp.utcAtReplyUs + (edgeUs - ntp.replyUs);
+  int64_t rtcAtEdgeUs = (static_cast<int64_t>(ntp.edge.second) - rtcUtcOffsetSec()) * 1000000LL;
+  ntp.lastOffsetUs = rtcAtEdgeUs - utcAtEdgeUs;
+
+  ntpUpdateDrift(static_cast<uint32_t>(utcAtEdgeUs / 1000000), ntp.lastOffsetUs);
+
+  if (rtcDiscipline.baselineUtc == 0 || llabs(ntp.lastOffsetUs) > NTP_STEP_THRESHOLD_US)
+    ntpEnterState(NTP_SET_RTC);
+  else
+    ntpFinish(true, nullptr);
+}
+
+// Gravar os segundos zera o divisor interno do DS3231: gravando exatamente
+// na virada do segundo UTC o RTC fica em fase com o servidor
+void ntpSetRtc()
+{
+  if (millis() - ntp.stateSince > NTP_ALIGN_TIMEOUT)
+  {
+    ntpFinish(false, "tempo esgotado ao ajustar o RTC");
+    return;
+  }
+
+  int64_t now = esp_timer_get_time();
+  int64_t utcNowUs = ntp.utcAtReplyUs + (now - ntp.replyUs);
+  int64_t targetSec = utcNowUs / 1000000 + 1;
+  int64_t targetUs = ntp.replyUs + (targetSec * 1000000LL - ntp.utcAtReplyUs);
+  if (targetUs - now > RTC_SPIN_MAX_US) return;
+
+  while (esp_timer_get_time() < targetUs)
+  {
+  }
+  adjustClock(DateTime(static_cast<uint32_t>(targetSec + rtcUtcOffsetSec())));
+
+  rtcDiscipline.baselineUtc = static_cast<uint32_t>(targetSec);
+  rtcDiscipline.baselineOffsetUs = 0;
+  saveRtcDiscipline();
+  ntp.stepCount++;
+
+  Serial.printf("[time] RTC ajustado (offset anterior: %+.1f ms)\n", ntp.lastOffsetUs / 1000.0);
+  ntpFinish(true, nullptr);
+}
+
+// Deriva residual = erro acumulado desde a referência / tempo decorrido
+// (µs por segundo = ppm). A correção vai para o registrador de aging do
+// DS3231, que passa a compensar continuamente entre as sincronizações.
+void ntpUpdateDrift(uint32_t utcSec, int64_t offsetUs)
+{
+  if (rtcDiscipline.baselineUtc == 0 || llabs(offsetUs) > NTP_DRIFT_MAX_OFFSET_US) return;
+
+  uint32_t elapsed = utcSec - rtcDiscipline.baselineUtc;
+  if (elapsed < NTP_DRIFT_MIN_WINDOW_S) return;
+
+  float ppm = static_cast<float>(offsetUs - rtcDiscipline.baselineOffsetUs) / elapsed;
+  rtcDiscipline.driftPpm = ppm;
+
+  // Aging positivo desacelera o oscilador (~0.1 ppm por LSB a 25 °C)
+  int aging = ntp.agingOffset + static_cast<int>(lroundf(ppm / DS3231_PPM_PER_AGING_LSB));
+  if (aging > 127) aging = 127;
+  if (aging < -127) aging = -127;
+  if (aging != ntp.agingOffset && writeRtcAging(static_cast<int8_t>(aging)))
+  {
+    Serial.printf("[time] Deriva %+.2f ppm em %u s: aging %d -> %d\n", ppm, elapsed, ntp.agingOffset, aging);
+    ntp.agingOffset = static_cast<int8_t>(aging);
+  }
+
+  rtcDiscipline.baselineUtc = utcSec;
+  rtcDiscipline.baselineOffsetUs = static_cast<int32_t>(offsetUs);
+  saveRtcDiscipline();
+}
+
+void ntpFinish(bool ok, const char *reason)
+{
+  ntpUdp.close();
+  unsigned long now = millis();
+
+  if (ok)
+  {
+    timeSynced = true;
+    ntp.syncCount++;
+    ntp.lastSyncAt = now;
+    ntp.retryDelay = NTP_RETRY_MIN;
+    ntp.nextAttempt = now + NTP_SYNC_INTERVAL;
+    Serial.printf("[time] Sincronizado: offset do RTC %+.1f ms, RTT %.1f ms, virada +/- %.1f ms, deriva %+.2f ppm\n",
+                  ntp.lastOffsetUs / 1000.0, ntp.roundTripUs / 1000.0,
+                  (ntp.edge.highUs - ntp.edge.lowUs) / 2000.0, rtcDiscipline.driftPpm);
+  }
+  else
+  {
+    ntp.failCount++;
+    ntp.nextAttempt = now + ntp.retryDelay;
+    Serial.printf("[time] Falha na sincronizacao NTP: %s (nova tentativa em %lu s)\n",
+                  reason, ntp.retryDelay / 1000);
+    ntp.retryDelay = ntp.retryDelay * 2 > NTP_RETRY_MAX ? NTP_RETRY_MAX : ntp.retryDelay * 2;
+  }
+
+  ntpEnterState(NTP_IDLE);
+}
+
+// O RTC guarda hora local (os agendamentos comparam hora/minuto direto)
+long rtcUtcOffsetSec()
+{
+  return gmtOffsetSec + daylightOffsetSec;
+}
+
+void saveRtcDiscipline()
+{
+  if (prefsReady)
+    hal::kvPutBytes("ntp", &rtcDiscipline, sizeof(rtcDiscipline));
+}
+
+bool readRtcAging(int8_t &value)
+{
+  Wire.beginTransmission(DS3231_ADDRESS);
+  Wire.write(DS3231_AGING_REG);
+  if (Wire.endTransmission() != 0) return false;
+  if (Wire.requestFrom(DS3231_ADDRESS, 1) != 1) return false;
+  value = static_cast<int8_t>(Wire.read());
+  return true;
+}
+
+bool writeRtcAging(int8_t value)
+{
+  Wire.beginTransmission(DS3231_ADDRESS);
+  Wire.write(DS3231_AGING_REG);
+  Wire.write(static_cast<uint8_t>(value));
+  return Wire.endTransmission() == 0;
+}
+
+void handlePostNtp(AsyncWebServerRequest *request)
+{
+  Serial.println("[http] Recebido: POST /ntp");
+
+  JsonLease lease(jsonSmallPool);
+  JsonDocument &doc = lease.doc();
+  DeserializationError error;
+  if (!readRequestDocument(request, doc, error))
+  {
+    Serial.println("[http] ERRO: Body ausente em /ntp");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"body ausente\"}");
+    return;
+  }
+
+  if (error)
+  {
+    Serial.println("[http] JSON Invalido em /ntp");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"json invalido\"}");
+    return;
+  }
+
+  const char *server = doc["server"] | ntp.server.c_str();
+  uint16_t port = doc["port"] | ntp.port;
+  bool sync = doc["sync"] | false;
+
+  if (strlen(server) == 0 || strlen(server) > InlineString<NTP_SERVER_SIZE>::capacity() || port == 0)
+  {
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"servidor invalido\"}");
+    return;
+  }
+
+  if (prefsReady)
+  {
+    hal::kvPutString("ntpServer", server);
+    hal::kvPutU16("ntpPort", port);
+  }
+
+  portENTER_CRITICAL(&ntpSettingsMux);
+  pendingNtpServer = server;
+  pendingNtpPort = port;
+  portEXIT_CRITICAL(&ntpSettingsMux);
+  // Aplicado (e sincronizado) pelo loop assim que a máquina estiver ociosa
+  if (sync || ntp.server != server || port != ntp.port)
+    ntpSettingsChanged = true;
+
+  Serial.printf("[time] Servidor NTP configurado: %s:%u\n", server, port);
+  request->send(200, "application/json", "{\"ok\":true}");
+}
+
+void fillNtpStatus(JsonObject status)
+{
+  status["state"] = NTP_STATE_NAMES[ntp.state];
+  status["server"] = ntp.server.c_str();
+  status["port"] = ntp.port;
+  status["synced"] = timeSynced;
+  status["lastSyncAgoSec"] = ntp.syncCount > 0 ? static_cast<long>((millis() - ntp.lastSyncAt) / 1000) : -1;
+  status["offsetMs"] = ntp.lastOffsetUs / 1000.0;
+  status["rttMs"] = ntp.roundTripUs / 1000.0;
+  status["driftPpm"] = rtcDiscipline.driftPpm;
+  status["agingOffset"] = ntp.agingOffset;
+  status["syncs"] = ntp.syncCount;
+  status["failures"] = ntp.failCount;
+  status["steps"] = ntp.stepCount;
+}
+
+// =========================================================
+// WebServer
+// =========================================================
+// Parte de GET /status que só existe na placa (handleStatus em src/api)
+void fillPlatformStatus(JsonDocument &doc)
+{
+  bool staConnected = isStaConnected();
+  char staIp[IP_TEXT_SIZE] = "";
+  if (staConnected)
+    formatIp(WiFi.localIP(), staIp, sizeof(staIp));
+
+  JsonObject wifi = doc["wifi"].to<JsonObject>();
+  wifi["connected"] = staConnected;
+  wifi["rssi"] = staConnected ? WiFi.RSSI() : 0;
+  wifi["ip"] = staIp;
+  fillWifiLinkStatus(wifi);
+
+  char apIp[IP_TEXT_SIZE];
+  formatIp(WiFi.softAPIP(), apIp, sizeof(apIp));
+
+  JsonObject ap = doc["ap"].to<JsonObject>();
+  ap["ssid"] = AP_SSID;
+  ap["ip"] = apIp;
+
+  fillHttpStats(doc["http"].to<JsonObject>());
+  fillNtpStatus(doc["ntp"].to<JsonObject>());
+  fillClockStatus(doc["clock"].to<JsonObject>());
+  fillPowerStatus(doc["power"].to<JsonObject>());
+}
+
+size_t largestFreeBlock()
+{
+  return ESP.getMaxAllocHeap();
+}
+
+// Body guardado no ticket da admissão (MessagePack pode conter bytes
+// nulos: o tamanho vem do Content-Length)
+bool admittedRequestBody(AsyncWebServerRequest *request, const char *&body, size_t &length)
+{
+  RequestTicket *ticket = requestTicket(request);
+  if (ticket == nullptr || ticket->bodyReserved == 0) return false;
+
+  body = ticketBody(ticket);
+  length = request->contentLength();
+  return true;
+}
+
+// Tempo até o cliente fechar a conexão = tempo de transferência pelo link
+void noteBulkResponse(AsyncWebServerRequest *request, bool compressed, size_t wireSize)
+{
+  RequestTicket *ticket = requestTicket(request);
+  if (ticket == nullptr) return;
+  // Chunked: a primeira chamada é no envio, a segunda traz o tamanho
+  if (!ticket->transferTracked) ticket->transferStart = millis();
+  ticket->transferTracked = true;
+  ticket->compressed = compressed;
+  ticket->wireSize = wireSize;
+}
+
+void handlePostConfigRollback(AsyncWebServerRequest *request)
+{
+  Serial.println("[http] Recebido: POST /config/rollback");
+
+  switch (rollbackConfig())
+  {
+  case CONFIG_ROLLBACK_OK:
+    wakeLoop();
+    Serial.println("[http] Rollback de config aplicado.");
+    request->send(200, "application/json", "{\"ok\":true}");
+    break;
+  case CONFIG_ROLLBACK_NONE:
+    request->send(409, "application/json", "{\"ok\":false,\"message\":\"sem geracao anterior\"}");
+    break;
+  case CONFIG_ROLLBACK_BUSY:
+    request->send(503, "application/json", "{\"ok\":false,\"message\":\"config em uso, tente de novo\"}");
+    break;
+  default:
+    request->send(500, "application/json", "{\"ok\":false,\"message\":\"geracao anterior invalida\"}");
+    break;
+  }
+}
+
+void handlePostTime(AsyncWebServerRequest *request)
 {
   Serial.println("[http] Recebido: POST /time");
-  String body;
 
-  if (!readRequestBody(request, body))
+  JsonLease lease(jsonSmallPool);
+  JsonDocument &doc = lease.doc();
+  DeserializationError error;
+  if (!readRequestDocument(request, doc, error))
   {
     Serial.println("[http] ERRO: Body ausente em /time");
     request->send(400, "application/json", "{\"ok\":false,\"message\":\"body ausente\"}");
     return;
   }
 
-  Serial.printf("[http] Body recebido: %s\n", body.c_str());
-
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, body);
   if (error)
   {
     Serial.println("[http] JSON Invalido em /time");
@@ -494,8 +1856,8 @@ void handlePostTime(AsyncWebServerRequest *request)
     return;
   }
 
-  String timeString = doc["time"].as<String>();
-  Serial.printf("[http] String de tempo recebida: %s\n", timeString.c_str());
+  const char *timeString = doc["time"] | "";
+  Serial.printf("[http] String de tempo recebida: %s\n", timeString);
 
   DateTime parsed;
   if (!parseDateTime(timeString, parsed))
@@ -505,731 +1867,1473 @@ void handlePostTime(AsyncWebServerRequest *request)
     return;
   }
 
-  rtc.adjust(parsed);
+  adjustClock(parsed);
+
+  // Ajuste manual invalida a referência usada para medir a deriva
+  rtcDiscipline.baselineUtc = 0;
+  saveRtcDiscipline();
   Serial.println("[http] Horario do RTC atualizado com sucesso.");
   request->send(200, "application/json", "{\"ok\":true}");
 }
 
-void handlePostDose(AsyncWebServerRequest *request)
+void handleDeleteLogs(AsyncWebServerRequest *request)
 {
-  Serial.println("[http] Recebido: POST /dose");
-  String body;
-
-  if (!readRequestBody(request, body))
+  Serial.println("[http] Recebido: DELETE /logs");
+  if (!fsReady && !logPartitionReady)
   {
-    Serial.println("[http] ERRO: Body ausente em /dose");
-    request->send(400, "application/json", "{\"ok\":false,\"message\":\"body ausente\"}");
+    request->send(503, "application/json", "{\"ok\":false,\"message\":\"filesystem indisponivel\"}");
     return;
   }
 
-  Serial.printf("[http] Body recebido: %s\n", body.c_str());
+  // Apagado pelo loop (que é quem grava os logs); leituras daqui em diante já vêm vazias
+  requestClearLocalLogs();
+  wakeLoop();
+  request->send(200, "application/json", "{\"ok\":true}");
+}
 
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, body);
-  if (error)
+void setupServer()
+{
+  DefaultHeaders::Instance().addHeader("Access-Control-Allow-Origin", "*");
+  DefaultHeaders::Instance().addHeader("Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS");
+  DefaultHeaders::Instance().addHeader("Access-Control-Allow-Headers", "Content-Type");
+
+  server.on("/ping", HTTP_GET, [](AsyncWebServerRequest *request) {
+    Serial.println("[http] GET /ping");
+    request->send(200, "text/plain", "pong");
+  });
+
+  server.on("/status", HTTP_GET, guardedHandler(ROUTE_STATUS, handleStatus));
+  // Antes de "/config": o handler de "/config" também casa "/config/..."
+  server.on("/config/rollback", HTTP_POST, guardedHandler(ROUTE_CONFIG_ROLLBACK, handlePostConfigRollback));
+  server.on("/config", HTTP_GET, guardedHandler(ROUTE_CONFIG_GET, handleGetConfig));
+  server.on("/config", HTTP_POST, guardedHandler(ROUTE_CONFIG_POST, handlePostConfig),
+            nullptr, guardedBodyHandler(ROUTE_CONFIG_POST));
+  server.on("/time", HTTP_POST, guardedHandler(ROUTE_TIME, handlePostTime),
+            nullptr, guardedBodyHandler(ROUTE_TIME));
+  server.on("/dose", HTTP_POST, guardedHandler(ROUTE_DOSE, handlePostDose),
+            nullptr, guardedBodyHandler(ROUTE_DOSE));
+  server.on("/logs", HTTP_GET, guardedHandler(ROUTE_LOGS_GET, handleGetLogs));
+  server.on("/logs", HTTP_DELETE, guardedHandler(ROUTE_LOGS_DELETE, handleDeleteLogs));
+  server.on("/metrics", HTTP_GET, guardedHandler(ROUTE_METRICS, handleGetMetrics));
+  server.on("/incidents", HTTP_GET, guardedHandler(ROUTE_INCIDENTS_GET, handleGetIncidents));
+  server.on("/incidents", HTTP_DELETE, guardedHandler(ROUTE_INCIDENTS_DELETE, handleDeleteIncidents));
+  server.on("/slo", HTTP_POST, guardedHandler(ROUTE_SLO_POST, handlePostSlo),
+            nullptr, guardedBodyHandler(ROUTE_SLO_POST));
+  server.on("/ntp", HTTP_POST, guardedHandler(ROUTE_NTP_POST, handlePostNtp),
+            nullptr, guardedBodyHandler(ROUTE_NTP_POST));
+  server.on("/power", HTTP_POST, guardedHandler(ROUTE_POWER_POST, handlePostPower),
+            nullptr, guardedBodyHandler(ROUTE_POWER_POST));
+  server.on("/sync", HTTP_POST, guardedHandler(ROUTE_SYNC_POST, handlePostSync),
+            nullptr, guardedBodyHandler(ROUTE_SYNC_POST));
+  server.on("/forecast", HTTP_POST, guardedHandler(ROUTE_FORECAST_POST, handlePostForecast),
+            nullptr, guardedBodyHandler(ROUTE_FORECAST_POST));
+  server.on("/program", HTTP_POST, guardedHandler(ROUTE_PROGRAM_POST, handlePostProgram),
+            nullptr, guardedBodyHandler(ROUTE_PROGRAM_POST));
+  server.on("/program", HTTP_GET, guardedHandler(ROUTE_PROGRAM_GET, handleGetProgram));
+  server.on("/program", HTTP_DELETE, guardedHandler(ROUTE_PROGRAM_DELETE, handleDeleteProgram));
+  server.on("/trace", HTTP_GET, guardedHandler(ROUTE_TRACE_GET, handleGetTrace));
+  server.on("/trace", HTTP_POST, guardedHandler(ROUTE_TRACE_POST, handlePostTrace),
+            nullptr, guardedBodyHandler(ROUTE_TRACE_POST));
+  // /hub/logs antes de /hub: o servidor casa pelo prefixo
+  server.on("/hub/logs", HTTP_GET, guardedHandler(ROUTE_HUB_LOGS, handleGetHubLogs));
+  server.on("/hub", HTTP_GET, guardedHandler(ROUTE_HUB_GET, handleGetHub));
+  server.on("/hub", HTTP_POST, guardedHandler(ROUTE_HUB_POST, handlePostHub),
+            nullptr, guardedBodyHandler(ROUTE_HUB_POST));
+
+  server.onNotFound([](AsyncWebServerRequest *request) {
+    Serial.printf("[http] 404/Options: %s %s\n",
+                  httpMethodToString((WebRequestMethodComposite)request->method()),
+                  request->url().c_str());
+    if (request->method() == HTTP_OPTIONS)
+    {
+      request->send(200);
+      return;
+    }
+    request->send(404, "application/json", "{\"ok\":false,\"message\":\"rota nao encontrada\"}");
+  });
+
+  server.begin();
+  Serial.printf("[http] Servidor HTTP iniciado em %s\n", WiFi.softAPIP().toString().c_str());
+}
+
+void storeRequestBody(AsyncWebServerRequest *request, HttpRoute route, uint8_t *data, size_t len, size_t index, size_t total)
+{
+  if (total == 0) return;
+
+  RequestTicket *ticket = requestTicket(request);
+  if (ticket == nullptr && index == 0)
+    ticket = admitRequest(request, route, total);
+
+  // Requisição recusada: descarta o resto do body sem alocar nada
+  if (ticket == nullptr || !ticket->admitted) return;
+  if (index + len > total) return;
+
+  char *body = ticketBody(ticket);
+  memcpy(body + index, data, len);
+  if (index + len >= total)
   {
-    Serial.println("[http] JSON Invalido em /dose");
-    request->send(400, "application/json", "{\"ok\":false,\"message\":\"json invalido\"}");
-    return;
+    body[total] = '\0';
   }
+}
 
-  int bomba = doc["bomb"] | 0;
-  float dosagem = doc["dosagem"] | 0.0f;
-  String origem = doc["origem"] | "Teste";
+// =========================================================
+// Admissão HTTP
+// =========================================================
+ArRequestHandlerFunction guardedHandler(HttpRoute route, ArRequestHandlerFunction handler)
+{
+  return [route, handler](AsyncWebServerRequest *request) {
+    RequestTicket *ticket = requestTicket(request);
+    if (ticket == nullptr)
+      ticket = admitRequest(request, route, 0);
 
-  if (bomba < 1 || bomba > BOMBA_COUNT || dosagem <= 0)
+    if (ticket == nullptr)
+    {
+      sendRejection(request, ADMISSION_NO_MEMORY);
+      return;
+    }
+    if (!ticket->admitted)
+    {
+      sendRejection(request, ticket->verdict);
+      return;
+    }
+
+    traceRequest(request, route);
+    {
+      MetricTimer timer(static_cast<MetricId>(MET_HTTP_FIRST + route));
+      handler(request);
+    }
+
+    // Medido após o handler, com a resposta já montada em RAM
+    uint32_t freeHeap = ESP.getFreeHeap();
+    RouteStats &stats = routeStats[route];
+    if (stats.heapLowWater == 0 || freeHeap < stats.heapLowWater)
+      stats.heapLowWater = freeHeap;
+  };
+}
+
+ArBodyHandlerFunction guardedBodyHandler(HttpRoute route)
+{
+  return [route](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    storeRequestBody(request, route, data, len, index, total);
+  };
+}
+
+RequestTicket *requestTicket(AsyncWebServerRequest *request)
+{
+  return static_cast<RequestTicket *>(request->_tempObject);
+}
+
+char *ticketBody(RequestTicket *ticket)
+{
+  return reinterpret_cast<char *>(ticket + 1);
+}
+
+RequestTicket *admitRequest(AsyncWebServerRequest *request, HttpRoute route, size_t bodySize)
+{
+  AdmissionVerdict verdict = checkAdmission(request, route, bodySize);
+  bool admitted = (verdict == ADMISSION_OK);
+  size_t reserve = (admitted && bodySize > 0) ? bodySize + 1 : 0;
+
+  RequestTicket *ticket = static_cast<RequestTicket *>(malloc(sizeof(RequestTicket) + reserve));
+  if (ticket == nullptr)
+  {
+    Serial.println("[http] ERRO: Falha ao alocar memoria para requisicao");
+    admissionCounters.noMemory++;
+    routeStats[route].rejected++;
+    return nullptr;
+  }
+
+  memset(ticket, 0, sizeof(RequestTicket));
+  ticket->route = route;
+  ticket->verdict = verdict;
+  ticket->admitted = admitted;
+  ticket->bodyReserved = reserve;
+  if (reserve > 0)
+    ticketBody(ticket)[0] = '\0';
+  request->_tempObject = ticket;
+
+  if (!admitted)
+  {
+    routeStats[route].rejected++;
+    Serial.printf("[http] Requisicao recusada (%s): motivo %d\n", ROUTE_LIMITS[route].name, verdict);
+    return ticket;
+  }
+
+  routeStats[route].inFlight++;
+  routeStats[route].accepted++;
+  // Scrapes periódicos do Prometheus não mantêm o dosador acordado
+  if (route != ROUTE_METRICS)
+    noteUserActivity();
+  bodyBytesInFlight += reserve;
+  request->onDisconnect([request]() { releaseRequest(request); });
+  return ticket;
+}
+
+AdmissionVerdict checkAdmission(AsyncWebServerRequest *request, HttpRoute route, size_t bodySize)
+{
+  const RouteLimit &limit = ROUTE_LIMITS[route];
+
+  if (bodySize > limit.maxBody)
   {
-    Serial.println("[http] Dados invalidos para dosagem");
-    request->send(400, "application/json", "{\"ok\":false,\"message\":\"dados invalidos\"}");
-    return;
+    admissionCounters.tooLarge++;
+    return ADMISSION_TOO_LARGE;
   }
 
-  Serial.printf("[http] Solicitacao valida: Bomba %d, %.2f ml\n", bomba, dosagem);
+  if (!takeClientToken(request->client()->remoteIP()))
+  {
+    admissionCounters.rateLimited++;
+    return ADMISSION_RATE_LIMITED;
+  }
 
-  bool queued = enqueuePumpJob(bomba - 1, dosagem, origem);
-  if (!queued)
+  if (ESP.getFreeHeap() < HTTP_HEAP_FLOOR + bodySize)
   {
-    request->send(409, "application/json", "{\"ok\":false,\"message\":\"fila cheia\"}");
-    return;
+    admissionCounters.heapFloor++;
+    return ADMISSION_NO_MEMORY;
   }
 
-  request->send(200, "application/json", "{\"ok\":true}");
+  if (routeStats[route].inFlight >= limit.maxInFlight)
+  {
+    admissionCounters.busy++;
+    return ADMISSION_BUSY;
+  }
+
+  if (bodyBytesInFlight + bodySize + 1 > HTTP_BODY_BUDGET)
+  {
+    admissionCounters.noMemory++;
+    return ADMISSION_NO_MEMORY;
+  }
+
+  return ADMISSION_OK;
 }
 
-void handleGetLogs(AsyncWebServerRequest *request)
+// Token bucket por IP; clientes além de HTTP_CLIENT_SLOTS ocupam o slot mais antigo
+bool takeClientToken(uint32_t ip)
 {
-  Serial.println("[http] Recebido: GET /logs");
-  if (!fsReady)
+  const uint32_t capacity = HTTP_RATE_BURST * 1000UL;
+  unsigned long now = millis();
+
+  ClientBucket *bucket = nullptr;
+  ClientBucket *oldest = &clientBuckets[0];
+  for (int i = 0; i < HTTP_CLIENT_SLOTS; i++)
   {
-    request->send(503, "application/json", "{\"ok\":false,\"message\":\"filesystem indisponivel\"}");
+    if (clientBuckets[i].ip == ip)
+    {
+      bucket = &clientBuckets[i];
+      break;
+    }
+    if (now - clientBuckets[i].lastRefill > now - oldest->lastRefill)
+      oldest = &clientBuckets[i];
+  }
+
+  if (bucket == nullptr)
+  {
+    bucket = oldest;
+    bucket->ip = ip;
+    bucket->milliTokens = capacity;
+    bucket->lastRefill = now;
+  }
+
+  uint32_t refill = (now - bucket->lastRefill) * HTTP_RATE_PER_SEC;
+  bucket->milliTokens = (refill >= capacity - bucket->milliTokens) ? capacity : bucket->milliTokens + refill;
+  bucket->lastRefill = now;
+
+  if (bucket->milliTokens < 1000) return false;
+  bucket->milliTokens -= 1000;
+  return true;
+}
+
+void releaseRequest(AsyncWebServerRequest *request)
+{
+  RequestTicket *ticket = requestTicket(request);
+  if (ticket == nullptr || !ticket->admitted) return;
+
+  RouteStats &stats = routeStats[ticket->route];
+  if (stats.inFlight > 0) stats.inFlight--;
+  bodyBytesInFlight = (bodyBytesInFlight > ticket->bodyReserved) ? bodyBytesInFlight - ticket->bodyReserved : 0;
+
+  if (ticket->transferTracked)
+  {
+    Serial.printf("[http] Transferencia concluida (%s): %u bytes em %lu ms\n",
+                  ticket->compressed ? "gzip" : "identity",
+                  static_cast<unsigned int>(ticket->wireSize), millis() - ticket->transferStart);
+  }
+
+  ticket->admitted = false;
+}
+
+void sendRejection(AsyncWebServerRequest *request, AdmissionVerdict verdict)
+{
+  AsyncWebServerResponse *response;
+
+  switch (verdict)
+  {
+  case ADMISSION_RATE_LIMITED:
+    response = request->beginResponse(429, "application/json", "{\"ok\":false,\"message\":\"muitas requisicoes\"}");
+    response->addHeader("Retry-After", "1");
+    break;
+  case ADMISSION_TOO_LARGE:
+    response = request->beginResponse(413, "application/json", "{\"ok\":false,\"message\":\"body muito grande\"}");
+    break;
+  case ADMISSION_BUSY:
+    response = request->beginResponse(503, "application/json", "{\"ok\":false,\"message\":\"servidor ocupado\"}");
+    response->addHeader("Retry-After", "1");
+    break;
+  case ADMISSION_NO_MEMORY:
+  default:
+    response = request->beginResponse(503, "application/json", "{\"ok\":false,\"message\":\"memoria insuficiente\"}");
+    response->addHeader("Retry-After", "2");
+    break;
+  }
+
+  request->send(response);
+}
+
+void fillHttpStats(JsonObject http)
+{
+  http["freeHeap"] = ESP.getFreeHeap();
+  http["largestFreeBlock"] = ESP.getMaxAllocHeap();
+  http["heapFloor"] = HTTP_HEAP_FLOOR;
+  http["bodyBytesInFlight"] = bodyBytesInFlight;
+  http["gzipFallbacks"] = gzipFallbackCount;
+
+  JsonObject rejected = http["rejected"].to<JsonObject>();
+  rejected["rateLimited"] = admissionCounters.rateLimited;
+  rejected["busy"] = admissionCounters.busy;
+  rejected["noMemory"] = admissionCounters.noMemory;
+  rejected["tooLarge"] = admissionCounters.tooLarge;
+  rejected["heapFloor"] = admissionCounters.heapFloor;
+
+  JsonObject routes = http["routes"].to<JsonObject>();
+  for (int i = 0; i < ROUTE_COUNT; i++)
+  {
+    JsonObject route = routes[ROUTE_LIMITS[i].name].to<JsonObject>();
+    route["inFlight"] = routeStats[i].inFlight;
+    route["accepted"] = routeStats[i].accepted;
+    route["rejected"] = routeStats[i].rejected;
+    route["heapLowWater"] = routeStats[i].heapLowWater;
+  }
+}
+
+// =========================================================
+// Métricas (/metrics, formato texto do Prometheus)
+// =========================================================
+void timedLoopPhase(MetricId id, void (*phase)())
+{
+  runningLoopPhase = id;
+  int64_t startUs = esp_timer_get_time();
+  uint32_t start = ESP.getCycleCount();
+  phase();
+  uint32_t cycles = metricCyclesSince(start, startUs);
+  runningLoopPhase = NO_LOOP_PHASE;
+
+  metricHistograms[id].record(cycles);
+  if (cycles > currentIteration.slowestCycles)
+  {
+    currentIteration.slowestCycles = cycles;
+    currentIteration.slowestPhase = id;
+  }
+}
+
+MetricFamily metricFamily(int id)
+{
+  if (id < MET_HTTP_FIRST) return FAMILY_LOOP_PHASE;
+  if (id < MET_FLASH_CONFIG_SAVE) return FAMILY_HTTP_HANDLER;
+  return FAMILY_FLASH_OP;
+}
+
+const char *metricLabel(int id)
+{
+  switch (metricFamily(id))
+  {
+  case FAMILY_LOOP_PHASE:   return LOOP_METRIC_NAMES[id];
+  case FAMILY_HTTP_HANDLER: return ROUTE_LIMITS[id - MET_HTTP_FIRST].name;
+  default:                  return FLASH_METRIC_NAMES[id - MET_FLASH_CONFIG_SAVE];
+  }
+}
+
+// Itens 0 e 1 = gauges/contadores (sistema e rede; relógio e energia), cada
+// um cabendo no buffer de 1.5 KB; depois um histograma por item. Retorna 0 no fim.
+// snprintf acumulativo: devolve o total usado, saturado em `size`
+size_t appendf(char *buffer, size_t size, size_t used, const char *format, ...)
+{
+  if (used >= size) return size;
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(buffer + used, size - used, format, args);
+  va_end(args);
+  if (written < 0) return used;
+  used += static_cast<size_t>(written);
+  return used > size ? size : used;
+}
+
+size_t renderMetricsItem(size_t item, char *buffer, size_t size)
+{
+  size_t used = 0;
+
+  if (item == 0)
+  {
+    int queueDepth = pumpQueueDepth();
+    bool staConnected = isStaConnected();
+
+    used = appendf(buffer, size, used, "# TYPE aqua_uptime_seconds gauge\naqua_uptime_seconds %llu\n",
+                   static_cast<unsigned long long>(esp_timer_get_time() / 1000000));
+    used = appendf(buffer, size, used, "# TYPE aqua_free_heap_bytes gauge\naqua_free_heap_bytes %u\n", ESP.getFreeHeap());
+    used = appendf(buffer, size, used, "# TYPE aqua_min_free_heap_bytes gauge\naqua_min_free_heap_bytes %u\n", ESP.getMinFreeHeap());
+    used = appendf(buffer, size, used, "# TYPE aqua_largest_free_block_bytes gauge\naqua_largest_free_block_bytes %u\n", ESP.getMaxAllocHeap());
+    used = appendf(buffer, size, used, "# TYPE aqua_pump_queue_depth gauge\naqua_pump_queue_depth %d\n", queueDepth);
+    used = appendf(buffer, size, used, "# TYPE aqua_pump_active gauge\naqua_pump_active %d\n", pumpActive ? 1 : 0);
+    used = appendf(buffer, size, used, "# TYPE aqua_wifi_connected gauge\naqua_wifi_connected %d\n", staConnected ? 1 : 0);
+    used = appendf(buffer, size, used, "# TYPE aqua_wifi_rssi_dbm gauge\naqua_wifi_rssi_dbm %d\n", staConnected ? WiFi.RSSI() : 0);
+    used = appendf(buffer, size, used, "# TYPE aqua_ap_clients gauge\naqua_ap_clients %u\n", apClientCount);
+    used = appendf(buffer, size, used, "# TYPE aqua_wifi_reconnect_attempts_total counter\naqua_wifi_reconnect_attempts_total %u\n", wifiLink.reconnectAttempts);
+    used = appendf(buffer, size, used, "# TYPE aqua_wifi_connected_seconds_total counter\naqua_wifi_connected_seconds_total %llu\n",
+                   static_cast<unsigned long long>(wifiConnectedMs() / 1000));
+    used = appendf(buffer, size, used, "# TYPE aqua_http_rejected_total counter\n");
+    used = appendf(buffer, size, used, "aqua_http_rejected_total{reason=\"rate_limited\"} %u\n", admissionCounters.rateLimited);
+    used = appendf(buffer, size, used, "aqua_http_rejected_total{reason=\"busy\"} %u\n", admissionCounters.busy);
+    used = appendf(buffer, size, used, "aqua_http_rejected_total{reason=\"no_memory\"} %u\n", admissionCounters.noMemory);
+    used = appendf(buffer, size, used, "aqua_http_rejected_total{reason=\"too_large\"} %u\n", admissionCounters.tooLarge);
+    used = appendf(buffer, size, used, "aqua_http_rejected_total{reason=\"heap_floor\"} %u\n", admissionCounters.heapFloor);
+    used = appendf(buffer, size, used, "# TYPE aqua_http_gzip_fallbacks_total counter\naqua_http_gzip_fallbacks_total %u\n", gzipFallbackCount);
+    used = appendf(buffer, size, used, "# TYPE aqua_slo_incidents_total counter\naqua_slo_incidents_total %u\n", incidentLog.total);
+    return used;
+  }
+
+  if (item == 1)
+  {
+    used = appendf(buffer, size, used, "# TYPE aqua_rtc_offset_seconds gauge\naqua_rtc_offset_seconds %.6f\n", ntp.lastOffsetUs / 1e6);
+    used = appendf(buffer, size, used, "# TYPE aqua_rtc_drift_ppm gauge\naqua_rtc_drift_ppm %.3f\n", rtcDiscipline.driftPpm);
+    used = appendf(buffer, size, used, "# TYPE aqua_ntp_failures_total counter\naqua_ntp_failures_total %u\n", ntp.failCount);
+    used = appendf(buffer, size, used, "# TYPE aqua_rtc_reads_total counter\naqua_rtc_reads_total %u\n", clockStats.rtcReads);
+    used = appendf(buffer, size, used, "# TYPE aqua_rtc_reads_per_hour gauge\naqua_rtc_reads_per_hour %u\n", rtcReadsPerHour());
+    used = appendf(buffer, size, used, "# TYPE aqua_clock_jumps_total counter\naqua_clock_jumps_total %u\n", clockStats.jumps);
+    used = appendf(buffer, size, used, "# TYPE aqua_clock_error_seconds gauge\naqua_clock_error_seconds %.6f\n", clockStats.lastErrorUs / 1e6);
+    used = appendf(buffer, size, used, "# TYPE aqua_power_idle gauge\naqua_power_idle %u\n", powerStats.mode == POWER_IDLE ? 1 : 0);
+    used = appendf(buffer, size, used, "# TYPE aqua_power_mode_seconds_total counter\n");
+    for (int mode = 0; mode < POWER_MODE_COUNT; mode++)
+      used = appendf(buffer, size, used, "aqua_power_mode_seconds_total{mode=\"%s\"} %llu\n", POWER_MODE_NAMES[mode],
+                     static_cast<unsigned long long>(powerModeMs(static_cast<PowerMode>(mode)) / 1000));
+
+    JsonArenaStats arenaStats[JSON_POOL_COUNT];
+    for (int p = 0; p < JSON_POOL_COUNT; p++)
+      arenaStats[p] = JSON_POOLS[p]->stats();
+    used = appendf(buffer, size, used, "# TYPE aqua_json_arena_exhausted_total counter\n");
+    for (int p = 0; p < JSON_POOL_COUNT; p++)
+      used = appendf(buffer, size, used, "aqua_json_arena_exhausted_total{pool=\"%s\"} %u\n", JSON_POOLS[p]->name(), arenaStats[p].exhausted);
+    used = appendf(buffer, size, used, "# TYPE aqua_json_arena_overflows_total counter\n");
+    for (int p = 0; p < JSON_POOL_COUNT; p++)
+      used = appendf(buffer, size, used, "aqua_json_arena_overflows_total{pool=\"%s\"} %u\n", JSON_POOLS[p]->name(), arenaStats[p].overflows);
+    used = appendf(buffer, size, used, "# TYPE aqua_json_arena_peak_bytes gauge\n");
+    for (int p = 0; p < JSON_POOL_COUNT; p++)
+      used = appendf(buffer, size, used, "aqua_json_arena_peak_bytes{pool=\"%s\"} %u\n", JSON_POOLS[p]->name(),
+                     static_cast<unsigned int>(arenaStats[p].peakBytes));
+    return used;
+  }
+
+  if (item == 2)
+  {
+    used = appendf(buffer, size, used, "# TYPE aqua_sync_pending_events gauge\naqua_sync_pending_events %u\n", outboxStats.pending);
+    used = appendf(buffer, size, used, "# TYPE aqua_sync_oldest_pending_seconds gauge\naqua_sync_oldest_pending_seconds %u\n", outboxOldestPendingSec());
+    used = appendf(buffer, size, used, "# TYPE aqua_sync_events_total counter\n");
+    used = appendf(buffer, size, used, "aqua_sync_events_total{result=\"sent\"} %u\n", outboxStats.sent);
+    used = appendf(buffer, size, used, "aqua_sync_events_total{result=\"rejected\"} %u\n", outboxStats.rejected);
+    used = appendf(buffer, size, used, "aqua_sync_events_total{result=\"dropped\"} %u\n", outboxStats.dropped);
+    used = appendf(buffer, size, used, "# TYPE aqua_sync_batches_total counter\naqua_sync_batches_total %u\n", outboxStats.batches);
+    used = appendf(buffer, size, used, "# TYPE aqua_sync_failures_total counter\naqua_sync_failures_total %u\n", outboxStats.failures);
+    used = appendf(buffer, size, used, "# TYPE aqua_scheduled_doses_held_total counter\naqua_scheduled_doses_held_total %u\n", heldScheduledDoses);
+    return used;
+  }
+
+  int id = static_cast<int>(item) - METRIC_GAUGE_ITEMS;
+  if (id >= MET_COUNT) return 0;
+
+  const MetricFamilyInfo &family = METRIC_FAMILIES[metricFamily(id)];
+  const char *label = metricLabel(id);
+  const LatencyHistogram<2> &histogram = metricHistograms[id];
+
+  bool firstOfFamily = (id == 0 || metricFamily(id - 1) != metricFamily(id));
+  if (firstOfFamily)
+    used = appendf(buffer, size, used, "# HELP %s %s\n# TYPE %s histogram\n",
+                   family.name, family.help, family.name);
+
+  for (uint32_t boundUs : METRIC_BOUNDS_US)
+  {
+    used = appendf(buffer, size, used, "%s_bucket{%s=\"%s\",le=\"%g\"} %u\n",
+                   family.name, family.label, label,
+                   boundUs / 1e6, histogram.countAtOrBelow(boundUs * cpuCyclesPerUs));
+  }
+  used = appendf(buffer, size, used, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %u\n", family.name, family.label, label, histogram.count());
+  used = appendf(buffer, size, used, "%s_sum{%s=\"%s\"} %.6f\n", family.name, family.label, label,
+                 static_cast<double>(histogram.sum()) / cpuCyclesPerUs / 1e6);
+  used = appendf(buffer, size, used, "%s_count{%s=\"%s\"} %u\n", family.name, family.label, label, histogram.count());
+  return used;
+}
+
+struct MetricsCursor
+{
+  size_t item = 0;
+  size_t length = 0;
+  size_t offset = 0;
+  char scratch[1536];
+};
+
+// Resposta chunked: cada item é renderizado num buffer de 1.5 KB e copiado
+// aos poucos, sem montar o texto inteiro em RAM
+void handleGetMetrics(AsyncWebServerRequest *request)
+{
+  std::shared_ptr<MetricsCursor> cursor(new (std::nothrow) MetricsCursor());
+  if (!cursor)
+  {
+    sendRejection(request, ADMISSION_NO_MEMORY);
     return;
   }
 
-  if (!LittleFS.exists(LOG_FILE))
+  AsyncWebServerResponse *response = request->beginChunkedResponse(
+      "text/plain; version=0.0.4",
+      [cursor](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        while (cursor->offset >= cursor->length)
+        {
+          cursor->length = renderMetricsItem(cursor->item, cursor->scratch, sizeof(cursor->scratch));
+          cursor->offset = 0;
+          if (cursor->length == 0) return 0;
+          cursor->item++;
+        }
+
+        size_t chunk = cursor->length - cursor->offset;
+        if (chunk > maxLen) chunk = maxLen;
+        memcpy(buffer, cursor->scratch + cursor->offset, chunk);
+        cursor->offset += chunk;
+        return chunk;
+      });
+  request->send(response);
+}
+
+// =========================================================
+// Monitor de travamentos (SLO do loop e da dosagem)
+// =========================================================
+void initStallMonitor()
+{
+  if (prefsReady)
+  {
+    SloConfig saved;
+    if (hal::kvGetBytes("slo", &saved, sizeof(saved)) == sizeof(saved))
+      slo = saved;
+    if (hal::kvGetBytes("incidents", &incidentLog, sizeof(incidentLog)) != sizeof(incidentLog) ||
+        incidentLog.next >= INCIDENT_COUNT)
+      memset(&incidentLog, 0, sizeof(incidentLog));
+  }
+
+  if (esp_reset_reason() == ESP_RST_TASK_WDT)
   {
-    request->send(200, "application/json", "[]");
+    uint8_t phase = runningLoopPhase < MET_LOOP_TOTAL ? runningLoopPhase : NO_LOOP_PHASE;
+    Serial.printf("[slo] Reset pelo watchdog! Fase em execucao: %s\n",
+                  phase == NO_LOOP_PHASE ? "desconhecida" : LOOP_METRIC_NAMES[phase]);
+    recordIncident(INCIDENT_WATCHDOG, phase, LOOP_WDT_TIMEOUT_S * 1000, LOOP_WDT_TIMEOUT_S * 1000);
+    lastIncidentFlush = millis() - INCIDENT_FLUSH_INTERVAL;
+    flushIncidents();
+  }
+  runningLoopPhase = NO_LOOP_PHASE;
+
+  Serial.printf("[slo] Limites: loop %u ms, inicio da dose %u ms, corte %u ms. Incidentes salvos: %u\n",
+                slo.loopPeriodMs, slo.doseStartMs, slo.doseCutoffMs, incidentLog.total);
+}
+
+// O loop só trava de verdade (e reinicia) depois de LOOP_WDT_TIMEOUT_S:
+// o timeout padrão do core (5 s) é curto para gravações longas em flash.
+void startLoopWatchdog()
+{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+  esp_task_wdt_config_t config = {};
+  config.timeout_ms = LOOP_WDT_TIMEOUT_S * 1000;
+  config.idle_core_mask = 0;
+  config.trigger_panic = true;
+  esp_task_wdt_reconfigure(&config);
+#else
+  esp_task_wdt_init(LOOP_WDT_TIMEOUT_S, true);
+#endif
+  if (esp_task_wdt_add(NULL) != ESP_OK)
+    Serial.println("[slo] ERRO: Falha ao registrar o loop no watchdog.");
+}
+
+void beginLoopIteration()
+{
+  esp_task_wdt_reset();
+
+  unsigned long now = millis();
+  previousIteration = currentIteration;
+  currentIteration.slowestPhase = NO_LOOP_PHASE;
+  currentIteration.slowestCycles = 0;
+
+  if (lastLoopStart != 0)
+  {
+    // O SLO inclui o delay normal do loop; no modo ocioso a espera maior é descontada
+    uint32_t period = now - lastLoopStart;
+    uint32_t limit = slo.loopPeriodMs;
+    if (powerStats.plannedWaitMs > POWER_ACTIVE_TICK_MS)
+      limit += powerStats.plannedWaitMs - POWER_ACTIVE_TICK_MS;
+    if (period > limit)
+      recordIncident(INCIDENT_LOOP_PERIOD, previousIteration.slowestPhase, period, limit);
+  }
+  lastLoopStart = now;
+}
+
+// Fase mais lenta entre a iteração anterior e a atual (até aqui)
+uint8_t likelyStallPhase()
+{
+  if (currentIteration.slowestCycles >= previousIteration.slowestCycles)
+    return currentIteration.slowestPhase;
+  return previousIteration.slowestPhase;
+}
+
+void recordIncident(IncidentType type, uint8_t phase, uint32_t measuredMs, uint32_t limitMs)
+{
+  StallIncident incident = {};
+  incident.uptimeSec = static_cast<uint32_t>(esp_timer_get_time() / 1000000);
+  incident.unixTime = wallClock.isAnchored() ? clockUnixTime() : 0;
+  incident.measuredMs = measuredMs;
+  incident.limitMs = limitMs;
+  incident.type = type;
+  incident.phase = phase;
+
+  portENTER_CRITICAL(&incidentMux);
+  incidentLog.items[incidentLog.next] = incident;
+  incidentLog.next = (incidentLog.next + 1) % INCIDENT_COUNT;
+  incidentLog.total++;
+  incidentsDirty = true;
+  portEXIT_CRITICAL(&incidentMux);
+
+  Serial.printf("[slo] VIOLACAO %s: %u ms (limite %u ms), fase: %s\n",
+                INCIDENT_TYPE_NAMES[type], measuredMs, limitMs,
+                phase == NO_LOOP_PHASE ? "-" : LOOP_METRIC_NAMES[phase]);
+}
+
+// Regravar a NVS a cada violação desgastaria a flash numa rajada: no
+// máximo uma gravação a cada INCIDENT_FLUSH_INTERVAL
+void flushIncidents()
+{
+  if (!incidentsDirty || !prefsReady) return;
+  if (millis() - lastIncidentFlush < INCIDENT_FLUSH_INTERVAL) return;
+
+  IncidentLog snapshot;
+  portENTER_CRITICAL(&incidentMux);
+  snapshot = incidentLog;
+  incidentsDirty = false;
+  portEXIT_CRITICAL(&incidentMux);
+
+  hal::kvPutBytes("incidents", &snapshot, sizeof(snapshot));
+  lastIncidentFlush = millis();
+}
+
+void handleGetIncidents(AsyncWebServerRequest *request)
+{
+  Serial.println("[http] Recebido: GET /incidents");
+
+  IncidentLog snapshot;
+  portENTER_CRITICAL(&incidentMux);
+  snapshot = incidentLog;
+  portEXIT_CRITICAL(&incidentMux);
+
+  JsonLease lease(jsonLargePool);
+  JsonDocument &doc = lease.doc();
+  JsonObject limits = doc["slo"].to<JsonObject>();
+  limits["loopPeriodMs"] = slo.loopPeriodMs;
+  limits["doseStartMs"] = slo.doseStartMs;
+  limits["doseCutoffMs"] = slo.doseCutoffMs;
+  doc["watchdogTimeoutSec"] = LOOP_WDT_TIMEOUT_S;
+  doc["total"] = snapshot.total;
+
+  // Do mais recente para o mais antigo
+  JsonArray items = doc["incidents"].to<JsonArray>();
+  uint32_t stored = snapshot.total < INCIDENT_COUNT ? snapshot.total : INCIDENT_COUNT;
+  for (uint32_t i = 0; i < stored; i++)
+  {
+    const StallIncident &incident = snapshot.items[(snapshot.next + INCIDENT_COUNT - 1 - i) % INCIDENT_COUNT];
+    JsonObject item = items.add<JsonObject>();
+    item["type"] = incident.type < INCIDENT_TYPE_COUNT ? INCIDENT_TYPE_NAMES[incident.type] : "?";
+    item["phase"] = incident.phase < MET_LOOP_TOTAL ? LOOP_METRIC_NAMES[incident.phase] : "";
+    item["measuredMs"] = incident.measuredMs;
+    item["limitMs"] = incident.limitMs;
+    item["uptimeSec"] = incident.uptimeSec;
+
+    char timestamp[TIMESTAMP_SIZE] = "";
+    if (incident.unixTime != 0)
+      formatTimestamp(DateTime(incident.unixTime), timestamp, sizeof(timestamp));
+    item["time"] = timestamp;
+  }
+
+  sendDocument(request, 200, doc);
+}
+
+void handleDeleteIncidents(AsyncWebServerRequest *request)
+{
+  Serial.println("[http] Recebido: DELETE /incidents");
+
+  portENTER_CRITICAL(&incidentMux);
+  memset(&incidentLog, 0, sizeof(incidentLog));
+  incidentsDirty = true;
+  portEXIT_CRITICAL(&incidentMux);
+
+  request->send(200, "application/json", "{\"ok\":true}");
+}
+
+void handlePostSlo(AsyncWebServerRequest *request)
+{
+  Serial.println("[http] Recebido: POST /slo");
+
+  JsonLease lease(jsonSmallPool);
+  JsonDocument &doc = lease.doc();
+  DeserializationError error;
+  if (!readRequestDocument(request, doc, error))
+  {
+    Serial.println("[http] ERRO: Body ausente em /slo");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"body ausente\"}");
     return;
   }
 
-  File file = LittleFS.open(LOG_FILE, FILE_READ);
-  if (!file)
+  if (error)
   {
-    request->send(500, "application/json", "{\"ok\":false,\"message\":\"falha ao abrir logs\"}");
+    Serial.println("[http] JSON Invalido em /slo");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"json invalido\"}");
     return;
   }
 
-  AsyncResponseStream *response = request->beginResponseStream("application/json");
-  response->print("[");
-  bool first = true;
+  // Campos ausentes mantêm o valor atual
+  SloConfig updated = slo;
+  updated.loopPeriodMs = doc["loopPeriodMs"] | updated.loopPeriodMs;
+  updated.doseStartMs = doc["doseStartMs"] | updated.doseStartMs;
+  updated.doseCutoffMs = doc["doseCutoffMs"] | updated.doseCutoffMs;
 
-  while (file.available())
+  if (updated.loopPeriodMs == 0 || updated.loopPeriodMs > SLO_MAX_MS ||
+      updated.doseStartMs == 0 || updated.doseStartMs > SLO_MAX_MS ||
+      updated.doseCutoffMs == 0 || updated.doseCutoffMs > SLO_MAX_MS)
   {
-    String line = file.readStringUntil('\n');
-    line.trim();
-    if (line.isEmpty()) continue;
-    if (!first) response->print(",");
-    response->print(line);
-    first = false;
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"limites invalidos\"}");
+    return;
   }
 
-  response->print("]");
-  file.close();
-  request->send(response);
+  slo = updated;
+  if (prefsReady)
+    hal::kvPutBytes("slo", &slo, sizeof(slo));
+
+  Serial.printf("[slo] Novos limites: loop %u ms, inicio da dose %u ms, corte %u ms\n",
+                slo.loopPeriodMs, slo.doseStartMs, slo.doseCutoffMs);
+  request->send(200, "application/json", "{\"ok\":true}");
 }
 
-void handleDeleteLogs(AsyncWebServerRequest *request)
+// =========================================================
+// Modo ocioso (economia de energia)
+// =========================================================
+void loadPowerConfig()
 {
-  Serial.println("[http] Recebido: DELETE /logs");
-  if (!fsReady)
+  if (prefsReady)
   {
-    request->send(503, "application/json", "{\"ok\":false,\"message\":\"filesystem indisponivel\"}");
-    return;
+    PowerConfig saved;
+    if (hal::kvGetBytes("power", &saved, sizeof(saved)) == sizeof(saved))
+      powerConfig = saved;
   }
 
-  if (LittleFS.exists(LOG_FILE))
-    LittleFS.remove(LOG_FILE);
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  powerStats.modeSince = millis();
 
-  logCount = 0;
-  request->send(200, "application/json", "{\"ok\":true}");
+  Serial.printf("[power] Modo ocioso %s (tick %u ms, carencia %u s, light sleep %s)\n",
+                powerConfig.enabled ? "HABILITADO" : "desabilitado",
+                powerConfig.idleTickMs, powerConfig.apGraceSec,
+                powerConfig.lightSleep ? "sim" : "nao");
 }
 
-void setupServer()
+// Chamado de outras tasks: encurta a espera do loop para o evento ser
+// tratado já na próxima iteração
+void wakeLoop()
 {
-  DefaultHeaders::Instance().addHeader("Access-Control-Allow-Origin", "*");
-  DefaultHeaders::Instance().addHeader("Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS");
-  DefaultHeaders::Instance().addHeader("Access-Control-Allow-Headers", "Content-Type");
+  if (loopTaskHandle != nullptr)
+    xTaskNotifyGive(loopTaskHandle);
+}
 
-  server.on("/ping", HTTP_GET, [](AsyncWebServerRequest *request) {
-    Serial.println("[http] GET /ping");
-    request->send(200, "text/plain", "pong");
-  });
+void noteUserActivity()
+{
+  lastUserActivity = millis();
+}
 
-  server.on("/status", HTTP_GET, handleStatus);
-  server.on("/config", HTTP_GET, handleGetConfig);
-  server.on("/config", HTTP_POST, handlePostConfig, nullptr, storeRequestBody);
-  server.on("/time", HTTP_POST, handlePostTime, nullptr, storeRequestBody);
-  server.on("/dose", HTTP_POST, handlePostDose, nullptr, storeRequestBody);
-  server.on("/logs", HTTP_GET, handleGetLogs);
-  server.on("/logs", HTTP_DELETE, handleDeleteLogs);
+bool canIdle(uint32_t nextDoseSec)
+{
+  if (!powerConfig.enabled) return false;
+  if (!pumpQueueIdle()) return false;
+  if (apClientCount > 0) return false;
+  if (millis() - lastUserActivity < powerConfig.apGraceSec * 1000UL) return false;
 
-  server.onNotFound([](AsyncWebServerRequest *request) {
-    Serial.printf("[http] 404/Options: %s %s\n",
-                  httpMethodToString((WebRequestMethodComposite)request->method()),
-                  request->url().c_str());
-    if (request->method() == HTTP_OPTIONS)
-    {
-      request->send(200);
-      return;
-    }
-    request->send(404, "application/json", "{\"ok\":false,\"message\":\"rota nao encontrada\"}");
-  });
+  // Conexão STA, troca NTP e busca da virada do RTC dependem de latência baixa
+  if (wifiLink.state == WIFI_STA_CONNECTING) return false;
+  if (ntp.state != NTP_IDLE || clockResyncActive) return false;
 
-  server.begin();
-  Serial.printf("[http] Servidor HTTP iniciado em %s\n", WiFi.softAPIP().toString().c_str());
+  return nextDoseSec == NO_NEXT_DOSE ||
+         static_cast<uint64_t>(nextDoseSec) * 1000 > POWER_DOSE_GUARD_MS;
 }
 
-bool readRequestBody(AsyncWebServerRequest *request, String &body)
+// Substitui o delay(100) do loop. Em modo ocioso a espera vai até o
+// próximo tick ocioso ou até POWER_DOSE_GUARD_MS antes da próxima dose,
+// o que vier primeiro; eventos (cliente no AP, job na fila) acordam antes.
+void idleUntilNextEvent()
 {
-  if (request->hasParam("plain", true))
-  {
-    body = request->getParam("plain", true)->value();
-    return true;
+  // Sem âncora cada clockNow() seria uma leitura I2C do RTC
+  uint32_t nextDoseSec = wallClock.isAnchored() ? secondsUntilNextDose() : NO_NEXT_DOSE;
+  // Lote de programa esperando na tabela conta como dose (tempo de uptime)
+  uint32_t programSec = secondsUntilProgramStep();
+  if (programSec < nextDoseSec) nextDoseSec = programSec;
+  powerStats.nextDoseSec = nextDoseSec;
+
+  uint32_t waitMs = POWER_ACTIVE_TICK_MS;
+  if (canIdle(nextDoseSec))
+  {
+    setPowerMode(POWER_IDLE);
+    waitMs = powerConfig.idleTickMs;
+    if (nextDoseSec != NO_NEXT_DOSE)
+    {
+      uint64_t untilGuard = static_cast<uint64_t>(nextDoseSec) * 1000 - POWER_DOSE_GUARD_MS;
+      if (untilGuard < waitMs) waitMs = untilGuard;
+    }
+    if (waitMs < POWER_ACTIVE_TICK_MS) waitMs = POWER_ACTIVE_TICK_MS;
   }
-  if (request->_tempObject != nullptr)
+  else
   {
-    body = String(static_cast<char *>(request->_tempObject));
-    free(request->_tempObject);
-    request->_tempObject = nullptr;
-    return true;
+    setPowerMode(POWER_ACTIVE);
   }
-  return false;
+
+  powerStats.plannedWaitMs = waitMs;
+  if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs)) > 0)
+    powerStats.earlyWakes++;
 }
 
-void storeRequestBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+void setPowerMode(PowerMode mode)
 {
-  if (total == 0) return;
+  if (mode == powerStats.mode) return;
+
+  unsigned long now = millis();
+  powerStats.modeMs[powerStats.mode] += now - powerStats.modeSince;
+  powerStats.modeSince = now;
+  powerStats.mode = mode;
+  powerStats.transitions++;
 
-  if (request->_tempObject == nullptr)
+  if (mode == POWER_IDLE)
   {
-    request->_tempObject = malloc(total + 1);
-    if (request->_tempObject == nullptr)
-    {
-      Serial.println("[http] ERRO: Falha ao alocar memoria para body");
-      return;
-    }
-    static_cast<char *>(request->_tempObject)[0] = '\0';
+    // Modem sleep só vale para o STA (acorda a cada DTIM); o AP continua
+    // transmitindo beacons e aceitando clientes normalmente
+    WiFi.setSleep(WIFI_PS_MIN_MODEM);
+    setCpuClock(POWER_IDLE_CPU_MHZ, powerConfig.lightSleep);
   }
-
-  memcpy(static_cast<uint8_t *>(request->_tempObject) + index, data, len);
-  if (index + len >= total)
+  else
   {
-    static_cast<char *>(request->_tempObject)[total] = '\0';
+    setCpuClock(cpuCyclesPerUs, false);
+    WiFi.setSleep(WIFI_PS_NONE);
   }
+
+  Serial.printf("[power] Modo %s (proxima dose em %ld s)\n", POWER_MODE_NAMES[mode],
+                powerStats.nextDoseSec == NO_NEXT_DOSE ? -1L : static_cast<long>(powerStats.nextDoseSec));
 }
 
-// =========================================================
-// Logs locais (LittleFS)
-// =========================================================
-size_t countLogLines(File &file)
+void setCpuClock(uint32_t mhz, bool lightSleep)
 {
-  size_t count = 0;
-  while (file.available())
+#if CONFIG_PM_ENABLE
+  // Frequência fixa (min = max) para o contador de ciclos continuar
+  // conversível; o light sleep automático entra nas esperas do loop
+  // quando nenhum driver (Wi-Fi incluído) segura o lock de energia
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+  esp_pm_config_t config = {};
+#else
+  esp_pm_config_esp32s3_t config = {};
+#endif
+  config.max_freq_mhz = mhz;
+  config.min_freq_mhz = mhz;
+  config.light_sleep_enable = lightSleep;
+  if (esp_pm_configure(&config) != ESP_OK)
+  {
+    Serial.println("[power] ERRO: esp_pm_configure falhou");
+    return;
+  }
+#else
+  (void)lightSleep;
+  if (!setCpuFrequencyMhz(mhz))
   {
-    String line = file.readStringUntil('\n');
-    line.trim();
-    if (!line.isEmpty()) count++;
+    Serial.printf("[power] ERRO: Falha ao mudar a CPU para %u MHz\n", mhz);
+    return;
   }
-  return count;
+#endif
+  cpuCycleScale = cpuCyclesPerUs / mhz;
 }
 
-bool trimLogFile(size_t removeCount)
+uint64_t powerModeMs(PowerMode mode)
 {
-  if (removeCount == 0) return true;
-  if (!LittleFS.exists(LOG_FILE)) return true;
+  uint64_t total = powerStats.modeMs[mode];
+  if (powerStats.mode == mode)
+    total += millis() - powerStats.modeSince;
+  return total;
+}
 
-  File input = LittleFS.open(LOG_FILE, FILE_READ);
-  if (!input)
-  {
-    Serial.println("[log] ERRO: Falha ao abrir arquivo de logs para trim");
-    return false;
-  }
+void handlePostPower(AsyncWebServerRequest *request)
+{
+  Serial.println("[http] Recebido: POST /power");
 
-  File output = LittleFS.open(LOG_TEMP_FILE, FILE_WRITE);
-  if (!output)
+  JsonLease lease(jsonSmallPool);
+  JsonDocument &doc = lease.doc();
+  DeserializationError error;
+  if (!readRequestDocument(request, doc, error))
   {
-    Serial.println("[log] ERRO: Falha ao criar arquivo temporario de logs");
-    input.close();
-    return false;
+    Serial.println("[http] ERRO: Body ausente em /power");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"body ausente\"}");
+    return;
   }
 
-  size_t skipped = 0;
-  while (input.available())
+  if (error)
   {
-    String line = input.readStringUntil('\n');
-    line.trim();
-    if (line.isEmpty()) continue;
-    if (skipped < removeCount)
-    {
-      skipped++;
-      continue;
-    }
-    output.println(line);
+    Serial.println("[http] JSON Invalido em /power");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"json invalido\"}");
+    return;
   }
 
-  input.close();
-  output.close();
+  // Campos ausentes mantêm o valor atual
+  PowerConfig updated = powerConfig;
+  updated.enabled = (doc["enabled"] | (updated.enabled != 0)) ? 1 : 0;
+  updated.lightSleep = (doc["lightSleep"] | (updated.lightSleep != 0)) ? 1 : 0;
+  updated.idleTickMs = doc["idleTickMs"] | updated.idleTickMs;
+  updated.apGraceSec = doc["apGraceSec"] | updated.apGraceSec;
 
-  LittleFS.remove(LOG_FILE);
-  if (!LittleFS.rename(LOG_TEMP_FILE, LOG_FILE))
+  if (updated.idleTickMs < POWER_ACTIVE_TICK_MS || updated.idleTickMs > POWER_IDLE_TICK_MAX ||
+      updated.apGraceSec > POWER_AP_GRACE_MAX)
   {
-    Serial.println("[log] ERRO: Falha ao substituir arquivo de logs");
-    return false;
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"parametros invalidos\"}");
+    return;
   }
 
-  return true;
+  // Aplicado pelo loop na próxima espera (sai do ocioso se desabilitado)
+  powerConfig = updated;
+  if (prefsReady)
+    hal::kvPutBytes("power", &powerConfig, sizeof(powerConfig));
+  wakeLoop();
+
+  Serial.printf("[power] Configuracao: %s, tick %u ms, carencia %u s, light sleep %s\n",
+                powerConfig.enabled ? "habilitado" : "desabilitado",
+                powerConfig.idleTickMs, powerConfig.apGraceSec,
+                powerConfig.lightSleep ? "sim" : "nao");
+  request->send(200, "application/json", "{\"ok\":true}");
 }
 
-bool initLogStorage()
+void fillPowerStatus(JsonObject status)
 {
-  fsReady = LittleFS.begin(true);
-  if (!fsReady)
-  {
-    Serial.println("[log] ERRO: Falha ao iniciar LittleFS");
-    return false;
-  }
+  status["enabled"] = powerConfig.enabled != 0;
+  status["mode"] = POWER_MODE_NAMES[powerStats.mode];
+  status["idleTickMs"] = powerConfig.idleTickMs;
+  status["apGraceSec"] = powerConfig.apGraceSec;
+  status["lightSleep"] = powerConfig.lightSleep != 0;
+#if CONFIG_PM_ENABLE
+  status["lightSleepAvailable"] = true;
+#else
+  status["lightSleepAvailable"] = false;
+#endif
+  status["cpuMHz"] = getCpuFrequencyMhz();
+
+  if (powerStats.nextDoseSec == NO_NEXT_DOSE)
+    status["nextDoseSec"] = nullptr;
+  else
+    status["nextDoseSec"] = powerStats.nextDoseSec;
+
+  uint64_t activeMs = powerModeMs(POWER_ACTIVE);
+  uint64_t idleMs = powerModeMs(POWER_IDLE);
+  status["activeSec"] = static_cast<uint32_t>(activeMs / 1000);
+  status["idleSec"] = static_cast<uint32_t>(idleMs / 1000);
+  status["dutyCyclePct"] = activeMs + idleMs > 0 ? 100.0f * activeMs / (activeMs + idleMs) : 100.0f;
+  status["transitions"] = powerStats.transitions;
+  status["earlyWakes"] = powerStats.earlyWakes;
+}
 
-  if (!LittleFS.exists(LOG_FILE))
+// =========================================================
+// Sincronização (outbox)
+// =========================================================
+// O POST bloqueia por segundos sem rede boa: roda nesta task, nunca no
+// loop. O loop monta o lote (serviceOutbox) e só volta a mexer nele
+// quando a task devolve o status. O GET do hub usa a mesma task.
+void syncTask(void *arg)
+{
+  (void)arg;
+  for (;;)
   {
-    File file = LittleFS.open(LOG_FILE, FILE_WRITE);
-    if (!file)
-    {
-      Serial.println("[log] ERRO: Falha ao criar arquivo de logs");
-      return false;
-    }
-    file.close();
-    logCount = 0;
-    return true;
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    outboxUpload();
+    hubFetch();
+    wakeLoop();
   }
+}
 
-  File file = LittleFS.open(LOG_FILE, FILE_READ);
-  if (!file)
+void startSyncTask()
+{
+  if (xTaskCreatePinnedToCore(syncTask, "sync", SYNC_TASK_STACK, nullptr, SYNC_TASK_PRIORITY,
+                              &syncTaskHandle, 0) != pdPASS)
   {
-    Serial.println("[log] ERRO: Falha ao abrir arquivo de logs");
-    return false;
+    syncTaskHandle = nullptr;
+    Serial.println("[sync] ERRO: Falha ao criar task de envio");
   }
+}
 
-  logCount = countLogLines(file);
-  file.close();
+void handlePostSync(AsyncWebServerRequest *request)
+{
+  Serial.println("[http] Recebido: POST /sync");
 
-  if (logCount > LOG_LIMIT)
+  JsonLease lease(jsonSmallPool);
+  JsonDocument &doc = lease.doc();
+  DeserializationError error;
+  if (!readRequestDocument(request, doc, error))
   {
-    size_t removeCount = logCount - LOG_LIMIT;
-    if (trimLogFile(removeCount))
-      logCount = LOG_LIMIT;
+    Serial.println("[http] ERRO: Body ausente em /sync");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"body ausente\"}");
+    return;
   }
 
-  Serial.printf("[log] Logs carregados: %u\n", static_cast<unsigned int>(logCount));
-  return true;
-}
-
-void appendLocalLog(int bombaIndex, float dosagem, const String &origem, const DateTime &timestamp)
-{
-  if (!fsReady) return;
-  if (bombaIndex < 0 || bombaIndex >= BOMBA_COUNT) return;
-  if (dosagem <= 0) return;
+  if (error)
+  {
+    Serial.println("[http] JSON Invalido em /sync");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"json invalido\"}");
+    return;
+  }
 
-  if (logCount >= LOG_LIMIT)
+  // "url" vazio desabilita; ausente mantém o destino atual
+  if (doc["url"].is<const char *>())
   {
-    size_t removeCount = (logCount - LOG_LIMIT) + 1;
-    if (!trimLogFile(removeCount))
+    const char *url = doc["url"];
+    bool valid = url[0] == '\0' ||
+                 ((strncmp(url, "http://", 7) == 0 || strncmp(url, "https://", 8) == 0) &&
+                  strlen(url) <= InlineString<OUTBOX_URL_SIZE>::capacity());
+    if (!valid)
     {
-      Serial.println("[log] ERRO: Falha ao limpar logs antigos");
+      request->send(400, "application/json", "{\"ok\":false,\"message\":\"url invalida\"}");
       return;
     }
-    logCount = (logCount > removeCount) ? (logCount - removeCount) : 0;
+    setOutboxUrl(url);
+    Serial.printf("[sync] Destino: %s\n", url[0] ? url : "(desabilitado)");
   }
 
-  File file = LittleFS.open(LOG_FILE, FILE_APPEND);
-  if (!file)
+  // Envio imediato, sem esperar o backoff; tratado pelo loop
+  if (doc["flush"] | false)
   {
-    Serial.println("[log] ERRO: Falha ao abrir arquivo de logs para escrita");
-    return;
+    flushOutbox();
+    wakeLoop();
   }
 
-  StaticJsonDocument<256> doc;
-  doc["bombaId"] = bombaIndex + 1;
-  doc["timestamp"] = formatTimestamp(timestamp);
-  doc["bomba"] = bombas[bombaIndex].name;
-  doc["dosagem"] = dosagem;
-  doc["origem"] = origem;
-
-  serializeJson(doc, file);
-  file.println();
-  file.close();
-
-  logCount++;
+  request->send(200, "application/json", "{\"ok\":true}");
 }
 
 // =========================================================
-// Config / JSON
+// Previsão de estoque
 // =========================================================
-void inicializarBombas()
-{
-  for (int i = 0; i < BOMBA_COUNT; i++)
-  {
-    pinMode(PUMP_PINS[i], OUTPUT);
-    digitalWrite(PUMP_PINS[i], LOW);
-  }
-
-  Serial.printf("[system] %d bombas inicializadas.\n", BOMBA_COUNT);
-}
-
-void resetSchedule(Schedule &schedule)
-{
-  schedule = Schedule();
-}
-
-void saveBombasConfig()
-{
-  if (!prefsReady) return;
-  Serial.println("[config] Salvando configuracoes na memoria (Preferences)...");
-  String json = buildConfigJson();
-  preferences.putString("bombas", json);
-}
-
-String buildConfigJson()
+void handlePostForecast(AsyncWebServerRequest *request)
 {
-  JsonDocument doc;
+  Serial.println("[http] Recebido: POST /forecast");
 
-  for (int i = 0; i < BOMBA_COUNT; i++)
+  JsonLease lease(jsonSmallPool);
+  JsonDocument &doc = lease.doc();
+  DeserializationError error;
+  if (!readRequestDocument(request, doc, error))
   {
-    char bombaKey[8];
-    snprintf(bombaKey, sizeof(bombaKey), "bomb%d", i + 1);
-    JsonObject bomba = doc[bombaKey].to<JsonObject>();
-
-    bomba["name"] = bombas[i].name;
-    bomba["calibrCoef"] = bombas[i].calibrCoef;
-    bomba["quantidadeEstoque"] = bombas[i].quantidadeEstoque;
-
-    JsonArray schedules = bomba["schedules"].to<JsonArray>();
-    for (int j = 0; j < SCHEDULE_COUNT; j++)
-    {
-      JsonObject schedule = schedules.add<JsonObject>();
-      schedule["id"] = j + 1;
-
-      JsonObject timeObj = schedule["time"].to<JsonObject>();
-      timeObj["hour"] = bombas[i].schedules[j].hour;
-      timeObj["minute"] = bombas[i].schedules[j].minute;
-
-      schedule["dosagem"] = bombas[i].schedules[j].dosagem;
-      schedule["status"] = bombas[i].schedules[j].status;
-
-      JsonArray dias = schedule["diasSemanaSelecionados"].to<JsonArray>();
-      for (int d = 0; d < 7; d++)
-        dias.add(bombas[i].schedules[j].diasSemana[d]);
-    }
+    Serial.println("[http] ERRO: Body ausente em /forecast");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"body ausente\"}");
+    return;
   }
 
-  String json;
-  serializeJson(doc, json);
-  return json;
-}
-
-void initDefaultBombasConfig()
-{
-  Serial.println("[config] Inicializando configuracao padrao de bombas...");
-  for (int i = 0; i < BOMBA_COUNT; i++)
+  if (error)
   {
-    bombas[i].name = "Bomba " + String(i + 1);
-    bombas[i].calibrCoef = 1.0f;
-    bombas[i].quantidadeEstoque = 1000.0f;
-    for (int j = 0; j < SCHEDULE_COUNT; j++)
-      resetSchedule(bombas[i].schedules[j]);
+    Serial.println("[http] JSON Invalido em /forecast");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"json invalido\"}");
+    return;
   }
-  saveBombasConfig();
-  Serial.println("[config] Configuracao padrao salva e aplicada.");
-}
-
-void parseBombData(int i, JsonObject bomba)
-{
-  if (bomba["name"].is<const char *>())
-    bombas[i].name = bomba["name"].as<String>();
-  else
-    bombas[i].name = "Bomba " + String(i + 1);
 
-  bombas[i].calibrCoef = bomba["calibrCoef"] | 1.0f;
-  bombas[i].quantidadeEstoque = bomba["quantidadeEstoque"] | 0.0f;
+  // Campos ausentes mantêm o valor atual
+  ForecastSettings updated = forecastSettings;
+  updated.floorUl = jsonMl(doc["floorMl"], updated.floorUl);
+  updated.hold = (doc["hold"] | (updated.hold != 0)) ? 1 : 0;
 
-  if (bomba["schedules"])
+  if (updated.floorUl < 0)
   {
-    JsonArray schedules = bomba["schedules"].as<JsonArray>();
-    for (int j = 0; j < SCHEDULE_COUNT; j++)
-    {
-      JsonObject schedule = schedules[j];
-      resetSchedule(bombas[i].schedules[j]);
-
-      if (schedule.isNull())
-        continue;
-
-      JsonObject timeObj = schedule["time"].as<JsonObject>();
-      bombas[i].schedules[j].hour = timeObj["hour"] | 0;
-      bombas[i].schedules[j].minute = timeObj["minute"] | 0;
-      bombas[i].schedules[j].dosagem = schedule["dosagem"] | 0.0f;
-      bombas[i].schedules[j].status = schedule["status"] | false;
-
-      if (schedule["diasSemanaSelecionados"])
-      {
-        JsonArray dias = schedule["diasSemanaSelecionados"].as<JsonArray>();
-        for (int d = 0; d < 7; d++)
-          bombas[i].schedules[j].diasSemana[d] = dias[d] | false;
-      }
-      else
-      {
-        for (int d = 0; d < 7; d++)
-          bombas[i].schedules[j].diasSemana[d] = false;
-      }
-    }
-  }
-  else
-  {
-    // Caso legado: sem "schedules"
-    for (int j = 0; j < SCHEDULE_COUNT; j++)
-      resetSchedule(bombas[i].schedules[j]);
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"parametros invalidos\"}");
+    return;
   }
 
-  for (int j = 0; j < SCHEDULE_COUNT; j++)
-    bombas[i].schedules[j].lastRunMinute = -1;
+  setForecastSettings(updated);
+  Serial.printf("[stock] Piso de estoque: %s ml, segurar doses %s\n",
+                MlText(updated.floorUl).c_str(), updated.hold ? "sim" : "nao");
+  request->send(200, "application/json", "{\"ok\":true}");
 }
 
-void loadBombasConfig()
+// =========================================================
+// Programas de dose
+// =========================================================
+void handlePostProgram(AsyncWebServerRequest *request)
 {
-  Serial.println("[config] Lendo configuracoes salvas...");
-  String configJson = preferences.getString("bombas", "");
+  Serial.println("[http] Recebido: POST /program");
 
-  if (configJson.isEmpty())
+  JsonLease lease(jsonSmallPool);
+  JsonDocument &doc = lease.doc();
+  DeserializationError error;
+  if (!readRequestDocument(request, doc, error))
   {
-    Serial.println("[config] Nenhuma config encontrada. Usando padrao.");
-    initDefaultBombasConfig();
+    Serial.println("[http] ERRO: Body ausente em /program");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"body ausente\"}");
     return;
   }
 
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, configJson);
   if (error)
   {
-    Serial.println("[config] ERRO critico ao ler JSON salvo.");
-    initDefaultBombasConfig();
+    Serial.println("[http] JSON Invalido em /program");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"json invalido\"}");
     return;
   }
 
-  for (int i = 0; i < BOMBA_COUNT; i++)
+  DoseProgram program;
+  if (parseDoseProgram(doc.as<JsonVariantConst>(), program) != PROGRAM_OK)
   {
-    char bombaKey[8];
-    snprintf(bombaKey, sizeof(bombaKey), "bomb%d", i + 1);
-    JsonObject bomba = doc[bombaKey];
-    if (bomba.isNull()) continue;
-    parseBombData(i, bomba);
+    Serial.println("[http] Programa invalido");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"programa invalido\"}");
+    return;
   }
 
-  // Migração NVS: preencher bombas que não existiam na config salva (ex: upgrade de 3→4)
-  for (int i = 0; i < BOMBA_COUNT; i++)
+  int detail = 0;
+  char body[96];
+  switch (submitDoseProgram(program, detail))
   {
-    if (bombas[i].name.isEmpty())
+  case PROGRAM_OK:
+    snprintf(body, sizeof(body), "{\"ok\":true,\"id\":%u,\"steps\":%u,\"durationSec\":%lu}", program.id,
+             program.stepCount, static_cast<unsigned long>((doseProgramDurationUs(program) + 999999) / 1000000));
+    request->send(200, "application/json", body);
+    return;
+  case PROGRAM_QUEUE_FULL:
+    snprintf(body, sizeof(body), "{\"ok\":false,\"message\":\"fila sem espaco\",\"free\":%d}", detail);
+    break;
+  case PROGRAM_NO_STOCK:
+    snprintf(body, sizeof(body), "{\"ok\":false,\"message\":\"estoque insuficiente\",\"bomb\":%d}", detail + 1);
+    break;
+  default:
+    snprintf(body, sizeof(body), "{\"ok\":false,\"message\":\"programas demais em andamento\"}");
+    break;
+  }
+  request->send(409, "application/json", body);
+}
+
+void handleGetProgram(AsyncWebServerRequest *request)
+{
+  Serial.println("[http] Recebido: GET /program");
+
+  JsonLease lease(jsonLargePool);
+  JsonDocument &doc = lease.doc();
+  JsonArray items = doc["programs"].to<JsonArray>();
+  WireFormat format = responseFormat(request);
+
+  DoseProgram program;
+  for (uint8_t slot = 0; slot < PROGRAM_SLOTS; slot++)
+  {
+    if (!copyDoseProgram(slot, program)) continue;
+
+    JsonObject item = items.add<JsonObject>();
+    item["id"] = program.id;
+    item["name"] = program.name.c_str();
+    item["state"] = programStateName(program.state);
+    item["steps"] = program.stepCount;
+    item["stepsDone"] = program.stepsDone;
+    jsonSetMl(item["plannedMl"], program.plannedUl, format);
+    jsonSetMl(item["dosedMl"], program.dosedUl, format);
+
+    char timestamp[TIMESTAMP_SIZE];
+    formatTimestamp(DateTime(program.submittedAt), timestamp, sizeof(timestamp));
+    item["submitted"] = timestamp;
+    if (program.finishedAt != 0)
+    {
+      formatTimestamp(DateTime(program.finishedAt), timestamp, sizeof(timestamp));
+      item["finished"] = timestamp;
+      continue;
+    }
+
+    // Em andamento: situação de cada passo (rodam na ordem da lista)
+    JsonArray steps = item["plan"].to<JsonArray>();
+    for (uint8_t i = 0; i < program.stepCount; i++)
     {
-      Serial.printf("[config] Slot %d vazio, preenchendo com valores padrao (upgrade).\n", i + 1);
-      bombas[i].name = "Bomba " + String(i + 1);
-      bombas[i].calibrCoef = 1.0f;
-      bombas[i].quantidadeEstoque = 1000.0f;
-      for (int j = 0; j < SCHEDULE_COUNT; j++)
-        resetSchedule(bombas[i].schedules[j]);
+      const ProgramStep &step = program.steps[i];
+      JsonObject entry = steps.add<JsonObject>();
+      entry["bomb"] = step.bombaIndex + 1;
+      jsonSetMl(entry["dosagem"], step.dosagemUl, format);
+      entry["group"] = step.group;
+      entry["delay"] = step.delayMs / 1000;
+      // pending = na fila; waiting = ainda na tabela, esperando o delay
+      const char *status = "waiting";
+      if (i < program.stepsDone) status = "done";
+      else if (i == program.currentStep) status = "running";
+      else if (i < program.stepsQueued) status = "pending";
+      entry["status"] = status;
     }
   }
 
-  saveBombasConfig();
-  Serial.println("[config] Configuracoes carregadas com sucesso.");
+  sendDocument(request, 200, doc);
 }
 
-bool applyConfigJson(const String &json)
+void handleDeleteProgram(AsyncWebServerRequest *request)
 {
-  Serial.println("[config] Aplicando novo JSON recebido...");
-  JsonDocument doc;
+  Serial.println("[http] Recebido: DELETE /program");
 
-  DeserializationError error = deserializeJson(doc, json);
-  if (error)
+  long id = request->hasParam("id") ? request->getParam("id")->value().toInt() : 0;
+  if (id <= 0 || id > 0xFFFF)
   {
-    Serial.println("[config] JSON invalido recebido via HTTP.");
-    return false;
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"id invalido\"}");
+    return;
   }
 
-  for (int i = 0; i < BOMBA_COUNT; i++)
+  switch (cancelDoseProgram(static_cast<uint16_t>(id)))
   {
-    char bombaKey[8];
-    snprintf(bombaKey, sizeof(bombaKey), "bomb%d", i + 1);
-    JsonObject bomba = doc[bombaKey];
-    if (bomba.isNull()) continue;
-    parseBombData(i, bomba);
+  case PROGRAM_OK:
+    request->send(200, "application/json", "{\"ok\":true}");
+    break;
+  case PROGRAM_FINISHED:
+    request->send(409, "application/json", "{\"ok\":false,\"message\":\"programa ja terminou\"}");
+    break;
+  default:
+    request->send(404, "application/json", "{\"ok\":false,\"message\":\"programa nao encontrado\"}");
+    break;
   }
-
-  saveBombasConfig();
-  return true;
 }
 
-bool parseDateTime(const String &value, DateTime &output)
+// =========================================================
+// Gravador de entradas
+// =========================================================
+// Rota, query e body de cada requisição admitida, antes do handler; as
+// rotas do próprio trace ficam de fora
+void traceRequest(AsyncWebServerRequest *request, HttpRoute route)
 {
-  int dia, mes, ano, hora, minuto, segundo;
+  if (!inputTraceEnabled() || route == ROUTE_TRACE_GET || route == ROUTE_TRACE_POST) return;
 
-  int parsed = sscanf(value.c_str(), "%d/%d/%d %d:%d:%d",
-                      &dia, &mes, &ano, &hora, &minuto, &segundo);
-  if (parsed == 6)
+  char query[TRACE_QUERY_MAX];
+  size_t queryLength = 0;
+  for (size_t i = 0; i < request->params(); i++)
   {
-    output = DateTime(ano, mes, dia, hora, minuto, segundo);
-    return true;
+    AsyncWebParameter *param = request->getParam(i);
+    if (param->isPost() || param->isFile()) continue;
+    int written = snprintf(query + queryLength, sizeof(query) - queryLength, "%s%s=%s", queryLength > 0 ? "&" : "",
+                           param->name().c_str(), param->value().c_str());
+    if (written < 0 || queryLength + written >= sizeof(query)) break;
+    queryLength += written;
   }
 
-  parsed = sscanf(value.c_str(), "%d/%d/%d %d:%d",
-                  &dia, &mes, &ano, &hora, &minuto);
-  if (parsed == 5)
+  uint8_t flags = 0;
+  if (requestFormat(request) == WIRE_MSGPACK) flags |= TRACE_HTTP_MSGPACK_BODY;
+  if (responseFormat(request) == WIRE_MSGPACK) flags |= TRACE_HTTP_MSGPACK_REPLY;
+  if (acceptsGzip(request)) flags |= TRACE_HTTP_GZIP;
+
+  const char *body;
+  size_t length;
+  if (!readRequestBody(request, body, length))
   {
-    output = DateTime(ano, mes, dia, hora, minuto, 0);
-    return true;
+    body = "";
+    length = 0;
   }
-
-  return false;
+  traceHttp(route, flags, query, queryLength, body, length);
 }
 
-// =========================================================
-// Scheduler
-// =========================================================
-void checkSchedules()
+// Arquivo inteiro como está na flash (o buffer em RAM sai em até TRACE_FLUSH_MS)
+void handleGetTrace(AsyncWebServerRequest *request)
 {
-  static long lastCheckedMinuteKey = -1;
-  static unsigned long lastCheckTime = 0;
+  Serial.println("[http] Recebido: GET /trace");
 
-  unsigned long nowMs = millis();
-  if (nowMs - lastCheckTime < 1000) return;
-  lastCheckTime = nowMs;
-
-  if (!rtcReady)
+  size_t size = 0;
+  {
+    hal::File file = hal::fsOpen(TRACE_FILE, hal::FILE_MODE_READ);
+    if (file) size = file.size();
+  }
+  if (size == 0)
   {
-    Serial.println("[scheduler] RTC nao pronto, pulando verificacao");
+    request->send(404, "application/json", "{\"ok\":false,\"message\":\"nenhuma gravacao\"}");
     return;
   }
 
-  DateTime rtcNow = rtc.now();
-  long minuteKey = rtcNow.unixtime() / 60;
-
-  // Só processa uma vez por minuto real (não por "minute()")
-  if (minuteKey == lastCheckedMinuteKey) return;
-  lastCheckedMinuteKey = minuteKey;
-
-  Serial.println("\n----------------------------------------");
-  Serial.printf("[scheduler] Verificando agendamentos para: %02d:%02d\n",
-                rtcNow.hour(), rtcNow.minute());
-
-  int diaSemana = rtcNow.dayOfTheWeek();
-  bool encontrouAlgumaCoisa = false;
+  AsyncWebServerResponse *response = request->beginResponse(
+      "application/octet-stream", size, [](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        hal::File file = hal::fsOpen(TRACE_FILE, hal::FILE_MODE_READ);
+        if (!file || !file.seek(index)) return 0;
+        return file.read(buffer, maxLen);
+      });
+  response->addHeader("Content-Disposition", "attachment; filename=\"inputs.trc\"");
+  request->send(response);
+}
 
-  Serial.printf("[scheduler] Dia da semana: %d, Chave de minuto: %ld\n", diaSemana, minuteKey);
+// {"record": true|false, "clear": true}
+void handlePostTrace(AsyncWebServerRequest *request)
+{
+  Serial.println("[http] Recebido: POST /trace");
 
-  for (int i = 0; i < BOMBA_COUNT; i++)
+  JsonLease lease(jsonSmallPool);
+  JsonDocument &doc = lease.doc();
+  DeserializationError error;
+  if (!readRequestDocument(request, doc, error))
   {
-    for (int j = 0; j < SCHEDULE_COUNT; j++)
-    {
-      Schedule &schedule = bombas[i].schedules[j];
-
-      if (!schedule.status) continue;
-      if (schedule.lastRunMinute == minuteKey) continue;
-      if (!schedule.diasSemana[diaSemana]) continue;
-
-      if (schedule.hour == rtcNow.hour() && schedule.minute == rtcNow.minute())
-      {
-        Serial.printf("[scheduler] >>> HORARIO ATINGIDO! Bomba %d (Schedule %d) <<<\n", i + 1, j + 1);
-        encontrouAlgumaCoisa = true;
-        schedule.lastRunMinute = minuteKey;
-        enqueuePumpJob(i, schedule.dosagem, "Programado");
-      }
-    }
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"body ausente\"}");
+    return;
+  }
+  if (error)
+  {
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"json invalido\"}");
+    return;
   }
 
-  if (!encontrouAlgumaCoisa)
-    Serial.println("[scheduler] Nenhum horario programado para este minuto.");
+  if (doc["clear"] | false)
+    clearInputTrace();
+  if (doc["record"].is<bool>())
+    setInputTrace(doc["record"].as<bool>());
 
-  Serial.println("----------------------------------------\n");
+  // O loop abre a sessão (ou apaga o arquivo) na próxima volta
+  wakeLoop();
+  request->send(200, "application/json", "{\"ok\":true}");
 }
 
 // =========================================================
-// Pump Queue
+// Hub
 // =========================================================
-bool enqueuePumpJob(int bombaIndex, float dosagem, const String &origem)
+void handleGetHub(AsyncWebServerRequest *request)
 {
-  if (bombaIndex < 0 || bombaIndex >= BOMBA_COUNT || dosagem <= 0)
-  {
-    Serial.printf("[queue] ERRO: Tentativa invalida de dosagem. Bomba: %d, Dose: %.2f\n",
-                  bombaIndex, dosagem);
-    return false;
+  Serial.println("[http] Recebido: GET /hub");
+
+  JsonLease lease(jsonLargePool);
+  JsonDocument &doc = lease.doc();
+  WireFormat format = responseFormat(request);
+  {
+    JsonLease selfLease(jsonSmallPool);
+    buildHubSelf(selfLease.doc(), format);
+    doc["self"] = selfLease.doc();
+  }
+
+  JsonArray list = doc["peers"].to<JsonArray>();
+  HubPeer peer;
+  for (uint8_t i = 0; copyHubPeer(i, peer); i++)
+  {
+    JsonObject item = list.add<JsonObject>();
+    item["url"] = peer.url.c_str();
+    item["device"] = peer.device.c_str();
+    item["lastSeq"] = peer.lastSeq;
+    item["remoteSeq"] = peer.remoteSeq;
+    item["pulled"] = peer.pulled;
+    item["gaps"] = peer.gaps;
+    item["failures"] = peer.failures;
+    item["lastStatus"] = peer.lastStatus;
+    if (peer.lastPullAt != 0)
+    {
+      char timestamp[TIMESTAMP_SIZE];
+      formatTimestamp(DateTime(peer.lastPullAt), timestamp, sizeof(timestamp));
+      item["lastPull"] = timestamp;
+    }
+    if (format == WIRE_JSON)
+    {
+      item["bombas"] = serialized(peer.bombas);
+      continue;
+    }
+    // O texto guardado do par é JSON: em MessagePack vai como documento
+    JsonLease bombasLease(jsonSmallPool);
+    if (!deserializeJson(bombasLease.doc(), peer.bombas))
+      item["bombas"] = bombasLease.doc();
   }
 
-  DateTime now = rtc.now();
-  bool queued = false;
+  sendDocument(request, 200, doc);
+}
 
-  portENTER_CRITICAL(&pumpQueueMux);
-  int nextTail = (pumpTail + 1) % MAX_PUMP_QUEUE;
-  if (nextTail != pumpHead)
-  {
-    pumpQueue[pumpTail] = {bombaIndex, dosagem, origem, now};
-    pumpTail = nextTail;
-    queued = true;
-  }
-  portEXIT_CRITICAL(&pumpQueueMux);
+// {"peers": ["http://192.168.1.20", ...], "pull": true}
+void handlePostHub(AsyncWebServerRequest *request)
+{
+  Serial.println("[http] Recebido: POST /hub");
 
-  if (queued)
+  JsonLease lease(jsonSmallPool);
+  JsonDocument &doc = lease.doc();
+  DeserializationError error;
+  if (!readRequestDocument(request, doc, error))
   {
-    Serial.printf("[queue] Job ADICIONADO: Bomba %d, %.2f ml, Origem: %s\n",
-                  bombaIndex + 1, dosagem, origem.c_str());
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"body ausente\"}");
+    return;
   }
-  else
+  if (error)
   {
-    Serial.println("[queue] ERRO: Fila de bombas cheia! Ignorando comando.");
+    request->send(400, "application/json", "{\"ok\":false,\"message\":\"json invalido\"}");
+    return;
   }
 
-  return queued;
-}
-
-int pumpPinForIndex(int bombaIndex)
-{
-  if (bombaIndex < 0 || bombaIndex >= BOMBA_COUNT) return PUMP_PINS[0];
-  return PUMP_PINS[bombaIndex];
-}
-
-void finishPumpJob()
-{
-  int bombaIndex = activeJob.bombaIndex;
-  int pin = pumpPinForIndex(bombaIndex);
-
-  digitalWrite(pin, LOW);
-  pumpActive = false;
-
-  Serial.printf("[pump] BOMBA %d DESLIGADA. Fim da dosagem.\n", bombaIndex + 1);
-
-  if (bombas[bombaIndex].quantidadeEstoque > 0)
+  if (doc["peers"].is<JsonArray>())
   {
-    float anterior = bombas[bombaIndex].quantidadeEstoque;
-    bombas[bombaIndex].quantidadeEstoque -= activeJob.dosagem;
-    if (bombas[bombaIndex].quantidadeEstoque < 0) bombas[bombaIndex].quantidadeEstoque = 0;
+    JsonArray list = doc["peers"].as<JsonArray>();
+    if (list.size() > HUB_PEERS_MAX)
+    {
+      request->send(400, "application/json", "{\"ok\":false,\"message\":\"controladores demais\"}");
+      return;
+    }
 
-    Serial.printf("[stock] Estoque Bomba %d atualizado: %.2f -> %.2f\n",
-                  bombaIndex + 1, anterior, bombas[bombaIndex].quantidadeEstoque);
+    const char *urls[HUB_PEERS_MAX];
+    uint8_t count = 0;
+    for (JsonVariant url : list)
+    {
+      if (!url.is<const char *>()) break;
+      urls[count++] = url.as<const char *>();
+    }
+    if (count != list.size() || !setHubPeers(urls, count))
+    {
+      request->send(400, "application/json", "{\"ok\":false,\"message\":\"url invalida\"}");
+      return;
+    }
   }
+  if (doc["pull"] | false)
+    pullHubNow();
 
-  saveBombasConfig();
-  appendLocalLog(bombaIndex, activeJob.dosagem, activeJob.origem, activeJob.timestamp);
+  wakeLoop();
+  request->send(200, "application/json", "{\"ok\":true}");
 }
 
-void startNextPumpJob()
+// Visão agregada: um array com as doses de todos, cada uma com "device",
+// em chunks como o GET /logs
+void handleGetHubLogs(AsyncWebServerRequest *request)
 {
-  if (pumpActive) return;
+  Serial.println("[http] Recebido: GET /hub/logs");
 
-  PumpJob nextJob;
-  bool hasJob = false;
-
-  portENTER_CRITICAL(&pumpQueueMux);
-  if (pumpHead != pumpTail)
+  BulkBody *body = new (std::nothrow) HubLogsBody();
+  if (body == nullptr)
   {
-    nextJob = pumpQueue[pumpHead];
-    pumpHead = (pumpHead + 1) % MAX_PUMP_QUEUE;
-    hasJob = true;
+    request->send(500, "application/json", "{\"ok\":false,\"message\":\"memoria insuficiente\"}");
+    return;
   }
-  portEXIT_CRITICAL(&pumpQueueMux);
+  sendBulkBody(request, WIRE_JSON, body);
+}
+
+// =========================================================
+// Ganchos do núcleo (dosing.h)
+// =========================================================
+void onPumpJobQueued()
+{
+  wakeLoop();
+}
 
-  if (!hasJob) return;
+void reportDoseStartDelay(uint32_t delayUs)
+{
+  uint32_t delayMs = delayUs / 1000;
+  if (delayMs > slo.doseStartMs)
+    recordIncident(INCIDENT_DOSE_START, likelyStallPhase(), delayMs, slo.doseStartMs);
+}
 
-  activeJob = nextJob;
-  float coef = bombas[activeJob.bombaIndex].calibrCoef;
-  pumpDuration = (unsigned long)(activeJob.dosagem * TEMPO_POR_ML * coef);
-  pumpStartTime = millis();
-  pumpActive = true;
+void reportDoseCutoffDelay(uint32_t delayUs)
+{
+  uint32_t delayMs = delayUs / 1000;
+  if (delayMs > slo.doseCutoffMs)
+    recordIncident(INCIDENT_DOSE_CUTOFF, likelyStallPhase(), delayMs, slo.doseCutoffMs);
+}
 
-  Serial.println("------------------------------------------------");
-  Serial.printf("[pump] INICIANDO DOSAGEM!\n");
-  Serial.printf("[pump] Bomba: %d\n", activeJob.bombaIndex + 1);
-  Serial.printf("[pump] Origem: %s\n", activeJob.origem.c_str());
-  Serial.printf("[pump] Volume: %.2f ml\n", activeJob.dosagem);
-  Serial.printf("[pump] Tempo Calculado: %lu ms\n", pumpDuration);
-  Serial.println("------------------------------------------------");
+void recordFlashOp(FlashOp op, uint32_t elapsedUs)
+{
+  metricHistograms[MET_FLASH_CONFIG_SAVE + op].record(metricCyclesFromUs(elapsedUs));
+}
 
-  int pin = pumpPinForIndex(activeJob.bombaIndex);
-  digitalWrite(pin, HIGH);
+void onOutboxBatchReady()
+{
+  if (syncTaskHandle != nullptr)
+    xTaskNotifyGive(syncTaskHandle);
 }
 
-void processPumpQueue()
+void onHubFetchReady()
 {
-  if (pumpActive)
-  {
-    if (millis() - pumpStartTime >= pumpDuration)
-      finishPumpJob();
-    return;
-  }
-  startNextPumpJob();
+  if (syncTaskHandle != nullptr)
+    xTaskNotifyGive(syncTaskHandle);
 }
 
 // =========================================================
@@ -1281,7 +3385,7 @@ void updateStatusLed()
     updateLedMode(LED_MODE_DOSING);
   else if (!systemReady)
     updateLedMode(LED_MODE_BOOT);
-  else if (WiFi.status() != WL_CONNECTED)
+  else if (!isStaConnected())
     updateLedMode(LED_MODE_NO_NET);
   else
     updateLedMode(LED_MODE_READY);
@@ -1342,28 +3446,42 @@ void setup()
   Serial.begin(115200);
   Serial.println("\n\n--- INICIANDO FIRE DOSER SYSTEM ---");
 
-  inicializarBombas();
+  cpuCyclesPerUs = ESP.getCpuFreqMHz();
 
+  // I2C antes das bombas: o banco pode estar em expansores MCP23017
   Wire.begin(I2C_SDA, I2C_SCL);
 
-  rtcReady = rtc.begin();
+  inicializarBombas();
+
+  rtcReady = hal::rtcBegin();
   if (!rtcReady)
   {
     Serial.println("[rtc] ERRO FATAL: Falha ao iniciar RTC!");
   }
   else
   {
-    DateTime now = rtc.now();
+    anchorClockAtBoot();
+    DateTime now = clockNow();
     Serial.printf("[rtc] RTC Iniciado. Hora atual: %02d:%02d:%02d\n", now.hour(), now.minute(), now.second());
   }
 
-  prefsReady = preferences.begin("bomb-config", false);
+  prefsReady = hal::kvBegin("bomb-config");
   if (prefsReady)
     loadBombasConfig();
   else
     Serial.println("[config] ERRO: Falha ao iniciar Preferences.");
 
   initLogStorage();
+  initOutbox();
+  initHub();
+  loadConsumption();
+  initDosePrograms();
+  initJournal();
+  for (int i = 0; i < ROUTE_COUNT; i++)
+    traceRouteNames[i] = ROUTE_LIMITS[i].name;
+  initInputTrace(traceRouteNames, ROUTE_COUNT);
+  loadNtpSettings();
+  loadPowerConfig();
 
   systemReady = rtcReady && prefsReady;
 
@@ -1376,23 +3494,36 @@ void setup()
   setupWifi();
   setupServer();
 
-  applyApPriority();
+  startWifiLink();
+
+  initStallMonitor();
+  startLoopWatchdog();
+  startSyncTask();
 
   Serial.println("[system] Setup concluido. Entrando no loop principal...");
 }
 
 void loop()
 {
-  applyApPriority();
-  ensureStaWifi();
-  ensureTimeSynced();
-  ensureApIsUp();
+  beginLoopIteration();
+  {
+    MetricTimer loopTimer(MET_LOOP_TOTAL, true);
 
-  checkSchedules();
-  processPumpQueue();
+    timedLoopPhase(MET_LOOP_SERVICE_WIFI, serviceWifi);
+    timedLoopPhase(MET_LOOP_ENSURE_TIME_SYNCED, ensureTimeSynced);
+    timedLoopPhase(MET_LOOP_MAINTAIN_CLOCK, maintainClock);
 
-  updateStatusLed();
-  logWifiStatusChange();
+    timedLoopPhase(MET_LOOP_CHECK_SCHEDULES, checkSchedules);
+    timedLoopPhase(MET_LOOP_PROCESS_PUMP_QUEUE, processPumpQueue);
+    timedLoopPhase(MET_LOOP_SERVICE_OUTBOX, serviceOutbox);
+    timedLoopPhase(MET_LOOP_SERVICE_HUB, serviceHub);
+
+    timedLoopPhase(MET_LOOP_UPDATE_STATUS_LED, updateStatusLed);
+  }
+  flushIncidents();
+  flushInputTrace();
+  serviceLocalLogs();
+  serviceConfig();
 
-  delay(100);
+  idleUntilNextEvent();
 }
@@ -0,0 +1,194 @@
+#pragma once
+
+// Base dos testes do ambiente `native` (pio test -e native): armazenamento
+// novo por teste, o mesmo boot do setup(), reset simulado e uma volta do
+// loop com o relógio manual. Os ganchos do núcleo (clockNow, onPumpJobQueued...)
+// vêm de native/main_native.cpp, compilado sem o main() nos testes.
+
+#include "dosing.h"
+#include "hal_native.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+// O pio test roda o programa na pasta do projeto
+#ifndef TEST_FIXTURES_DIR
+#define TEST_FIXTURES_DIR "test/fixtures"
+#endif
+
+namespace native_test
+{
+// Segunda-feira, 1/1/2024 00:00
+const uint32_t START_TIME = 1704067200UL;
+const uint32_t TICK_MS = 1000;
+
+// Diretório temporário novo: NVS, LittleFS e partição de logs vazios.
+// partitionKb 0 = placa sem a partição (logs no LittleFS)
+inline void freshStorage(size_t partitionKb = 128)
+{
+  static std::string root;
+  char pattern[] = "/tmp/aquabalance-test-XXXXXX";
+  if (mkdtemp(pattern) == nullptr)
+  {
+    perror("mkdtemp");
+    abort();
+  }
+  root = std::string(pattern) + "/fs";
+
+  hal::setLogEnabled(false);
+  hal::native::setManualClock(true);
+  hal::native::setRtc(START_TIME);
+  hal::native::setFsRoot(root.c_str());
+  hal::native::setPartitionSize(partitionKb * 1024);
+  hal::native::setPowerCutAfter(-1);
+  hal::native::kvClear();
+}
+
+// Mesma ordem do setup() da firmware
+inline void boot()
+{
+  inicializarBombas();
+  rtcReady = hal::rtcBegin();
+  prefsReady = hal::kvBegin("bomb-config");
+  loadBombasConfig();
+  initLogStorage();
+  initOutbox();
+  initHub();
+  loadConsumption();
+  initDosePrograms();
+  initJournal();
+}
+
+// Reset da placa: saídas desligadas, fila e dose ativa perdidas da RAM;
+// depois o mesmo boot
+inline void reset()
+{
+  pumpBank.begin();
+  pumpActive = false;
+  pumpHead = 0;
+  pumpTail = 0;
+
+  loadBombasConfig();
+  initLogStorage();
+  initOutbox();
+  initHub();
+  loadConsumption();
+  initDosePrograms();
+  initJournal();
+}
+
+// Uma volta do loop() e o relógio adiante
+inline void step(uint32_t ms = TICK_MS)
+{
+  checkSchedules();
+  processPumpQueue();
+  serviceOutbox();
+  serviceHub();
+  serviceLocalLogs();
+  serviceConfig();
+  hal::native::advanceUs(static_cast<int64_t>(ms) * 1000);
+}
+
+// Bordas do banco de bombas, como o executor observa: a de subida é o início
+// da dose e a de descida o fim (activeJob ainda tem o volume)
+struct BankEdges
+{
+  uint32_t lastMask = 0;
+  uint32_t started = 0;
+  uint32_t finished = 0;
+  uint32_t startedMask = 0;  // bombas que ligaram no último observe()
+  uint32_t finishedMask = 0; // bombas que desligaram no último observe()
+
+  void observe()
+  {
+    uint32_t mask = pumpBank.onMask();
+    startedMask = mask & ~lastMask;
+    finishedMask = lastMask & ~mask;
+    for (int i = 0; i < BOMBA_COUNT; i++)
+    {
+      if (startedMask & (1UL << i)) started++;
+      if (finishedMask & (1UL << i)) finished++;
+    }
+    lastMask = mask;
+  }
+};
+
+inline void runSeconds(uint32_t seconds)
+{
+  for (uint32_t i = 0; i < seconds * 1000 / TICK_MS; i++)
+    step();
+}
+
+inline void runUntilIdle(uint32_t maxSteps = 100000)
+{
+  for (uint32_t i = 0; i < maxSteps && !pumpQueueIdle(); i++)
+    step();
+}
+
+inline bool readFixture(const char *name, std::string &text)
+{
+  std::string path = std::string(TEST_FIXTURES_DIR) + "/" + name;
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file) return false;
+  char chunk[1024];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    text.append(chunk, read);
+  fclose(file);
+  return true;
+}
+
+// Mesmo caminho do POST /config em JSON, mais a gravação que o loop faria
+inline bool applyConfigFixture(const char *name)
+{
+  std::string text;
+  if (!readFixture(name, text)) return false;
+  if (applyConfigJson(text.c_str(), text.size()) != CONFIG_APPLY_OK) return false;
+  serviceConfig();
+  return true;
+}
+
+// Body de POST /program lido de test/fixtures e validado como o handler faz
+inline bool parseProgramFixture(const char *name, DoseProgram &program)
+{
+  std::string text;
+  if (!readFixture(name, text)) return false;
+  JsonDocument body;
+  if (deserializeJson(body, text)) return false;
+  return parseDoseProgram(body.as<JsonVariantConst>(), program) == PROGRAM_OK;
+}
+
+// Programa da tabela pelo id (false se já saiu dela)
+inline bool findProgram(uint16_t id, DoseProgram &out)
+{
+  for (uint8_t slot = 0; slot < PROGRAM_SLOTS; slot++)
+  {
+    if (copyDoseProgram(slot, out) && out.id == id) return true;
+  }
+  return false;
+}
+
+// Linhas do log (partição ou arquivo, mais as guardadas pelo hub) e a soma
+// do "dosagem" delas em µL; pump >= 0 conta só as linhas dessa bomba
+inline uint32_t localLogLines(int32_t &dosedUl, int pump = -1)
+{
+  dosedUl = 0;
+  uint32_t lines = 0;
+  MergedLogCursor merged;
+  mergedLogBegin(merged);
+  char line[MERGED_LINE_MAX];
+  size_t length;
+  while (mergedLogNext(merged, line, length))
+  {
+    std::string text(line, length);
+    size_t at = text.find("\"dosagem\":");
+    if (at == std::string::npos) continue;
+    size_t id = text.find("\"bombaId\":");
+    if (pump >= 0 && (id == std::string::npos || atoi(text.c_str() + id + 10) != pump + 1)) continue;
+    lines++;
+    dosedUl += static_cast<int32_t>(atof(text.c_str() + at + 10) * UL_PER_ML + 0.5);
+  }
+  return lines;
+}
+} // namespace native_test
@@ -0,0 +1,132 @@
+// Config pelo esquema (config_schema.cpp) em MessagePack: o que
+// buildConfigMsgPack() escreve volta igual por parseConfigMsgPack(), o body
+// de outro codificador (serializeMsgPack) vale o mesmo que o JSON e body
+// truncado ou fora da faixa é recusado sem mudar nada.
+
+#include <unity.h>
+
+#include "../native_test.h"
+
+#include <string>
+
+namespace
+{
+std::string configJson()
+{
+  char buffer[CONFIG_JSON_MAX];
+  size_t length = buildConfigJson(buffer, sizeof(buffer));
+  TEST_ASSERT_GREATER_THAN_INT32(0, static_cast<int32_t>(length));
+  return std::string(buffer, length);
+}
+
+std::string configPack()
+{
+  char buffer[CONFIG_JSON_MAX];
+  size_t length = buildConfigMsgPack(buffer, sizeof(buffer));
+  TEST_ASSERT_GREATER_THAN_INT32(0, static_cast<int32_t>(length));
+  return std::string(buffer, length);
+}
+
+void applyPack(const std::string &pack, ConfigApply expected)
+{
+  TEST_ASSERT_EQUAL_INT(expected, applyConfigMsgPack(pack.data(), pack.size()));
+  serviceConfig();
+}
+
+void beginWithFixture()
+{
+  native_test::freshStorage();
+  native_test::boot();
+  TEST_ASSERT_TRUE(native_test::applyConfigFixture("config.json"));
+}
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+// Escrita e leitura pelo esquema: a config volta igual
+void test_msgpack_round_trip_keeps_config()
+{
+  beginWithFixture();
+  std::string before = configJson();
+  std::string pack = configPack();
+  TEST_ASSERT_TRUE(pack.size() < before.size());
+
+  initDefaultBombasConfig();
+  serviceConfig();
+  TEST_ASSERT_FALSE(before == configJson());
+  applyPack(pack, CONFIG_APPLY_OK);
+  TEST_ASSERT_EQUAL_STRING(before.c_str(), configJson().c_str());
+}
+
+// O mesmo documento pelo ArduinoJson nos dois sentidos: o MessagePack
+// escrito pelo esquema é lido por ele, e o dele pelo esquema
+void test_msgpack_matches_arduinojson()
+{
+  beginWithFixture();
+  std::string before = configJson();
+
+  JsonDocument doc;
+  std::string pack = configPack();
+  TEST_ASSERT_FALSE(deserializeMsgPack(doc, pack.data(), pack.size()));
+  std::string json;
+  serializeJson(doc, json);
+  initDefaultBombasConfig();
+  serviceConfig();
+  TEST_ASSERT_EQUAL_INT(CONFIG_APPLY_OK, applyConfigJson(json.c_str(), json.size()));
+  serviceConfig();
+  TEST_ASSERT_EQUAL_STRING(before.c_str(), configJson().c_str());
+
+  doc.clear();
+  TEST_ASSERT_FALSE(deserializeJson(doc, before));
+  std::string foreign;
+  serializeMsgPack(doc, foreign);
+  initDefaultBombasConfig();
+  serviceConfig();
+  applyPack(foreign, CONFIG_APPLY_OK);
+  TEST_ASSERT_EQUAL_STRING(before.c_str(), configJson().c_str());
+}
+
+// Body cortado em qualquer ponto é recusado e a config fica como estava
+void test_truncated_msgpack_is_refused()
+{
+  beginWithFixture();
+  std::string before = configJson();
+  std::string pack = configPack();
+  for (size_t length = 0; length < pack.size(); length++)
+    applyPack(pack.substr(0, length), CONFIG_APPLY_INVALID);
+  TEST_ASSERT_EQUAL_STRING(before.c_str(), configJson().c_str());
+}
+
+// Faixa e tipo conferidos como no JSON; float vira ponto fixo arredondado
+void test_msgpack_ranges_and_types()
+{
+  beginWithFixture();
+  std::string before = configJson();
+
+  // {"bomb1":{"calibrCoef":1000}}: acima de 100
+  applyPack(std::string("\x81\xA5" "bomb1" "\x81\xAA" "calibrCoef" "\xCD\x03\xE8", 22), CONFIG_APPLY_INVALID);
+  // {"bomb1":{"name":5}}
+  applyPack(std::string("\x81\xA5" "bomb1" "\x81\xA4" "name" "\x05", 14), CONFIG_APPLY_INVALID);
+  // {"bomb1":{"quantidadeEstoque":-1}}
+  applyPack(std::string("\x81\xA5" "bomb1" "\x81\xB1" "quantidadeEstoque" "\xFF", 27), CONFIG_APPLY_INVALID);
+  TEST_ASSERT_EQUAL_STRING(before.c_str(), configJson().c_str());
+
+  // {"bomb2":{"quantidadeEstoque":12.3456 (float64),"extra":[1,{}]}}
+  std::string pack("\x81\xA5" "bomb2" "\x82\xB1" "quantidadeEstoque" "\xCB\x40\x28\xB0\xF2\x7B\xB2\xFE\xC5"
+                   "\xA5" "extra" "\x92\x01\x80",
+                   44);
+  applyPack(pack, CONFIG_APPLY_OK);
+  TEST_ASSERT_EQUAL_INT32(12346, bombas[1].estoqueUl);
+  TEST_ASSERT_EQUAL_INT32(CALIBR_PPM_ONE, bombas[1].calibrPpm);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_msgpack_round_trip_keeps_config);
+  RUN_TEST(test_msgpack_matches_arduinojson);
+  RUN_TEST(test_truncated_msgpack_is_refused);
+  RUN_TEST(test_msgpack_ranges_and_types);
+  return UNITY_END();
+}
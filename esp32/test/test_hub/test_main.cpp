@@ -0,0 +1,205 @@
+// Hub (hub.cpp): puxa o log de outro controlador por GET /logs?afterSeq=,
+// guarda cada linha uma vez com o device na frente, conta as lacunas de
+// seq e, depois de um reset, segue do cursor gravado na NVS. O controlador
+// puxado é um servidor HTTP mínimo numa thread, servindo
+// test/fixtures/peer_logs.jsonl (o httpGet() da HAL nativa é TCP de verdade).
+
+#include <unity.h>
+
+#include "../native_test.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+const char *const PEER_DEVICE = "doser-b";
+
+struct PeerServer
+{
+  int fd = -1;
+  uint16_t port = 0;
+  std::thread thread;
+  std::mutex mutex;
+  std::vector<std::string> lines;
+  std::atomic<uint32_t> served{0};
+
+  bool begin()
+  {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t size = sizeof(address);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, 4) != 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr *>(&address), &size) != 0)
+      return false;
+    port = ntohs(address.sin_port);
+    thread = std::thread([this]() {
+      int client;
+      while ((client = accept(fd, nullptr, nullptr)) >= 0)
+      {
+        answer(client);
+        close(client);
+      }
+    });
+    return true;
+  }
+
+  void end()
+  {
+    shutdown(fd, SHUT_RDWR);
+    if (thread.joinable()) thread.join();
+    close(fd);
+  }
+
+  void add(const std::string &line)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    lines.push_back(line);
+  }
+
+  // Cabeçalho com o último seq e as linhas depois de afterSeq, como buildLogPage()
+  void answer(int client)
+  {
+    std::string request;
+    char chunk[512];
+    ssize_t received;
+    while (request.find("\r\n\r\n") == std::string::npos && (received = recv(client, chunk, sizeof(chunk), 0)) > 0)
+      request.append(chunk, received);
+
+    unsigned long afterSeq = 0;
+    sscanf(request.c_str(), "GET /logs?afterSeq=%lu", &afterSeq);
+    std::string page;
+    uint32_t lastSeq = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (const std::string &line : lines)
+      {
+        uint32_t seq = logLineSeq(line.c_str(), line.size());
+        lastSeq = seq;
+        if (seq > afterSeq) page += line + "\n";
+      }
+    }
+    char header[256];
+    int bodyHeader = snprintf(header, sizeof(header), "{\"device\":\"%s\",\"seq\":%u,\"bombas\":[]}\n", PEER_DEVICE,
+                              static_cast<unsigned int>(lastSeq));
+    page.insert(0, header, bodyHeader);
+
+    std::ostringstream response;
+    response << "HTTP/1.0 200 OK\r\nContent-Type: application/x-ndjson\r\nContent-Length: " << page.size()
+             << "\r\nConnection: close\r\n\r\n"
+             << page;
+    std::string bytes = response.str();
+    send(client, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+    served++;
+  }
+};
+
+PeerServer peer;
+std::string peerUrl;
+
+// Puxa até o cursor alcançar o último seq do controlador (ou desistir)
+bool pullUntilCaughtUp()
+{
+  for (int round = 0; round < 20; round++)
+  {
+    pullHubNow();
+    serviceHub(); // GET (no host, hubFetch() roda na hora)
+    serviceHub(); // grava a página
+    HubPeer state;
+    if (copyHubPeer(0, state) && state.lastStatus == 200 && state.lastSeq >= state.remoteSeq && state.remoteSeq > 0)
+      return true;
+  }
+  return false;
+}
+
+// Linhas guardadas do controlador puxado na visão agregada
+uint32_t storedPeerLines()
+{
+  uint32_t count = 0;
+  MergedLogCursor cursor;
+  mergedLogBegin(cursor);
+  char line[MERGED_LINE_MAX];
+  size_t length;
+  std::string prefix = std::string("{\"device\":\"") + PEER_DEVICE + "\",";
+  while (mergedLogNext(cursor, line, length))
+  {
+    if (length > prefix.size() && std::string(line, prefix.size()) == prefix) count++;
+  }
+  return count;
+}
+} // namespace
+
+void setUp()
+{
+  native_test::freshStorage();
+  native_test::boot();
+  std::string text;
+  TEST_ASSERT_TRUE(native_test::readFixture("peer_logs.jsonl", text));
+  std::istringstream input(text);
+  std::string line;
+  while (std::getline(input, line))
+  {
+    if (!line.empty()) peer.add(line);
+  }
+  TEST_ASSERT_TRUE(peer.begin());
+  peerUrl = "http://127.0.0.1:" + std::to_string(peer.port);
+  const char *urls[] = {peerUrl.c_str()};
+  TEST_ASSERT_TRUE(setHubPeers(urls, 1));
+}
+
+void tearDown()
+{
+  peer.end();
+  peer.lines.clear();
+}
+
+void test_hub_stores_each_peer_line_once()
+{
+  TEST_ASSERT_TRUE(pullUntilCaughtUp());
+  HubPeer state;
+  TEST_ASSERT_TRUE(copyHubPeer(0, state));
+  TEST_ASSERT_EQUAL_STRING(PEER_DEVICE, state.device.c_str());
+  TEST_ASSERT_EQUAL_UINT32(7, state.lastSeq);
+  TEST_ASSERT_EQUAL_UINT32(5, hubStats.merged);
+  TEST_ASSERT_EQUAL_UINT32(5, storedPeerLines());
+  // seq 4 e 5 não existem no controlador
+  TEST_ASSERT_EQUAL_UINT32(2, state.gaps);
+
+  // Nada novo: outra volta não repete linha
+  TEST_ASSERT_TRUE(pullUntilCaughtUp());
+  TEST_ASSERT_EQUAL_UINT32(5, hubStats.merged);
+  TEST_ASSERT_EQUAL_UINT32(5, storedPeerLines());
+}
+
+void test_hub_resumes_from_saved_cursor_after_reset()
+{
+  TEST_ASSERT_TRUE(pullUntilCaughtUp());
+  native_test::reset();
+  TEST_ASSERT_EQUAL_UINT32(1, hubPeerCount());
+  TEST_ASSERT_EQUAL_UINT32(5, hubStats.stored);
+
+  peer.add("{\"seq\":8,\"bombaId\":2,\"timestamp\":\"01/01/2024 13:00:00\",\"bomba\":\"Mg\",\"dosagem\":1,"
+           "\"origem\":\"Manual\"}");
+  TEST_ASSERT_TRUE(pullUntilCaughtUp());
+  HubPeer state;
+  TEST_ASSERT_TRUE(copyHubPeer(0, state));
+  TEST_ASSERT_EQUAL_UINT32(8, state.lastSeq);
+  TEST_ASSERT_EQUAL_UINT32(1, hubStats.merged);
+  TEST_ASSERT_EQUAL_UINT32(6, storedPeerLines());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_hub_stores_each_peer_line_once);
+  RUN_TEST(test_hub_resumes_from_saved_cursor_after_reset);
+  return UNITY_END();
+}
@@ -0,0 +1,83 @@
+// Diário de doses (journal.cpp) contra queda de energia no fim da dose: a
+// energia cai depois de cada uma das gravações de finishPumpJob() e, depois
+// do reset, a dose tem de estar no estoque e no log exatamente uma vez.
+
+#include <unity.h>
+
+#include "../native_test.h"
+
+namespace
+{
+const int PUMP = 0;
+const int32_t DOSE_UL = 5 * UL_PER_ML;
+
+int32_t stockAtStart = 0;
+
+// Dose manual até o último passo com a bomba ligada; devolve as gravações até ali
+uint32_t runDoseUntilFinish(size_t partitionKb)
+{
+  native_test::freshStorage(partitionKb);
+  native_test::boot();
+  TEST_ASSERT_TRUE(native_test::applyConfigFixture("config.json"));
+  stockAtStart = bombas[PUMP].estoqueUl;
+
+  TEST_ASSERT_TRUE(enqueuePumpJob(PUMP, DOSE_UL, "Manual"));
+  native_test::step();
+  TEST_ASSERT_TRUE(pumpActive);
+  while (hal::uptimeUs() + static_cast<int64_t>(native_test::TICK_MS) * 1000 < pumpStartUs + pumpDurationUs)
+    native_test::step();
+  return hal::native::persistentWrites();
+}
+
+void checkCutAtEveryWrite(size_t partitionKb)
+{
+  // Sem queda: quantas gravações o fim da dose faz
+  uint32_t base = runDoseUntilFinish(partitionKb);
+  native_test::runUntilIdle();
+  uint32_t total = hal::native::persistentWrites() - base;
+  TEST_ASSERT_GREATER_THAN_INT32(0, static_cast<int32_t>(total));
+
+  for (uint32_t cut = 0; cut <= total; cut++)
+  {
+    base = runDoseUntilFinish(partitionKb);
+    hal::native::setPowerCutAfter(static_cast<int32_t>(base + cut));
+    native_test::runUntilIdle();
+    hal::native::setPowerCutAfter(-1);
+    native_test::reset();
+    native_test::runUntilIdle();
+
+    char message[96];
+    snprintf(message, sizeof(message), "queda depois de %u de %u gravacoes", static_cast<unsigned int>(cut),
+             static_cast<unsigned int>(total));
+    int32_t loggedUl = 0;
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, native_test::localLogLines(loggedUl), message);
+    TEST_ASSERT_GREATER_THAN_INT32(0, loggedUl);
+    TEST_ASSERT_EQUAL_INT32_MESSAGE(stockAtStart - loggedUl, bombas[PUMP].estoqueUl, message);
+
+    // O estoque gravado é o mesmo da RAM
+    loadBombasConfig();
+    TEST_ASSERT_EQUAL_INT32_MESSAGE(stockAtStart - loggedUl, bombas[PUMP].estoqueUl, message);
+  }
+}
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_power_cut_at_dose_end_with_log_partition()
+{
+  checkCutAtEveryWrite(128);
+}
+
+void test_power_cut_at_dose_end_with_littlefs_log()
+{
+  checkCutAtEveryWrite(0);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_power_cut_at_dose_end_with_log_partition);
+  RUN_TEST(test_power_cut_at_dose_end_with_littlefs_log);
+  return UNITY_END();
+}
@@ -0,0 +1,126 @@
+// Programas de dose (programs.cpp): os passos rodam na ordem, um por vez,
+// com as esperas entre os lotes, e o cancelamento corta a dose ativa e
+// descarta o resto.
+
+#include <unity.h>
+
+#include "../native_test.h"
+
+#include <vector>
+
+namespace
+{
+struct StepRun
+{
+  int pump;
+  int64_t startUs;
+  int64_t endUs;
+};
+
+std::vector<StepRun> runs;
+native_test::BankEdges edges;
+
+void stepObserved()
+{
+  native_test::step();
+  edges.observe();
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    if (edges.startedMask & (1UL << i)) runs.push_back({i, hal::uptimeUs(), -1});
+    if (edges.finishedMask & (1UL << i)) runs.back().endUs = hal::uptimeUs();
+  }
+}
+
+uint16_t submitFixture(const char *name)
+{
+  DoseProgram program;
+  TEST_ASSERT_TRUE(native_test::parseProgramFixture(name, program));
+  int detail = 0;
+  TEST_ASSERT_EQUAL_INT(PROGRAM_OK, submitDoseProgram(program, detail));
+  TEST_ASSERT_GREATER_THAN_INT32(0, program.id);
+  return program.id;
+}
+} // namespace
+
+void setUp()
+{
+  runs.clear();
+  edges = native_test::BankEdges();
+  native_test::freshStorage();
+  native_test::boot();
+  TEST_ASSERT_TRUE(native_test::applyConfigFixture("config.json"));
+}
+
+void tearDown() {}
+
+// Bomba 1, espera 300 s, bombas 2 e 3 em seguida, espera 60 s, bomba 1
+void test_program_runs_steps_in_order_with_delays()
+{
+  int32_t stockBefore[BOMBA_COUNT];
+  for (int i = 0; i < BOMBA_COUNT; i++)
+    stockBefore[i] = bombas[i].estoqueUl;
+
+  uint16_t id = submitFixture("program.json");
+  DoseProgram program;
+  for (int i = 0; i < 3600 && native_test::findProgram(id, program) && program.state != PROGRAM_DONE; i++)
+    stepObserved();
+
+  TEST_ASSERT_EQUAL_INT(PROGRAM_DONE, program.state);
+  TEST_ASSERT_EQUAL_UINT32(4, runs.size());
+  const int order[] = {0, 1, 2, 0};
+  for (int i = 0; i < 4; i++)
+  {
+    TEST_ASSERT_EQUAL_INT(order[i], runs[i].pump);
+    TEST_ASSERT_TRUE(runs[i].endUs >= runs[i].startUs);
+  }
+  TEST_ASSERT_TRUE(runs[1].startUs - runs[0].endUs >= 300 * 1000000LL);
+  // Grupo parallel: o segundo passo liga no tick em que o primeiro desliga
+  TEST_ASSERT_TRUE(runs[2].startUs - runs[1].endUs <= native_test::TICK_MS * 1000LL);
+  TEST_ASSERT_TRUE(runs[3].startUs - runs[2].endUs >= 60 * 1000000LL);
+
+  TEST_ASSERT_EQUAL_INT32(11500, program.plannedUl);
+  TEST_ASSERT_EQUAL_INT32(program.plannedUl, program.dosedUl);
+  TEST_ASSERT_EQUAL_INT32(stockBefore[0] - 6 * UL_PER_ML, bombas[0].estoqueUl);
+  TEST_ASSERT_EQUAL_INT32(stockBefore[1] - 3 * UL_PER_ML, bombas[1].estoqueUl);
+  TEST_ASSERT_EQUAL_INT32(stockBefore[2] - 2500, bombas[2].estoqueUl);
+}
+
+// Cancelado com o primeiro passo no meio: bomba desliga, o resto nunca roda
+// e só o volume cortado sai do estoque e vai para o log
+void test_cancel_cuts_active_step_and_drops_the_rest()
+{
+  int32_t stockBefore = bombas[0].estoqueUl;
+  uint16_t id = submitFixture("program.json");
+  for (int i = 0; i < 60 && runs.empty(); i++)
+    stepObserved();
+  TEST_ASSERT_EQUAL_UINT32(1, runs.size());
+  stepObserved();
+  TEST_ASSERT_TRUE(pumpActive);
+
+  TEST_ASSERT_EQUAL_INT(PROGRAM_OK, cancelDoseProgram(id));
+  for (int i = 0; i < 600; i++)
+    stepObserved();
+
+  DoseProgram program;
+  TEST_ASSERT_TRUE(native_test::findProgram(id, program));
+  TEST_ASSERT_EQUAL_INT(PROGRAM_CANCELLED, program.state);
+  TEST_ASSERT_TRUE(pumpQueueIdle());
+  TEST_ASSERT_EQUAL_UINT32(1, runs.size());
+  TEST_ASSERT_TRUE(runs[0].endUs >= 0);
+
+  int32_t loggedUl = 0;
+  TEST_ASSERT_EQUAL_UINT32(1, native_test::localLogLines(loggedUl));
+  TEST_ASSERT_GREATER_THAN_INT32(0, loggedUl);
+  TEST_ASSERT_TRUE(loggedUl < 5 * UL_PER_ML);
+  TEST_ASSERT_EQUAL_INT32(stockBefore - loggedUl, bombas[0].estoqueUl);
+  TEST_ASSERT_EQUAL_INT32(loggedUl, program.dosedUl);
+  TEST_ASSERT_EQUAL_INT(PROGRAM_FINISHED, cancelDoseProgram(id));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_program_runs_steps_in_order_with_delays);
+  RUN_TEST(test_cancel_cuts_active_step_and_drops_the_rest);
+  return UNITY_END();
+}
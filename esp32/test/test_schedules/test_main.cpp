@@ -0,0 +1,84 @@
+// Agenda (scheduler.cpp): cada agendamento que vence vira dose na fila em
+// até SCHEDULE_WAIT_MAX_S, também com um programa de espera longa pendente.
+
+#include <unity.h>
+
+#include "../native_test.h"
+#include "native_checks.h"
+
+namespace
+{
+const uint32_t SECONDS_PER_DAY = 86400;
+
+ScheduleCheck scheduleCheck;
+
+// Dias de agenda; program != nullptr é enviado à meia-noite de cada dia
+void simulateDays(uint32_t days, const DoseProgram *program, uint32_t &programsSubmitted)
+{
+  native_test::BankEdges edges;
+  programsSubmitted = 0;
+  for (uint32_t second = 0; second < days * SECONDS_PER_DAY; second++)
+  {
+    if (program && second % SECONDS_PER_DAY == 0)
+    {
+      DoseProgram submitted = *program;
+      int detail = 0;
+      if (submitDoseProgram(submitted, detail) == PROGRAM_OK) programsSubmitted++;
+    }
+
+    scheduleCheck.onTick(clockNow());
+    checkSchedules();
+    processPumpQueue();
+    serviceConfig();
+    edges.observe();
+    if (edges.startedMask) scheduleCheck.onDoseStarted();
+    hal::native::advanceUs(1000000);
+  }
+}
+} // namespace
+
+void setUp()
+{
+  scheduleCheck = ScheduleCheck();
+  native_test::freshStorage();
+  native_test::boot();
+  TEST_ASSERT_TRUE(native_test::applyConfigFixture("config.json"));
+}
+
+void tearDown() {}
+
+// Três bombas às 08:00 todos os dias: uma semana, 21 doses
+void test_every_due_schedule_becomes_a_dose()
+{
+  uint32_t submitted = 0;
+  simulateDays(7, nullptr, submitted);
+
+  TEST_ASSERT_EQUAL_UINT32(21, scheduleCheck.due);
+  TEST_ASSERT_EQUAL_UINT32(21, scheduleCheck.started);
+  TEST_ASSERT_EQUAL_UINT32(0, scheduleCheck.late);
+  TEST_ASSERT_TRUE(scheduleCheck.ok());
+}
+
+// O segundo passo do programa espera 10 h (de 00:00 até depois das 08:00):
+// a espera fica na tabela de programas e a agenda não fica atrás dela
+void test_long_program_delay_does_not_hold_schedules()
+{
+  DoseProgram program;
+  TEST_ASSERT_TRUE(native_test::parseProgramFixture("program_long.json", program));
+  uint32_t submitted = 0;
+  simulateDays(3, &program, submitted);
+
+  TEST_ASSERT_EQUAL_UINT32(3, submitted);
+  TEST_ASSERT_EQUAL_UINT32(9, scheduleCheck.due);
+  TEST_ASSERT_EQUAL_UINT32(0, scheduleCheck.late);
+  TEST_ASSERT_TRUE(scheduleCheck.ok());
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(60, scheduleCheck.maxWaitS);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_every_due_schedule_becomes_a_dose);
+  RUN_TEST(test_long_program_delay_does_not_hold_schedules);
+  return UNITY_END();
+}
@@ -0,0 +1,64 @@
+// Fragmentação do heap (src/api + núcleo): três dias de doses com um app
+// aberto passando pelos handlers a cada hora, no heap modelado de 160 KB.
+// O maior bloco livre, o total livre e o pico de cada dia ficam no valor
+// do primeiro dia (SoakCheck em native/include/native_checks.h).
+
+#include <unity.h>
+
+#include "../native_test.h"
+#include "native_checks.h"
+
+namespace
+{
+const uint32_t DAYS = 3;
+const uint32_t HEAP_KB = 160;
+
+SoakCheck soakCheck;
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+void test_heap_holds_across_days_of_requests()
+{
+  native_test::freshStorage();
+  hal::native::heapModelBegin(HEAP_KB * 1024);
+  native_test::boot();
+  TEST_ASSERT_TRUE(native_test::applyConfigFixture("config.json"));
+
+  const uint32_t secondsPerDay = 86400;
+  int manualPump = 0;
+  for (uint32_t second = 0; second < DAYS * secondsPerDay; second++)
+  {
+    // O new/delete da simulação vai para o heap modelado
+    hal::native::HeapScope heapScope;
+    if (second > 0 && second % secondsPerDay == 0) soakCheck.sampleDay();
+    if (second % 3600 == 1800) soakCheck.hour();
+    if (second % 1800 == 0)
+    {
+      enqueuePumpJob(manualPump, 1 * UL_PER_ML, "Manual");
+      manualPump = (manualPump + 1) % BOMBA_COUNT;
+    }
+    native_test::step();
+  }
+  {
+    hal::native::HeapScope heapScope;
+    native_test::runUntilIdle();
+    soakCheck.sampleDay();
+    soakCheck.held.reset();
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(DAYS, soakCheck.days);
+  TEST_ASSERT_EQUAL_UINT32(DAYS * 24 * 6, soakCheck.requests);
+  TEST_ASSERT_EQUAL_UINT32(0, soakCheck.errors);
+  TEST_ASSERT_EQUAL_UINT32(0, hal::native::heapModelFailures());
+  TEST_ASSERT_EQUAL_UINT32(0, soakCheck.shrinks);
+  TEST_ASSERT_TRUE(soakCheck.ok());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_heap_holds_across_days_of_requests);
+  return UNITY_END();
+}
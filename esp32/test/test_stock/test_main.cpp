@@ -0,0 +1,146 @@
+// Estoque em µL (config.cpp, pump_queue.cpp): cada dose concluída sai do
+// estoque exatamente pelo volume pedido, a config relida da NVS devolve o
+// mesmo valor e, com resets no meio das doses, o estoque fecha com o log.
+
+#include <unity.h>
+
+#include "../native_test.h"
+#include "native_checks.h"
+
+namespace
+{
+const uint32_t DAYS = 30;
+const uint32_t SECONDS_PER_DAY = 86400;
+
+StockCheck stockCheck;
+int32_t stockBefore[BOMBA_COUNT];
+uint32_t partialDoses = 0;
+
+void beginWithFixture(size_t partitionKb = 128)
+{
+  native_test::freshStorage(partitionKb);
+  native_test::boot();
+  TEST_ASSERT_TRUE(native_test::applyConfigFixture("config.json"));
+  for (int i = 0; i < BOMBA_COUNT; i++)
+    stockBefore[i] = bombas[i].estoqueUl;
+  stockCheck.begin();
+  partialDoses = 0;
+}
+
+// Dias com doses programadas e uma manual por hora; resetEvery > 0 corta
+// a energia no meio de cada N-ésima dose
+void simulateDays(uint32_t days, uint32_t resetEvery)
+{
+  native_test::BankEdges edges;
+  int64_t resetAtUs = -1;
+  int manualPump = 0;
+  for (uint32_t second = 0; second < days * SECONDS_PER_DAY; second++)
+  {
+    // Virada do dia: boot relendo a config gravada (JSON na NVS)
+    if (second > 0 && second % SECONDS_PER_DAY == 0 && pumpQueueIdle())
+    {
+      loadBombasConfig();
+      stockCheck.verify("recarga da config");
+    }
+    if (second % 3600 == 1800)
+    {
+      enqueuePumpJob(manualPump, 1 * UL_PER_ML, "Manual");
+      manualPump = (manualPump + 1) % BOMBA_COUNT;
+    }
+
+    checkSchedules();
+    processPumpQueue();
+    serviceConfig();
+    edges.observe();
+    for (int i = 0; i < BOMBA_COUNT; i++)
+    {
+      if ((edges.startedMask & (1UL << i)) && resetEvery > 0 && edges.started % resetEvery == 0)
+        resetAtUs = pumpStartUs + pumpDurationUs / 2;
+      if (edges.finishedMask & (1UL << i)) stockCheck.onDoseFinished(i, activeJob.dosagemUl);
+    }
+
+    if (resetAtUs >= 0 && hal::uptimeUs() >= resetAtUs)
+    {
+      resetAtUs = -1;
+      native_test::reset();
+      edges.lastMask = pumpBank.onMask();
+      // A dose cortada entra no estoque esperado pelo volume que o diário
+      // estimou; a de 1 ml pode ter acabado antes do tick do reset
+      if (journalStats.partialDose)
+      {
+        partialDoses++;
+        stockCheck.onDoseFinished(activeJob.bombaIndex, journalStats.recoveredUl);
+      }
+    }
+    hal::native::advanceUs(1000000);
+  }
+  native_test::runUntilIdle();
+}
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+// Sem resets: 30 dias de 20/15/10 ml por dia mais as manuais, sem deriva
+void test_month_of_doses_debits_exact_microliters()
+{
+  beginWithFixture();
+  simulateDays(DAYS, 0);
+  stockCheck.verify("fim");
+
+  TEST_ASSERT_EQUAL_UINT32(0, stockCheck.mismatches);
+  TEST_ASSERT_EQUAL_UINT32(DAYS * 3 + DAYS * 24, stockCheck.doses);
+  // Manuais: 24 por dia em rodízio, 1 ml cada
+  const int32_t scheduledUl[BOMBA_COUNT] = {20 * UL_PER_ML, 15 * UL_PER_ML, 10 * UL_PER_ML, 0};
+  const int32_t manualUl = static_cast<int32_t>(DAYS * 24 / BOMBA_COUNT) * UL_PER_ML;
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    int32_t dosedUl = static_cast<int32_t>(DAYS) * scheduledUl[i] + manualUl;
+    TEST_ASSERT_EQUAL_INT32(dosedUl, stockCheck.dosedUl[i]);
+    TEST_ASSERT_EQUAL_INT32(stockBefore[i] - dosedUl, bombas[i].estoqueUl);
+  }
+}
+
+// Reset no meio de cada terceira dose: o débito parcial reconciliado pelo
+// diário bate com o esperado e com o volume que foi para o log
+void test_resets_mid_dose_keep_stock_and_log_in_step()
+{
+  beginWithFixture();
+  simulateDays(5, 3);
+  stockCheck.verify("fim");
+
+  TEST_ASSERT_EQUAL_UINT32(0, stockCheck.mismatches);
+  TEST_ASSERT_GREATER_THAN_INT32(0, partialDoses);
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    int32_t loggedUl = 0;
+    native_test::localLogLines(loggedUl, i);
+    TEST_ASSERT_EQUAL_INT32(stockBefore[i] - loggedUl, bombas[i].estoqueUl);
+  }
+}
+
+// Placa sem a partição de logs: o mesmo com os logs no LittleFS
+void test_resets_mid_dose_with_littlefs_log()
+{
+  beginWithFixture(0);
+  simulateDays(3, 2);
+  stockCheck.verify("fim");
+
+  TEST_ASSERT_EQUAL_UINT32(0, stockCheck.mismatches);
+  TEST_ASSERT_GREATER_THAN_INT32(0, partialDoses);
+  for (int i = 0; i < BOMBA_COUNT; i++)
+  {
+    int32_t loggedUl = 0;
+    native_test::localLogLines(loggedUl, i);
+    TEST_ASSERT_EQUAL_INT32(stockBefore[i] - loggedUl, bombas[i].estoqueUl);
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_month_of_doses_debits_exact_microliters);
+  RUN_TEST(test_resets_mid_dose_keep_stock_and_log_in_step);
+  RUN_TEST(test_resets_mid_dose_with_littlefs_log);
+  return UNITY_END();
+}
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""Baselines e comparação dos microbenchmarks do AquaBalancePro.
+
+Os ambientes `bench` (host) e `bench_device` (placa) imprimem uma linha
+"BENCH {json}" por benchmark. Este script:
+
+  parse    lê a captura (stdout do host ou Serial da placa) e grava um
+           JSON com os resultados, que pode virar baseline;
+  compare  compara um resultado com a baseline e falha (código 1) se
+           algum benchmark ficou mais lento que --threshold por cento.
+
+As baselines não vão para o repositório: tempo de host e de placa só vale
+na máquina em que foi medido. Grave a sua em bench/baselines/ (ignorada
+pelo git) a partir do commit de referência e compare a mudança com ela.
+
+Exemplos:
+    cd esp32
+    git stash    # ou checkout do commit de referência
+    pio run -e bench && .pio/build/bench/program | tee bench.txt
+    python3 tools/bench.py parse bench.txt -o bench/baselines/native.json
+    git stash pop
+    pio run -e bench && .pio/build/bench/program | python3 tools/bench.py parse - -o atual.json
+    python3 tools/bench.py compare bench/baselines/native.json atual.json --threshold 10
+
+    pio run -e bench_device -t upload && pio device monitor | tee serial.txt
+    python3 tools/bench.py parse serial.txt -o bench/baselines/esp32s3.json
+    python3 tools/bench.py compare bench/baselines/esp32s3.json serial.json --metric cyclesPerOp
+
+Somente biblioteca padrão do Python 3.
+"""
+
+import argparse
+import json
+import os
+import sys
+
+METRICS = ("nsPerOp", "minNsPerOp", "cyclesPerOp", "bytesPerOp")
+
+
+def parse_capture(stream):
+    env = {}
+    results = {}
+    for raw in stream:
+        # Serial pode trazer lixo antes do prefixo (boot, monitor)
+        line = raw.strip()
+        for prefix in ("BENCH_BEGIN ", "BENCH "):
+            at = line.find(prefix)
+            if at < 0:
+                continue
+            try:
+                data = json.loads(line[at + len(prefix):])
+            except ValueError:
+                print(f"linha ignorada: {line}", file=sys.stderr)
+                break
+            if prefix == "BENCH_BEGIN ":
+                env = data
+            else:
+                results[data.pop("name")] = data
+            break
+    return {"env": env, "results": results}
+
+
+def cmd_parse(args):
+    stream = sys.stdin if args.capture == "-" else open(args.capture, encoding="utf-8", errors="replace")
+    with stream:
+        data = parse_capture(stream)
+    if not data["results"]:
+        print("nenhuma linha BENCH encontrada", file=sys.stderr)
+        return 1
+
+    text = json.dumps(data, indent=2, sort_keys=True) + "\n"
+    if args.output:
+        directory = os.path.dirname(args.output)
+        if directory:
+            os.makedirs(directory, exist_ok=True)
+        with open(args.output, "w", encoding="utf-8") as out:
+            out.write(text)
+        print(f"{len(data['results'])} resultado(s) em {args.output}")
+    else:
+        sys.stdout.write(text)
+    return 0
+
+
+def load(path):
+    with open(path, encoding="utf-8") as f:
+        return json.load(f)
+
+
+def cmd_compare(args):
+    if not os.path.exists(args.baseline):
+        print(f"baseline {args.baseline} não existe: grave uma nesta máquina com "
+              f"'bench.py parse captura.txt -o {args.baseline}' a partir do commit de referência",
+              file=sys.stderr)
+        return 2
+    baseline = load(args.baseline)
+    current = load(args.current)
+    if baseline.get("env", {}).get("env") != current.get("env", {}).get("env"):
+        print("aviso: baseline e resultado vêm de ambientes diferentes", file=sys.stderr)
+
+    base_results = baseline["results"]
+    cur_results = current["results"]
+    regressions = 0
+
+    print(f"{'benchmark':<24} {'baseline':>12} {'atual':>12} {'delta':>8}")
+    for name in sorted(set(base_results) | set(cur_results)):
+        if name not in cur_results:
+            print(f"{name:<24} {'':>12} {'ausente':>12}")
+            continue
+        if name not in base_results:
+            print(f"{name:<24} {'novo':>12} {cur_results[name].get(args.metric, 0):>12.1f}")
+            continue
+
+        before = base_results[name].get(args.metric)
+        after = cur_results[name].get(args.metric)
+        if not before or after is None:
+            print(f"{name:<24} sem {args.metric}")
+            continue
+
+        delta = (after - before) / before * 100.0
+        flag = ""
+        if delta > args.threshold:
+            flag = "  REGRESSAO"
+            regressions += 1
+        elif delta < -args.threshold:
+            flag = "  melhora"
+        print(f"{name:<24} {before:>12.1f} {after:>12.1f} {delta:>+7.1f}%{flag}")
+
+    if regressions:
+        print(f"\n{regressions} regressão(ões) acima de {args.threshold:.0f}% em {args.metric}")
+        return 1
+    print(f"\nsem regressões acima de {args.threshold:.0f}% em {args.metric}")
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("parse", help="converte a captura em JSON de resultados")
+    p.add_argument("capture", help="arquivo capturado ou - para stdin")
+    p.add_argument("-o", "--output", help="arquivo de saída (padrão: stdout)")
+    p.set_defaults(func=cmd_parse)
+
+    c = sub.add_parser("compare", help="compara resultado com a baseline")
+    c.add_argument("baseline")
+    c.add_argument("current")
+    c.add_argument("--threshold", type=float, default=10.0, help="regressão máxima em %% (padrão 10)")
+    c.add_argument("--metric", choices=METRICS, default="nsPerOp",
+                   help="métrica comparada (cyclesPerOp só na placa; bytesPerOp só nas respostas da API)")
+    c.set_defaults(func=cmd_compare)
+
+    args = parser.parse_args()
+    return args.func(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
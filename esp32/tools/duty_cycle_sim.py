@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+"""Simulação do modo ocioso do AquaBalancePro (POST /power).
+
+Reproduz a política da firmware (idleUntilNextEvent/canIdle) sobre um
+conjunto de agendamentos e estima quanto tempo o dosador passa ativo
+(CPU nominal, Wi-Fi sem modem sleep, loop a cada 100 ms) e ocioso (CPU
+reduzida, modem sleep no STA, loop a cada --idle-tick ms).
+
+Fica ativo:
+  - durante cada dosagem (fila sequencial, ml * 700 ms * calibrCoef);
+  - POWER_DOSE_GUARD_MS (2 s) antes de cada horário agendado;
+  - enquanto há cliente no AP e por --ap-grace segundos depois;
+  - na ressincronização do relógio com o RTC (a cada 15 min) e no SNTP
+    (a cada 6 h, só com --sta).
+
+Exemplos:
+    python3 duty_cycle_sim.py --config config.json --days 7
+    curl -s http://192.168.4.1/config > config.json
+    python3 duty_cycle_sim.py --schedule 1:08:00:5 --schedule 2:20:30:2.5:1-5 \\
+        --ap-session 19:00+15 --battery-mah 10000
+
+Somente biblioteca padrão do Python 3.
+"""
+
+import argparse
+import json
+import sys
+
+TEMPO_POR_ML = 700          # ms por ml (main.cpp)
+ACTIVE_TICK_MS = 100        # POWER_ACTIVE_TICK_MS
+DOSE_GUARD_MS = 2000        # POWER_DOSE_GUARD_MS
+CLOCK_RESYNC_MS = 15 * 60 * 1000
+CLOCK_RESYNC_BUSY_MS = 1500  # busca da virada do segundo do RTC
+NTP_INTERVAL_MS = 6 * 3600 * 1000
+NTP_BUSY_MS = 3000
+DAY_MS = 24 * 3600 * 1000
+WEEK_DAYS = ["dom", "seg", "ter", "qua", "qui", "sex", "sab"]
+
+
+class Schedule:
+    def __init__(self, bomb, hour, minute, ml, days, coef=1.0):
+        self.bomb = bomb
+        self.hour = hour
+        self.minute = minute
+        self.ml = ml
+        self.days = days        # 7 booleanos, 0 = domingo (dayOfTheWeek do RTClib)
+        self.coef = coef
+
+
+def parse_days(text):
+    days = [False] * 7
+    for part in text.split(","):
+        first, _, last = part.partition("-")
+        last = last or first
+        for day in range(int(first), int(last) + 1):
+            days[day % 7] = True
+    return days
+
+
+def parse_schedule(text):
+    """bomba:HH:MM:ml[:dias], dias como "0-6" ou "1,3,5" (0 = domingo)."""
+    fields = text.split(":")
+    if len(fields) not in (4, 5):
+        raise argparse.ArgumentTypeError(f"agendamento invalido: {text}")
+    days = parse_days(fields[4]) if len(fields) == 5 else [True] * 7
+    return Schedule(int(fields[0]), int(fields[1]), int(fields[2]), float(fields[3]), days)
+
+
+def parse_session(text):
+    """HH:MM+minutos, todo dia."""
+    start, _, minutes = text.partition("+")
+    hour, _, minute = start.partition(":")
+    if not minutes:
+        raise argparse.ArgumentTypeError(f"sessao invalida: {text}")
+    return (int(hour) * 60 + int(minute)) * 60000, float(minutes) * 60000
+
+
+def load_config(path):
+    """Lê o JSON de GET /config."""
+    with open(path) as handle:
+        config = json.load(handle)
+
+    schedules = []
+    for key, bomb in sorted(config.items()):
+        if not key.startswith("bomb"):
+            continue
+        index = int(key[4:])
+        coef = float(bomb.get("calibrCoef", 1.0))
+        for item in bomb.get("schedules", []):
+            if not item.get("status"):
+                continue
+            days = [bool(d) for d in item.get("diasSemanaSelecionados", [False] * 7)]
+            schedules.append(Schedule(index, int(item["time"]["hour"]), int(item["time"]["minute"]),
+                                      float(item.get("dosagem", 0)), days, coef))
+    return schedules
+
+
+def merge(intervals):
+    merged = []
+    for start, end in sorted(intervals):
+        if merged and start <= merged[-1][1]:
+            merged[-1][1] = max(merged[-1][1], end)
+        else:
+            merged.append([start, end])
+    return merged
+
+
+def simulate(schedules, sessions, args):
+    horizon = args.days * DAY_MS
+    busy = []
+    doses = []
+
+    # Dia 0 = domingo, como o scheduler da firmware
+    for day in range(args.days):
+        weekday = day % 7
+        for schedule in schedules:
+            if schedule.days[weekday] and schedule.ml > 0:
+                at = day * DAY_MS + (schedule.hour * 60 + schedule.minute) * 60000
+                doses.append((at, schedule.ml * TEMPO_POR_ML * schedule.coef))
+        for start, length in sessions:
+            begin = day * DAY_MS + start
+            busy.append((begin, begin + length + args.ap_grace * 1000))
+
+    # Fila sequencial: doses no mesmo minuto esperam a bomba anterior
+    pump_ms = 0.0
+    pump_free = 0.0
+    for at, duration in sorted(doses):
+        begin = max(at, pump_free)
+        pump_free = begin + duration
+        pump_ms += duration
+        busy.append((at - DOSE_GUARD_MS, pump_free + ACTIVE_TICK_MS))
+
+    for at in range(0, horizon, CLOCK_RESYNC_MS):
+        busy.append((at, at + CLOCK_RESYNC_BUSY_MS))
+    if args.sta:
+        for at in range(0, horizon, NTP_INTERVAL_MS):
+            busy.append((at, at + NTP_BUSY_MS))
+
+    active = merge((max(0, s), min(horizon, e)) for s, e in busy if e > 0 and s < horizon)
+    active_ms = sum(e - s for s, e in active)
+    idle_ms = horizon - active_ms if args.enabled else 0
+    if not args.enabled:
+        active_ms = horizon
+
+    # Em ocioso a espera é encurtada para acordar antes do guarda da dose
+    idle_wakeups = 0
+    if args.enabled:
+        cursor = 0
+        for start, end in active + [[horizon, horizon]]:
+            gap = start - cursor
+            if gap > 0:
+                idle_wakeups += -(-gap // args.idle_tick)
+            cursor = end
+
+    active_wakeups = active_ms / ACTIVE_TICK_MS
+    avg_ma = (active_ms * args.active_ma + idle_ms * args.idle_ma + pump_ms * args.pump_ma) / horizon
+
+    return {
+        "days": args.days,
+        "doses": len(doses),
+        "pumpSec": round(pump_ms / 1000, 1),
+        "activeSec": round(active_ms / 1000, 1),
+        "idleSec": round(idle_ms / 1000, 1),
+        "dutyCyclePct": round(100.0 * active_ms / horizon, 3),
+        "loopWakeupsPerHour": round((active_wakeups + idle_wakeups) / (horizon / 3600000.0), 1),
+        "avgCurrentMa": round(avg_ma, 2),
+        "batteryHours": round(args.battery_mah / avg_ma, 1) if args.battery_mah else None,
+        "alwaysActiveMa": args.active_ma,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--config", help="JSON de GET /config (usa só agendamentos ativos)")
+    parser.add_argument("--schedule", type=parse_schedule, action="append", default=[],
+                        help="bomba:HH:MM:ml[:dias], pode repetir")
+    parser.add_argument("--ap-session", type=parse_session, action="append", default=[],
+                        help="cliente no AP todo dia: HH:MM+minutos, pode repetir")
+    parser.add_argument("--days", type=int, default=7)
+    parser.add_argument("--idle-tick", type=int, default=1000, help="idleTickMs do POST /power")
+    parser.add_argument("--ap-grace", type=int, default=60, help="apGraceSec do POST /power")
+    parser.add_argument("--sta", action="store_true", help="STA configurado (SNTP a cada 6 h)")
+    parser.add_argument("--disabled", dest="enabled", action="store_false", help="simula o modo ocioso desligado")
+    parser.add_argument("--active-ma", type=float, default=110.0, help="consumo ativo (240 MHz, Wi-Fi sem sleep)")
+    parser.add_argument("--idle-ma", type=float, default=45.0, help="consumo ocioso (80 MHz, modem sleep, AP no ar)")
+    parser.add_argument("--pump-ma", type=float, default=0.0, help="consumo extra com a bomba ligada, se na mesma fonte")
+    parser.add_argument("--battery-mah", type=float, default=0.0)
+    parser.add_argument("--json", action="store_true", help="imprime o resultado em JSON")
+    args = parser.parse_args()
+
+    schedules = list(args.schedule)
+    if args.config:
+        schedules.extend(load_config(args.config))
+    if args.days <= 0 or args.idle_tick < ACTIVE_TICK_MS:
+        parser.error("--days > 0 e --idle-tick >= 100")
+
+    result = simulate(schedules, args.ap_session, args)
+    if args.json:
+        print(json.dumps(result, indent=2))
+        return 0
+
+    print(f"{len(schedules)} agendamentos ativos, {result['doses']} doses em {args.days} dias "
+          f"({result['pumpSec']} s de bomba)")
+    for schedule in schedules:
+        days = ",".join(WEEK_DAYS[d] for d in range(7) if schedule.days[d])
+        print(f"  bomba {schedule.bomb} {schedule.hour:02d}:{schedule.minute:02d} {schedule.ml:g} ml [{days}]")
+    print(f"Ativo:  {result['activeSec']:>10} s  ({result['dutyCyclePct']}%)")
+    print(f"Ocioso: {result['idleSec']:>10} s")
+    print(f"Iteracoes do loop por hora: {result['loopWakeupsPerHour']} (sempre ativo: 36000)")
+    print(f"Consumo medio estimado: {result['avgCurrentMa']} mA (sempre ativo: {args.active_ma:g} mA)")
+    if result["batteryHours"] is not None:
+        print(f"Autonomia com {args.battery_mah:g} mAh: {result['batteryHours']} h")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+"""Simula um hub com vários dosadores, cada um num processo do executor nativo.
+
+Sobe N controladores (--serve, cada um com seu --fs e --device-id), espera
+a simulação de cada um terminar e lê o log completo deles paginando
+GET /logs?afterSeq=. Depois roda o hub (--hub-peer para cada um) e confere
+a visão agregada do GET /hub/logs: os seqs de cada controlador precisam
+ser exatamente os do próprio controlador, sem repetidos. Sai com 1 se
+algo divergir.
+
+    pio run -e native
+    python3 tools/hub_sim.py --peers 3 --days 2
+
+Somente biblioteca padrão do Python 3.
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+import urllib.request
+from collections import Counter
+
+PAGE_MAX = 20  # HUB_PAGE_MAX (dosing.h)
+
+
+def start(program, fs, device, port, args, extra):
+    os.makedirs(fs, exist_ok=True)
+    command = [program, "--fs", os.path.join(fs, "fs"), "--device-id", device, "--serve", str(port),
+               "--linger", str(args.linger), "--days", str(args.days), "--tick", "1000", "--quiet"] + extra
+    return subprocess.Popen(command, stdout=subprocess.PIPE, text=True)
+
+
+def wait_serving(process, name, timeout):
+    """Lê a saída até o executor entrar no --linger; devolve o resumo."""
+    deadline = time.time() + timeout
+    lines = []
+    while time.time() < deadline:
+        line = process.stdout.readline()
+        if not line:
+            break
+        lines.append(line.rstrip())
+        if line.startswith("Servindo na porta"):
+            return lines
+    raise SystemExit(f"[hub_sim] {name} nao chegou a servir:\n" + "\n".join(lines))
+
+
+def get(url):
+    with urllib.request.urlopen(url, timeout=10) as response:
+        return response.read().decode("utf-8")
+
+
+def read_peer(port):
+    """Log inteiro do controlador, de página em página."""
+    base = f"http://127.0.0.1:{port}"
+    after = 0
+    seqs = []
+    while True:
+        lines = get(f"{base}/logs?afterSeq={after}").splitlines()
+        header = json.loads(lines[0])
+        page = [json.loads(line)["seq"] for line in lines[1:] if line]
+        seqs.extend(page)
+        if page:
+            after = page[-1]
+        if len(page) < PAGE_MAX:
+            return header["device"], header["seq"], seqs
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--program", default=".pio/build/native/program")
+    parser.add_argument("--peers", type=int, default=2)
+    parser.add_argument("--days", type=int, default=2)
+    parser.add_argument("--manual-per-hour", type=int, default=6,
+                        help="doses manuais por hora no primeiro controlador (os outros, uma a menos cada)")
+    parser.add_argument("--base-port", type=int, default=18080)
+    parser.add_argument("--linger", type=int, default=600,
+                        help="segundos que cada processo continua servindo (encerrado antes pelo script)")
+    parser.add_argument("--work", help="diretório dos sistemas de arquivos (padrão: temporário)")
+    parser.add_argument("--timeout", type=int, default=300)
+    args = parser.parse_args()
+
+    work = args.work or tempfile.mkdtemp(prefix="hub_sim_")
+    processes = []
+    failures = 0
+    try:
+        peers = []
+        for index in range(args.peers):
+            port = args.base_port + 1 + index
+            rate = max(1, args.manual_per_hour - index)
+            process = start(args.program, os.path.join(work, f"peer{index}"), f"doser-{index}", port, args,
+                            ["--manual-per-hour", str(rate)])
+            processes.append(process)
+            peers.append(port)
+        for index, process in enumerate(processes):
+            wait_serving(process, f"doser-{index}", args.timeout)
+
+        expected = {}
+        for port in peers:
+            device, last, seqs = read_peer(port)
+            expected[device] = (last, seqs)
+            print(f"[hub_sim] {device}: {len(seqs)} linhas, ultimo seq {last}")
+
+        extra = ["--manual-per-hour", str(args.manual_per_hour)]
+        for port in peers:
+            extra += ["--hub-peer", f"http://127.0.0.1:{port}"]
+        hub = start(args.program, os.path.join(work, "hub"), "hub", args.base_port, args, extra)
+        processes.append(hub)
+        summary = wait_serving(hub, "hub", args.timeout)
+        for line in summary:
+            if line.startswith("Hub:") or line.startswith("  http://"):
+                print(f"[hub_sim] {line.strip()}")
+
+        merged = json.loads(get(f"http://127.0.0.1:{args.base_port}/hub/logs"))
+        pairs = Counter((entry.get("device"), entry.get("seq")) for entry in merged)
+        repeated = [pair for pair, count in pairs.items() if count > 1]
+        if repeated:
+            failures += 1
+            print(f"[hub_sim] ERRO: {len(repeated)} pares (device, seq) repetidos, ex.: {repeated[:3]}")
+
+        own = sum(1 for device, _ in pairs if device == "hub")
+        print(f"[hub_sim] hub: {len(merged)} linhas na visao agregada ({own} proprias)")
+        for device, (last, seqs) in sorted(expected.items()):
+            got = sorted(seq for dev, seq in pairs if dev == device)
+            if got != sorted(seqs):
+                failures += 1
+                missing = sorted(set(seqs) - set(got))
+                extra_seqs = sorted(set(got) - set(seqs))
+                print(f"[hub_sim] ERRO: {device}: {len(missing)} faltando, {len(extra_seqs)} a mais "
+                      f"(ex.: {missing[:3]} {extra_seqs[:3]})")
+            else:
+                print(f"[hub_sim] {device}: ok, {len(got)} linhas ate o seq {last}")
+    finally:
+        for process in processes:
+            process.terminate()
+            process.wait()
+
+    print("[hub_sim] OK" if failures == 0 else f"[hub_sim] {failures} divergencia(s)")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+"""Gerador de carga para a API HTTP do AquaBalancePro.
+
+Dispara uma mistura de requisições com N clientes concorrentes e mede
+vazão e latência (p50/p99/p999) por endpoint. No final lê o objeto
+"http" de GET /status para reportar o menor heap livre visto pelo
+firmware em cada rota e os contadores do controle de admissão.
+
+Contra o servidor nativo (native/server_native.cpp, ambiente
+`native_server`) os mesmos handlers rodam no Linux e cada rota informa
+"heapPeak": o maior pico de heap de uma requisição, em bytes.
+
+Exemplos:
+    python3 loadgen.py --host 192.168.4.1 --concurrency 4 --duration 30
+    python3 loadgen.py --host 127.0.0.1 --port 8080 --allow-dose \
+        --mix status=40,config=20,logs=20,postconfig=10,dose=10
+    python3 loadgen.py --mix status=70,config=20,logs=10 --json baseline.json
+
+Somente biblioteca padrão do Python 3.
+"""
+
+import argparse
+import http.client
+import json
+import random
+import sys
+import threading
+import time
+
+# nome -> (método, caminho, rota no /status do firmware)
+ENDPOINTS = {
+    "status": ("GET", "/status", "GET /status"),
+    "config": ("GET", "/config", "GET /config"),
+    "postconfig": ("POST", "/config", "POST /config"),
+    "logs": ("GET", "/logs", "GET /logs"),
+    "dose": ("POST", "/dose", "POST /dose"),
+}
+
+DEFAULT_MIX = "status=60,config=20,logs=15,postconfig=5"
+
+
+def parse_mix(text):
+    mix = []
+    for part in text.split(","):
+        name, _, weight = part.partition("=")
+        name = name.strip()
+        if name not in ENDPOINTS:
+            raise SystemExit(f"endpoint desconhecido no --mix: {name}")
+        mix.append((name, float(weight or 1)))
+    return mix
+
+
+def percentile(sorted_values, pct):
+    if not sorted_values:
+        return 0.0
+    index = min(len(sorted_values) - 1, int(round(pct / 100.0 * (len(sorted_values) - 1))))
+    return sorted_values[index]
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.latencies = {name: [] for name in ENDPOINTS}
+        self.statuses = {name: {} for name in ENDPOINTS}
+        self.bytes = {name: 0 for name in ENDPOINTS}
+
+    def record(self, name, latency_ms, status, size):
+        with self.lock:
+            self.latencies[name].append(latency_ms)
+            self.statuses[name][status] = self.statuses[name].get(status, 0) + 1
+            self.bytes[name] += size
+
+
+def request(host, port, method, path, body, headers, timeout):
+    conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    try:
+        conn.request(method, path, body=body, headers=headers)
+        response = conn.getresponse()
+        payload = response.read()
+        return response.status, payload
+    finally:
+        conn.close()
+
+
+def worker(args, mix, config_body, stats, deadline, seed):
+    rng = random.Random(seed)
+    names = [name for name, _ in mix]
+    weights = [weight for _, weight in mix]
+    headers = {"Accept": args.accept}
+    if args.gzip:
+        headers["Accept-Encoding"] = "gzip"
+
+    while time.monotonic() < deadline:
+        name = rng.choices(names, weights)[0]
+        method, path, _ = ENDPOINTS[name]
+        body = None
+        req_headers = dict(headers)
+
+        if name == "postconfig":
+            body = config_body
+            req_headers["Content-Type"] = "application/json"
+        elif name == "dose":
+            body = json.dumps({"bomb": args.dose_pump, "dosagem": args.dose_ml, "origem": "Loadgen"})
+            req_headers["Content-Type"] = "application/json"
+
+        start = time.perf_counter()
+        try:
+            status, payload = request(args.host, args.port, method, path, body, req_headers, args.timeout)
+            size = len(payload)
+        except (OSError, http.client.HTTPException):
+            status, size = "erro", 0
+        latency_ms = (time.perf_counter() - start) * 1000.0
+        stats.record(name, latency_ms, status, size)
+
+        if args.think_ms > 0:
+            time.sleep(args.think_ms / 1000.0)
+
+
+def fetch_server_stats(args):
+    try:
+        status, payload = request(args.host, args.port, "GET", "/status", None, {}, args.timeout)
+        if status == 200:
+            return json.loads(payload).get("http", {})
+    except (OSError, ValueError, http.client.HTTPException):
+        pass
+    return {}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="192.168.4.1")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--concurrency", type=int, default=2)
+    parser.add_argument("--duration", type=float, default=20.0, help="segundos")
+    parser.add_argument("--mix", default=DEFAULT_MIX, help="endpoint=peso,... (status, config, postconfig, logs, dose)")
+    parser.add_argument("--think-ms", type=float, default=0.0, help="pausa entre requisições de cada cliente")
+    parser.add_argument("--timeout", type=float, default=10.0)
+    parser.add_argument("--accept", default="application/json", help="ex.: application/msgpack")
+    parser.add_argument("--gzip", action="store_true", help="envia Accept-Encoding: gzip")
+    parser.add_argument("--allow-dose", action="store_true", help="permite 'dose' no mix (aciona a bomba de verdade)")
+    parser.add_argument("--dose-pump", type=int, default=1)
+    parser.add_argument("--dose-ml", type=float, default=0.1)
+    parser.add_argument("--json", metavar="ARQUIVO", help="grava o resultado em JSON (baseline)")
+    args = parser.parse_args()
+
+    mix = parse_mix(args.mix)
+    if any(name == "dose" for name, _ in mix) and not args.allow_dose:
+        raise SystemExit("'dose' aciona as bombas; use --allow-dose para incluir no mix")
+
+    config_body = None
+    if any(name == "postconfig" for name, _ in mix):
+        # Reenvia a configuração atual sem alterações (POST idempotente)
+        status, payload = request(args.host, args.port, "GET", "/config", None, {}, args.timeout)
+        if status != 200:
+            raise SystemExit(f"GET /config falhou ({status}); não dá para montar o POST")
+        config_body = payload
+
+    stats = Stats()
+    started = time.monotonic()
+    deadline = started + args.duration
+    threads = [
+        threading.Thread(target=worker, args=(args, mix, config_body, stats, deadline, i), daemon=True)
+        for i in range(args.concurrency)
+    ]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    elapsed = time.monotonic() - started
+
+    server = fetch_server_stats(args)
+    server_routes = server.get("routes", {})
+
+    result = {"host": args.host, "concurrency": args.concurrency, "duration": elapsed,
+              "accept": args.accept, "gzip": args.gzip, "endpoints": {}}
+
+    print(f"{'endpoint':<12} {'reqs':>6} {'req/s':>7} {'p50 ms':>8} {'p99 ms':>8} {'p999 ms':>8} "
+          f"{'bytes/req':>9} {'heap min':>9} {'heap pico':>9}  status")
+    for name, _ in mix:
+        values = sorted(stats.latencies[name])
+        route = server_routes.get(ENDPOINTS[name][2], {})
+        entry = {
+            "requests": len(values),
+            "throughput": len(values) / elapsed if elapsed > 0 else 0.0,
+            "p50": percentile(values, 50),
+            "p99": percentile(values, 99),
+            "p999": percentile(values, 99.9),
+            "bytesPerRequest": stats.bytes[name] / len(values) if values else 0,
+            "statuses": {str(k): v for k, v in stats.statuses[name].items()},
+            "serverHeapLowWater": route.get("heapLowWater"),
+            "serverHeapPeak": route.get("heapPeak"),
+        }
+        result["endpoints"][name] = entry
+        statuses = " ".join(f"{k}:{v}" for k, v in sorted(entry["statuses"].items()))
+        heap = entry["serverHeapLowWater"] if entry["serverHeapLowWater"] is not None else "-"
+        peak = entry["serverHeapPeak"] if entry["serverHeapPeak"] is not None else "-"
+        print(f"{name:<12} {entry['requests']:>6} {entry['throughput']:>7.1f} {entry['p50']:>8.1f} "
+              f"{entry['p99']:>8.1f} {entry['p999']:>8.1f} {entry['bytesPerRequest']:>9.0f} {heap:>9} {peak:>9}  "
+              f"{statuses}")
+
+    total = sum(len(v) for v in stats.latencies.values())
+    print(f"\ntotal: {total} requisições em {elapsed:.1f}s ({total / elapsed:.1f} req/s)")
+    if server:
+        result["server"] = server
+        if "heapLive" in server:
+            print(f"heap vivo agora: {server.get('heapLive')}  fallbacks de gzip: {server.get('gzipFallbacks')}")
+        else:
+            print(f"heap livre agora: {server.get('freeHeap')}  recusas: {json.dumps(server.get('rejected', {}))}")
+
+    if args.json:
+        with open(args.json, "w") as out:
+            json.dump(result, out, indent=2)
+        print(f"resultado gravado em {args.json}")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
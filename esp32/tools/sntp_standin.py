@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Servidor SNTP mínimo para testar a sincronização do AquaBalancePro.
+
+Responde pedidos SNTP v4 com a hora deste computador, opcionalmente
+deslocada (--offset) ou andando mais rápido/devagar (--skew-ppm) para
+simular um RTC com deriva. Também consegue simular perda de pacotes,
+atraso e respostas "kiss-o-death".
+
+Com o notebook conectado ao AP do dosador:
+    python3 sntp_standin.py --port 1123 --offset 2.5
+    curl -X POST http://192.168.4.1/ntp -H "Content-Type: application/json" \\
+         -d '{"server":"192.168.4.2","port":1123,"sync":true}'
+
+Somente biblioteca padrão do Python 3. Portas abaixo de 1024 exigem root.
+"""
+
+import argparse
+import random
+import socket
+import struct
+import sys
+import time
+
+NTP_UNIX_OFFSET = 2208988800
+PACKET_SIZE = 48
+
+
+def to_ntp(unix_seconds):
+    seconds = int(unix_seconds)
+    fraction = int((unix_seconds - seconds) * (1 << 32)) & 0xFFFFFFFF
+    return struct.pack("!II", (seconds + NTP_UNIX_OFFSET) & 0xFFFFFFFF, fraction)
+
+
+class Clock:
+    def __init__(self, offset, skew_ppm):
+        self.offset = offset
+        self.skew = skew_ppm * 1e-6
+        self.start_wall = time.time()
+        self.start_mono = time.monotonic()
+
+    def now(self):
+        elapsed = time.monotonic() - self.start_mono
+        return self.start_wall + elapsed * (1.0 + self.skew) + self.offset
+
+
+def build_reply(request, receive_time, clock, args):
+    version = (request[0] >> 3) & 0x07 or 4
+    if args.kiss:
+        stratum, ref_id = 0, b"RATE"
+    else:
+        stratum, ref_id = args.stratum, b"LOCL"
+
+    header = struct.pack("!BBbb", (0 << 6) | (version << 3) | 4, stratum, request[2], -20)
+    root = struct.pack("!II", 0, 0)
+    reference = to_ntp(receive_time - 1.0)
+    originate = request[40:48]
+    receive = to_ntp(receive_time)
+
+    if args.delay_ms > 0:
+        time.sleep(args.delay_ms / 1000.0)
+    transmit = to_ntp(clock.now())
+    return header + root + ref_id + reference + originate + receive + transmit
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--bind", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=1123)
+    parser.add_argument("--offset", type=float, default=0.0, help="segundos somados à hora local")
+    parser.add_argument("--skew-ppm", type=float, default=0.0, help="faz o relógio servido andar mais rápido (+) ou devagar (-)")
+    parser.add_argument("--stratum", type=int, default=1)
+    parser.add_argument("--delay-ms", type=float, default=0.0, help="espera entre receber e responder (T3 - T2)")
+    parser.add_argument("--drop", type=float, default=0.0, help="fração de pedidos ignorados (0-1)")
+    parser.add_argument("--kiss", action="store_true", help="responde kiss-o-death (stratum 0, RATE)")
+    args = parser.parse_args()
+
+    clock = Clock(args.offset, args.skew_ppm)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.bind, args.port))
+    print(f"SNTP em {args.bind}:{args.port} (offset {args.offset:+.3f} s, skew {args.skew_ppm:+.1f} ppm)")
+
+    while True:
+        request, address = sock.recvfrom(512)
+        receive_time = clock.now()
+        if len(request) < PACKET_SIZE or (request[0] & 0x07) != 3:
+            continue
+        if args.drop > 0 and random.random() < args.drop:
+            print(f"{address[0]}: pedido descartado")
+            continue
+
+        sock.sendto(build_reply(request, receive_time, clock, args), address)
+        print(f"{address[0]}: {time.strftime('%H:%M:%S', time.gmtime(receive_time))}"
+              f".{int((receive_time % 1) * 1000):03d} UTC")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Destino HTTP mínimo para testar a sincronização (outbox) do AquaBalancePro.
+
+Recebe os lotes do POST do dosador ({"device": "...", "events": [...]}),
+descarta eventos repetidos pelo par (device, seq), avisa saltos de seq e
+grava os eventos novos num arquivo JSONL. Também consegue simular falhas
+(5xx aleatório, atraso, rejeição 4xx) para exercitar o backoff.
+
+Com o notebook conectado ao AP do dosador:
+    python3 sync_standin.py --port 8080 --out eventos.jsonl --fail-rate 0.3
+    curl -X POST http://192.168.4.1/sync -H "Content-Type: application/json" \\
+         -d '{"url":"http://192.168.4.2:8080/ingest","flush":true}'
+
+Somente biblioteca padrão do Python 3.
+"""
+
+import argparse
+import json
+import random
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class Ledger:
+    """Último seq e seqs já vistos por dispositivo."""
+
+    def __init__(self, out_path):
+        self.lock = threading.Lock()
+        self.seen = {}
+        self.out = open(out_path, "a", encoding="utf-8") if out_path else None
+        self.accepted = 0
+        self.duplicates = 0
+        self.gaps = 0
+
+    def record(self, device, events):
+        fresh = 0
+        with self.lock:
+            seen = self.seen.setdefault(device, set())
+            last = max(seen) if seen else 0
+            for event in events:
+                seq = event.get("seq")
+                if not isinstance(seq, int):
+                    continue
+                if seq in seen:
+                    self.duplicates += 1
+                    continue
+                if seq != last + 1 and seen:
+                    self.gaps += 1
+                    print(f"[standin] {device}: salto de seq {last} -> {seq}", file=sys.stderr)
+                seen.add(seq)
+                last = max(last, seq)
+                fresh += 1
+                if self.out:
+                    self.out.write(json.dumps({"device": device, **event}, ensure_ascii=False) + "\n")
+            if self.out:
+                self.out.flush()
+            self.accepted += fresh
+        return fresh
+
+
+def make_handler(ledger, args):
+    class Handler(BaseHTTPRequestHandler):
+        def log_message(self, fmt, *values):
+            if args.verbose:
+                super().log_message(fmt, *values)
+
+        def reply(self, code, payload):
+            body = json.dumps(payload).encode()
+            self.send_response(code)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def do_POST(self):
+            length = int(self.headers.get("Content-Length", 0))
+            raw = self.rfile.read(length)
+
+            if args.delay_ms > 0:
+                time.sleep(args.delay_ms / 1000.0)
+            if random.random() < args.fail_rate:
+                self.reply(503, {"ok": False, "message": "falha simulada"})
+                return
+            if args.reject:
+                self.reply(422, {"ok": False, "message": "rejeicao simulada"})
+                return
+
+            try:
+                batch = json.loads(raw)
+                device = batch["device"]
+                events = batch["events"]
+            except (ValueError, KeyError, TypeError):
+                self.reply(400, {"ok": False, "message": "lote invalido"})
+                return
+
+            fresh = ledger.record(device, events)
+            seqs = [e.get("seq") for e in events]
+            print(f"[standin] {device}: lote com {len(events)} eventos "
+                  f"(seq {min(seqs)}..{max(seqs)}), {fresh} novos")
+            self.reply(200, {"ok": True, "accepted": fresh})
+
+        def do_GET(self):
+            with ledger.lock:
+                devices = {d: max(s) for d, s in ledger.seen.items() if s}
+                payload = {"accepted": ledger.accepted, "duplicates": ledger.duplicates,
+                           "gaps": ledger.gaps, "lastSeq": devices}
+            self.reply(200, payload)
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--out", help="grava os eventos novos neste arquivo JSONL")
+    parser.add_argument("--fail-rate", type=float, default=0.0, help="fração de lotes respondidos com 503")
+    parser.add_argument("--delay-ms", type=int, default=0, help="atraso antes de responder")
+    parser.add_argument("--reject", action="store_true", help="recusa todos os lotes com 422")
+    parser.add_argument("--verbose", action="store_true")
+    args = parser.parse_args()
+
+    ledger = Ledger(args.out)
+    server = ThreadingHTTPServer((args.host, args.port), make_handler(ledger, args))
+    print(f"[standin] Escutando em {args.host}:{args.port} (GET / mostra o resumo)")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    print(f"[standin] {ledger.accepted} eventos aceitos, {ledger.duplicates} repetidos, {ledger.gaps} saltos")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())